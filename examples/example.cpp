@@ -8,6 +8,9 @@
 #include <string>
 #include <cstring>
 #include <cassert>
+#include <memory>
+
+#include "gpu_events.h"
 
 using namespace slang;
 
@@ -223,32 +226,29 @@ void execute_shader()
   WGPUBuffer readBuffer = wgpuDeviceCreateBuffer(device, &readDesc);
   wgpuCommandEncoderCopyBufferToBuffer(encoder, resultBuffer, 0, readBuffer, 0, bufDesc.size);
 
-  // 9. Submit
+  // 9. Submit through the completion dispatcher of the renderer
+  WGPU::GpuEvents events;
+  events.Init(instance, std::make_shared<WGPUDevice>(device), std::make_shared<WGPUQueue>(wgpuDeviceGetQueue(device)));
+
   WGPUCommandBuffer cmd = wgpuCommandEncoderFinish(encoder, nullptr);
-  wgpuQueueSubmit(wgpuDeviceGetQueue(device), 1, &cmd);
+  events.Submit(cmd);
 
   // 10. Map and read back result
-  struct Context {
-    bool ready;
-    WGPUBuffer buffer;
-  };
-  struct MapContext { bool done = false; WGPUBuffer buffer; };
-  Context context = { false, readBuffer };
-
-  auto onBuffer2Mapped = [](WGPUBufferMapAsyncStatus status, void* pUserData) {
-    Context* context = reinterpret_cast<Context*>(pUserData);
-    context->ready = true;
-    std::cout << "Result buffer mapped with status " << status << std::endl;
-    if (status != WGPUBufferMapAsyncStatus_Success) return;
-  };
+  bool mapped_done = false;
+  bool mapped_ok = false;
 
-  wgpuBufferMapAsync(readBuffer, WGPUMapMode_Read, 0, bufDesc.size, onBuffer2Mapped, (void*)&context);
+  events.MapAsync(readBuffer, WGPUMapMode_Read, 0, bufDesc.size, [&](bool success) {
+    mapped_done = true;
+    mapped_ok = success;
+  });
 
-  while (!context.ready) {
-    wgpuDevicePoll(device, false, nullptr);
+  //  Sleeps in the driver until the submission is done, then delivers the map callback
+  if (!events.WaitUntil([&]() { return mapped_done; }) || !mapped_ok) {
+    std::cerr << "Could not read back the result buffer" << std::endl;
+    return;
   }
 
-  const float* mapped = static_cast<const float*>(wgpuBufferGetMappedRange(readBuffer, 0, bufDesc.size));
+  const float* mapped = static_cast<const float*>(wgpuBufferGetConstMappedRange(readBuffer, 0, bufDesc.size));
   std::memcpy(result.data(), mapped, bufDesc.size);
   wgpuBufferUnmap(readBuffer);
 
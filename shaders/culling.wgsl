@@ -0,0 +1,396 @@
+/**
+*   Frustum culling of instances against their mesh's bounding sphere. Visible instances are compacted into their
+*   mesh's region of the visible list and counted into the mesh's indirect draw. With occlusion culling, cs_cull_early
+*   and cs_cull_late replace cs_cull and test the sphere against a depth pyramid as well.
+*
+*   Meshes with several levels of detail have a draw and region per level. Visible instances go to the coarsest level
+*   whose error projects below the threshold, and within the fade band of the next coarser level to both of them
+*/
+struct Uniforms
+{
+    projectionMatrix: mat4x4f,
+    viewMatrix: mat4x4f,
+    modelMatrix: mat4x4f,
+    color: vec4f,
+    time: f32,
+};
+
+struct Instance
+{
+    transform: mat4x4f,
+    color: vec4f,
+};
+
+//  Levels of detail a mesh can have, GpuCulling::MAX_LODS
+const MAX_LODS = 8u;
+
+/**
+*   Mesh space bounds, the draw of its first level and the mesh space error of every level, see GpuCulling::MeshCulling
+*/
+struct MeshCulling
+{
+    center: vec3f,
+    radius: f32,
+    firstDraw: u32,
+    lodCount: u32,
+    _pad0: u32,
+    _pad1: u32,
+    lodErrors: array<f32, MAX_LODS>,
+};
+
+/**
+*   Arguments of drawIndexedIndirect
+*/
+struct DrawIndexedIndirect
+{
+    indexCount: u32,
+    instanceCount: atomic<u32>,
+    firstIndex: u32,
+    baseVertex: i32,
+    firstInstance: u32,
+};
+
+/**
+*   lodThreshold is the largest error to draw in NDC units, lodFadeBand relative to it
+*/
+struct CullingParams
+{
+    instanceCount: u32,
+    drawCount: u32,
+    pyramidValid: u32,
+    lodThreshold: f32,
+    lodFadeBand: f32,
+    _pad0: u32,
+    _pad1: u32,
+    _pad2: u32,
+};
+
+/**
+*   Read back for the stats. Occluded counts instances rejected by the early test that the late test did not bring back.
+*   Triangles of many instances of large meshes exceed 32 bits, they are counted in a low word carrying into a high one
+*/
+struct CullingCounters
+{
+    visible: atomic<u32>,
+    occluded: atomic<u32>,
+    trianglesLow: atomic<u32>,
+    trianglesHigh: atomic<u32>,
+};
+
+@group(0) @binding(0) var<uniform> uUniforms: Uniforms;
+@group(0) @binding(1) var<uniform> uParams: CullingParams;
+@group(0) @binding(2) var<storage, read> uInstances: array<Instance>;
+@group(0) @binding(3) var<storage, read> uInstanceMeshes: array<u32>;
+@group(0) @binding(4) var<storage, read> uMeshes: array<MeshCulling>;
+@group(0) @binding(5) var<storage, read_write> uDraws: array<DrawIndexedIndirect>;
+@group(0) @binding(6) var<storage, read_write> uVisible: array<u32>;
+@group(0) @binding(7) var<storage, read_write> uCounters: CullingCounters;
+
+//  Start of every draw's region in uVisible
+@group(0) @binding(10) var<storage, read> uDrawVisible: array<u32>;
+
+//  Occlusion culling only, see depth_pyramid.wgsl
+@group(0) @binding(8) var uDepthPyramid: texture_2d<f32>;
+@group(0) @binding(9) var<storage, read_write> uInstanceStates: array<u32>;
+
+const WORKGROUP_SIZE = 64u;
+
+//  uInstanceStates after the early test: only occluded instances are tested again
+const STATE_DONE = 0u;
+const STATE_OCCLUDED = 1u;
+
+//  Visible entries are the instance in the low 24 bits. Cross-faded ones have the fade towards the coarser level in
+//  bits 24-30, out of 128, and bit 31 set on the coarser level's entry
+const INSTANCE_MASK = 0xffffffu;
+const FADE_SHIFT = 24u;
+const FADE_COARSER = 0x80000000u;
+
+var<workgroup> groupVisible: atomic<u32>;
+var<workgroup> groupOccluded: atomic<u32>;
+var<workgroup> groupTrianglesLow: atomic<u32>;
+var<workgroup> groupTrianglesHigh: atomic<u32>;
+
+@compute @workgroup_size(WORKGROUP_SIZE)
+fn cs_reset(@builtin(global_invocation_id) id: vec3u)
+{
+    if (id.x < uParams.drawCount)
+    {
+        atomicStore(&uDraws[id.x].instanceCount, 0u);
+    }
+}
+
+fn row(m: mat4x4f, i: u32) -> vec4f
+{
+    return vec4f(m[0][i], m[1][i], m[2][i], m[3][i]);
+}
+
+//  Signed distance of the sphere center to the plane, in units of the plane normal
+fn outside(plane: vec4f, center: vec3f, radius: f32) -> bool
+{
+    return dot(plane.xyz, center) + plane.w < -radius * length(plane.xyz);
+}
+
+//  World space bounding sphere of the instance, center in xyz and radius in w
+fn instanceSphere(instance: u32) -> vec4f
+{
+    let bounds = uMeshes[uInstanceMeshes[instance]];
+
+    //  Same model matrix as vs_main, the sphere grows with the largest axis scale
+    let model = uUniforms.modelMatrix * uInstances[instance].transform;
+    let center = (model * vec4f(bounds.center, 1.0)).xyz;
+    let scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+
+    return vec4f(center, bounds.radius * scale);
+}
+
+fn inFrustum(sphere: vec4f) -> bool
+{
+    //  Clip space planes of the world space frustum (Gribb-Hartmann), 0 <= z <= w as WebGPU clips
+    let viewProjection = uUniforms.projectionMatrix * uUniforms.viewMatrix;
+    let r0 = row(viewProjection, 0u);
+    let r1 = row(viewProjection, 1u);
+    let r2 = row(viewProjection, 2u);
+    let r3 = row(viewProjection, 3u);
+
+    return !(outside(r3 + r0, sphere.xyz, sphere.w) || outside(r3 - r0, sphere.xyz, sphere.w) ||
+             outside(r3 + r1, sphere.xyz, sphere.w) || outside(r3 - r1, sphere.xyz, sphere.w) ||
+             outside(r2, sphere.xyz, sphere.w) || outside(r3 - r2, sphere.xyz, sphere.w));
+}
+
+//  Whether the depth pyramid has something nearer than the sphere everywhere the sphere covers the screen
+fn occluded(sphere: vec4f) -> bool
+{
+    let viewProjection = uUniforms.projectionMatrix * uUniforms.viewMatrix;
+
+    //  Screen rectangle and nearest depth of the box around the sphere, from its corners
+    var boxMin = vec3f(1e30);
+    var boxMax = vec3f(-1e30);
+
+    for (var corner = 0u; corner < 8u; corner++)
+    {
+        let offset = vec3f(select(-sphere.w, sphere.w, (corner & 1u) != 0u),
+                           select(-sphere.w, sphere.w, (corner & 2u) != 0u),
+                           select(-sphere.w, sphere.w, (corner & 4u) != 0u));
+        let clip = viewProjection * vec4f(sphere.xyz + offset, 1.0);
+
+        //  Box reaches behind the camera, its projection is unbounded
+        if (clip.w <= 1e-5)
+        {
+            return false;
+        }
+
+        let ndc = clip.xyz / clip.w;
+        boxMin = min(boxMin, ndc);
+        boxMax = max(boxMax, ndc);
+    }
+
+    //  Texture rows go down the screen
+    let size = vec2f(textureDimensions(uDepthPyramid, 0));
+    let texelMin = clamp(vec2f(boxMin.x, -boxMax.y) * 0.5 + 0.5, vec2f(0.0), vec2f(1.0)) * size;
+    let texelMax = clamp(vec2f(boxMax.x, -boxMin.y) * 0.5 + 0.5, vec2f(0.0), vec2f(1.0)) * size;
+
+    //  Level where the rectangle is at most one texel wide, so it touches at most 2x2 texels
+    let extent = max(texelMax - texelMin, vec2f(1.0));
+    let level = min(u32(ceil(log2(max(extent.x, extent.y)))), textureNumLevels(uDepthPyramid) - 1u);
+
+    let levelLast = vec2i(textureDimensions(uDepthPyramid, level)) - 1;
+    let scale = 1.0 / f32(1u << level);
+    let first = min(vec2i(texelMin * scale), levelLast);
+    let last = min(vec2i(texelMax * scale), levelLast);
+
+    var farthest = 0.0;
+    for (var y = first.y; y <= last.y; y++)
+    {
+        for (var x = first.x; x <= last.x; x++)
+        {
+            farthest = max(farthest, textureLoad(uDepthPyramid, vec2i(x, y), i32(level)).r);
+        }
+    }
+
+    return boxMin.z > farthest;
+}
+
+//  World space camera position of the rigid view matrix
+fn cameraPosition() -> vec3f
+{
+    let view = uUniforms.viewMatrix;
+    let rotation = mat3x3f(view[0].xyz, view[1].xyz, view[2].xyz);
+    return -(transpose(rotation) * view[3].xyz);
+}
+
+//  Level of detail of the mesh for a sphere and the fade towards the next coarser level, 0 without fading. A mesh space
+//  error projects to NDC by the sphere's scale and the vertical focal length over the distance to its nearest point
+fn selectLod(mesh: u32, sphere: vec4f) -> vec2f
+{
+    let bounds = uMeshes[mesh];
+    if (bounds.lodCount <= 1u)
+    {
+        return vec2f(0.0);
+    }
+
+    let distance = max(length(sphere.xyz - cameraPosition()) - sphere.w, 1e-4);
+    let scale = uUniforms.projectionMatrix[1][1] * sphere.w / (bounds.radius * distance);
+
+    var level = 0u;
+    while (level + 1u < bounds.lodCount && uMeshes[mesh].lodErrors[level + 1u] * scale <= uParams.lodThreshold)
+    {
+        level++;
+    }
+
+    //  Fade in the next level as its error approaches the threshold, from the edge of the band
+    var fade = 0.0;
+    if (uParams.lodFadeBand > 0.0 && level + 1u < bounds.lodCount)
+    {
+        let excess = uMeshes[mesh].lodErrors[level + 1u] * scale / uParams.lodThreshold - 1.0;
+        fade = clamp(1.0 - excess / uParams.lodFadeBand, 0.0, 1.0);
+    }
+
+    return vec2f(f32(level), fade);
+}
+
+fn appendDraw(draw: u32, entry: u32)
+{
+    let slot = atomicAdd(&uDraws[draw].instanceCount, 1u);
+    uVisible[uDrawVisible[draw] + slot] = entry;
+
+    //  Exactly one add sees the low word wrap and carries
+    let triangles = uDraws[draw].indexCount / 3u;
+    let low = atomicAdd(&groupTrianglesLow, triangles);
+    if (low + triangles < low)
+    {
+        atomicAdd(&groupTrianglesHigh, 1u);
+    }
+}
+
+//  Append the instance to the visible list and draw of its mesh's selected level, and of the next one while fading
+fn emitVisible(instance: u32, sphere: vec4f)
+{
+    let mesh = uInstanceMeshes[instance];
+    let lod = selectLod(mesh, sphere);
+    let draw = uMeshes[mesh].firstDraw + u32(lod.x);
+    let fade = min(u32(lod.y * 128.0), 127u);
+
+    if (fade == 0u)
+    {
+        appendDraw(draw, instance);
+    }
+    else
+    {
+        appendDraw(draw, instance | (fade << FADE_SHIFT));
+        appendDraw(draw + 1u, instance | (fade << FADE_SHIFT) | FADE_COARSER);
+    }
+    atomicAdd(&groupVisible, 1u);
+}
+
+fn beginGroup(local: u32)
+{
+    if (local == 0u)
+    {
+        atomicStore(&groupVisible, 0u);
+        atomicStore(&groupOccluded, 0u);
+        atomicStore(&groupTrianglesLow, 0u);
+        atomicStore(&groupTrianglesHigh, 0u);
+    }
+    workgroupBarrier();
+}
+
+//  Called by the first invocation once the group is done
+fn addGroupTriangles()
+{
+    let triangles = atomicLoad(&groupTrianglesLow);
+    let low = atomicAdd(&uCounters.trianglesLow, triangles);
+    atomicAdd(&uCounters.trianglesHigh, atomicLoad(&groupTrianglesHigh) + select(0u, 1u, low + triangles < low));
+}
+
+//  One global atomic per counter and workgroup for the stats
+fn endGroup(local: u32)
+{
+    workgroupBarrier();
+    if (local == 0u)
+    {
+        atomicAdd(&uCounters.visible, atomicLoad(&groupVisible));
+        atomicAdd(&uCounters.occluded, atomicLoad(&groupOccluded));
+        addGroupTriangles();
+    }
+}
+
+//  Dispatches of the culling entry points are 2D once there are more than 65535 workgroups of instances
+@compute @workgroup_size(WORKGROUP_SIZE)
+fn cs_cull(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) local: u32,
+           @builtin(num_workgroups) groups: vec3u)
+{
+    beginGroup(local);
+
+    let instance = id.y * groups.x * WORKGROUP_SIZE + id.x;
+    if (instance < uParams.instanceCount)
+    {
+        let sphere = instanceSphere(instance);
+        if (inFrustum(sphere))
+        {
+            emitVisible(instance, sphere);
+        }
+    }
+
+    endGroup(local);
+}
+
+//  Frustum and last frame's depth pyramid. Occluded instances are only remembered, the last frame's depth may be
+//  stale where things or the camera moved
+@compute @workgroup_size(WORKGROUP_SIZE)
+fn cs_cull_early(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) local: u32,
+                 @builtin(num_workgroups) groups: vec3u)
+{
+    beginGroup(local);
+
+    let instance = id.y * groups.x * WORKGROUP_SIZE + id.x;
+    if (instance < uParams.instanceCount)
+    {
+        var state = STATE_DONE;
+        let sphere = instanceSphere(instance);
+
+        if (inFrustum(sphere))
+        {
+            if (uParams.pyramidValid != 0u && occluded(sphere))
+            {
+                state = STATE_OCCLUDED;
+                atomicAdd(&groupOccluded, 1u);
+            }
+            else
+            {
+                emitVisible(instance, sphere);
+            }
+        }
+
+        uInstanceStates[instance] = state;
+    }
+
+    endGroup(local);
+}
+
+//  Instances the early test found occluded, against the pyramid of what the early draws left in the depth buffer
+@compute @workgroup_size(WORKGROUP_SIZE)
+fn cs_cull_late(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) local: u32,
+                @builtin(num_workgroups) groups: vec3u)
+{
+    beginGroup(local);
+
+    let instance = id.y * groups.x * WORKGROUP_SIZE + id.x;
+    if (instance < uParams.instanceCount && uInstanceStates[instance] == STATE_OCCLUDED)
+    {
+        let sphere = instanceSphere(instance);
+        if (!occluded(sphere))
+        {
+            emitVisible(instance, sphere);
+        }
+    }
+
+    //  Every instance drawn late was counted as occluded by the early test
+    workgroupBarrier();
+    if (local == 0u)
+    {
+        let reclaimed = atomicLoad(&groupVisible);
+        atomicAdd(&uCounters.visible, reclaimed);
+        atomicSub(&uCounters.occluded, reclaimed);
+        addGroupTriangles();
+    }
+}
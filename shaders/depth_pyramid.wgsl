@@ -0,0 +1,70 @@
+/**
+*   Hierarchical depth: level 0 holds the farthest sample of every pixel of the multisampled depth buffer, every
+*   further level the farthest of the texels below it. Levels are mip levels and round their size down, so below an
+*   odd size the 2x2 footprint grows to 3 texels in that direction to keep covering the last row or column and the
+*   pyramid stays conservative. cs_depth_single builds level 0 of a single sample depth buffer
+*/
+@group(0) @binding(0) var uDepth: texture_depth_multisampled_2d;
+@group(0) @binding(1) var uSource: texture_2d<f32>;
+@group(0) @binding(2) var uDestination: texture_storage_2d<r32float, write>;
+@group(0) @binding(3) var uDepthSingle: texture_depth_2d;
+
+const GROUP_SIZE = 8u;
+
+@compute @workgroup_size(GROUP_SIZE, GROUP_SIZE)
+fn cs_depth(@builtin(global_invocation_id) id: vec3u)
+{
+    let size = textureDimensions(uDestination);
+    if (any(id.xy >= size))
+    {
+        return;
+    }
+
+    var farthest = 0.0;
+    for (var sampleIndex = 0u; sampleIndex < textureNumSamples(uDepth); sampleIndex++)
+    {
+        farthest = max(farthest, textureLoad(uDepth, vec2i(id.xy), i32(sampleIndex)));
+    }
+
+    textureStore(uDestination, vec2i(id.xy), vec4f(farthest, 0.0, 0.0, 0.0));
+}
+
+@compute @workgroup_size(GROUP_SIZE, GROUP_SIZE)
+fn cs_depth_single(@builtin(global_invocation_id) id: vec3u)
+{
+    let size = textureDimensions(uDestination);
+    if (any(id.xy >= size))
+    {
+        return;
+    }
+
+    textureStore(uDestination, vec2i(id.xy), vec4f(textureLoad(uDepthSingle, vec2i(id.xy), 0), 0.0, 0.0, 0.0));
+}
+
+@compute @workgroup_size(GROUP_SIZE, GROUP_SIZE)
+fn cs_reduce(@builtin(global_invocation_id) id: vec3u)
+{
+    let size = textureDimensions(uDestination);
+    if (any(id.xy >= size))
+    {
+        return;
+    }
+
+    let sourceSize = vec2i(textureDimensions(uSource));
+    let last = sourceSize - 1;
+    let base = vec2i(id.xy) * 2;
+
+    //  2 texels per direction, 3 where the source size is odd. Clamping only matters for 1 texel wide sources
+    let footprint = vec2i(2) + (sourceSize & vec2i(1));
+
+    var farthest = 0.0;
+    for (var y = 0; y < footprint.y; y++)
+    {
+        for (var x = 0; x < footprint.x; x++)
+        {
+            farthest = max(farthest, textureLoad(uSource, min(base + vec2i(x, y), last), 0).r);
+        }
+    }
+
+    textureStore(uDestination, vec2i(id.xy), vec4f(farthest, 0.0, 0.0, 0.0));
+}
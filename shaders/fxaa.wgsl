@@ -0,0 +1,157 @@
+/**
+*   FXAA (Lottes 2009, after the quality preset of FXAA 3.11) over a single sample frame: pixels whose neighbourhood
+*   has enough luma contrast find the direction of their edge, search along it for both ends and resample the frame
+*   across the edge by how far the pixel is from the nearer end. A subpixel term blends isolated features as well
+*/
+@group(0) @binding(0) var uInput: texture_2d<f32>;
+@group(0) @binding(1) var uSampler: sampler;
+@group(0) @binding(2) var uOutput: texture_storage_2d<rgba8unorm, write>;
+
+const GROUP_SIZE = 8u;
+
+//  Contrast below max(EDGE_THRESHOLD_MIN, EDGE_THRESHOLD * local maximum) is left alone
+const EDGE_THRESHOLD = 0.125;
+const EDGE_THRESHOLD_MIN = 0.0312;
+
+const SEARCH_STEPS = 12;
+const SUBPIXEL_QUALITY = 0.75;
+
+fn luma(color: vec3f) -> f32
+{
+    return dot(color, vec3f(0.299, 0.587, 0.114));
+}
+
+fn lumaAt(uv: vec2f) -> f32
+{
+    return luma(textureSampleLevel(uInput, uSampler, uv, 0.0).rgb);
+}
+
+fn lumaOffset(pixel: vec2i, offset: vec2i, last: vec2i) -> f32
+{
+    return luma(textureLoad(uInput, clamp(pixel + offset, vec2i(0), last), 0).rgb);
+}
+
+//  Search steps grow along the edge, the first ones go texel by texel
+fn searchStep(i: i32) -> f32
+{
+    if (i < 5)
+    {
+        return 1.0;
+    }
+    if (i == 5)
+    {
+        return 1.5;
+    }
+    if (i < 10)
+    {
+        return 2.0;
+    }
+    return select(8.0, 4.0, i == 10);
+}
+
+@compute @workgroup_size(GROUP_SIZE, GROUP_SIZE)
+fn cs_fxaa(@builtin(global_invocation_id) id: vec3u)
+{
+    let size = textureDimensions(uOutput);
+    if (any(id.xy >= size))
+    {
+        return;
+    }
+
+    let pixel = vec2i(id.xy);
+    let last = vec2i(size) - 1;
+    let texel = 1.0 / vec2f(size);
+    let uv = (vec2f(pixel) + 0.5) * texel;
+
+    let center = textureLoad(uInput, pixel, 0);
+    let lumaM = luma(center.rgb);
+    let lumaN = lumaOffset(pixel, vec2i(0, -1), last);
+    let lumaS = lumaOffset(pixel, vec2i(0, 1), last);
+    let lumaW = lumaOffset(pixel, vec2i(-1, 0), last);
+    let lumaE = lumaOffset(pixel, vec2i(1, 0), last);
+
+    let lumaMin = min(lumaM, min(min(lumaN, lumaS), min(lumaW, lumaE)));
+    let lumaMax = max(lumaM, max(max(lumaN, lumaS), max(lumaW, lumaE)));
+    let range = lumaMax - lumaMin;
+
+    if (range < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD))
+    {
+        textureStore(uOutput, pixel, center);
+        return;
+    }
+
+    let lumaNW = lumaOffset(pixel, vec2i(-1, -1), last);
+    let lumaNE = lumaOffset(pixel, vec2i(1, -1), last);
+    let lumaSW = lumaOffset(pixel, vec2i(-1, 1), last);
+    let lumaSE = lumaOffset(pixel, vec2i(1, 1), last);
+
+    //  Edge runs horizontally when luma changes more across rows than across columns
+    let edgeHorizontal = abs(lumaNW + lumaSW - 2.0 * lumaW) + 2.0 * abs(lumaN + lumaS - 2.0 * lumaM) + abs(lumaNE + lumaSE - 2.0 * lumaE);
+    let edgeVertical = abs(lumaNW + lumaNE - 2.0 * lumaN) + 2.0 * abs(lumaW + lumaE - 2.0 * lumaM) + abs(lumaSW + lumaSE - 2.0 * lumaS);
+    let horizontal = edgeHorizontal >= edgeVertical;
+
+    //  Side of the pixel the edge is on: the neighbour across it with the steeper gradient
+    let luma1 = select(lumaW, lumaN, horizontal);
+    let luma2 = select(lumaE, lumaS, horizontal);
+    let gradient1 = luma1 - lumaM;
+    let gradient2 = luma2 - lumaM;
+    let steepest1 = abs(gradient1) >= abs(gradient2);
+    let gradientScaled = 0.25 * max(abs(gradient1), abs(gradient2));
+
+    var stepLength = select(texel.x, texel.y, horizontal);
+    var lumaLocalAverage = 0.5 * (luma2 + lumaM);
+    if (steepest1)
+    {
+        stepLength = -stepLength;
+        lumaLocalAverage = 0.5 * (luma1 + lumaM);
+    }
+
+    //  Search from halfway between the pixel and its neighbour across the edge, in both directions along it
+    let across = select(vec2f(stepLength * 0.5, 0.0), vec2f(0.0, stepLength * 0.5), horizontal);
+    let along = select(vec2f(0.0, texel.y), vec2f(texel.x, 0.0), horizontal);
+    let start = uv + across;
+
+    var uv1 = start - along;
+    var uv2 = start + along;
+    var lumaEnd1 = lumaAt(uv1) - lumaLocalAverage;
+    var lumaEnd2 = lumaAt(uv2) - lumaLocalAverage;
+    var reached1 = abs(lumaEnd1) >= gradientScaled;
+    var reached2 = abs(lumaEnd2) >= gradientScaled;
+
+    for (var i = 1; i < SEARCH_STEPS && !(reached1 && reached2); i++)
+    {
+        if (!reached1)
+        {
+            uv1 -= along * searchStep(i);
+            lumaEnd1 = lumaAt(uv1) - lumaLocalAverage;
+            reached1 = abs(lumaEnd1) >= gradientScaled;
+        }
+        if (!reached2)
+        {
+            uv2 += along * searchStep(i);
+            lumaEnd2 = lumaAt(uv2) - lumaLocalAverage;
+            reached2 = abs(lumaEnd2) >= gradientScaled;
+        }
+    }
+
+    let distance1 = select(uv.y - uv1.y, uv.x - uv1.x, horizontal);
+    let distance2 = select(uv2.y - uv.y, uv2.x - uv.x, horizontal);
+    let nearer1 = distance1 < distance2;
+    let distanceNearer = min(distance1, distance2);
+    let edgeLength = distance1 + distance2;
+
+    //  Only move towards the edge if the luma at its nearer end varies the same way as at the pixel
+    let lumaEndNearer = select(lumaEnd2, lumaEnd1, nearer1);
+    let centerSmaller = lumaM < lumaLocalAverage;
+    let edgeOffset = select(0.0, 0.5 - distanceNearer / edgeLength, (lumaEndNearer < 0.0) != centerSmaller);
+
+    //  Subpixel aliasing: contrast of the pixel against its 3x3 neighbourhood
+    let average = (2.0 * (lumaN + lumaS + lumaW + lumaE) + lumaNW + lumaNE + lumaSW + lumaSE) / 12.0;
+    let subpixel = smoothstep(0.0, 1.0, clamp(abs(average - lumaM) / range, 0.0, 1.0));
+    let subpixelOffset = subpixel * subpixel * SUBPIXEL_QUALITY;
+
+    let offset = max(edgeOffset, subpixelOffset) * stepLength;
+    let sampleUv = uv + select(vec2f(offset, 0.0), vec2f(0.0, offset), horizontal);
+
+    textureStore(uOutput, pixel, textureSampleLevel(uInput, uSampler, sampleUv, 0.0));
+}
@@ -0,0 +1,212 @@
+/**
+*   Cluster culling: one thread per meshlet of every instance tests the meshlet's bounding sphere against the frustum
+*   and its normal cone against the camera. Surviving (instance, meshlet) pairs are appended to the cluster list the
+*   rasterizer's vs_meshlet draws with a single indirect draw, one draw instance per cluster
+*/
+struct Uniforms
+{
+    projectionMatrix: mat4x4f,
+    viewMatrix: mat4x4f,
+    modelMatrix: mat4x4f,
+    color: vec4f,
+    time: f32,
+};
+
+struct Instance
+{
+    transform: mat4x4f,
+    color: vec4f,
+};
+
+/**
+*   Mesh space bounds of a meshlet, see MeshletCulling::GpuMeshlet
+*/
+struct Meshlet
+{
+    vertexOffset: u32,
+    triangleOffset: u32,
+    vertexCount: u32,
+    triangleCount: u32,
+    center: vec3f,
+    radius: f32,
+    coneAxis: vec3f,
+    coneCutoff: f32,
+};
+
+/**
+*   Pairs of a mesh's instances and meshlets, instance major, see MeshletCulling::MeshPairs
+*/
+struct MeshPairs
+{
+    firstPair: u32,
+    firstInstance: u32,
+    firstMeshlet: u32,
+    meshletCount: u32,
+};
+
+/**
+*   Arguments of drawIndirect
+*/
+struct DrawIndirect
+{
+    vertexCount: u32,
+    instanceCount: u32,
+    firstVertex: u32,
+    firstInstance: u32,
+};
+
+struct MeshletParams
+{
+    pairCount: u32,
+    meshCount: u32,
+    capacity: u32,
+    _pad0: u32,
+};
+
+/**
+*   Clusters is the append counter of the cluster list, triangles are read back for the stats. Only appended clusters
+*   count, at most capacity of MESHLET_MAX_TRIANGLES each, which stays within 32 bits
+*/
+struct MeshletCounters
+{
+    clusters: atomic<u32>,
+    triangles: atomic<u32>,
+};
+
+@group(0) @binding(0) var<uniform> uUniforms: Uniforms;
+@group(0) @binding(1) var<uniform> uParams: MeshletParams;
+@group(0) @binding(2) var<storage, read> uInstances: array<Instance>;
+@group(0) @binding(3) var<storage, read> uMeshPairs: array<MeshPairs>;
+@group(0) @binding(4) var<storage, read> uMeshlets: array<Meshlet>;
+@group(0) @binding(5) var<storage, read_write> uDraw: DrawIndirect;
+@group(0) @binding(6) var<storage, read_write> uClusters: array<vec2u>;
+@group(0) @binding(7) var<storage, read_write> uCounters: MeshletCounters;
+
+const WORKGROUP_SIZE = 64u;
+
+//  Triangles every cluster is drawn with, utils::MESHLET_MAX_TRIANGLES. Smaller meshlets emit degenerate triangles
+const MAX_TRIANGLES = 124u;
+
+var<workgroup> groupTriangles: atomic<u32>;
+
+fn row(m: mat4x4f, i: u32) -> vec4f
+{
+    return vec4f(m[0][i], m[1][i], m[2][i], m[3][i]);
+}
+
+//  Signed distance of the sphere center to the plane, in units of the plane normal
+fn outside(plane: vec4f, center: vec3f, radius: f32) -> bool
+{
+    return dot(plane.xyz, center) + plane.w < -radius * length(plane.xyz);
+}
+
+fn inFrustum(center: vec3f, radius: f32) -> bool
+{
+    //  Clip space planes of the world space frustum (Gribb-Hartmann), 0 <= z <= w as WebGPU clips
+    let viewProjection = uUniforms.projectionMatrix * uUniforms.viewMatrix;
+    let r0 = row(viewProjection, 0u);
+    let r1 = row(viewProjection, 1u);
+    let r2 = row(viewProjection, 2u);
+    let r3 = row(viewProjection, 3u);
+
+    return !(outside(r3 + r0, center, radius) || outside(r3 - r0, center, radius) ||
+             outside(r3 + r1, center, radius) || outside(r3 - r1, center, radius) ||
+             outside(r2, center, radius) || outside(r3 - r2, center, radius));
+}
+
+//  World space camera position of the rigid view matrix
+fn cameraPosition() -> vec3f
+{
+    let view = uUniforms.viewMatrix;
+    let rotation = mat3x3f(view[0].xyz, view[1].xyz, view[2].xyz);
+    return -(transpose(rotation) * view[3].xyz);
+}
+
+//  Mesh whose pairs hold pair, the last one starting at or before it
+fn findMesh(pair: u32) -> u32
+{
+    var first = 0u;
+    var count = uParams.meshCount;
+
+    while (count > 1u)
+    {
+        let half = count / 2u;
+        if (uMeshPairs[first + half].firstPair <= pair)
+        {
+            first += half;
+            count -= half;
+        }
+        else
+        {
+            count = half;
+        }
+    }
+
+    return first;
+}
+
+//  Dispatches are 2D once there are more than 65535 workgroups of pairs
+@compute @workgroup_size(WORKGROUP_SIZE)
+fn cs_cull(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) local: u32,
+           @builtin(num_workgroups) groups: vec3u)
+{
+    if (local == 0u)
+    {
+        atomicStore(&groupTriangles, 0u);
+    }
+    workgroupBarrier();
+
+    let pair = id.y * groups.x * WORKGROUP_SIZE + id.x;
+
+    if (pair < uParams.pairCount)
+    {
+        let mesh = uMeshPairs[findMesh(pair)];
+        let offset = pair - mesh.firstPair;
+        let instance = mesh.firstInstance + offset / mesh.meshletCount;
+        let meshletIndex = mesh.firstMeshlet + offset % mesh.meshletCount;
+        let meshlet = uMeshlets[meshletIndex];
+
+        //  Same model matrix as the vertex shader. The cone is moved as a normal, assuming no non-uniform scale
+        let model = uUniforms.modelMatrix * uInstances[instance].transform;
+        let center = (model * vec4f(meshlet.center, 1.0)).xyz;
+        let scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+        let radius = meshlet.radius * scale;
+
+        var visible = inFrustum(center, radius);
+
+        //  Every triangle faces away when the view direction is inside the backface cone, cutoff 1 never culls
+        if (visible && meshlet.coneCutoff < 1.0)
+        {
+            let axis = normalize((model * vec4f(meshlet.coneAxis, 0.0)).xyz);
+            let view = center - cameraPosition();
+            visible = dot(view, axis) < meshlet.coneCutoff * length(view) + radius;
+        }
+
+        if (visible)
+        {
+            let slot = atomicAdd(&uCounters.clusters, 1u);
+            if (slot < uParams.capacity)
+            {
+                uClusters[slot] = vec2u(instance, meshletIndex);
+                atomicAdd(&groupTriangles, meshlet.triangleCount);
+            }
+        }
+    }
+
+    //  One global atomic per workgroup for the stats
+    workgroupBarrier();
+    if (local == 0u)
+    {
+        atomicAdd(&uCounters.triangles, atomicLoad(&groupTriangles));
+    }
+}
+
+//  Single thread after cs_cull: the draw covers the appended clusters that fit the list
+@compute @workgroup_size(1)
+fn cs_finish()
+{
+    uDraw.vertexCount = MAX_TRIANGLES * 3u;
+    uDraw.instanceCount = min(atomicLoad(&uCounters.clusters), uParams.capacity);
+    uDraw.firstVertex = 0u;
+    uDraw.firstInstance = 0u;
+}
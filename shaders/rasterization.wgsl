@@ -7,11 +7,14 @@ struct VertexInput
     @location(3) texCoord: vec2f,
 };
 
+// Positions are invariant: the colour pass after a depth pre-pass tests them for equality with the pre-pass depths
 struct VertexOutput
 {
-    @builtin(position) position: vec4f,
+    @invariant @builtin(position) position: vec4f,
     @location(0) color: vec3f,
     @location(1) normal: vec3f,
+    // Level of detail cross-fade of the instance, see FADE_SHIFT in culling.wgsl
+    @location(2) @interpolate(flat) fade: u32,
 };
 
 /**
@@ -26,22 +29,145 @@ struct Uniforms
     time: f32,
 };
 
+/**
+*   Per-instance transform and color, see InstanceData
+*/
+struct Instance
+{
+    transform: mat4x4f,
+    color: vec4f,
+};
+
 // Instead of the simple uTime variable, our uniform variable is a struct
 @group(0) @binding(0) var<uniform> uUniforms: Uniforms;
+@group(0) @binding(1) var<storage, read> uInstances: array<Instance>;
 
-@vertex
-fn vs_main(in: VertexInput) -> VertexOutput 
-{ 
+// Visible instances of the drawn mesh after GPU culling, bound at the start of the mesh's region
+@group(1) @binding(0) var<storage, read> uVisibleInstances: array<u32>;
+
+/**
+*   Meshlet as built by utils::build_meshlets, see meshlet_culling.wgsl
+*/
+struct Meshlet
+{
+    vertexOffset: u32,
+    triangleOffset: u32,
+    vertexCount: u32,
+    triangleCount: u32,
+    center: vec3f,
+    radius: f32,
+    coneAxis: vec3f,
+    coneCutoff: f32,
+};
+
+// Meshlet rendering pulls its vertices: the clusters that survived culling as (instance, meshlet), the meshlets' arena
+// vertex indices, their triangles as three 8 bit meshlet vertex indices per u32, and the arena's packed vertices
+@group(1) @binding(1) var<storage, read> uMeshlets: array<Meshlet>;
+@group(1) @binding(2) var<storage, read> uMeshletVertices: array<u32>;
+@group(1) @binding(3) var<storage, read> uMeshletTriangles: array<u32>;
+@group(1) @binding(4) var<storage, read> uVertices: array<f32>;
+@group(1) @binding(5) var<storage, read> uClusters: array<vec2u>;
+
+// Vertex is pos, normal, color and texCoord, tightly packed floats
+const VERTEX_FLOATS = 11u;
+
+// Clip space position, computed the same way by every vertex entry point
+fn clipPosition(position: vec3f, modelMatrix: mat4x4f) -> vec4f
+{
+    return uUniforms.projectionMatrix * uUniforms.viewMatrix * modelMatrix * vec4(position, 1.0f);
+}
+
+fn transformVertex(in: VertexInput, instanceIndex: u32) -> VertexOutput
+{
     var out: VertexOutput;
-	out.position = uUniforms.projectionMatrix * uUniforms.viewMatrix * uUniforms.modelMatrix * vec4(in.position, 1.0f);
+    let instance = uInstances[instanceIndex];
+    let modelMatrix = uUniforms.modelMatrix * instance.transform;
+	out.position = clipPosition(in.position, modelMatrix);
 	// Forward the normal
-    out.normal = (uUniforms.modelMatrix * vec4f(in.normal, 0.0)).xyz;
-	out.color = in.color;
+    out.normal = (modelMatrix * vec4f(in.normal, 0.0)).xyz;
+	out.color = in.color * instance.color.rgb;
+    out.fade = 0u;
 	return out;
 }
 
-@fragment
-fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> 
+@vertex
+fn vs_main(in: VertexInput, @builtin(instance_index) instanceIndex: u32) -> VertexOutput 
+{ 
+    // Instance index includes the draw's first instance, the start of the mesh's group
+    return transformVertex(in, instanceIndex);
+}
+
+@vertex
+fn vs_culled(in: VertexInput, @builtin(instance_index) instanceIndex: u32) -> VertexOutput
+{
+    // Indirect draws start at instance 0 of the draw's visible list. Entries hold the instance in their low 24 bits
+    let entry = uVisibleInstances[instanceIndex];
+    var out = transformVertex(in, entry & 0xffffffu);
+    out.fade = entry >> 24u;
+    return out;
+}
+
+@vertex
+fn vs_meshlet(@builtin(vertex_index) vertexIndex: u32, @builtin(instance_index) clusterIndex: u32) -> VertexOutput
+{
+    // Every cluster is drawn with the triangles of the largest meshlet, the ones past its own are moved out of the
+    // clip volume as a whole and never rasterised
+    let cluster = uClusters[clusterIndex];
+    let meshlet = uMeshlets[cluster.y];
+    let triangle = vertexIndex / 3u;
+
+    if (triangle >= meshlet.triangleCount)
+    {
+        var out: VertexOutput;
+        out.position = vec4f(0.0, 0.0, -1.0, 1.0);
+        return out;
+    }
+
+    let corner = (uMeshletTriangles[meshlet.triangleOffset + triangle] >> (8u * (vertexIndex % 3u))) & 0xffu;
+    let base = uMeshletVertices[meshlet.vertexOffset + corner] * VERTEX_FLOATS;
+
+    var in: VertexInput;
+    in.position = vec3f(uVertices[base + 0u], uVertices[base + 1u], uVertices[base + 2u]);
+    in.normal = vec3f(uVertices[base + 3u], uVertices[base + 4u], uVertices[base + 5u]);
+    in.color = vec3f(uVertices[base + 6u], uVertices[base + 7u], uVertices[base + 8u]);
+    in.texCoord = vec2f(uVertices[base + 9u], uVertices[base + 10u]);
+
+    return transformVertex(in, cluster.x);
+}
+
+/**
+*   Depth pre-pass: positions come from the arena's position stream, 12 bytes per vertex, and nothing is shaded
+*/
+struct DepthOutput
+{
+    @invariant @builtin(position) position: vec4f,
+    @location(0) @interpolate(flat) fade: u32,
+};
+
+fn transformDepth(position: vec3f, instanceIndex: u32) -> DepthOutput
+{
+    var out: DepthOutput;
+    out.position = clipPosition(position, uUniforms.modelMatrix * uInstances[instanceIndex].transform);
+    out.fade = 0u;
+    return out;
+}
+
+@vertex
+fn vs_depth(@location(0) position: vec3f, @builtin(instance_index) instanceIndex: u32) -> DepthOutput
+{
+    return transformDepth(position, instanceIndex);
+}
+
+@vertex
+fn vs_depth_culled(@location(0) position: vec3f, @builtin(instance_index) instanceIndex: u32) -> DepthOutput
+{
+    let entry = uVisibleInstances[instanceIndex];
+    var out = transformDepth(position, entry & 0xffffffu);
+    out.fade = entry >> 24u;
+    return out;
+}
+
+fn shade(in: VertexOutput) -> vec4f
 {
     let normal = normalize(in.normal);
 
@@ -57,4 +183,49 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4<f32>
 	// Gamma-correction
 	let corrected_color = pow(color, vec3f(2.2));
 	return vec4f(corrected_color, uUniforms.color.a);
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> 
+{
+    return shade(in);
+}
+
+// Level of detail cross-fade: an instance between two levels is drawn at both, and every pixel keeps exactly one of
+// them. The finer level keeps the pixels whose threshold is at or above the fade, the coarser one the others
+fn fadeDiscarded(position: vec4f, fade: u32) -> bool
+{
+    if (fade == 0u)
+    {
+        return false;
+    }
+
+    // 4x4 ordered dither thresholds, a var to be indexed dynamically
+    var bayer = array<f32, 16>(0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    let pixel = vec2u(position.xy) % 4u;
+    let threshold = (bayer[pixel.y * 4u + pixel.x] + 0.5) / 16.0;
+    let fraction = f32(fade & 0x7fu) / 128.0;
+    let coarser = (fade & 0x80u) != 0u;
+
+    return (threshold < fraction) != coarser;
+}
+
+@fragment
+fn fs_fade(in: VertexOutput) -> @location(0) vec4<f32>
+{
+    if (fadeDiscarded(in.position, in.fade))
+    {
+        discard;
+    }
+    return shade(in);
+}
+
+// Depth pre-pass of cross-faded levels has to drop the same pixels, without it the pre-pass needs no fragment shader
+@fragment
+fn fs_depth_fade(in: DepthOutput)
+{
+    if (fadeDiscarded(in.position, in.fade))
+    {
+        discard;
+    }
 }
\ No newline at end of file
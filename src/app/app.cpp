@@ -1,7 +1,13 @@
 #include <cassert>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
 
 #include "app.h"
 #include "utils.h"
+#include "mesh_utils.h"
+#include "thread_pool.h"
+#include "simplify.h"
 
 #include <LiteMath.h>
 
@@ -75,6 +81,22 @@ static void handle_request_device(WGPURequestDeviceStatus status,
   *(WGPUDevice *)userdata1 = device;
 }
 
+//  Waits on the GPU give up from now on and the main loop ends
+static void handle_device_lost(WGPUDevice const* device, WGPUDeviceLostReason reason, WGPUStringView message,
+                               void *userdata1, void *userdata2)
+{
+  UNUSED(device);
+  UNUSED(userdata2);
+
+  //  Releasing the device at exit loses it too
+  if (reason != WGPUDeviceLostReason_Destroyed)
+  {
+    std::cerr << "Device lost (reason " << reason << "): " << std::string(message.data ? message.data : "", message.data ? message.length : 0) << std::endl;
+  }
+
+  static_cast<WGPU::GpuEvents*>(userdata1)->OnDeviceLost();
+}
+
 void onDeviceError(WGPUErrorType type, const char* message, void*) 
 {
   UNUSED(type);
@@ -82,6 +104,26 @@ void onDeviceError(WGPUErrorType type, const char* message, void*)
   std::cerr << "Device error: " << message << std::endl;
 }
 
+//  Clamp pitch and recompute the front vector from yaw and pitch
+static void update_camera_front()
+{
+  if (pitch > 89.0f)
+    pitch = 89.0f;
+  if (pitch < -89.0f)
+    pitch = -89.0f;
+
+  // Calculate new front vector
+  float frontX = cosf(yaw * M_PI / 180.0f) * cosf(pitch * M_PI / 180.0f);
+  float frontY = sinf(pitch * M_PI / 180.0f);
+  float frontZ = sinf(yaw * M_PI / 180.0f) * cosf(pitch * M_PI / 180.0f);
+
+  // Normalize front
+  float length = sqrtf(frontX * frontX + frontY * frontY + frontZ * frontZ);
+  cameraFrontX = frontX / length;
+  cameraFrontY = frontY / length;
+  cameraFrontZ = frontZ / length;
+}
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) 
 {
   if (!use_camera_movement)
@@ -107,24 +149,116 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
   yaw += xoffset;
   pitch += yoffset;
 
-  if (pitch > 89.0f)
-    pitch = 89.0f;
-  if (pitch < -89.0f)
-    pitch = -89.0f;
+  update_camera_front();
+}
 
-  // Calculate new front vector
-  float frontX = cosf(yaw * M_PI / 180.0f) * cosf(pitch * M_PI / 180.0f);
-  float frontY = sinf(pitch * M_PI / 180.0f);
-  float frontZ = sinf(yaw * M_PI / 180.0f) * cosf(pitch * M_PI / 180.0f);
+bool Application::Initialize(bool headless)
+{
+  this->headless = headless;
 
-  // Normalize front
-  float length = sqrtf(frontX * frontX + frontY * frontY + frontZ * frontZ);
-  cameraFrontX = frontX / length;
-  cameraFrontY = frontY / length;
-  cameraFrontZ = frontZ / length;
+  if (!headless && !initWindow())
+  {
+    return false;
+  }
+
+  WGPUInstanceDescriptor desc = {};
+  desc.nextInChain = nullptr;
+
+  // Create the instance using this descriptor
+  instance = wgpuCreateInstance(&desc);
+
+  if (!instance) {
+    std::cerr << "Could not initialize WebGPU!" << std::endl;
+    return false;
+  }
+
+  //  Headless runs request an adapter without surface, software adapters (e.g. lavapipe) are fine
+  if (!headless)
+  {
+    initSurface();
+  }
+
+  WGPURequestAdapterOptions adapterOpts = {.nextInChain = nullptr, .compatibleSurface = surface};
+
+  const WGPURequestAdapterCallbackInfo adapterCallbackInfo = {
+    .callback = handle_request_adapter,
+    .userdata1 = &adapter
+  };
+
+  // //  Get supported limits
+  // WGPULimits supportedLimits;
+  // wgpuAdapterGetLimits(adapter, &supportedLimits);
+  // WGPURequir
+
+  device = std::make_shared<WGPUDevice>();
+
+  const WGPURequestDeviceCallbackInfo deviceCallbackInfo = {
+    .callback = handle_request_device,
+    .userdata1 = device.get()
+  };
+
+  wgpuInstanceRequestAdapter(instance, &adapterOpts, adapterCallbackInfo);
+
+  if (!adapter) {
+    std::cerr << "Could not get WebGPU adapter!" << std::endl;
+    return false;
+  }
+
+  //  Optional features: timestamp queries for GPU pass times, adapter specific format features for 2x and 8x MSAA,
+  //  pipeline statistics for fragment shader invocations
+  std::vector<WGPUFeatureName> features;
+  for (WGPUFeatureName feature : { WGPUFeatureName_TimestampQuery, (WGPUFeatureName)WGPUNativeFeature_TextureAdapterSpecificFormatFeatures,
+    (WGPUFeatureName)WGPUNativeFeature_PipelineStatisticsQuery })
+  {
+    if (wgpuAdapterHasFeature(adapter, feature))
+    {
+      features.push_back(feature);
+    }
+  }
+
+  WGPUDeviceDescriptor deviceDesc = {};
+  deviceDesc.label = WEBGPU_STR("Device");
+  deviceDesc.requiredFeatureCount = features.size();
+  deviceDesc.requiredFeatures = features.data();
+  deviceDesc.deviceLostCallbackInfo.mode = WGPUCallbackMode_AllowSpontaneous;
+  deviceDesc.deviceLostCallbackInfo.callback = handle_device_lost;
+  deviceDesc.deviceLostCallbackInfo.userdata1 = &gpu_events;
+
+  wgpuAdapterRequestDevice(adapter, &deviceDesc, deviceCallbackInfo);
+
+  queue = std::make_shared<WGPUQueue>(wgpuDeviceGetQueue(*device));
+
+  if (!headless)
+  {
+    //  Present modes can only be queried while we still hold the adapter
+    WGPUSurfaceCapabilities capabilities = {};
+    wgpuSurfaceGetCapabilities(surface, adapter, &capabilities);
+    supported_present_modes.assign(capabilities.presentModes, capabilities.presentModes + capabilities.presentModeCount);
+    wgpuSurfaceCapabilitiesFreeMembers(capabilities);
+
+    configureSurface(present_mode, max_frame_latency);
+    initImGui();
+  }
+
+  gpu_events.Init(instance, device, queue);
+  render_graph.Init(device);
+
+  //  Render APIs take their shaders and pipelines from here
+  pipeline_cache = std::make_shared<PipelineCache>();
+  pipeline_cache->Init(*device);
+
+  initFrameBuffers();
+
+  //  One staging buffer more than frames in flight, so mapping never holds back the next capture
+  frame_capture.Init(&gpu_events, device, APP_WIDTH, APP_HEIGHT, frames_in_flight + 1);
+
+  // Release the adapter only after it has been fully utilized
+	wgpuAdapterRelease(adapter);
+
+  return true;
 }
 
-bool Application::Initialize()
+bool Application::initWindow()
 {
   if (!glfwInit())
   {
@@ -147,17 +281,11 @@ bool Application::Initialize()
   // Set mouse movement callback
   glfwSetCursorPosCallback(window, mouse_callback);
 
-  WGPUInstanceDescriptor desc = {};
-  desc.nextInChain = nullptr;
-
-  // Create the instance using this descriptor
-  instance = wgpuCreateInstance(&desc);
-
-  if (!instance) {
-    std::cerr << "Could not initialize WebGPU!" << std::endl;
-    return false;
-  }
+  return true;
+}
 
+void Application::initSurface()
+{
   #if defined(GLFW_EXPOSE_NATIVE_X11)
 
   Display *x11_display = glfwGetX11Display();
@@ -200,38 +328,23 @@ bool Application::Initialize()
   surface = wgpuInstanceCreateSurface(instance, &tmp1);
 
   #endif
+}
 
-  WGPURequestAdapterOptions adapterOpts = {.nextInChain = nullptr, .compatibleSurface = surface};
-
-  const WGPURequestAdapterCallbackInfo adapterCallbackInfo = {
-    .callback = handle_request_adapter,
-    .userdata1 = &adapter
-  };
-
-  // //  Get supported limits
-  // WGPULimits supportedLimits;
-  // wgpuAdapterGetLimits(adapter, &supportedLimits);
-  // WGPURequir
-
-  device = std::make_shared<WGPUDevice>();
-
-  const WGPURequestDeviceCallbackInfo deviceCallbackInfo = {
-    .callback = handle_request_device,
-    .userdata1 = device.get()
-  };
-
-  wgpuInstanceRequestAdapter(instance, &adapterOpts, adapterCallbackInfo);
-  wgpuAdapterRequestDevice(adapter, NULL, deviceCallbackInfo);
-
-  queue = std::make_shared<WGPUQueue>(wgpuDeviceGetQueue(*device));
+void Application::configureSurface(WGPUPresentMode mode, uint32_t latency)
+{
+  //  wgpu-native extension, the default latency of the backend is used otherwise
+  WGPUSurfaceConfigurationExtras configExtras = {};
+  configExtras.chain.sType = (WGPUSType)WGPUSType_SurfaceConfigurationExtras;
+  configExtras.chain.next = nullptr;
+  configExtras.desiredMaximumFrameLatency = latency;
 
   WGPUSurfaceConfiguration config = {};
 
   config.device = *device;
   config.usage = WGPUTextureUsage_RenderAttachment;
   config.format = WGPUTextureFormat_RGBA8Unorm,
-  config.presentMode = WGPUPresentMode_Fifo; 
-  config.nextInChain = nullptr;
+  config.presentMode = mode; 
+  config.nextInChain = (const WGPUChainedStruct *)&configExtras;
   config.viewFormatCount = 0;
   config.viewFormats = nullptr;
   config.alphaMode = WGPUCompositeAlphaMode_Auto;
@@ -243,19 +356,30 @@ bool Application::Initialize()
 
   wgpuSurfaceConfigure(surface, &config);
 
-  initImGui();
-  initFrameBuffers();
+  configured_present_mode = mode;
+  configured_frame_latency = latency;
+}
 
-  // Release the adapter only after it has been fully utilized
-	wgpuAdapterRelease(adapter);
+void Application::setPresentMode(WGPUPresentMode mode)
+{
+  if (std::find(supported_present_modes.begin(), supported_present_modes.end(), mode) == supported_present_modes.end())
+  {
+    std::cerr << "Present mode " << mode << " is not supported by the surface" << std::endl;
+    return;
+  }
 
-  return true;
+  present_mode = mode;
+}
+
+void Application::setMaxFrameLatency(uint32_t latency)
+{
+  max_frame_latency = std::max(latency, 1u);
 }
 
 void Application::initFrameBuffers()
 {
-  int width, height;
-  glfwGetWindowSize(window, &width, &height);
+  //  Headless runs have no window to ask
+  uint32_t width = APP_WIDTH, height = APP_HEIGHT;
 
   uint32_t bytesPerRowUnpadded = width * 4;
   uint32_t bytesPerRow = bytesPerRowUnpadded;
@@ -267,35 +391,12 @@ void Application::initFrameBuffers()
   textureBufferDesc.usage = WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst;
   textureBufferDesc.label = WEBGPU_STR("frame texture buffer");
 
-  output_buffer = wgpuDeviceCreateBuffer(*device, &textureBufferDesc);
-  
-  //  Create texture
-  WGPUExtent3D textureSize = {(uint32_t)width, (uint32_t)height, 1};
-
-  WGPUTextureDescriptor textureDesc{};
-  textureDesc.dimension = WGPUTextureDimension_2D;
-  textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
-  textureDesc.size = textureSize;
-  textureDesc.sampleCount = 1;
-  textureDesc.viewFormatCount = 0;
-  textureDesc.viewFormats = nullptr;
-  textureDesc.mipLevelCount = 1;
-  textureDesc.label = WEBGPU_STR("Input");
-  textureDesc.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst;
-
-  frame_texture = wgpuDeviceCreateTexture(*device, &textureDesc);
+  frame_slots.resize(frames_in_flight);
 
-  WGPUTextureViewDescriptor textureViewDesc {};
-  textureViewDesc.aspect = WGPUTextureAspect_All;
-  textureViewDesc.baseArrayLayer = 0;
-  textureViewDesc.arrayLayerCount = 1;
-  textureViewDesc.dimension = WGPUTextureViewDimension_2D;
-  textureViewDesc.format = WGPUTextureFormat_RGBA8Unorm;
-  textureViewDesc.mipLevelCount = 1;
-  textureViewDesc.baseMipLevel = 0;
-  textureViewDesc.label = WEBGPU_STR("Input");
-  
-  frame_texture_view = wgpuTextureCreateView(frame_texture, &textureViewDesc);
+  for (uint32_t i = 0; i < frames_in_flight; i++)
+  {
+    output_buffers.push_back(wgpuDeviceCreateBuffer(*device, &textureBufferDesc));
+  }
 }
 
 void Application::image2Texture(const std::string& path)
@@ -351,6 +452,16 @@ void Application::image2Texture(const std::string& path)
 
 bool Application::IsRunning() const
 {
+  if (gpu_events.IsDeviceLost())
+  {
+    return false;
+  }
+
+  if (headless)
+  {
+    return frame_number < headless_frames;
+  }
+
   return !glfwWindowShouldClose(window);
 }
 
@@ -360,9 +471,34 @@ WGPUTextureView Application::getNextSurfaceViewData()
   WGPUSurfaceTexture surfaceTexture;
 
   wgpuSurfaceGetCurrentTexture(surface, &surfaceTexture);
-	if (surfaceTexture.status == WGPUSurfaceGetCurrentTextureStatus_Error) {
-		return nullptr;
-	}
+
+  switch (surfaceTexture.status)
+  {
+  case WGPUSurfaceGetCurrentTextureStatus_SuccessOptimal:
+  case WGPUSurfaceGetCurrentTextureStatus_SuccessSuboptimal:
+    break;
+
+  case WGPUSurfaceGetCurrentTextureStatus_Outdated:
+  case WGPUSurfaceGetCurrentTextureStatus_Lost:
+    //  Nothing is acquired, so the surface can be reconfigured right away and the next frame acquires again
+    if (surfaceTexture.texture)
+    {
+      wgpuTextureRelease(surfaceTexture.texture);
+    }
+    configureSurface(configured_present_mode, configured_frame_latency);
+    return nullptr;
+
+  default:
+    //  Timeout, out of memory, device lost or error: skip the frame
+    std::cerr << "Could not acquire the surface texture, status " << surfaceTexture.status << std::endl;
+    if (surfaceTexture.texture)
+    {
+      wgpuTextureRelease(surfaceTexture.texture);
+    }
+    return nullptr;
+  }
+
+  surface_texture = surfaceTexture.texture;
 
   // Create a view for this surface texture
 	WGPUTextureViewDescriptor viewDescriptor;
@@ -391,7 +527,7 @@ void Application::initImGui()
   //  Setup Platform/Renderer backends
   ImGui_ImplWGPU_InitInfo imGuiRenderInfo{};
   imGuiRenderInfo.Device = *device;
-  imGuiRenderInfo.NumFramesInFlight = 3;
+  imGuiRenderInfo.NumFramesInFlight = frames_in_flight;
   imGuiRenderInfo.RenderTargetFormat = WGPUTextureFormat_RGBA8Unorm;
   imGuiRenderInfo.DepthStencilFormat = WGPUTextureFormat_Undefined;
 
@@ -405,26 +541,172 @@ void Application::terminateImGui()
 	ImGui_ImplGlfw_Shutdown();
 }
 
-void Application::onGui(WGPURenderPassEncoder renderPass)
+void Application::onGui(GuiSnapshot& gui)
 {
+  //  Latest stats of the render thread, it publishes them after every frame
+  published_stats.Update();
+  const RenderStats& stats = published_stats.Read();
+
+  //  Held until the capture, the render thread may be drawing the previous snapshot with the same backend
+  std::lock_guard<std::mutex> lock(imgui_mutex);
+
   ImGui_ImplWGPU_NewFrame();
   ImGui_ImplGlfw_NewFrame();
   ImGui::NewFrame();
 
-  //  Display image
+  //  Display image, the render thread substitutes the frame's view or drops it in the direct path
+  ImDrawList* drawList = ImGui::GetBackgroundDrawList();
+  drawList->AddImage(GUI_FRAME_TEXTURE, {0, 0}, {APP_WIDTH, APP_HEIGHT});
+
+  ImGui::SetNextWindowSize(ImVec2(420, 600));
+  ImGui::Begin("Performance");
+  ImGui::Text("Render thread %.3f ms/frame (%.1f FPS), busy %.3f ms, jitter %.3f ms", stats.pacing.interval_ms,
+    stats.pacing.interval_ms > 0.0 ? 1000.0 / stats.pacing.interval_ms : 0.0, stats.pacing.busy_ms, stats.pacing.jitter_ms);
+  ImGui::Text("Main thread %.3f ms/tick, busy %.3f ms, jitter %.3f ms", main_pacing.interval_ms, main_pacing.busy_ms, main_pacing.jitter_ms);
+  ImGui::Text("Packet age %.3f ms, packets skipped %llu", stats.packet_age_ms, (unsigned long long)packets_skipped);
+
+  float rate = (float)input_rate;
+  if (ImGui::SliderFloat("Input rate (Hz)", &rate, 30.0f, 1000.0f, "%.0f"))
   {
-    ImDrawList* drawList = ImGui::GetBackgroundDrawList();
-    drawList->AddImage((ImTextureID)(frame_texture_view), {0, 0}, {APP_WIDTH, APP_HEIGHT});
+    input_rate = rate;
   }
 
-  ImGui::SetNextWindowSize(ImVec2(350, 50));
-  ImGui::Begin("Performance");
-  ImGuiIO& io = ImGui::GetIO();
-  ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.f / io.Framerate, io.Framerate);
+  int path = (int)present_path;
+  ImGui::RadioButton("Direct", &path, (int)PresentPath::Direct);
+  ImGui::SameLine();
+  ImGui::RadioButton("Composite", &path, (int)PresentPath::Composite);
+  present_path = (PresentPath)path;
+
+  int mode = (int)submit_mode;
+  ImGui::RadioButton("Single submit", &mode, (int)SubmitMode::Single);
+  ImGui::SameLine();
+  ImGui::RadioButton("Submit per pass", &mode, (int)SubmitMode::PerPass);
+  submit_mode = (SubmitMode)mode;
+  ImGui::Text("Submits/frame: %u, CPU finish+submit %.3f ms", stats.submit.submits, stats.submit.cpu_ms);
+  ImGui::Text("Frames in flight: %u, fence wait %.3f ms", frames_in_flight, stats.fence_wait_ms);
+  ImGui::Text("GPU callbacks: %llu, blocking waits: %llu", (unsigned long long)stats.events.dispatched,
+    (unsigned long long)stats.events.blocking_waits);
+
+  const std::pair<WGPUPresentMode, const char*> present_modes[] = {
+    { WGPUPresentMode_Fifo, "Fifo" }, { WGPUPresentMode_Mailbox, "Mailbox" }, { WGPUPresentMode_Immediate, "Immediate" }
+  };
+  for (const auto& [mode_value, name] : present_modes)
+  {
+    bool supported = std::find(supported_present_modes.begin(), supported_present_modes.end(), mode_value) != supported_present_modes.end();
+
+    ImGui::BeginDisabled(!supported);
+    if (ImGui::RadioButton(name, present_mode == mode_value) && present_mode != mode_value)
+    {
+      setPresentMode(mode_value);
+    }
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+  }
+  ImGui::NewLine();
+
+  int latency = (int)max_frame_latency;
+  if (ImGui::SliderInt("Max frame latency", &latency, 1, 3))
+  {
+    setMaxFrameLatency((uint32_t)latency);
+  }
+  ImGui::Text("Input->acquire %.2f ms, ->present %.2f ms, ->GPU done %.2f ms", stats.latency.input_to_acquire_ms, stats.latency.input_to_present_ms, stats.latency.input_to_gpu_done_ms);
+
+  ImGui::Text("Graph: %u passes (%u culled), %u transients on %u objects", stats.graph.passes, stats.graph.culled_passes, stats.graph.transient_resources, stats.graph.physical_resources);
+  ImGui::Text("Transient memory %.1f MB, allocated %.1f MB", stats.graph.transient_bytes / 1048576.0, stats.graph.physical_bytes / 1048576.0);
+  ImGui::Text("Pipelines: %.0f%% hits of %llu, compile %.2f ms, saved %.2f ms", stats.pipelines.lookups ? 100.0 * stats.pipelines.hits / stats.pipelines.lookups : 0.0,
+    (unsigned long long)stats.pipelines.lookups, stats.pipelines.compile_ms, stats.pipelines.saved_ms);
+  ImGui::Text("Shader reloads %llu (%llu failed), compile %.2f + build %.2f ms, change->swap %.2f ms", (unsigned long long)stats.shader_reload.reloads,
+    (unsigned long long)stats.shader_reload.failures, stats.shader_reload.compile_ms, stats.shader_reload.build_ms, stats.shader_reload.latency_ms);
+
+  ImGui::Text("Instances: %u in %u draws, %.1f KB uploaded", stats.instances.instances, stats.instances.draws, stats.instances.uploaded_bytes / 1024.0);
+
+  if (stats.api.rays > 0)
+  {
+    ImGui::Text("Rays: %.2f M/frame, %.1f Mrays/s", stats.api.rays / 1e6, stats.api.rays_per_second / 1e6);
+  }
+  if (stats.api.cpu_ms > 0.0)
+  {
+    ImGui::Text("CPU raster: %.2f ms, %.3f M triangles, %u tiles on %u threads", stats.api.cpu_ms, stats.api.triangles / 1e6,
+      stats.api.raster_tiles, stats.api.raster_threads);
+  }
+  if (stats.api.visible_objects + stats.api.culled_objects + stats.api.occluded_objects > 0)
+  {
+    ImGui::Text("GPU culling: %u visible, %u outside the frustum, %u occluded", stats.api.visible_objects, stats.api.culled_objects, stats.api.occluded_objects);
+  }
+  if (stats.api.scene_triangles > 0 && stats.api.total_clusters == 0)
+  {
+    ImGui::Text("Triangles: %.3f of %.3f M drawn", stats.api.triangles / 1e6, stats.api.scene_triangles / 1e6);
+  }
+  if (stats.api.total_clusters > 0)
+  {
+    ImGui::Text("Meshlets: %u of %u drawn, %.3f of %.3f M triangles", stats.api.visible_clusters, stats.api.total_clusters,
+      stats.api.triangles / 1e6, stats.api.scene_triangles / 1e6);
+  }
+
+  //  Every mode keeps the GPU times last measured in it, so switching between them compares them side by side
+  ImGui::Text("Anti-aliasing, GPU scene + post-process ms:");
+  for (AntiAliasingTiming& timing : aa_timings)
+  {
+    if (timing.aa == stats.api.aa && stats.api.gpu_scene_ms > 0.0)
+    {
+      timing.scene_ms = stats.api.gpu_scene_ms;
+      timing.post_ms = stats.api.gpu_aa_ms;
+    }
+
+    if (ImGui::RadioButton(timing.name, aa == timing.aa))
+    {
+      aa = timing.aa;
+    }
+    ImGui::SameLine(100);
+    if (timing.scene_ms > 0.0)
+    {
+      ImGui::Text("%.3f + %.3f = %.3f", timing.scene_ms, timing.post_ms, timing.scene_ms + timing.post_ms);
+    }
+    else
+    {
+      ImGui::TextDisabled("not measured");
+    }
+  }
+
+  //  Same for the depth pre-pass: shaded fragments and GPU scene time of the last frames drawn without and with it
+  if (stats.api.gpu_scene_ms > 0.0)
+  {
+    PrepassMeasurement& measured = prepass_measurements[stats.api.depth_prepass ? 1 : 0];
+    measured.fragments = stats.api.fragments;
+    measured.prepass_fragments = stats.api.prepass_fragments;
+    measured.scene_ms = stats.api.gpu_scene_ms;
+    measured.prepass_ms = stats.api.gpu_prepass_ms;
+  }
+
+  ImGui::Checkbox("Depth pre-pass", &depth_prepass);
+  for (int with = 0; with < 2; with++)
+  {
+    const PrepassMeasurement& measured = prepass_measurements[with];
+    ImGui::Text(with ? "  With:" : "  Without:");
+    ImGui::SameLine(100);
+    if (measured.scene_ms > 0.0)
+    {
+      ImGui::Text("%.3f M shaded, %.3f ms (pre-pass %.3f M, %.3f ms)", measured.fragments / 1e6, measured.scene_ms,
+        measured.prepass_fragments / 1e6, measured.prepass_ms);
+    }
+    else
+    {
+      ImGui::TextDisabled("not measured");
+    }
+  }
+
+  if (ImGui::Button("Read back frame"))
+  {
+    requestReadback();
+  }
+  ImGui::SameLine();
+  ImGui::Checkbox("Capture frames", &capture_frames);
+
+  ImGui::Text("Captured %llu, dropped %llu, delivered %llu, latency %.1f frames", (unsigned long long)stats.capture.captured, (unsigned long long)stats.capture.dropped, (unsigned long long)stats.capture.delivered, stats.capture.latency_frames);
   ImGui::End();
 
   ImGui::Render();
-	ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), renderPass);
+  gui.Capture(ImGui::GetDrawData());
 }
 
 bool Application::loadImage(const std::string& path, uint8_t** data, int &width, int &height, int &channels)
@@ -435,29 +717,21 @@ bool Application::loadImage(const std::string& path, uint8_t** data, int &width,
   return true;
 }
 
-void Application::copyOutBuffer2FrameTexture(WGPUCommandEncoder encoder)
+void Application::setCamera(float3 position, float camera_yaw, float camera_pitch)
 {
-  uint32_t bytesPerRowUnpadded = APP_WIDTH * 4;
-  uint32_t bytesPerRow = bytesPerRowUnpadded;
-  uint32_t bufferSize = bytesPerRow * APP_HEIGHT;
-
-  WGPUExtent3D textureSize = {(uint32_t)APP_WIDTH, (uint32_t)APP_HEIGHT, 1};
+  cameraPosX = position.x;
+  cameraPosY = position.y;
+  cameraPosZ = position.z;
 
-  //  Copy buffer to texture
-  WGPUTexelCopyTextureInfo dest{};
-  dest.texture = frame_texture;
-  dest.origin = {0, 0, 0};
-  dest.aspect = WGPUTextureAspect_All;
-  dest.mipLevel = 0;
+  yaw = camera_yaw;
+  pitch = camera_pitch;
 
-  WGPUTexelCopyBufferInfo source{};
-  source.buffer = output_buffer;
-  source.layout.bytesPerRow = bytesPerRow;
-  source.layout.offset = 0;
-  source.layout.rowsPerImage = APP_HEIGHT;
+  update_camera_front();
+}
 
-  //  Copy output buffer to texture for further drawing
-  wgpuCommandEncoderCopyBufferToTexture(encoder, &source, &dest, &textureSize);
+void Application::requestReadback()
+{
+  readback_requests++;
 }
 
 void Application::userInput()
@@ -517,106 +791,487 @@ void Application::userInput()
     cameraPosY -= rightY * currentSpeed;
     cameraPosZ -= rightZ * currentSpeed;
   }
-
-  update_uniform_buffer();
 }
 
 void Application::mainLoop()
 {
-  float currentFrame = glfwGetTime();
-  deltaTime = currentFrame - lastFrame;
-  lastFrame = currentFrame;
+  double now = utils::get_time();
+  main_pacing.BeginIteration(now);
 
-  //  Process all pending events
-  userInput();
+  deltaTime = now - lastFrame;
+  lastFrame = now;
 
-  WGPUTextureView targetView = getNextSurfaceViewData();
-  
-  if (!targetView)
+  if (headless && frame_number == 0)
+  {
+    headless_start_time = now;
+  }
+
+  if (!headless)
   {
+    glfwPollEvents();
+    userInput();
+  }
+
+  //  Snapshot of everything the frame needs, the render thread never reads main thread state
+  FramePacket& packet = packets.WriteBuffer();
+  packet.tick = tick_number++;
+  packet.input_time = now;
+  packet.uniforms = camera_uniforms();
+  packet.readback_requests = readback_requests;
+  packet.capture_frames = capture_frames;
+  packet.present_path = present_path;
+  packet.submit_mode = submit_mode;
+  packet.present_mode = present_mode;
+  packet.max_frame_latency = max_frame_latency;
+  packet.aa = aa;
+  packet.depth_prepass = depth_prepass;
+
+  if (!headless)
+  {
+    onGui(packet.gui);
+  }
+
+  packet.publish_time = utils::get_time();
+
+  if (!packets.Publish())
+  {
+    packets_skipped++;
+  }
+
+  main_pacing.EndIteration(utils::get_time());
+
+  if (headless)
+  {
+    packets.Update();
+    renderFrame(packets.Read());
     return;
   }
 
-  //  Create a command encoder for the draw call
+  if (!render_thread.joinable())
+  {
+    startRenderThread();
+  }
+
+  waitForNextTick();
+}
+
+void Application::waitForNextTick()
+{
+  double now = utils::get_time();
+
+  //  A late tick starts the schedule anew instead of bursting to catch up
+  next_tick = std::max(next_tick + 1.0 / input_rate, now);
+
+  //  Events arriving meanwhile are still delivered to the GLFW callbacks right away
+  while (now < next_tick)
+  {
+    glfwWaitEventsTimeout(next_tick - now);
+    now = utils::get_time();
+  }
+}
+
+void Application::startRenderThread()
+{
+  render_thread_running = true;
+  render_thread = std::thread([this]() { renderThreadLoop(); });
+}
+
+void Application::stopRenderThread()
+{
+  render_thread_running = false;
+
+  //  Wake the render thread if it sleeps on the packets
+  packets.Publish();
+  render_thread.join();
+}
+
+void Application::renderThreadLoop()
+{
+  while (true)
+  {
+    //  Sleep until the main thread publishes, a packet is never drawn twice
+    packets.Wait();
+
+    if (!render_thread_running)
+    {
+      break;
+    }
+
+    packets.Update();
+    renderFrame(packets.Read());
+  }
+}
+
+void Application::renderFrame(FramePacket& packet)
+{
+  render_stats.pacing.BeginIteration(utils::get_time());
+  render_stats.packet_age_ms = 0.95 * render_stats.packet_age_ms + 0.05 * 1000.0 * (utils::get_time() - packet.publish_time);
+
+  //  Surface can only be reconfigured while none of its textures is acquired
+  if (!headless && (packet.present_mode != configured_present_mode || packet.max_frame_latency != configured_frame_latency))
+  {
+    configureSurface(packet.present_mode, packet.max_frame_latency);
+  }
+
+  //  Frame boundary: pipelines rebuilt in the background are swapped in before anything of this frame is recorded
+  shader_reload.ApplyPending();
+
+  //  Acquire before taking a slot: a frame without surface texture is skipped without consuming the slot or touching
+  //  its stats
+  WGPUTextureView targetView = nullptr;
+  double acquire_time = 0.0;
+
+  if (!headless)
+  {
+    targetView = getNextSurfaceViewData();
+    acquire_time = utils::get_time();
+
+    if (!targetView)
+    {
+      render_stats.pacing.EndIteration(utils::get_time());
+      return;
+    }
+  }
+
+  //  Wait for the slot before touching its resources
+  if (!beginFrame())
+  {
+    if (targetView)
+    {
+      wgpuTextureViewRelease(targetView);
+      wgpuTextureRelease(surface_texture);
+      surface_texture = nullptr;
+    }
+
+    render_stats.pacing.EndIteration(utils::get_time());
+    return;
+  }
+
+  frame_slots[frame_index].input_time = packet.input_time;
+  frame_slots[frame_index].acquire_time = acquire_time;
+  wgpuQueueWriteBuffer(*queue, uniform_buffers[frame_index], 0, &packet.uniforms, sizeof(Uniforms));
+
+  //  One buffer for all slots: queue writes are ordered after the frames already submitted
+  instances->Upload(*device, *queue);
+
+  bool readback = packet.readback_requests != readbacks_done;
+  readbacks_done = packet.readback_requests;
+
+  //  Readback and captured frames are resolved into the render API texture, so they are composited
+  bool direct = !headless && packet.present_path == PresentPath::Direct && !readback && !packet.capture_frames;
+
+  if (readback)
+  {
+    render_api->RequestReadback();
+  }
+
+  //  Declare the frame
+  render_graph.Reset();
+
+  if (headless)
+  {
+    //  Offscreen target of the render API is the frame's only output
+    RGResource frame_color = render_api->Draw({ &render_graph, RG_INVALID, frame_index, &packet.uniforms, packet.aa, packet.depth_prepass });
+    render_graph.MarkOutput(frame_color);
+
+    if (packet.capture_frames)
+    {
+      frame_capture.Capture(render_graph, frame_color, frame_number);
+    }
+  }
+  else
+  {
+    RGResource backbuffer = render_graph.ImportTexture("Surface texture", nullptr, targetView);
+    render_graph.MarkOutput(backbuffer);
+
+    RGResource frame_color = render_api->Draw({ &render_graph, direct ? backbuffer : RG_INVALID, frame_index, &packet.uniforms, packet.aa,
+      packet.depth_prepass });
+
+    if (packet.capture_frames)
+    {
+      frame_capture.Capture(render_graph, frame_color, frame_number);
+    }
+
+    addGuiPass(backbuffer, frame_color, &packet.gui);
+  }
+
+  render_graph.Compile();
+
+  //  Create a command encoder for the frame
   WGPUCommandEncoderDescriptor encoderDesc = {};
   encoderDesc.nextInChain = nullptr;
-  WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(*device, &encoderDesc);
 
-  render_api->Draw();
-  
-  copyOutBuffer2FrameTexture(encoder);
+  double submit_ms = 0.0;
+  uint32_t submits = 0;
+
+  if (packet.submit_mode == SubmitMode::PerPass)
+  {
+    for (uint32_t i = 0; i < render_graph.ExecutedPassCount(); i++)
+    {
+      WGPUCommandEncoder pass_encoder = wgpuDeviceCreateCommandEncoder(*device, &encoderDesc);
+      render_graph.ExecutePass(i, pass_encoder);
+
+      submit_ms += submitEncoder(pass_encoder);
+      submits++;
+    }
+  }
+  else
+  {
+    WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(*device, &encoderDesc);
+    render_graph.Execute(encoder);
+
+    // Finally encode and submit the whole frame
+    submit_ms += submitEncoder(encoder);
+    submits++;
+  }
+
+  render_stats.submit.submits = submits;
+  render_stats.submit.cpu_ms = 0.95 * render_stats.submit.cpu_ms + 0.05 * submit_ms;
 
-  // Create the render pass that clears the screen with our color
-  WGPURenderPassDescriptor renderPassDesc = {};
-	renderPassDesc.nextInChain = nullptr;
+  endFrame();
+  frame_capture.OnSubmitted(frame_number);
+  frame_number++;
 
-  // The attachment part of the render pass descriptor describes the target texture of the pass
-	WGPURenderPassColorAttachment renderPassColorAttachment = {};
-	renderPassColorAttachment.view = targetView;
-	renderPassColorAttachment.resolveTarget = nullptr;
-	renderPassColorAttachment.loadOp = WGPULoadOp_Clear;
-	renderPassColorAttachment.storeOp = WGPUStoreOp_Store;
-	renderPassColorAttachment.clearValue = WGPUColor{ 1.0, 1.0, 1.0, 1.0 };
-  renderPassColorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+  if (!headless)
+  {
+    // At the end of the frame
+    wgpuTextureViewRelease(targetView);
 
-  renderPassDesc.colorAttachmentCount = 1;
-	renderPassDesc.colorAttachments = &renderPassColorAttachment;
-	renderPassDesc.depthStencilAttachment = nullptr;
-	renderPassDesc.timestampWrites = nullptr;
+    wgpuSurfacePresent(surface);
+    frame_slots[frame_index].present_time = utils::get_time();
 
-  // Create the render pass and end it immediately (we only clear the screen but do not draw anything)
-	WGPURenderPassEncoder renderPass = wgpuCommandEncoderBeginRenderPass(encoder, &renderPassDesc);
+    wgpuTextureRelease(surface_texture);
+    surface_texture = nullptr;
+  }
 
-  onGui(renderPass);
+  //  Deliver completions without blocking
+  gpu_events.ProcessEvents();
 
-	wgpuRenderPassEncoderEnd(renderPass);
-	wgpuRenderPassEncoderRelease(renderPass);
+  render_stats.pacing.EndIteration(utils::get_time());
+
+  render_stats.graph = render_graph.GetStats();
+  render_stats.capture = frame_capture.GetStats();
+  render_stats.events = gpu_events.GetStats();
+  render_stats.pipelines = pipeline_cache->GetStats();
+  render_stats.shader_reload = shader_reload.GetStats();
+  render_stats.api = render_api->GetStats();
+  render_stats.instances = instances->GetStats();
+
+  published_stats.WriteBuffer() = render_stats;
+  published_stats.Publish();
+}
+
+void Application::addGuiPass(RGResource backbuffer, RGResource frame_color, GuiSnapshot* gui)
+{
+  //  In the direct path the frame is already in the backbuffer and GUI is drawn on top of it
+  bool composite = frame_color != backbuffer;
+
+  RenderGraph::PassBuilder pass = render_graph.AddPass("GUI");
+  pass.Read(frame_color);
+  pass.Write(backbuffer);
+
+  pass.SetExecute([this, backbuffer, frame_color, composite, gui](WGPUCommandEncoder encoder, const RenderGraph& graph)
+  {
+    // Create the render pass that clears the screen with our color
+    WGPURenderPassDescriptor renderPassDesc = {};
+    renderPassDesc.nextInChain = nullptr;
+
+    // The attachment part of the render pass descriptor describes the target texture of the pass
+    WGPURenderPassColorAttachment renderPassColorAttachment = {};
+    renderPassColorAttachment.view = graph.GetTextureView(backbuffer);
+    renderPassColorAttachment.resolveTarget = nullptr;
+    renderPassColorAttachment.loadOp = composite ? WGPULoadOp_Clear : WGPULoadOp_Load;
+    renderPassColorAttachment.storeOp = WGPUStoreOp_Store;
+    renderPassColorAttachment.clearValue = WGPUColor{ 1.0, 1.0, 1.0, 1.0 };
+    renderPassColorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+
+    renderPassDesc.colorAttachmentCount = 1;
+    renderPassDesc.colorAttachments = &renderPassColorAttachment;
+    renderPassDesc.depthStencilAttachment = nullptr;
+    renderPassDesc.timestampWrites = nullptr;
+
+    // Create the GUI render pass on top of the frame
+    WGPURenderPassEncoder renderPass = wgpuCommandEncoderBeginRenderPass(encoder, &renderPassDesc);
+
+    {
+      //  Backend buffers and font texture are shared with the main thread's NewFrame, see imgui_mutex
+      std::lock_guard<std::mutex> lock(imgui_mutex);
+
+      gui->SetFrameTexture(composite ? graph.GetTextureView(frame_color) : nullptr);
+
+      if (ImDrawData* drawData = gui->GetDrawData())
+      {
+        ImGui_ImplWGPU_RenderDrawData(drawData, renderPass);
+      }
+    }
+
+    wgpuRenderPassEncoderEnd(renderPass);
+    wgpuRenderPassEncoderRelease(renderPass);
+  });
+}
+
+bool Application::beginFrame()
+{
+  frame_index = (frame_index + 1) % frames_in_flight;
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  //  The slot is reused N frames later, normally its work is long done and this does not block.
+  //  Otherwise sleep until exactly the slot's last submission is done
+  if (frame_slots[frame_index].in_flight)
+  {
+    gpu_events.WaitForSubmission(frame_slots[frame_index].submission);
+
+    if (!gpu_events.WaitUntil([this]() { return !frame_slots[frame_index].in_flight; }))
+    {
+      return false;
+    }
+  }
+
+  auto end = std::chrono::high_resolution_clock::now();
+  render_stats.fence_wait_ms = 0.95 * render_stats.fence_wait_ms + 0.05 * std::chrono::duration<double, std::milli>(end - start).count();
+
+  //  The slot's previous frame is complete now, so all its probe timestamps are known
+  const FrameSlot& slot = frame_slots[frame_index];
+  if (slot.gpu_done_time > 0.0)
+  {
+    LatencyStats& latency = render_stats.latency;
+    latency.input_to_acquire_ms = 0.95 * latency.input_to_acquire_ms + 0.05 * 1000.0 * (slot.acquire_time - slot.input_time);
+    latency.input_to_present_ms = 0.95 * latency.input_to_present_ms + 0.05 * 1000.0 * (slot.present_time - slot.input_time);
+    latency.input_to_gpu_done_ms = 0.95 * latency.input_to_gpu_done_ms + 0.05 * 1000.0 * (slot.gpu_done_time - slot.input_time);
+  }
+
+  return true;
+}
+
+void Application::endFrame()
+{
+  FrameSlot* slot = &frame_slots[frame_index];
+
+  slot->in_flight = true;
+  slot->submission = gpu_events.LastSubmission();
+
+  gpu_events.OnWorkDone([slot]()
+  {
+    slot->in_flight = false;
+    slot->gpu_done_time = utils::get_time();
+  });
+}
+
+double Application::submitEncoder(WGPUCommandEncoder encoder)
+{
+  auto start = std::chrono::high_resolution_clock::now();
 
-  // Finally encode and submit the render pass
 	WGPUCommandBufferDescriptor cmdBufferDescriptor = {};
 	cmdBufferDescriptor.nextInChain = nullptr;
 	WGPUCommandBuffer command = wgpuCommandEncoderFinish(encoder, &cmdBufferDescriptor);
 	wgpuCommandEncoderRelease(encoder);
 
-	wgpuQueueSubmit(*queue, 1, &command);
+	gpu_events.Submit(command);
 	wgpuCommandBufferRelease(command);
 
-	// At the end of the frame
-	wgpuTextureViewRelease(targetView);
+  auto end = std::chrono::high_resolution_clock::now();
 
-  wgpuSurfacePresent(surface);
-  wgpuDevicePoll(*device, false, nullptr);
-
-  glfwPollEvents();
+  return std::chrono::duration<double, std::milli>(end - start).count();
 }
 
 void Application::terminateBuffers()
 {
-  wgpuBufferRelease(output_buffer);
-  wgpuBufferRelease(vertex_buffer);
-  wgpuBufferRelease(index_buffer);
-  wgpuTextureViewRelease(frame_texture_view);
-  wgpuTextureRelease(frame_texture);
+  for (uint32_t i = 0; i < frames_in_flight; i++)
+  {
+    wgpuBufferRelease(output_buffers[i]);
+    wgpuBufferRelease(uniform_buffers[i]);
+  }
+  mesh_arena->Terminate();
+  instances->Terminate();
+
+  if (frame_texture)
+  {
+    wgpuTextureViewRelease(frame_texture_view);
+    wgpuTextureRelease(frame_texture);
+  }
 }
 
 void Application::Terminate()
 {
+  if (render_thread.joinable())
+  {
+    stopRenderThread();
+  }
+
+  //  Throughput counts until the GPU has finished the last frame
+  if (headless && frame_number > 0 && gpu_events.WaitForSubmission(gpu_events.LastSubmission()))
+  {
+    double elapsed = utils::get_time() - headless_start_time;
+    printf("Headless: %lu frames in %.3f s (%.1f FPS)\n", (unsigned long)frame_number, elapsed, frame_number / elapsed);
+  }
+
+  RenderAPIStats api_stats = render_api->GetStats();
+  if (api_stats.rays > 0)
+  {
+    printf("Ray tracing: %lu rays/frame, %.1f Mrays/s\n", (unsigned long)api_stats.rays, api_stats.rays_per_second / 1e6);
+  }
+  if (api_stats.cpu_ms > 0.0)
+  {
+    printf("Software raster: %.2f ms/frame, %lu triangles, %u tiles on %u threads\n", api_stats.cpu_ms, (unsigned long)api_stats.triangles,
+      api_stats.raster_tiles, api_stats.raster_threads);
+  }
+  if (api_stats.visible_objects + api_stats.culled_objects + api_stats.occluded_objects > 0)
+  {
+    printf("GPU culling: %u visible, %u outside the frustum, %u occluded instances\n", api_stats.visible_objects, api_stats.culled_objects, api_stats.occluded_objects);
+  }
+  if (api_stats.scene_triangles > 0 && api_stats.total_clusters == 0)
+  {
+    printf("Triangles: %lu of %lu drawn per frame\n", (unsigned long)api_stats.triangles, (unsigned long)api_stats.scene_triangles);
+  }
+  if (api_stats.total_clusters > 0)
+  {
+    printf("Meshlets: %u of %u clusters drawn, %lu of %lu triangles submitted per frame\n", api_stats.visible_clusters, api_stats.total_clusters,
+      (unsigned long)api_stats.triangles, (unsigned long)api_stats.scene_triangles);
+  }
+  if (api_stats.gpu_scene_ms > 0.0)
+  {
+    printf("GPU time with %ux MSAA%s: scene %.3f ms, post-process %.3f ms\n", api_stats.aa.sample_count, api_stats.aa.fxaa ? " and FXAA" : "",
+      api_stats.gpu_scene_ms, api_stats.gpu_aa_ms);
+    printf("Fragment shader invocations %s depth pre-pass: %.0f shaded, %.0f in the pre-pass, pre-pass %.3f ms\n",
+      api_stats.depth_prepass ? "with" : "without", api_stats.fragments, api_stats.prepass_fragments, api_stats.gpu_prepass_ms);
+  }
+
+  shader_reload.Stop();
+
+  frame_capture.Terminate();
   render_api->Terminate();
 
+  const PipelineCacheStats& pipeline_stats = pipeline_cache->GetStats();
+  printf("Pipeline cache: %lu lookups, %lu hits, %lu compiled (%lu warm) in %.2f ms, %.2f ms saved\n",
+    (unsigned long)pipeline_stats.lookups, (unsigned long)pipeline_stats.hits, (unsigned long)pipeline_stats.created,
+    (unsigned long)pipeline_stats.warm, pipeline_stats.compile_ms, pipeline_stats.saved_ms);
+  pipeline_cache->Terminate();
+  render_graph.Terminate();
+
   terminateBuffers();
   
-  wgpuSurfaceUnconfigure(surface);
-  wgpuSurfaceRelease(surface);
+  if (!headless)
+  {
+    wgpuSurfaceUnconfigure(surface);
+    wgpuSurfaceRelease(surface);
+  }
   
   wgpuQueueRelease(*queue);
   wgpuDeviceRelease(*device);
   
-  terminateImGui();
-  
-  glfwDestroyWindow(window);
+  if (!headless)
+  {
+    terminateImGui();
+    glfwDestroyWindow(window);
+  }
+
   wgpuInstanceRelease(instance);
   
-  glfwTerminate();
+  if (!headless)
+  {
+    glfwTerminate();
+  }
 }
 
 void Application::load_scene(const std::string& path)
@@ -638,48 +1293,131 @@ void Application::load_scene(const std::string& path)
     std::cerr << "ERR: " << err << std::endl;
   }
 
+  size_t total_unwelded = 0, total_welded = 0;
+
   for (int i = 0; i < shapes.size(); i++)
   {
     tinyobj::shape_t &shape = shapes[i];
     tinyobj::mesh_t &mesh = shape.mesh;
 
     host_meshes.emplace_back();
+    host_meshes.back().indices.reserve(mesh.indices.size());
+
+    //  Corners shared by several triangles become one vertex
+    utils::VertexWelder welder(host_meshes.back(), mesh.indices.size() / 2);
 
     for (int j = 0; j < mesh.indices.size(); j++)
     {
       tinyobj::index_t k = mesh.indices[j];
       float3 pos = { attrib.vertices[k.vertex_index * 3], -attrib.vertices[k.vertex_index * 3 + 2], attrib.vertices[k.vertex_index * 3 + 1] };
-      float3 normal = { attrib.normals[k.normal_index * 3], -attrib.normals[k.normal_index * 3 + 2], attrib.normals[k.normal_index * 3 + 1] };
-      float2 texCoord = { attrib.texcoords[k.texcoord_index  * 2], 1.0f - attrib.texcoords[k.texcoord_index  * 2 + 1] };
+      float3 normal = { 0, 0, 0 };
+      float2 texCoord = { 0, 0 };
       float3 color = { 1, 1, 1 };
+
+      //  Normals and texcoords are optional in OBJ
+      if (k.normal_index >= 0)
+      {
+        normal = { attrib.normals[k.normal_index * 3], -attrib.normals[k.normal_index * 3 + 2], attrib.normals[k.normal_index * 3 + 1] };
+      }
+      if (k.texcoord_index >= 0)
+      {
+        texCoord = { attrib.texcoords[k.texcoord_index  * 2], 1.0f - attrib.texcoords[k.texcoord_index  * 2 + 1] };
+      }
       
-      Vertex vert { pos, normal, color, texCoord };
+      welder.Add({ pos, normal, color, texCoord });
+    }
+
+    const Mesh& loaded = host_meshes.back();
+    size_t unwelded_bytes = loaded.indices.size() * sizeof(Vertex);
+    size_t welded_bytes = loaded.vertices.size() * sizeof(Vertex) + loaded.indices.size() * sizeof(uint32_t);
+
+    //  Without indices every corner is shaded, with them only post-transform cache misses are
+    printf("Mesh_%d was loaded, vertices: %lu (%lu unwelded), indices: %lu, %.1f KB -> %.1f KB, VS invocations %lu -> %u\n", i,
+      loaded.vertices.size(), loaded.indices.size(), loaded.indices.size(), unwelded_bytes / 1024.0, welded_bytes / 1024.0,
+      loaded.indices.size(), utils::vertex_cache_misses(loaded.indices));
+
+    total_unwelded += unwelded_bytes;
+    total_welded += welded_bytes;
+  }
+
+  printf("Scene vertex data: %.2f MB unwelded, %.2f MB welded with indices\n", total_unwelded / 1048576.0, total_welded / 1048576.0);
+}
 
-      host_meshes.back().vertices.push_back(vert);
-      host_meshes.back().indices.push_back(host_meshes.back().indices.size());
+void Application::optimize_scene()
+{
+  if (!optimize_meshes)
+  {
+    printf("Mesh optimisation is off\n");
+    return;
+  }
+
+  std::vector<utils::VertexCacheStats> before(host_meshes.size()), after(host_meshes.size());
+
+  double start = utils::get_time();
+
+  utils::ThreadPool pool;
+  pool.ParallelFor(host_meshes.size(), 1, [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; i++)
+    {
+      Mesh& mesh = host_meshes[i];
+
+      before[i] = utils::analyze_vertex_cache(mesh.indices, mesh.vertices.size());
+      utils::optimize_mesh(mesh);
+      after[i] = utils::analyze_vertex_cache(mesh.indices, mesh.vertices.size());
     }
+  });
 
-    printf("Mesh_%d was loaded, vertices: %lu, indices: %lu\n", i, host_meshes.back().vertices.size(), host_meshes.back().indices.size());
+  double elapsed_ms = (utils::get_time() - start) * 1000.0;
+
+  for (size_t i = 0; i < host_meshes.size(); i++)
+  {
+    printf("Mesh_%zu optimised, ACMR: %.3f -> %.3f, ATVR: %.3f -> %.3f\n", i, before[i].acmr, after[i].acmr, before[i].atvr, after[i].atvr);
   }
+
+  printf("Mesh optimisation took %.1f ms\n", elapsed_ms);
 }
 
-void Application::load_scene_on_GPU()
+void Application::generate_lods()
 {
-  WGPUBufferDescriptor vertex_desc {};
-  vertex_desc.label = WEBGPU_STR("Vertex Buffer");
-  vertex_desc.size = sizeof(Vertex) * host_meshes[0].vertices.size();
-  vertex_desc.usage = WGPUBufferUsage_Vertex | WGPUBufferUsage_CopyDst;
-  vertex_desc.mappedAtCreation = false; 
+  double start = utils::get_time();
+
+  //  Meshes differ wildly in size, one per task balances best
+  utils::ThreadPool pool;
+  pool.ParallelFor(host_meshes.size(), 1, [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; i++)
+    {
+      host_meshes[i].lods = utils::build_lod_chain(host_meshes[i]);
+    }
+  });
+
+  double elapsed_ms = (utils::get_time() - start) * 1000.0;
+
+  for (size_t i = 0; i < host_meshes.size(); i++)
+  {
+    const Mesh& mesh = host_meshes[i];
+
+    printf("Mesh_%zu levels of detail: %zu", i, mesh.indices.size() / 3);
+    for (const MeshLod& level : mesh.lods)
+    {
+      printf(" -> %zu (error %.4f)", level.indices.size() / 3, level.error);
+    }
+    printf(" triangles\n");
+  }
 
-  utils::load_data_to_buffer(&vertex_buffer, static_cast<void*>(host_meshes[0].vertices.data()), vertex_desc, *device);
+  printf("Level of detail generation took %.1f ms\n", elapsed_ms);
+}
 
-  WGPUBufferDescriptor index_desc {};
-  index_desc.label = WEBGPU_STR("Index Buffer");
-  index_desc.size = sizeof(uint32_t) * host_meshes[0].indices.size();
-  index_desc.usage = WGPUBufferUsage_Index | WGPUBufferUsage_CopyDst;
-  index_desc.mappedAtCreation = false; 
+void Application::load_scene_on_GPU()
+{
+  //  All shapes share one vertex and one index buffer, however many there are
+  mesh_arena = std::make_shared<MeshArena>();
+  mesh_arena->Upload(*device, host_meshes);
 
-  utils::load_data_to_buffer(&index_buffer, static_cast<void*>(host_meshes[0].indices.data()), index_desc, *device);
+  instances = std::make_shared<InstanceSet>();
+  create_instances();
+  instances->Upload(*device, *queue);
   
   Uniforms obj;
   float3 pos = float3(cameraPosX, cameraPosY, cameraPosZ);
@@ -698,11 +1436,61 @@ void Application::load_scene_on_GPU()
 
   uniforms = obj;
 
-  uniform_buffer = wgpuDeviceCreateBuffer(*device, &uniforms_desc);
-  wgpuQueueWriteBuffer(wgpuDeviceGetQueue(*device), uniform_buffer, 0, &uniforms, uniforms_desc.size);
+  for (uint32_t i = 0; i < frames_in_flight; i++)
+  {
+    uniform_buffers.push_back(wgpuDeviceCreateBuffer(*device, &uniforms_desc));
+    wgpuQueueWriteBuffer(*queue, uniform_buffers.back(), 0, &uniforms, uniforms_desc.size);
+  }
 }
 
-void Application::update_uniform_buffer()
+void Application::create_instances()
+{
+  instances->Clear();
+
+  if (instances_per_mesh == 0)
+  {
+    for (uint32_t mesh = 0; mesh < host_meshes.size(); mesh++)
+    {
+      instances->Add(mesh, float4x4{});
+    }
+    return;
+  }
+
+  //  Cube of instances around the origin, spaced by the size of each mesh
+  const uint32_t side = (uint32_t)std::ceil(std::cbrt((double)instances_per_mesh));
+
+  for (uint32_t mesh = 0; mesh < host_meshes.size(); mesh++)
+  {
+    float3 bounds_min(1e30f, 1e30f, 1e30f);
+    float3 bounds_max(-1e30f, -1e30f, -1e30f);
+
+    for (const Vertex& vertex : host_meshes[mesh].vertices)
+    {
+      bounds_min = LiteMath::min(bounds_min, vertex.pos);
+      bounds_max = LiteMath::max(bounds_max, vertex.pos);
+    }
+
+    float3 extent = host_meshes[mesh].vertices.empty() ? float3(1.0f) : bounds_max - bounds_min;
+    float spacing = 1.5f * std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f));
+
+    for (uint32_t i = 0; i < instances_per_mesh; i++)
+    {
+      float3 cell((float)(i % side), (float)(i / side % side), (float)(i / (side * side)));
+      float3 offset = (cell - float3(0.5f * (side - 1))) * spacing;
+
+      //  Cheap hash for a stable pastel color per instance
+      uint32_t hash = i * 2654435761u;
+      float4 color(0.5f + (hash & 0xff) / 510.0f, 0.5f + ((hash >> 8) & 0xff) / 510.0f, 0.5f + ((hash >> 16) & 0xff) / 510.0f, 1.0f);
+
+      instances->Add(mesh, LiteMath::translate4x4(offset), color);
+    }
+  }
+
+  printf("Instances: %u of each of %zu meshes, %.2f MB\n", instances_per_mesh, host_meshes.size(),
+    (double)instances_per_mesh * host_meshes.size() * sizeof(InstanceData) / 1048576.0);
+}
+
+Uniforms Application::camera_uniforms() const
 {
   float3 pos = float3(cameraPosX, cameraPosY, cameraPosZ);
   float3 target = pos + float3(cameraFrontX, cameraFrontY, cameraFrontZ);
@@ -710,8 +1498,7 @@ void Application::update_uniform_buffer()
   Uniforms obj = uniforms;
   obj.viewMtrx = LiteMath::lookAt(pos, target, float3(0, 1, 0));
   
-  uniforms = obj;
-  wgpuQueueWriteBuffer(wgpuDeviceGetQueue(*device), uniform_buffer, 0, &uniforms, wgpuBufferGetSize(uniform_buffer));
+  return obj;
 }
 
 };
\ No newline at end of file
@@ -19,6 +19,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include <imgui.h>
@@ -26,29 +29,77 @@
 #include <backends/imgui_impl_glfw.h>
 
 #include "render.h"
+#include "render_graph.h"
+#include "async_readback.h"
+#include "gpu_events.h"
+#include "pipeline_cache.h"
+#include "mesh_arena.h"
+#include "instance_set.h"
+#include "frame_packet.h"
+#include "triple_buffer.h"
 #include "mesh.h"
 #include "utils.h"
 
 constexpr uint32_t APP_WIDTH = 1024;
 constexpr uint32_t APP_HEIGHT = 1024;
 
+//  Default size of the ring of per-frame GPU resources
+constexpr uint32_t FRAMES_IN_FLIGHT = 3;
+
+//  Default rate of input sampling and simulation on the main thread, independent of the render rate
+constexpr double INPUT_RATE = 240.0;
+
 namespace WGPU
 {
 void error_callback(int error, const char* description);
 
+//  Last measurement of the scene drawn without or with depth pre-pass
+struct PrepassMeasurement
+{
+  double fragments = 0.0;           //  Fragment shader invocations of the colour passes
+  double prepass_fragments = 0.0;
+  double scene_ms = 0.0;
+  double prepass_ms = 0.0;
+};
+
+//  Anti-aliasing mode of the GUI and the GPU times last measured with it
+struct AntiAliasingTiming
+{
+  AntiAliasing aa;
+  const char* name;
+  double scene_ms = 0.0;
+  double post_ms = 0.0;
+};
+
+//  State of one slot of the frames-in-flight ring
+struct FrameSlot
+{
+  bool in_flight = false;   //  Set on submit, cleared by the queue work done callback
+  WGPUSubmissionIndex submission = 0;
+
+  //  Latency probe timestamps of the slot's last frame, utils::get_time() seconds
+  double input_time = 0.0;
+  double acquire_time = 0.0;
+  double present_time = 0.0;
+  double gpu_done_time = 0.0;
+};
+
 class Application
 {
 public:
-  //  Init everything and return true if all went right
-  bool Initialize();
+  //  Init everything and return true if all went right. Headless mode needs no display:
+  //  no window, surface or GUI, frames are rendered into the render API's offscreen targets
+  bool Initialize(bool headless = false);
 
   //  Clean all App resources
   void Terminate();
 
-  //  Draw a frame and handle events
+  //  One main thread tick: handle events, sample input, build the GUI and publish a frame packet. In windowed mode
+  //  the packet is drawn by the render thread, started on the first tick, and the tick sleeps until the next one.
+  //  Headless ticks draw the packet right away
   void mainLoop();
 
-  //  Return true as long as the main loop should keep on running 
+  //  Return true as long as the main loop should keep on running, false once the device is lost
   bool IsRunning() const;
 
   void image2Texture(const std::string& path);
@@ -60,27 +111,70 @@ public:
   void load_scene(const std::string& path);
   void load_scene_on_GPU();
 
-  //  Process every interacted added event
+  //  Fill instances: instances_per_mesh copies of every mesh in a grid, or one untransformed instance per mesh
+  void create_instances();
+
+  //  Reorder host_meshes for the vertex cache, overdraw and vertex fetches and report ACMR/ATVR before and after.
+  //  Does nothing unless optimize_meshes is set
+  void optimize_scene();
+
+  //  Simplify every mesh of host_meshes into its levels of detail, in parallel across meshes. After optimize_scene,
+  //  levels are reordered for the vertex cache themselves
+  void generate_lods();
+
+  //  Move the camera by the keys held down, runs on the main thread
   void userInput();
 
+  //  Place the camera, angles in degrees as in the mouse look
+  void setCamera(float3 position, float camera_yaw, float camera_pitch);
+
   //  Init render API
   void initRenderAPI();
 
+  //  Copy the next frame into its slot's output buffer
+  void requestReadback();
+
+  //  Switch present mode, ignored if the surface does not support it. Applied at the start of the next frame
+  void setPresentMode(WGPUPresentMode mode);
+
+  //  Max number of frames the presentation engine may queue. Applied at the start of the next frame
+  void setMaxFrameLatency(uint32_t latency);
+
 private:
-//  Init frame buffer, texture and its view
+//  Init GLFW and the window
+bool initWindow();
+
+//  Create the surface of the window
+void initSurface();
+
+//  (Re)configure the surface with present mode and frame latency
+void configureSurface(WGPUPresentMode mode, uint32_t latency);
+
+//  Init output buffer used for frame readbacks
 void initFrameBuffers();
 
-//  Get next texture view from swapchain
+//  Acquire the next swapchain texture into surface_texture and return a view of it. nullptr if there is nothing to
+//  draw into this time: an outdated or lost surface is reconfigured, the caller skips the frame
 WGPUTextureView getNextSurfaceViewData();
 
-//  Copy data from output buffer to frame texture
-void copyOutBuffer2FrameTexture(WGPUCommandEncoder encoder);
-
 // Init ImGui
 void initImGui();
 
-//  Load buffer data and renderPass to commandBuffer
-void onGui(WGPURenderPassEncoder renderPass);
+//  Build the GUI on the main thread and capture it into gui. The frame is drawn as GUI_FRAME_TEXTURE background
+void onGui(GuiSnapshot& gui);
+
+//  Add GUI pass drawing gui on top of backbuffer. frame_color is composited unless it already is the backbuffer
+void addGuiPass(RGResource backbuffer, RGResource frame_color, GuiSnapshot* gui);
+
+//  Draw one frame packet: runs on the render thread, or on the main thread in headless mode
+void renderFrame(FramePacket& packet);
+
+void startRenderThread();
+void stopRenderThread();
+void renderThreadLoop();
+
+//  Sleep until the next main thread tick, handling events meanwhile
+void waitForNextTick();
 
 //  Terminate ImGui
 void terminateImGui(); 
@@ -88,29 +182,106 @@ void terminateImGui();
 //  Terminate buffers
 void terminateBuffers();
 
-void update_uniform_buffer();
+//  Uniforms of the current camera
+Uniforms camera_uniforms() const;
+
+//  Pick the next frames-in-flight slot and wait until the GPU has finished with it. False if the wait gave up, the
+//  frame has to be skipped
+bool beginFrame();
+
+//  Fence the current slot with the work submitted so far
+void endFrame();
+
+//  Finish, submit and release encoder. Return CPU time spent in ms
+double submitEncoder(WGPUCommandEncoder encoder);
 
 // private:
 public:
-GLFWwindow* window;
+GLFWwindow* window = nullptr;
 WGPUInstance instance;
-WGPUSurface surface;
+WGPUSurface surface = nullptr;
 WGPUAdapter adapter;
 std::shared_ptr<WGPUDevice> device;
 std::shared_ptr<WGPUQueue> queue;
-WGPUTexture frame_texture;
-WGPUTextureView frame_texture_view;
+WGPUTexture frame_texture = nullptr;
+WGPUTextureView frame_texture_view = nullptr;
+
+//  Every mesh of host_meshes, uploaded by load_scene_on_GPU
+std::shared_ptr<MeshArena> mesh_arena;
+
+//  What is drawn of mesh_arena, uploaded by the render thread at the start of every frame
+std::shared_ptr<InstanceSet> instances;
+uint32_t instances_per_mesh = 0;
+
+//  Per frames-in-flight slot, set frames_in_flight before Initialize to resize the ring
+uint32_t frames_in_flight = FRAMES_IN_FLIGHT;
+uint32_t frame_index = 0;
+std::vector<FrameSlot> frame_slots;
+WGPUTexture surface_texture = nullptr;    //  Acquired swapchain texture, released after present
+std::vector<WGPUBuffer> output_buffers;
+std::vector<WGPUBuffer> uniform_buffers;
 
-WGPUBuffer output_buffer;
-WGPUBuffer vertex_buffer;
-WGPUBuffer index_buffer;
-WGPUBuffer uniform_buffer;
+//  Requested on the main thread, applied by the render thread when a packet asks for something else
+WGPUPresentMode present_mode = WGPUPresentMode_Fifo;
+uint32_t max_frame_latency = 2;
+WGPUPresentMode configured_present_mode = WGPUPresentMode_Fifo;
+uint32_t configured_frame_latency = 2;
+std::vector<WGPUPresentMode> supported_present_modes;
+
+//  Requested on the main thread, the render API switches between frames
+AntiAliasing aa;
+std::vector<AntiAliasingTiming> aa_timings = {
+  { { 1, false }, "No AA" }, { { 1, true }, "FXAA" }, { { 2, false }, "2x MSAA" }, { { 4, false }, "4x MSAA" }, { { 8, false }, "8x MSAA" }
+};
+bool depth_prepass = false;
+PrepassMeasurement prepass_measurements[2];   //  Without and with depth pre-pass
+
+//  Main thread -> render thread frame packets and render thread -> main thread stats, neither side waits for the other
+utils::TripleBuffer<FramePacket> packets;
+utils::TripleBuffer<RenderStats> published_stats;
+
+std::thread render_thread;
+std::atomic<bool> render_thread_running = false;
+
+//  The ImGui context and the WGPU backend's device objects are shared by the main thread building the GUI and the
+//  render thread drawing it. NewFrame to Render and every ImGui_ImplWGPU_* call happen under this lock. GLFW input
+//  callbacks only queue events into the context's input queue, which the WGPU backend never reads
+std::mutex imgui_mutex;
+
+//  Owned by the render thread
+RenderStats render_stats;
+uint64_t readbacks_done = 0;
+
+//  Owned by the main thread
+double input_rate = INPUT_RATE;
+double next_tick = 0.0;
+uint64_t tick_number = 0;
+uint64_t packets_skipped = 0;   //  Published packets replaced before the render thread picked them up
+uint64_t readback_requests = 0;
+PacingStats main_pacing;
 
 Uniforms uniforms;
 
 std::shared_ptr<RenderAPI> render_api;
+std::shared_ptr<PipelineCache> pipeline_cache;
+ShaderHotReload shader_reload;
+RenderGraph render_graph;
+GpuEvents gpu_events;
+
+//  Continuous asynchronous capture of rendered frames, set a callback on frame_capture to consume them
+AsyncReadback frame_capture;
+bool capture_frames = false;
+
+bool headless = false;
+uint64_t headless_frames = 1000;  //  Frames to render before IsRunning turns false in headless mode
+double headless_start_time = 0.0;
+uint64_t frame_number = 0;
+
+PresentPath present_path = PresentPath::Direct;
+SubmitMode submit_mode = SubmitMode::Single;
 
 std::vector<Mesh> host_meshes;
+bool optimize_meshes = true;
 
 };
 };
\ No newline at end of file
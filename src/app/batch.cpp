@@ -0,0 +1,146 @@
+#include "batch.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+#include "stb_image_write.h"
+
+namespace WGPU
+{
+std::vector<CameraKey> load_camera_path(const std::string& path)
+{
+  std::vector<CameraKey> cameras;
+  std::ifstream file(path);
+
+  if (!file)
+  {
+    std::cerr << "Could not open camera path " << path << std::endl;
+    return cameras;
+  }
+
+  std::string line;
+  int line_number = 0;
+
+  while (std::getline(file, line))
+  {
+    line_number++;
+    line = line.substr(0, line.find('#'));
+
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+    {
+      continue;
+    }
+
+    std::istringstream stream(line);
+    CameraKey key;
+
+    if (!(stream >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch))
+    {
+      std::cerr << path << ":" << line_number << ": expected \"x y z yaw pitch\"" << std::endl;
+      return {};
+    }
+
+    cameras.push_back(key);
+  }
+
+  return cameras;
+}
+
+bool run_batch(Application& app, const BatchSettings& settings)
+{
+  std::vector<CameraKey> cameras = load_camera_path(settings.camera_path);
+
+  if (cameras.empty())
+  {
+    return false;
+  }
+
+  std::filesystem::create_directories(settings.output_dir);
+
+  utils::ThreadPool pool(settings.threads);
+  std::atomic<uint64_t> encoded = 0;
+  std::atomic<uint64_t> failed = 0;
+
+  const uint64_t first_frame = app.frame_number;
+
+  //  Runs inside the GpuEvents dispatch on the render thread: only strip row padding and hand the frame to an encoder
+  app.frame_capture.SetCallback([&](const ReadbackFrame& frame)
+  {
+    const uint64_t index = frame.frame_number - first_frame;
+    const uint32_t width = frame.width, height = frame.height;
+
+    auto pixels = std::make_shared<std::vector<uint8_t>>((size_t)width * height * 4);
+    for (uint32_t y = 0; y < height; y++)
+    {
+      memcpy(pixels->data() + (size_t)y * width * 4, frame.data + (size_t)y * frame.bytes_per_row, (size_t)width * 4);
+    }
+
+    pool.Submit([&settings, &encoded, &failed, pixels, index, width, height]()
+    {
+      char name[64];
+      snprintf(name, sizeof(name), "frame_%05lu.%s", (unsigned long)index, settings.jpg ? "jpg" : "png");
+      std::string path = (std::filesystem::path(settings.output_dir) / name).string();
+
+      int ok = settings.jpg
+        ? stbi_write_jpg(path.c_str(), width, height, 4, pixels->data(), settings.jpg_quality)
+        : stbi_write_png(path.c_str(), width, height, 4, pixels->data(), width * 4);
+
+      if (ok)
+      {
+        encoded++;
+      }
+      else
+      {
+        failed++;
+        std::cerr << "Could not write " << path << std::endl;
+      }
+    });
+  });
+
+  app.capture_frames = true;
+
+  double start = utils::get_time();
+
+  for (const CameraKey& camera : cameras)
+  {
+    //  Bound the frames waiting for an encoder, each one holds a full image
+    while (pool.Pending() > 2 * pool.Size())
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    //  Every view is needed, so wait for a staging buffer instead of dropping the frame
+    if (!app.frame_capture.WaitForStaging())
+    {
+      std::cerr << "Batch: stopped, the GPU did not free a staging buffer" << std::endl;
+      break;
+    }
+
+    app.setCamera(camera.position, camera.yaw, camera.pitch);
+    app.mainLoop();
+  }
+
+  if (!app.frame_capture.Flush())
+  {
+    std::cerr << "Batch: frames still being read back were lost" << std::endl;
+  }
+  double render_done = utils::get_time();
+
+  pool.Wait();
+  double elapsed = utils::get_time() - start;
+
+  app.capture_frames = false;
+  app.frame_capture.SetCallback(nullptr);
+
+  printf("Batch: %lu frames in %.3f s (%.1f FPS end to end), GPU + readback done after %.3f s, %lu failed\n",
+    (unsigned long)encoded.load(), elapsed, encoded.load() / elapsed, render_done - start, (unsigned long)failed.load());
+
+  return failed == 0;
+}
+};
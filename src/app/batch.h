@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "app.h"
+
+namespace WGPU
+{
+//  One view of a camera path, angles in degrees as in the interactive camera
+struct CameraKey
+{
+  float3 position;
+  float yaw;
+  float pitch;
+};
+
+struct BatchSettings
+{
+  std::string camera_path;              //  Text file, one "x y z yaw pitch" per line, '#' starts a comment
+  std::string output_dir = "output";
+  bool jpg = false;                     //  PNG otherwise
+  int jpg_quality = 90;
+  uint32_t threads = 0;                 //  Encoder threads, 0 means one per hardware thread
+};
+
+//  Load camera path, return empty vector on error
+std::vector<CameraKey> load_camera_path(const std::string& path);
+
+//  Render every view of the camera path offscreen and write frames into settings.output_dir.
+//  Frames are read back asynchronously and encoded on a thread pool while the GPU renders the next ones
+bool run_batch(Application& app, const BatchSettings& settings);
+};
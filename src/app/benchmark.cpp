@@ -0,0 +1,195 @@
+#include "benchmark.h"
+#include "bvh.h"
+#include "meshlet.h"
+#include "mesh_utils.h"
+#include "utils.h"
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+namespace WGPU
+{
+static constexpr float PI = 3.14159265358979f;
+
+//  UV sphere, evenly spread small triangles as in scanned or tessellated models. Counter-clockwise seen from outside,
+//  as the rasterizer's front faces
+static Mesh make_sphere(uint32_t triangles)
+{
+  uint32_t rings = std::max((uint32_t)std::sqrt(triangles / 4.0), 2u);
+  uint32_t segments = 2 * rings;
+  Mesh mesh;
+
+  for (uint32_t y = 0; y <= rings; y++)
+  {
+    for (uint32_t x = 0; x <= segments; x++)
+    {
+      float theta = PI * y / rings, phi = 2.0f * PI * x / segments;
+      float3 p = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+      mesh.vertices.push_back({ p, p, { 1, 1, 1 }, { (float)x / segments, (float)y / rings } });
+    }
+  }
+
+  for (uint32_t y = 0; y < rings; y++)
+  {
+    for (uint32_t x = 0; x < segments; x++)
+    {
+      uint32_t i = y * (segments + 1) + x;
+      mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + segments + 1, i + 1, i + segments + 2, i + segments + 1 });
+    }
+  }
+
+  return mesh;
+}
+
+//  Randomly placed and sized triangles, overlapping each other, the hard case for SAH splits
+static Mesh make_soup(uint32_t triangles)
+{
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+  std::exponential_distribution<float> size(4.0f);
+  std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+  Mesh mesh;
+
+  for (uint32_t t = 0; t < triangles; t++)
+  {
+    float3 center = { position(random), position(random), position(random) };
+    float scale = size(random);
+
+    for (int k = 0; k < 3; k++)
+    {
+      float3 p = center + float3(offset(random), offset(random), offset(random)) * scale;
+      mesh.indices.push_back((uint32_t)mesh.vertices.size());
+      mesh.vertices.push_back({ p, { 0, 0, 1 }, { 1, 1, 1 }, { 0, 0 } });
+    }
+  }
+
+  return mesh;
+}
+
+static void benchmark_scene(const char* name, const std::vector<Mesh>& meshes, const BvhBenchmarkSettings& settings)
+{
+  size_t triangles = 0;
+  for (const Mesh& mesh : meshes)
+  {
+    triangles += mesh.indices.size() / 3;
+  }
+
+  printf("%s: %zu triangles\n", name, triangles);
+
+  //  Single threaded build first, it is the baseline of the speedups
+  std::vector<uint32_t> thread_counts = { 0 };
+  for (uint32_t threads = 2; threads < std::thread::hardware_concurrency(); threads *= 2)
+  {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(std::max(std::thread::hardware_concurrency(), 1u));
+
+  double baseline_ms = 0.0;
+  utils::Bvh bvh;
+
+  for (uint32_t threads : thread_counts)
+  {
+    std::unique_ptr<utils::ThreadPool> pool = threads > 0 ? std::make_unique<utils::ThreadPool>(threads) : nullptr;
+    double best_ms = 1e30;
+
+    for (uint32_t run = 0; run < std::max(settings.runs, 1u); run++)
+    {
+      double start = utils::get_time();
+      bvh = utils::build_bvh(meshes, {}, pool.get());
+      best_ms = std::min(best_ms, 1000.0 * (utils::get_time() - start));
+    }
+
+    if (threads == 0)
+    {
+      baseline_ms = best_ms;
+    }
+
+    std::string label = threads == 0 ? "serial" : std::to_string(threads) + " threads";
+    printf("  %-10s %8.1f ms, %6.2f Mtris/s, speedup %.2fx\n", label.c_str(), best_ms, triangles / best_ms / 1000.0, baseline_ms / best_ms);
+  }
+
+  utils::BvhStats stats = utils::analyze_bvh(bvh);
+  printf("  SAH cost %.2f, %u nodes, %u leaves of %u-%u (avg %.2f) triangles, depth %u (avg leaf %.1f)\n", stats.sah_cost,
+    stats.nodes, stats.leaves, stats.min_leaf_size, stats.max_leaf_size, stats.average_leaf_size, stats.max_depth,
+    stats.average_leaf_depth);
+}
+
+void run_bvh_benchmark(const BvhBenchmarkSettings& settings)
+{
+  benchmark_scene("Sphere", { make_sphere(settings.triangles) }, settings);
+  benchmark_scene("Triangle soup", { make_soup(settings.triangles) }, settings);
+}
+
+static void benchmark_meshlets(const char* name, const Mesh& mesh, const MeshletBenchmarkSettings& settings)
+{
+  const size_t triangles = mesh.indices.size() / 3;
+
+  double start = utils::get_time();
+  utils::MeshletMesh meshlets = utils::build_meshlets(mesh);
+  double build_ms = 1000.0 * (utils::get_time() - start);
+
+  size_t filled_vertices = 0;
+  for (const utils::Meshlet& meshlet : meshlets.meshlets)
+  {
+    filled_vertices += meshlet.vertex_count;
+  }
+
+  const size_t count = meshlets.meshlets.size();
+  printf("%s: %zu triangles, %zu meshlets of %.1f triangles and %.1f vertices on average, built in %.1f ms\n", name, triangles,
+    count, (double)triangles / std::max<size_t>(count, 1), (double)filled_vertices / std::max<size_t>(count, 1), build_ms);
+
+  //  Cameras spread evenly over a sphere around the mesh, far enough that the whole mesh is in view so only the
+  //  backface cones cull
+  utils::BoundingSphere bounds = utils::compute_bounding_sphere(mesh);
+  const uint32_t views = std::max(settings.views, 1u);
+
+  uint64_t visible_meshlets = 0;
+  uint64_t visible_triangles = 0;
+
+  for (uint32_t view = 0; view < views; view++)
+  {
+    float y = 1.0f - 2.0f * (view + 0.5f) / views;
+    float ring = std::sqrt(std::max(1.0f - y * y, 0.0f));
+    float phi = PI * (3.0f - std::sqrt(5.0f)) * view;
+    float3 camera = bounds.center + float3(ring * std::cos(phi), y, ring * std::sin(phi)) * (3.0f * bounds.radius);
+
+    for (const utils::Meshlet& meshlet : meshlets.meshlets)
+    {
+      if (!utils::meshlet_backfacing(meshlet, camera))
+      {
+        visible_meshlets++;
+        visible_triangles += meshlet.triangle_count;
+      }
+    }
+  }
+
+  //  The whole-mesh path is an indexed draw, its vertex shader runs once per post-transform cache miss. Meshlet draws
+  //  are not indexed and run it for every corner of MESHLET_MAX_TRIANGLES triangles per cluster
+  uint32_t whole_invocations = utils::vertex_cache_misses(mesh.indices);
+  double meshlet_triangles = (double)visible_triangles / views;
+  double meshlet_invocations = (double)visible_meshlets / views * utils::MESHLET_MAX_TRIANGLES * 3;
+
+  printf("  whole mesh %10zu triangles, %10u vertex invocations per view\n", triangles, whole_invocations);
+  printf("  meshlets   %10.0f triangles (%.1f%%), %10.0f vertex invocations per view, %.1f of %zu meshlets culled\n",
+    meshlet_triangles, 100.0 * meshlet_triangles / std::max<size_t>(triangles, 1), meshlet_invocations,
+    count - (double)visible_meshlets / views, count);
+}
+
+void run_meshlet_benchmark(const MeshletBenchmarkSettings& settings)
+{
+  Mesh sphere = make_sphere(settings.triangles);
+  benchmark_meshlets("Sphere", sphere, settings);
+
+  //  Vertex cache order keeps neighbours together, the load-time optimisation the app runs
+  utils::optimize_mesh(sphere);
+  benchmark_meshlets("Sphere, optimised", sphere, settings);
+
+  benchmark_meshlets("Triangle soup", make_soup(settings.triangles), settings);
+}
+};
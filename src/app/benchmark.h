@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+namespace WGPU
+{
+struct BvhBenchmarkSettings
+{
+  uint32_t triangles = 1 << 20;         //  Approximate triangle count of each generated mesh
+  uint32_t runs = 3;                    //  Builds per configuration, the fastest one is reported
+};
+
+//  Build BVHs over generated million-triangle meshes with one thread and with growing thread pools, and print build
+//  times and tree quality. Needs no GPU or window
+void run_bvh_benchmark(const BvhBenchmarkSettings& settings);
+
+struct MeshletBenchmarkSettings
+{
+  uint32_t triangles = 1 << 20;         //  Approximate triangle count of each generated mesh
+  uint32_t views = 64;                  //  Camera positions around the mesh the cluster culling is averaged over
+};
+
+//  Build meshlets of generated meshes and print their fill, then compare the triangles and vertex shader invocations
+//  the whole-mesh draw and the backface cone culled meshlet draw submit from views around the mesh. Needs no GPU
+void run_meshlet_benchmark(const MeshletBenchmarkSettings& settings);
+};
@@ -0,0 +1,112 @@
+#include "frame_packet.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace WGPU
+{
+const ImTextureID GUI_FRAME_TEXTURE = (ImTextureID)1;
+
+void PacingStats::BeginIteration(double time)
+{
+  if (iterations > 0)
+  {
+    double interval = 1000.0 * (time - begin_time);
+
+    jitter_ms = 0.95 * jitter_ms + 0.05 * std::abs(interval - interval_ms);
+    interval_ms = 0.95 * interval_ms + 0.05 * interval;
+  }
+
+  begin_time = time;
+  iterations++;
+}
+
+void PacingStats::EndIteration(double time)
+{
+  busy_ms = 0.95 * busy_ms + 0.05 * 1000.0 * (time - begin_time);
+}
+
+template <typename T>
+static void copy_vector(ImVector<T>& dest, const ImVector<T>& source)
+{
+  //  ImVector assignment frees the old storage, resize keeps it
+  dest.resize(source.Size);
+
+  if (source.Size > 0)
+  {
+    memcpy(dest.Data, source.Data, (size_t)source.Size * sizeof(T));
+  }
+}
+
+GuiSnapshot::~GuiSnapshot()
+{
+  for (ImDrawList* list : lists)
+  {
+    IM_DELETE(list);
+  }
+}
+
+void GuiSnapshot::Capture(const ImDrawData* source)
+{
+  if (!source || !source->Valid)
+  {
+    data.Valid = false;
+    return;
+  }
+
+  while ((int)lists.size() < source->CmdListsCount)
+  {
+    lists.push_back(IM_NEW(ImDrawList)(ImGui::GetDrawListSharedData()));
+  }
+
+  data.CmdLists.resize(source->CmdListsCount);
+
+  for (int i = 0; i < source->CmdListsCount; i++)
+  {
+    const ImDrawList* from = source->CmdLists[i];
+    ImDrawList* to = lists[i];
+
+    copy_vector(to->CmdBuffer, from->CmdBuffer);
+    copy_vector(to->IdxBuffer, from->IdxBuffer);
+    copy_vector(to->VtxBuffer, from->VtxBuffer);
+    to->Flags = from->Flags;
+
+    data.CmdLists[i] = to;
+  }
+
+  data.CmdListsCount = source->CmdListsCount;
+  data.TotalIdxCount = source->TotalIdxCount;
+  data.TotalVtxCount = source->TotalVtxCount;
+  data.DisplayPos = source->DisplayPos;
+  data.DisplaySize = source->DisplaySize;
+  data.FramebufferScale = source->FramebufferScale;
+  data.OwnerViewport = source->OwnerViewport;
+  data.Valid = true;
+}
+
+void GuiSnapshot::SetFrameTexture(WGPUTextureView view)
+{
+  for (int i = 0; i < data.CmdListsCount; i++)
+  {
+    ImVector<ImDrawCmd>& commands = data.CmdLists[i]->CmdBuffer;
+
+    for (int j = 0; j < commands.Size;)
+    {
+      if (commands[j].TextureId != GUI_FRAME_TEXTURE)
+      {
+        j++;
+      }
+      else if (view)
+      {
+        commands[j].TextureId = (ImTextureID)(view);
+        j++;
+      }
+      else
+      {
+        //  Commands carry their own buffer offsets, so removing one does not shift the others
+        commands.erase(commands.Data + j);
+      }
+    }
+  }
+}
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include <imgui.h>
+
+#include "render_graph.h"
+#include "async_readback.h"
+#include "gpu_events.h"
+#include "pipeline_cache.h"
+#include "shader_reload.h"
+#include "render.h"
+#include "mesh.h"
+
+namespace WGPU
+{
+//  How the render API output reaches the swapchain
+enum class PresentPath
+{
+  Direct,     //  Render API resolves straight into the swapchain view
+  Composite,  //  Render API resolves into its own texture, ImGui draws it as a background image
+};
+
+//  How the frame's command buffers reach the queue
+enum class SubmitMode
+{
+  Single,   //  All render graph passes are recorded into one encoder, one submit per frame
+  PerPass,  //  Every render graph pass gets its own encoder and submit, kept to measure the difference
+};
+
+//  Smoothed latencies from input sampling to later points of the frame
+struct LatencyStats
+{
+  double input_to_acquire_ms = 0.0;
+  double input_to_present_ms = 0.0;
+  double input_to_gpu_done_ms = 0.0;
+};
+
+struct SubmitStats
+{
+  uint32_t submits = 0;   //  Submits in the last frame
+  double cpu_ms = 0.0;    //  Smoothed CPU time spent in finish + submit per frame
+};
+
+//  Smoothed loop timing of one thread
+struct PacingStats
+{
+  double interval_ms = 0.0;   //  Between the starts of consecutive iterations
+  double jitter_ms = 0.0;     //  Mean absolute deviation of the interval from its average
+  double busy_ms = 0.0;       //  Working part of the interval, the rest is spent waiting
+  uint64_t iterations = 0;
+
+  void BeginIteration(double time);
+  void EndIteration(double time);
+
+private:
+  double begin_time = 0.0;
+};
+
+//  Render thread state shown by the GUI, published by the render thread after every frame
+struct RenderStats
+{
+  PacingStats pacing;
+  SubmitStats submit;
+  LatencyStats latency;
+  double fence_wait_ms = 0.0;
+  double packet_age_ms = 0.0;   //  From packet publish on the main thread to the start of its frame
+
+  RenderGraphStats graph;
+  ReadbackStats capture;
+  GpuEventStats events;
+  PipelineCacheStats pipelines;
+  ShaderReloadStats shader_reload;
+  RenderAPIStats api;
+  InstanceStats instances;
+};
+
+//  Texture id the GUI uses for the rendered frame, the render thread replaces it with the view of the frame
+extern const ImTextureID GUI_FRAME_TEXTURE;
+
+//  Deep copy of ImGui draw data: the main thread builds the next GUI while the render thread still draws this one.
+//  Buffers are reused between captures
+class GuiSnapshot
+{
+public:
+  GuiSnapshot() = default;
+  ~GuiSnapshot();
+
+  GuiSnapshot(const GuiSnapshot&) = delete;
+  GuiSnapshot& operator=(const GuiSnapshot&) = delete;
+
+  void Capture(const ImDrawData* source);
+
+  //  Point GUI_FRAME_TEXTURE draws to view, or drop them if view is nullptr. Call once per capture
+  void SetFrameTexture(WGPUTextureView view);
+
+  //  nullptr if nothing was captured
+  ImDrawData* GetDrawData() { return data.Valid ? &data : nullptr; }
+
+private:
+  std::vector<ImDrawList*> lists;
+  ImDrawData data;
+};
+
+//  Everything the render thread needs for one frame. Built by the main thread and not touched by it after publishing
+struct FramePacket
+{
+  uint64_t tick = 0;
+  double input_time = 0.0;      //  When the input of the packet was sampled, utils::get_time() seconds
+  double publish_time = 0.0;
+
+  Uniforms uniforms;
+
+  uint64_t readback_requests = 0;   //  Grows with every requested readback, so skipped packets do not lose one
+  bool capture_frames = false;
+
+  PresentPath present_path = PresentPath::Direct;
+  SubmitMode submit_mode = SubmitMode::Single;
+  WGPUPresentMode present_mode = WGPUPresentMode_Fifo;
+  uint32_t max_frame_latency = 2;
+  AntiAliasing aa;
+  bool depth_prepass = false;
+
+  //  Empty in headless mode
+  GuiSnapshot gui;
+};
+};
@@ -7,30 +7,215 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cctype>
 #include <cassert>
+#include <algorithm>
 
 #include <GLFW/glfw3.h>
 
 #include "app.h"
+#include "batch.h"
+#include "ray_tracing.h"
+#include "software_raster.h"
+#include "benchmark.h"
 
-int main()
+int main(int argc, char** argv)
 {
   WGPU::Application app;
 
-  if (!app.Initialize())
+  //  --headless [--frames N]: render offscreen without window, surface and GUI and report throughput
+  //  --input-rate N: main thread ticks per second sampling input and building the GUI, frames are drawn on a render thread
+  //  --ray-tracing: draw with the compute shader ray tracer instead of the rasterizer
+  //  --software-raster: draw with the CPU rasterizer, a reference for the GPU rasterizer's images
+  //  --bvh-benchmark [triangles]: time BVH builds over generated meshes on 1..N threads and exit, needs no GPU
+  //  --instances N: draw N instances of every mesh in a grid, one draw per mesh
+  //  --gpu-culling: frustum cull instances in a compute pass, the rasterizer draws the visible ones with indirect draws
+  //  --occlusion-culling: GPU culling plus two-phase occlusion culling against a depth pyramid
+  //  --meshlets: draw meshlets surviving frustum and backface cone culling in a compute pass, replaces GPU culling
+  //  --lod [pixels]: GPU culling that draws every instance at the coarsest level of detail within that screen error, 1 by default
+  //  --lod-fade: dither between levels of detail near a switch instead of popping
+  //  --meshlet-benchmark [triangles]: meshlet fill and culled triangles on generated meshes against whole meshes and exit
+  //  --msaa N: rasterize with 1, 2, 4 (default) or 8 samples, switchable in the GUI
+  //  --fxaa: single sample rasterization with an FXAA compute pass, GPU times of both are reported
+  //  --depth-prepass: lay down depth from the position stream first and shade only visible fragments, switchable in the GUI
+  //  --no-mesh-opt: keep the triangle and vertex order of the OBJ files, to A/B frame times against the optimised meshes
+  //  --batch cameras.txt [--out dir] [--jpg] [--threads N]: render a camera path to image files, implies --headless
+  bool headless = false;
+  bool ray_tracing = false;
+  bool software_raster = false;
+  bool gpu_culling = false;
+  bool occlusion_culling = false;
+  bool meshlets = false;
+  bool lod = false;
+  float lod_pixel_error = 1.0f;
+  bool lod_fade = false;
+  WGPU::BatchSettings batch;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--headless") == 0)
+    {
+      headless = true;
+    }
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+    {
+      app.headless_frames = std::stoull(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--input-rate") == 0 && i + 1 < argc)
+    {
+      app.input_rate = std::max(std::stod(argv[++i]), 1.0);
+    }
+    else if (strcmp(argv[i], "--ray-tracing") == 0)
+    {
+      ray_tracing = true;
+    }
+    else if (strcmp(argv[i], "--software-raster") == 0)
+    {
+      software_raster = true;
+    }
+    else if (strcmp(argv[i], "--bvh-benchmark") == 0)
+    {
+      WGPU::BvhBenchmarkSettings benchmark;
+
+      if (i + 1 < argc && isdigit(argv[i + 1][0]))
+      {
+        benchmark.triangles = (uint32_t)std::stoul(argv[++i]);
+      }
+
+      WGPU::run_bvh_benchmark(benchmark);
+      return 0;
+    }
+    else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+    {
+      app.instances_per_mesh = (uint32_t)std::stoul(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--gpu-culling") == 0)
+    {
+      gpu_culling = true;
+    }
+    else if (strcmp(argv[i], "--occlusion-culling") == 0)
+    {
+      occlusion_culling = true;
+    }
+    else if (strcmp(argv[i], "--meshlets") == 0)
+    {
+      meshlets = true;
+    }
+    else if (strcmp(argv[i], "--lod") == 0)
+    {
+      lod = true;
+
+      if (i + 1 < argc && isdigit(argv[i + 1][0]))
+      {
+        lod_pixel_error = std::stof(argv[++i]);
+      }
+    }
+    else if (strcmp(argv[i], "--lod-fade") == 0)
+    {
+      lod_fade = true;
+    }
+    else if (strcmp(argv[i], "--meshlet-benchmark") == 0)
+    {
+      WGPU::MeshletBenchmarkSettings benchmark;
+
+      if (i + 1 < argc && isdigit(argv[i + 1][0]))
+      {
+        benchmark.triangles = (uint32_t)std::stoul(argv[++i]);
+      }
+
+      WGPU::run_meshlet_benchmark(benchmark);
+      return 0;
+    }
+    else if (strcmp(argv[i], "--msaa") == 0 && i + 1 < argc)
+    {
+      app.aa.sample_count = (uint32_t)std::stoul(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--fxaa") == 0)
+    {
+      app.aa = { 1, true };
+    }
+    else if (strcmp(argv[i], "--depth-prepass") == 0)
+    {
+      app.depth_prepass = true;
+    }
+    else if (strcmp(argv[i], "--no-mesh-opt") == 0)
+    {
+      app.optimize_meshes = false;
+    }
+    else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+    {
+      batch.camera_path = argv[++i];
+      headless = true;
+    }
+    else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+    {
+      batch.output_dir = argv[++i];
+    }
+    else if (strcmp(argv[i], "--jpg") == 0)
+    {
+      batch.jpg = true;
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      batch.threads = (uint32_t)std::stoul(argv[++i]);
+    }
+  }
+
+  if (!app.Initialize(headless))
   {
     return 1;
   }
 
-  app.load_scene("data\\models\\pyramid.obj");
+  app.load_scene("data/models/pyramid.obj");
+  app.optimize_scene();
+  if (lod)
+  {
+    app.generate_lods();
+  }
   app.load_scene_on_GPU();
 
-  app.render_api = std::make_shared<WGPU::RasterizationRenderAPI>(APP_WIDTH, APP_HEIGHT);
-  app.render_api->Init(app.device, app.queue, app.host_meshes[0].indices.size(), app.output_buffer, app.vertex_buffer, app.index_buffer, app.uniform_buffer);
+  if (ray_tracing)
+  {
+    app.render_api = std::make_shared<WGPU::RayTracingRenderAPI>(APP_WIDTH, APP_HEIGHT);
+  }
+  else if (software_raster)
+  {
+    app.render_api = std::make_shared<WGPU::SoftwareRasterRenderAPI>(APP_WIDTH, APP_HEIGHT);
+  }
+  else
+  {
+    std::shared_ptr<WGPU::RasterizationRenderAPI> rasterization = std::make_shared<WGPU::RasterizationRenderAPI>(APP_WIDTH, APP_HEIGHT);
+    rasterization->gpu_culling = gpu_culling;
+    rasterization->occlusion_culling = occlusion_culling;
+    rasterization->meshlets = meshlets;
+    rasterization->lod = lod;
+    rasterization->lod_pixel_error = lod_pixel_error;
+    rasterization->lod_fade = lod_fade;
+    app.render_api = rasterization;
+  }
+
+  app.render_api->SetGpuEvents(&app.gpu_events);
+  app.render_api->SetInstances(app.instances);
+  app.render_api->Init(app.device, app.queue, app.pipeline_cache, app.mesh_arena, app.output_buffers, app.uniform_buffers);
+  app.render_api->SetScene(app.host_meshes);
 
-  while (app.IsRunning())
+  //  Interactive runs pick up shader edits without a restart
+  if (!headless)
+  {
+    app.render_api->WatchShaders(app.shader_reload);
+    app.shader_reload.Start();
+  }
+
+  if (!batch.camera_path.empty())
+  {
+    WGPU::run_batch(app, batch);
+  }
+  else
   {
-    app.mainLoop();
+    while (app.IsRunning())
+    {
+      app.mainLoop();
+    }
   }
 
   app.Terminate();
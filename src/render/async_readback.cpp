@@ -0,0 +1,160 @@
+#include "async_readback.h"
+
+#include <iostream>
+
+namespace WGPU
+{
+void AsyncReadback::Init(GpuEvents* events, std::shared_ptr<WGPUDevice> device, uint32_t width, uint32_t height, uint32_t staging_count)
+{
+  this->events = events;
+  this->width = width;
+  this->height = height;
+
+  //  Texture to buffer copies need 256 byte aligned rows
+  bytes_per_row = (width * 4 + 255) & ~255u;
+
+  WGPUBufferDescriptor stagingDesc {};
+  stagingDesc.label = {"Readback staging buffer", WGPU_STRLEN};
+  stagingDesc.size = (uint64_t)bytes_per_row * height;
+  stagingDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+  stagingDesc.mappedAtCreation = false;
+
+  staging.resize(staging_count);
+
+  for (Staging& entry : staging)
+  {
+    entry.buffer = wgpuDeviceCreateBuffer(*device, &stagingDesc);
+  }
+}
+
+void AsyncReadback::Terminate()
+{
+  Flush();
+
+  for (Staging& entry : staging)
+  {
+    wgpuBufferRelease(entry.buffer);
+  }
+  staging.clear();
+}
+
+bool AsyncReadback::Capture(RenderGraph& graph, RGResource frame, uint64_t frame_number)
+{
+  Staging* target = nullptr;
+
+  for (Staging& entry : staging)
+  {
+    if (entry.state == StagingState::Free)
+    {
+      target = &entry;
+      break;
+    }
+  }
+
+  if (!target)
+  {
+    stats.dropped++;
+    return false;
+  }
+
+  target->state = StagingState::Copying;
+  target->frame_number = frame_number;
+  stats.captured++;
+
+  RenderGraph::PassBuilder pass = graph.AddPass("Readback copy");
+  pass.Read(frame);
+  RGResource output = pass.Write(graph.ImportBuffer("Readback staging buffer", target->buffer));
+  pass.SideEffect();
+
+  const uint32_t copy_width = width, copy_height = height, row_pitch = bytes_per_row;
+
+  pass.SetExecute([frame, output, copy_width, copy_height, row_pitch](WGPUCommandEncoder encoder, const RenderGraph& graph)
+  {
+    WGPUExtent3D textureSize = {copy_width, copy_height, 1};
+
+    WGPUTexelCopyTextureInfo src{};
+    src.texture = graph.GetTexture(frame);
+    src.origin = {0, 0, 0};
+    src.aspect = WGPUTextureAspect_All;
+    src.mipLevel = 0;
+
+    WGPUTexelCopyBufferInfo dest{};
+    dest.buffer = graph.GetBuffer(output);
+    dest.layout.bytesPerRow = row_pitch;
+    dest.layout.offset = 0;
+    dest.layout.rowsPerImage = copy_height;
+
+    wgpuCommandEncoderCopyTextureToBuffer(encoder, &src, &dest, &textureSize);
+  });
+
+  return true;
+}
+
+void AsyncReadback::OnSubmitted(uint64_t frame_number)
+{
+  last_submitted = frame_number;
+
+  for (Staging& entry : staging)
+  {
+    if (entry.state != StagingState::Copying) continue;
+
+    entry.state = StagingState::Mapping;
+
+    Staging* mapped = &entry;
+    events->MapAsync(entry.buffer, WGPUMapMode_Read, 0, (size_t)bytes_per_row * height, [this, mapped](bool success) { onMapped(*mapped, success); });
+  }
+}
+
+void AsyncReadback::onMapped(Staging& entry, bool success)
+{
+  if (success)
+  {
+    const size_t size = (size_t)bytes_per_row * height;
+    const uint8_t* data = static_cast<const uint8_t*>(wgpuBufferGetConstMappedRange(entry.buffer, 0, size));
+
+    if (callback)
+    {
+      callback({ entry.frame_number, data, width, height, bytes_per_row });
+    }
+
+    stats.delivered++;
+    stats.latency_frames = 0.9 * stats.latency_frames + 0.1 * (double)(last_submitted - entry.frame_number);
+
+    wgpuBufferUnmap(entry.buffer);
+  }
+  else
+  {
+    std::cerr << "Readback of frame " << entry.frame_number << " failed" << std::endl;
+  }
+
+  entry.state = StagingState::Free;
+}
+
+bool AsyncReadback::hasFreeStaging() const
+{
+  for (const Staging& entry : staging)
+  {
+    if (entry.state == StagingState::Free) return true;
+  }
+
+  return false;
+}
+
+bool AsyncReadback::WaitForStaging()
+{
+  return events->WaitUntil([this]() { return hasFreeStaging(); });
+}
+
+bool AsyncReadback::Flush()
+{
+  //  Copies recorded but never submitted can not complete, only wait for the mapping ones
+  return events->WaitUntil([this]()
+  {
+    for (const Staging& entry : staging)
+    {
+      if (entry.state == StagingState::Mapping) return false;
+    }
+    return true;
+  });
+}
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "render_graph.h"
+#include "gpu_events.h"
+
+namespace WGPU
+{
+//  Completed frame, data is only valid during the callback. Rows are bytes_per_row apart (padded to 256 bytes)
+struct ReadbackFrame
+{
+  uint64_t frame_number;
+  const uint8_t* data;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bytes_per_row;
+};
+
+using ReadbackCallback = std::function<void(const ReadbackFrame& frame)>;
+
+struct ReadbackStats
+{
+  uint64_t captured = 0;        //  Frames copied into a staging buffer
+  uint64_t dropped = 0;         //  Frames skipped because every staging buffer was busy
+  uint64_t delivered = 0;       //  Frames handed to the callback
+  double latency_frames = 0.0;  //  Smoothed frames between capture and delivery
+};
+
+//  Pipelined GPU->CPU frame readback: frames are copied into a ring of MapRead staging buffers inside the frame's graph,
+//  mapped asynchronously after submit and delivered to the callback by the GpuEvents dispatcher. Nothing ever waits on
+//  the GPU unless the caller asks for it with WaitForStaging
+class AsyncReadback
+{
+public:
+  void Init(GpuEvents* events, std::shared_ptr<WGPUDevice> device, uint32_t width, uint32_t height, uint32_t staging_count);
+  void Terminate();
+
+  void SetCallback(ReadbackCallback callback) { this->callback = std::move(callback); }
+
+  //  Add a copy of frame (RGBA8 texture with CopySrc usage) to the graph. Return false and drop the frame if no staging
+  //  buffer is free
+  bool Capture(RenderGraph& graph, RGResource frame, uint64_t frame_number);
+
+  //  Start mapping the buffers captured since the last call, call right after the frame was submitted
+  void OnSubmitted(uint64_t frame_number);
+
+  //  Block until a staging buffer is free, for callers that must not drop frames. False if the wait gave up, see
+  //  GpuEvents::WaitUntil
+  bool WaitForStaging();
+
+  //  Block until every pending frame has been delivered, false if the wait gave up
+  bool Flush();
+
+  uint32_t GetBytesPerRow() const { return bytes_per_row; }
+  const ReadbackStats& GetStats() const { return stats; }
+
+private:
+  enum class StagingState
+  {
+    Free,
+    Copying,    //  Copy recorded, frame not submitted yet
+    Mapping,    //  wgpuBufferMapAsync in flight
+  };
+
+  struct Staging
+  {
+    WGPUBuffer buffer = nullptr;
+    StagingState state = StagingState::Free;
+    uint64_t frame_number = 0;
+  };
+
+  void onMapped(Staging& entry, bool success);
+
+  bool hasFreeStaging() const;
+
+  GpuEvents* events = nullptr;
+
+  uint32_t width = 0, height = 0;
+  uint32_t bytes_per_row = 0;
+
+  //  Never resized after Init, map callbacks keep pointers into it
+  std::vector<Staging> staging;
+  uint64_t last_submitted = 0;
+
+  ReadbackCallback callback;
+  ReadbackStats stats;
+};
+};
@@ -0,0 +1,140 @@
+#include "fxaa.h"
+#include "render.h"
+
+namespace WGPU
+{
+  static const char* FXAA_SHADER_PATH = "shaders/fxaa.wgsl";
+  static const uint32_t FXAA_GROUP_SIZE = 8;
+
+  void Fxaa::Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<PipelineCache> pipeline_cache, uint32_t frames_in_flight)
+  {
+    this->device = device;
+    this->pipeline_cache = pipeline_cache;
+
+    WGPUBindGroupLayoutEntry entries[3] {};
+    entries[0].binding = 0;
+    entries[0].visibility = WGPUShaderStage_Compute;
+    entries[0].texture.sampleType = WGPUTextureSampleType_Float;
+    entries[0].texture.viewDimension = WGPUTextureViewDimension_2D;
+    entries[0].texture.multisampled = false;
+
+    entries[1].binding = 1;
+    entries[1].visibility = WGPUShaderStage_Compute;
+    entries[1].sampler.type = WGPUSamplerBindingType_Filtering;
+
+    entries[2].binding = 2;
+    entries[2].visibility = WGPUShaderStage_Compute;
+    entries[2].storageTexture.access = WGPUStorageTextureAccess_WriteOnly;
+    entries[2].storageTexture.format = WGPUTextureFormat_RGBA8Unorm;
+    entries[2].storageTexture.viewDimension = WGPUTextureViewDimension_2D;
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.label = {"FXAA bind group layout", WGPU_STRLEN};
+    bindGroupLayoutDesc.entryCount = 3;
+    bindGroupLayoutDesc.entries = entries;
+    bind_group_layout = pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+
+    WGPUPipelineLayoutDescriptor layoutDesc {};
+    layoutDesc.label = {"FXAA pipeline layout", WGPU_STRLEN};
+    layoutDesc.bindGroupLayoutCount = 1;
+    layoutDesc.bindGroupLayouts = &bind_group_layout;
+
+    WGPUComputePipelineDescriptor pipelineDesc {};
+    pipelineDesc.label = {"FXAA pipeline", WGPU_STRLEN};
+    pipelineDesc.layout = pipeline_cache->GetPipelineLayout(layoutDesc);
+    pipelineDesc.compute.module = pipeline_cache->GetShaderModule(readFile(FXAA_SHADER_PATH), "FXAA shader module");
+    pipelineDesc.compute.entryPoint = {"cs_fxaa", WGPU_STRLEN};
+    pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+    //  Bilinear taps between texels along and across edges
+    WGPUSamplerDescriptor samplerDesc {};
+    samplerDesc.label = {"FXAA sampler", WGPU_STRLEN};
+    samplerDesc.addressModeU = WGPUAddressMode_ClampToEdge;
+    samplerDesc.addressModeV = WGPUAddressMode_ClampToEdge;
+    samplerDesc.addressModeW = WGPUAddressMode_ClampToEdge;
+    samplerDesc.magFilter = WGPUFilterMode_Linear;
+    samplerDesc.minFilter = WGPUFilterMode_Linear;
+    samplerDesc.mipmapFilter = WGPUMipmapFilterMode_Nearest;
+    samplerDesc.lodMinClamp = 0.0f;
+    samplerDesc.lodMaxClamp = 1.0f;
+    samplerDesc.maxAnisotropy = 1;
+    sampler = wgpuDeviceCreateSampler(*device, &samplerDesc);
+
+    bind_groups.assign(frames_in_flight, nullptr);
+    bound_inputs.assign(frames_in_flight, nullptr);
+    bound_outputs.assign(frames_in_flight, nullptr);
+  }
+
+  void Fxaa::AddPass(RenderGraph& graph, uint32_t frame_index, RGResource input, RGResource output, uint32_t width, uint32_t height,
+    const WGPUPassTimestampWrites* timestamps)
+  {
+    RenderGraph::PassBuilder pass = graph.AddPass("FXAA");
+    pass.Read(input);
+    pass.Write(output);
+
+    pass.SetExecute([this, frame_index, input, output, width, height, timestamps](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      //  Transients may be backed by other textures from frame to frame
+      WGPUTextureView input_view = graph.GetTextureView(input);
+      WGPUTextureView output_view = graph.GetTextureView(output);
+
+      if (input_view != bound_inputs[frame_index] || output_view != bound_outputs[frame_index])
+      {
+        if (bind_groups[frame_index])
+        {
+          wgpuBindGroupRelease(bind_groups[frame_index]);
+        }
+
+        WGPUBindGroupEntry entries[3] {};
+        entries[0].binding = 0;
+        entries[0].textureView = input_view;
+        entries[1].binding = 1;
+        entries[1].sampler = sampler;
+        entries[2].binding = 2;
+        entries[2].textureView = output_view;
+
+        WGPUBindGroupDescriptor bindGroupDesc {};
+        bindGroupDesc.label = {"FXAA bind group", WGPU_STRLEN};
+        bindGroupDesc.layout = bind_group_layout;
+        bindGroupDesc.entryCount = 3;
+        bindGroupDesc.entries = entries;
+
+        bind_groups[frame_index] = wgpuDeviceCreateBindGroup(*device, &bindGroupDesc);
+        bound_inputs[frame_index] = input_view;
+        bound_outputs[frame_index] = output_view;
+      }
+
+      WGPUComputePassDescriptor compute_pass_desc {};
+      compute_pass_desc.label = {"FXAA", WGPU_STRLEN};
+      compute_pass_desc.timestampWrites = timestamps;
+
+      WGPUComputePassEncoder compute_pass = wgpuCommandEncoderBeginComputePass(command_encoder, &compute_pass_desc);
+      wgpuComputePassEncoderSetPipeline(compute_pass, pipeline);
+      wgpuComputePassEncoderSetBindGroup(compute_pass, 0, bind_groups[frame_index], 0, nullptr);
+      wgpuComputePassEncoderDispatchWorkgroups(compute_pass, (width + FXAA_GROUP_SIZE - 1) / FXAA_GROUP_SIZE, (height + FXAA_GROUP_SIZE - 1) / FXAA_GROUP_SIZE, 1);
+      wgpuComputePassEncoderEnd(compute_pass);
+      wgpuComputePassEncoderRelease(compute_pass);
+    });
+  }
+
+  void Fxaa::Terminate()
+  {
+    //  Pipeline and layout belong to the pipeline cache
+    for (WGPUBindGroup bind_group : bind_groups)
+    {
+      if (bind_group)
+      {
+        wgpuBindGroupRelease(bind_group);
+      }
+    }
+    bind_groups.clear();
+    bound_inputs.clear();
+    bound_outputs.clear();
+
+    if (sampler)
+    {
+      wgpuSamplerRelease(sampler);
+    }
+    sampler = nullptr;
+  }
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "render_graph.h"
+#include "pipeline_cache.h"
+
+namespace WGPU
+{
+//  FXAA post-process (shaders/fxaa.wgsl): a compute pass filtering a single sample frame into a storage texture, the
+//  cheap alternative to multisampling
+class Fxaa
+{
+public:
+  void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<PipelineCache> pipeline_cache, uint32_t frames_in_flight);
+  void Terminate();
+
+  //  Add the pass filtering input, sampled and filterable, into output, an rgba8unorm storage texture of the same size.
+  //  timestamps measure the pass if not nullptr
+  void AddPass(RenderGraph& graph, uint32_t frame_index, RGResource input, RGResource output, uint32_t width, uint32_t height,
+    const WGPUPassTimestampWrites* timestamps);
+
+private:
+  std::shared_ptr<WGPUDevice> device;
+  std::shared_ptr<PipelineCache> pipeline_cache;
+
+  WGPUComputePipeline pipeline = nullptr;
+  WGPUBindGroupLayout bind_group_layout = nullptr;
+  WGPUSampler sampler = nullptr;
+
+  //  Per frames-in-flight slot, rebuilt when the views behind the graph resources change
+  std::vector<WGPUBindGroup> bind_groups;
+  std::vector<WGPUTextureView> bound_inputs;
+  std::vector<WGPUTextureView> bound_outputs;
+};
+};
@@ -0,0 +1,803 @@
+#include "gpu_culling.h"
+#include "render.h"
+#include "mesh_utils.h"
+
+#include <algorithm>
+#include <cassert>
+
+#define UNUSED(x) (void)(x)
+
+namespace WGPU
+{
+  static const char* CULLING_SHADER_PATH = "shaders/culling.wgsl";
+  static const char* DEPTH_PYRAMID_SHADER_PATH = "shaders/depth_pyramid.wgsl";
+  static const uint32_t CULLING_GROUP_SIZE = 64;
+  static const uint32_t PYRAMID_GROUP_SIZE = 8;
+
+  //  Dynamic offsets of storage bindings have to be multiples of minStorageBufferOffsetAlignment, 256 by default
+  static const uint32_t VISIBLE_ALIGNMENT = 256 / sizeof(uint32_t);
+
+  //  Visible entries keep their top 8 bits for the level of detail cross-fade
+  static const uint32_t MAX_VISIBLE_INSTANCES = 1u << 24;
+  static const uint32_t MAX_DISPATCH_GROUPS = 65535;
+
+  static_assert(sizeof(DrawIndexedIndirect) == 5 * sizeof(uint32_t), "Indirect draws are 5 consecutive u32");
+
+  void GpuCulling::Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache,
+    const std::vector<WGPUBuffer>& uniform_buffers, GpuEvents* gpu_events)
+  {
+    assert(!occlusion || (depth_width > 0 && depth_height > 0));
+
+    this->device = device;
+    this->queue = queue;
+    this->pipeline_cache = pipeline_cache;
+    this->uniform_buffers = uniform_buffers;
+    this->gpu_events = gpu_events;
+
+    const WGPUBufferBindingType types[] = {
+      WGPUBufferBindingType_Uniform,          //  Uniforms
+      WGPUBufferBindingType_Uniform,          //  Params
+      WGPUBufferBindingType_ReadOnlyStorage,  //  Instances
+      WGPUBufferBindingType_ReadOnlyStorage,  //  Mesh of every instance
+      WGPUBufferBindingType_ReadOnlyStorage,  //  Mesh bounds
+      WGPUBufferBindingType_Storage,          //  Indirect draws
+      WGPUBufferBindingType_Storage,          //  Visible instances
+      WGPUBufferBindingType_Storage,          //  Counters
+    };
+
+    std::vector<WGPUBindGroupLayoutEntry> entries(sizeof(types) / sizeof(types[0]));
+
+    for (uint32_t binding = 0; binding < entries.size(); binding++)
+    {
+      entries[binding].binding = binding;
+      entries[binding].visibility = WGPUShaderStage_Compute;
+      entries[binding].buffer.type = types[binding];
+      entries[binding].buffer.minBindingSize = 0;
+    }
+
+    //  Visible region of every draw
+    WGPUBindGroupLayoutEntry draw_visible_entry {};
+    draw_visible_entry.binding = 10;
+    draw_visible_entry.visibility = WGPUShaderStage_Compute;
+    draw_visible_entry.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    draw_visible_entry.buffer.minBindingSize = 0;
+    entries.push_back(draw_visible_entry);
+
+    //  Depth pyramid and instance states
+    if (occlusion)
+    {
+      WGPUBindGroupLayoutEntry pyramid_entry {};
+      pyramid_entry.binding = 8;
+      pyramid_entry.visibility = WGPUShaderStage_Compute;
+      pyramid_entry.texture.sampleType = WGPUTextureSampleType_UnfilterableFloat;
+      pyramid_entry.texture.viewDimension = WGPUTextureViewDimension_2D;
+      pyramid_entry.texture.multisampled = false;
+      entries.push_back(pyramid_entry);
+
+      WGPUBindGroupLayoutEntry state_entry {};
+      state_entry.binding = 9;
+      state_entry.visibility = WGPUShaderStage_Compute;
+      state_entry.buffer.type = WGPUBufferBindingType_Storage;
+      state_entry.buffer.minBindingSize = 0;
+      entries.push_back(state_entry);
+    }
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.label = {"Culling bind group layout", WGPU_STRLEN};
+    bindGroupLayoutDesc.entryCount = entries.size();
+    bindGroupLayoutDesc.entries = entries.data();
+    bind_group_layout = pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+
+    WGPUPipelineLayoutDescriptor layoutDesc {};
+    layoutDesc.label = {"Culling pipeline layout", WGPU_STRLEN};
+    layoutDesc.bindGroupLayoutCount = 1;
+    layoutDesc.bindGroupLayouts = &bind_group_layout;
+    WGPUPipelineLayout layout = pipeline_cache->GetPipelineLayout(layoutDesc);
+
+    WGPUShaderModule shader_module = pipeline_cache->GetShaderModule(readFile(CULLING_SHADER_PATH), "Culling shader module");
+
+    WGPUComputePipelineDescriptor pipelineDesc {};
+    pipelineDesc.label = {"Culling reset pipeline", WGPU_STRLEN};
+    pipelineDesc.layout = layout;
+    pipelineDesc.compute.module = shader_module;
+    pipelineDesc.compute.entryPoint = {"cs_reset", WGPU_STRLEN};
+    reset_pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+    pipelineDesc.label = {"Culling pipeline", WGPU_STRLEN};
+    pipelineDesc.compute.entryPoint = {occlusion ? "cs_cull_early" : "cs_cull", WGPU_STRLEN};
+    cull_pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+    if (occlusion)
+    {
+      pipelineDesc.label = {"Late culling pipeline", WGPU_STRLEN};
+      pipelineDesc.compute.entryPoint = {"cs_cull_late", WGPU_STRLEN};
+      late_pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+      createPyramid();
+    }
+
+    WGPUBufferDescriptor counterDesc {};
+    counterDesc.label = {"Culling counters", WGPU_STRLEN};
+    counterDesc.size = sizeof(Counters);
+    counterDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst;
+
+    WGPUBufferDescriptor stagingDesc {};
+    stagingDesc.label = {"Culling counters staging", WGPU_STRLEN};
+    stagingDesc.size = sizeof(Counters);
+    stagingDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+
+    for (size_t i = 0; i < uniform_buffers.size(); i++)
+    {
+      counter_buffers.push_back(wgpuDeviceCreateBuffer(*device, &counterDesc));
+      counter_staging.push_back(wgpuDeviceCreateBuffer(*device, &stagingDesc));
+      counter_states.push_back(CounterState::Idle);
+      counter_instances.push_back(0);
+      counter_triangles.push_back(0);
+    }
+
+    reserve(params_buffer, sizeof(Params), WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst, "Culling params");
+  }
+
+  void GpuCulling::createPyramid()
+  {
+    //  Level 0 has the size of the depth buffer, down to 1x1
+    uint32_t levels = 1;
+    while ((std::max(depth_width, depth_height) >> levels) > 0)
+    {
+      levels++;
+    }
+
+    WGPUTextureDescriptor textureDesc {};
+    textureDesc.label = {"Depth pyramid", WGPU_STRLEN};
+    textureDesc.dimension = WGPUTextureDimension_2D;
+    textureDesc.format = WGPUTextureFormat_R32Float;
+    textureDesc.size = {depth_width, depth_height, 1};
+    textureDesc.sampleCount = 1;
+    textureDesc.mipLevelCount = levels;
+    textureDesc.usage = WGPUTextureUsage_StorageBinding | WGPUTextureUsage_TextureBinding;
+    pyramid = wgpuDeviceCreateTexture(*device, &textureDesc);
+
+    WGPUTextureViewDescriptor viewDesc {};
+    viewDesc.label = {"Depth pyramid view", WGPU_STRLEN};
+    viewDesc.format = WGPUTextureFormat_R32Float;
+    viewDesc.dimension = WGPUTextureViewDimension_2D;
+    viewDesc.baseMipLevel = 0;
+    viewDesc.mipLevelCount = levels;
+    viewDesc.baseArrayLayer = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.aspect = WGPUTextureAspect_All;
+    pyramid_view = wgpuTextureCreateView(pyramid, &viewDesc);
+
+    for (uint32_t level = 0; level < levels; level++)
+    {
+      viewDesc.label = {"Depth pyramid level view", WGPU_STRLEN};
+      viewDesc.baseMipLevel = level;
+      viewDesc.mipLevelCount = 1;
+      pyramid_levels.push_back(wgpuTextureCreateView(pyramid, &viewDesc));
+    }
+
+    //  Depth into level 0, multisampled or not, then level by level
+    WGPUBindGroupLayoutEntry depth_entries[2] {};
+    depth_entries[0].binding = 0;
+    depth_entries[0].visibility = WGPUShaderStage_Compute;
+    depth_entries[0].texture.sampleType = WGPUTextureSampleType_Depth;
+    depth_entries[0].texture.viewDimension = WGPUTextureViewDimension_2D;
+    depth_entries[0].texture.multisampled = true;
+
+    depth_entries[1].binding = 2;
+    depth_entries[1].visibility = WGPUShaderStage_Compute;
+    depth_entries[1].storageTexture.access = WGPUStorageTextureAccess_WriteOnly;
+    depth_entries[1].storageTexture.format = WGPUTextureFormat_R32Float;
+    depth_entries[1].storageTexture.viewDimension = WGPUTextureViewDimension_2D;
+
+    WGPUBindGroupLayoutEntry depth_single_entries[2] {};
+    depth_single_entries[0] = depth_entries[0];
+    depth_single_entries[0].binding = 3;
+    depth_single_entries[0].texture.multisampled = false;
+    depth_single_entries[1] = depth_entries[1];
+
+    WGPUBindGroupLayoutEntry reduce_entries[2] {};
+    reduce_entries[0].binding = 1;
+    reduce_entries[0].visibility = WGPUShaderStage_Compute;
+    reduce_entries[0].texture.sampleType = WGPUTextureSampleType_UnfilterableFloat;
+    reduce_entries[0].texture.viewDimension = WGPUTextureViewDimension_2D;
+    reduce_entries[0].texture.multisampled = false;
+    reduce_entries[1] = depth_entries[1];
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.label = {"Depth pyramid bind group layout", WGPU_STRLEN};
+    bindGroupLayoutDesc.entryCount = 2;
+    bindGroupLayoutDesc.entries = depth_entries;
+    depth_layout = pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+
+    bindGroupLayoutDesc.entries = depth_single_entries;
+    depth_single_layout = pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+
+    bindGroupLayoutDesc.entries = reduce_entries;
+    reduce_layout = pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+
+    WGPUShaderModule shader_module = pipeline_cache->GetShaderModule(readFile(DEPTH_PYRAMID_SHADER_PATH), "Depth pyramid shader module");
+
+    WGPUPipelineLayoutDescriptor layoutDesc {};
+    layoutDesc.label = {"Depth pyramid pipeline layout", WGPU_STRLEN};
+    layoutDesc.bindGroupLayoutCount = 1;
+    layoutDesc.bindGroupLayouts = &depth_layout;
+
+    WGPUComputePipelineDescriptor pipelineDesc {};
+    pipelineDesc.label = {"Depth pyramid pipeline", WGPU_STRLEN};
+    pipelineDesc.layout = pipeline_cache->GetPipelineLayout(layoutDesc);
+    pipelineDesc.compute.module = shader_module;
+    pipelineDesc.compute.entryPoint = {"cs_depth", WGPU_STRLEN};
+    depth_pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+    layoutDesc.bindGroupLayouts = &depth_single_layout;
+    pipelineDesc.label = {"Depth pyramid single sample pipeline", WGPU_STRLEN};
+    pipelineDesc.layout = pipeline_cache->GetPipelineLayout(layoutDesc);
+    pipelineDesc.compute.entryPoint = {"cs_depth_single", WGPU_STRLEN};
+    depth_single_pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+    layoutDesc.bindGroupLayouts = &reduce_layout;
+    pipelineDesc.label = {"Depth pyramid reduce pipeline", WGPU_STRLEN};
+    pipelineDesc.layout = pipeline_cache->GetPipelineLayout(layoutDesc);
+    pipelineDesc.compute.entryPoint = {"cs_reduce", WGPU_STRLEN};
+    reduce_pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+    for (uint32_t level = 0; level + 1 < levels; level++)
+    {
+      WGPUBindGroupEntry entries[2] {};
+      entries[0].binding = 1;
+      entries[0].textureView = pyramid_levels[level];
+      entries[1].binding = 2;
+      entries[1].textureView = pyramid_levels[level + 1];
+
+      WGPUBindGroupDescriptor bindGroupDesc {};
+      bindGroupDesc.label = {"Depth pyramid reduce bind group", WGPU_STRLEN};
+      bindGroupDesc.layout = reduce_layout;
+      bindGroupDesc.entryCount = 2;
+      bindGroupDesc.entries = entries;
+
+      reduce_bind_groups.push_back(wgpuDeviceCreateBindGroup(*device, &bindGroupDesc));
+    }
+  }
+
+  void GpuCulling::SetScene(const std::vector<Mesh>& scene_meshes, const std::vector<MeshRange>& ranges, const std::vector<std::vector<LodRange>>& lods)
+  {
+    assert(scene_meshes.size() == ranges.size() && scene_meshes.size() == lods.size());
+
+    meshes.resize(scene_meshes.size());
+    mesh_ranges = ranges;
+    draw_lods.clear();
+    draw_meshes.clear();
+
+    for (size_t mesh = 0; mesh < scene_meshes.size(); mesh++)
+    {
+      utils::BoundingSphere sphere = utils::compute_bounding_sphere(scene_meshes[mesh]);
+
+      meshes[mesh] = {};
+      meshes[mesh].center[0] = sphere.center.x;
+      meshes[mesh].center[1] = sphere.center.y;
+      meshes[mesh].center[2] = sphere.center.z;
+      meshes[mesh].radius = sphere.radius;
+
+      //  Level 0 is the full mesh, without LOD selection the only one
+      meshes[mesh].first_draw = (uint32_t)draw_lods.size();
+      meshes[mesh].lod_count = lod ? (uint32_t)std::min<size_t>(lods[mesh].size(), MAX_LODS) : 1;
+
+      for (uint32_t level = 0; level < meshes[mesh].lod_count; level++)
+      {
+        meshes[mesh].lod_errors[level] = lods[mesh][level].error;
+        draw_lods.push_back(lods[mesh][level]);
+        draw_meshes.push_back((uint32_t)mesh);
+      }
+    }
+
+    //  Storage bindings can not be empty, a scene without meshes keeps one unused entry
+    const WGPUBufferUsage draw_usage = WGPUBufferUsage_Storage | WGPUBufferUsage_Indirect | WGPUBufferUsage_CopyDst;
+    const uint64_t draws_size = std::max<size_t>(draw_lods.size(), 1) * sizeof(DrawIndexedIndirect);
+
+    reserve(mesh_buffer, std::max<size_t>(meshes.size(), 1) * sizeof(MeshCulling), WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst, "Culling meshes");
+    reserve(draw_buffer, draws_size, draw_usage, "Culled draws");
+    reserve(draw_visible_buffer, std::max<size_t>(draw_lods.size(), 1) * sizeof(uint32_t), WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst, "Draw visible regions");
+
+    if (occlusion)
+    {
+      reserve(late_draw_buffer, draws_size, draw_usage, "Late culled draws");
+    }
+
+    layout_version = ~0ull;
+    bound_instance_buffer = nullptr;
+  }
+
+  void GpuCulling::reserve(WGPUBuffer& buffer, uint64_t size, WGPUBufferUsage usage, const char* label)
+  {
+    if (buffer && size <= wgpuBufferGetSize(buffer))
+    {
+      return;
+    }
+
+    uint64_t capacity = size;
+
+    //  Frames in flight keep the old buffer alive through their bind groups
+    if (buffer)
+    {
+      capacity = std::max(size, 2 * wgpuBufferGetSize(buffer));
+      wgpuBufferRelease(buffer);
+    }
+
+    WGPUBufferDescriptor desc {};
+    desc.label = {label, WGPU_STRLEN};
+    desc.size = (capacity + 3) & ~3ull;
+    desc.usage = usage;
+    desc.mappedAtCreation = false;
+
+    buffer = wgpuDeviceCreateBuffer(*device, &desc);
+  }
+
+  void GpuCulling::relayout(const InstanceSet& instances)
+  {
+    const std::vector<InstanceRange>& ranges = instances.GetRanges();
+    const uint32_t mesh_count = (uint32_t)meshes.size();
+    const uint32_t draw_count = (uint32_t)draw_lods.size();
+
+    //  Every instance's mesh
+    std::vector<uint32_t> instance_meshes;
+    full_triangles = 0;
+
+    for (uint32_t mesh = 0; mesh < mesh_count; mesh++)
+    {
+      uint32_t count = mesh < ranges.size() ? ranges[mesh].count : 0;
+
+      if (count > 0)
+      {
+        instance_meshes.resize(ranges[mesh].first + count, 0);
+        std::fill(instance_meshes.begin() + ranges[mesh].first, instance_meshes.end(), mesh);
+      }
+
+      full_triangles += (uint64_t)count * (mesh_ranges[mesh].index_count / 3);
+    }
+
+    //  A visible region per draw big enough for all instances of its mesh, any of them may pick any level
+    std::vector<DrawIndexedIndirect> draws(draw_count);
+    std::vector<uint32_t> draw_visible(draw_count);
+    visible_offsets.assign(draw_count, 0);
+
+    uint32_t visible_first = 0;
+    uint32_t largest_region = VISIBLE_ALIGNMENT;
+
+    for (uint32_t draw = 0; draw < draw_count; draw++)
+    {
+      uint32_t mesh = draw_meshes[draw];
+      uint32_t count = mesh < ranges.size() ? ranges[mesh].count : 0;
+      uint32_t region = (count + VISIBLE_ALIGNMENT - 1) / VISIBLE_ALIGNMENT * VISIBLE_ALIGNMENT;
+
+      draw_visible[draw] = visible_first;
+      visible_offsets[draw] = visible_first * sizeof(uint32_t);
+      largest_region = std::max(largest_region, region);
+
+      //  instance_count is zeroed and counted by the culling pass every frame
+      const LodRange& level = draw_lods[draw];
+      draws[draw] = { level.index_count, 0, level.first_index, (int32_t)mesh_ranges[mesh].first_vertex, 0 };
+
+      visible_first += region;
+    }
+
+    //  Entries beyond the limit would run into the fade bits, those instances are never tested and never drawn
+    instance_count = (uint32_t)instance_meshes.size();
+
+    if (instance_count > MAX_VISIBLE_INSTANCES)
+    {
+      printf("Visible lists address %u instances, the last %u of %u are not drawn\n", MAX_VISIBLE_INSTANCES,
+        instance_count - MAX_VISIBLE_INSTANCES, instance_count);
+      instance_count = MAX_VISIBLE_INSTANCES;
+    }
+
+    //  Every region is bound with the size of the largest, so the buffer reaches that far past the last one. The late
+    //  pass has the same regions in buffers of its own
+    uint64_t visible_size = ((uint64_t)visible_first + largest_region) * sizeof(uint32_t);
+    WGPUBuffer previous_visible = visible_buffer;
+    reserve(visible_buffer, visible_size, WGPUBufferUsage_Storage, "Visible instances");
+
+    if (occlusion)
+    {
+      reserve(late_visible_buffer, wgpuBufferGetSize(visible_buffer), WGPUBufferUsage_Storage, "Late visible instances");
+    }
+
+    if (visible_buffer != previous_visible || visible_binding_size != largest_region * sizeof(uint32_t))
+    {
+      visible_binding_size = largest_region * sizeof(uint32_t);
+      visible_version++;
+    }
+
+    const uint64_t per_instance_size = std::max<size_t>(instance_meshes.size(), 1) * sizeof(uint32_t);
+    WGPUBuffer previous_instance_meshes = instance_mesh_buffer;
+    WGPUBuffer previous_states = state_buffer;
+    reserve(instance_mesh_buffer, per_instance_size, WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst, "Instance meshes");
+
+    if (occlusion)
+    {
+      reserve(state_buffer, per_instance_size, WGPUBufferUsage_Storage, "Instance culling states");
+    }
+
+    if (!instance_meshes.empty())
+    {
+      wgpuQueueWriteBuffer(*queue, instance_mesh_buffer, 0, instance_meshes.data(), instance_meshes.size() * sizeof(uint32_t));
+    }
+
+    if (mesh_count > 0)
+    {
+      wgpuQueueWriteBuffer(*queue, mesh_buffer, 0, meshes.data(), meshes.size() * sizeof(MeshCulling));
+      wgpuQueueWriteBuffer(*queue, draw_visible_buffer, 0, draw_visible.data(), draw_visible.size() * sizeof(uint32_t));
+      wgpuQueueWriteBuffer(*queue, draw_buffer, 0, draws.data(), draws.size() * sizeof(DrawIndexedIndirect));
+
+      if (occlusion)
+      {
+        wgpuQueueWriteBuffer(*queue, late_draw_buffer, 0, draws.data(), draws.size() * sizeof(DrawIndexedIndirect));
+      }
+    }
+
+    layout_version = instances.GetLayoutVersion();
+
+    if (visible_buffer != previous_visible || instance_mesh_buffer != previous_instance_meshes || state_buffer != previous_states)
+    {
+      bound_instance_buffer = nullptr;
+    }
+  }
+
+  WGPUBindGroup GpuCulling::createBindGroup(size_t slot, WGPUBuffer instance_buffer, WGPUBuffer draws, WGPUBuffer visible) const
+  {
+    std::vector<WGPUBindGroupEntry> entries(8);
+    const WGPUBuffer buffers[] = { uniform_buffers[slot], params_buffer, instance_buffer, instance_mesh_buffer, mesh_buffer, draws, visible, counter_buffers[slot] };
+
+    for (uint32_t binding = 0; binding < entries.size(); binding++)
+    {
+      entries[binding].binding = binding;
+      entries[binding].buffer = buffers[binding];
+      entries[binding].offset = 0;
+      entries[binding].size = wgpuBufferGetSize(buffers[binding]);
+    }
+
+    WGPUBindGroupEntry draw_visible_entry {};
+    draw_visible_entry.binding = 10;
+    draw_visible_entry.buffer = draw_visible_buffer;
+    draw_visible_entry.offset = 0;
+    draw_visible_entry.size = wgpuBufferGetSize(draw_visible_buffer);
+    entries.push_back(draw_visible_entry);
+
+    if (occlusion)
+    {
+      WGPUBindGroupEntry pyramid_entry {};
+      pyramid_entry.binding = 8;
+      pyramid_entry.textureView = pyramid_view;
+      entries.push_back(pyramid_entry);
+
+      WGPUBindGroupEntry state_entry {};
+      state_entry.binding = 9;
+      state_entry.buffer = state_buffer;
+      state_entry.offset = 0;
+      state_entry.size = wgpuBufferGetSize(state_buffer);
+      entries.push_back(state_entry);
+    }
+
+    WGPUBindGroupDescriptor bindGroupDesc {};
+    bindGroupDesc.label = {"Culling bind group", WGPU_STRLEN};
+    bindGroupDesc.layout = bind_group_layout;
+    bindGroupDesc.entryCount = entries.size();
+    bindGroupDesc.entries = entries.data();
+
+    return wgpuDeviceCreateBindGroup(*device, &bindGroupDesc);
+  }
+
+  void GpuCulling::createBindGroups(WGPUBuffer instance_buffer)
+  {
+    //  Frames in flight keep the previous bind groups alive until they are done
+    for (WGPUBindGroup bind_group : bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    for (WGPUBindGroup bind_group : late_bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    bind_groups.clear();
+    late_bind_groups.clear();
+
+    bound_instance_buffer = instance_buffer;
+
+    for (size_t i = 0; i < uniform_buffers.size(); i++)
+    {
+      bind_groups.push_back(createBindGroup(i, instance_buffer, draw_buffer, visible_buffer));
+
+      if (occlusion)
+      {
+        late_bind_groups.push_back(createBindGroup(i, instance_buffer, late_draw_buffer, late_visible_buffer));
+      }
+    }
+  }
+
+  void GpuCulling::recordCulling(WGPUCommandEncoder command_encoder, const char* label, WGPUComputePipeline pipeline, WGPUBindGroup bind_group) const
+  {
+    const uint32_t draw_count = (uint32_t)draw_lods.size();
+
+    WGPUComputePassDescriptor compute_pass_desc {};
+    compute_pass_desc.label = {label, WGPU_STRLEN};
+
+    //  Dispatches of one pass are ordered, the reset is visible to the culling
+    WGPUComputePassEncoder compute_pass = wgpuCommandEncoderBeginComputePass(command_encoder, &compute_pass_desc);
+    wgpuComputePassEncoderSetBindGroup(compute_pass, 0, bind_group, 0, nullptr);
+
+    wgpuComputePassEncoderSetPipeline(compute_pass, reset_pipeline);
+    wgpuComputePassEncoderDispatchWorkgroups(compute_pass, (std::max(draw_count, 1u) + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, 1, 1);
+
+    if (instance_count > 0)
+    {
+      wgpuComputePassEncoderSetPipeline(compute_pass, pipeline);
+      uint32_t groups = (instance_count + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE;
+      uint32_t groups_x = std::min(groups, MAX_DISPATCH_GROUPS);
+      wgpuComputePassEncoderDispatchWorkgroups(compute_pass, groups_x, (groups + groups_x - 1) / groups_x, 1);
+    }
+
+    wgpuComputePassEncoderEnd(compute_pass);
+    wgpuComputePassEncoderRelease(compute_pass);
+  }
+
+  CulledDraws GpuCulling::AddPass(RenderGraph& graph, uint32_t frame_index, const InstanceSet& instances)
+  {
+    assert(mesh_buffer && "SetScene has to be called before culling");
+
+    if (instances.GetLayoutVersion() != layout_version)
+    {
+      relayout(instances);
+    }
+
+    if (instances.GetBuffer() != bound_instance_buffer)
+    {
+      createBindGroups(instances.GetBuffer());
+    }
+
+    //  Queue writes land before the frame's submission, frames in flight keep what they were submitted with
+    //  Errors are compared in NDC, which spans 2 units over the viewport height
+    Params params = { instance_count, (uint32_t)draw_lods.size(), pyramid_valid ? 1u : 0u,
+      lod_pixel_error * 2.0f / std::max(depth_height, 1u), lod_fade_band, { 0, 0, 0 } };
+    wgpuQueueWriteBuffer(*queue, params_buffer, 0, &params, sizeof(Params));
+
+    //  The slot's previous frame is done, its counter copy can be mapped right away
+    if (counter_states[frame_index] == CounterState::Copied && gpu_events)
+    {
+      counter_states[frame_index] = CounterState::Mapping;
+
+      WGPUBuffer staging = counter_staging[frame_index];
+      gpu_events->MapAsync(staging, WGPUMapMode_Read, 0, sizeof(Counters), [this, staging, frame_index](bool success)
+      {
+        if (success)
+        {
+          Counters counters = *static_cast<const Counters*>(wgpuBufferGetConstMappedRange(staging, 0, sizeof(Counters)));
+          wgpuBufferUnmap(staging);
+
+          uint32_t total = counter_instances[frame_index];
+          stats.visible = counters.visible;
+          stats.occluded = counters.occluded;
+          stats.culled = total - std::min(counters.visible + counters.occluded, total);
+          stats.triangles = counters.triangles_low | (uint64_t)counters.triangles_high << 32;
+          stats.full_triangles = counter_triangles[frame_index];
+        }
+
+        //  Buffers released by Terminate complete their mapping with a failure
+        if (frame_index < counter_states.size())
+        {
+          counter_states[frame_index] = CounterState::Idle;
+        }
+      });
+    }
+
+    bool sample_counters = counter_states[frame_index] == CounterState::Idle && gpu_events;
+    if (sample_counters)
+    {
+      counter_states[frame_index] = CounterState::Copied;
+      counter_instances[frame_index] = instance_count;
+      counter_triangles[frame_index] = full_triangles;
+    }
+
+    CulledDraws culled;
+    culled.draws = graph.ImportBuffer("Culled draws", draw_buffer);
+    culled.visible = graph.ImportBuffer("Visible instances", visible_buffer);
+
+    RenderGraph::PassBuilder pass = graph.AddPass(occlusion ? "Early culling" : "Frustum culling");
+    culled.draws = pass.Write(culled.draws);
+    culled.visible = pass.Write(culled.visible);
+
+    //  Last frame's pyramid, rebuilt later in the frame
+    if (occlusion)
+    {
+      frame_pyramid = pass.Read(graph.ImportTexture("Depth pyramid", pyramid, pyramid_view));
+    }
+
+    //  With occlusion the counters are copied once the late pass added to them
+    bool copy_counters = sample_counters && !occlusion;
+    sample_late = sample_counters && occlusion;
+
+    pass.SetExecute([this, frame_index, copy_counters](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      UNUSED(graph);
+
+      WGPUBuffer counters = counter_buffers[frame_index];
+      wgpuCommandEncoderClearBuffer(command_encoder, counters, 0, sizeof(Counters));
+
+      recordCulling(command_encoder, occlusion ? "Early culling" : "Frustum culling", cull_pipeline, bind_groups[frame_index]);
+
+      if (copy_counters)
+      {
+        wgpuCommandEncoderCopyBufferToBuffer(command_encoder, counters, 0, counter_staging[frame_index], 0, sizeof(Counters));
+      }
+    });
+
+    return culled;
+  }
+
+  RGResource GpuCulling::AddPyramidPass(RenderGraph& graph, RGResource depth, uint32_t sample_count)
+  {
+    assert(occlusion && frame_pyramid != RG_INVALID && "The early pass has to be added first");
+
+    RenderGraph::PassBuilder pass = graph.AddPass("Depth pyramid");
+    pass.Read(depth);
+    RGResource result = pass.Write(frame_pyramid);
+
+    const bool multisampled = sample_count > 1;
+
+    pass.SetExecute([this, depth, multisampled](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      //  The depth transient may be backed by another texture from frame to frame, or change its sample count
+      WGPUTextureView depth_view = graph.GetTextureView(depth);
+
+      if (depth_view != bound_depth_view || multisampled != bound_depth_multisampled)
+      {
+        if (depth_bind_group)
+        {
+          wgpuBindGroupRelease(depth_bind_group);
+        }
+
+        WGPUBindGroupEntry entries[2] {};
+        entries[0].binding = multisampled ? 0 : 3;
+        entries[0].textureView = depth_view;
+        entries[1].binding = 2;
+        entries[1].textureView = pyramid_levels[0];
+
+        WGPUBindGroupDescriptor bindGroupDesc {};
+        bindGroupDesc.label = {"Depth pyramid bind group", WGPU_STRLEN};
+        bindGroupDesc.layout = multisampled ? depth_layout : depth_single_layout;
+        bindGroupDesc.entryCount = 2;
+        bindGroupDesc.entries = entries;
+
+        depth_bind_group = wgpuDeviceCreateBindGroup(*device, &bindGroupDesc);
+        bound_depth_view = depth_view;
+        bound_depth_multisampled = multisampled;
+      }
+
+      WGPUComputePassDescriptor compute_pass_desc {};
+      compute_pass_desc.label = {"Depth pyramid", WGPU_STRLEN};
+
+      WGPUComputePassEncoder compute_pass = wgpuCommandEncoderBeginComputePass(command_encoder, &compute_pass_desc);
+
+      uint32_t width = depth_width;
+      uint32_t height = depth_height;
+
+      wgpuComputePassEncoderSetPipeline(compute_pass, multisampled ? depth_pipeline : depth_single_pipeline);
+      wgpuComputePassEncoderSetBindGroup(compute_pass, 0, depth_bind_group, 0, nullptr);
+      wgpuComputePassEncoderDispatchWorkgroups(compute_pass, (width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+
+      //  Levels are different subresources, every dispatch sees the level written by the previous one
+      wgpuComputePassEncoderSetPipeline(compute_pass, reduce_pipeline);
+
+      for (WGPUBindGroup bind_group : reduce_bind_groups)
+      {
+        //  Mip extents, rounded down
+        width = std::max(width >> 1, 1u);
+        height = std::max(height >> 1, 1u);
+
+        wgpuComputePassEncoderSetBindGroup(compute_pass, 0, bind_group, 0, nullptr);
+        wgpuComputePassEncoderDispatchWorkgroups(compute_pass, (width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+      }
+
+      wgpuComputePassEncoderEnd(compute_pass);
+      wgpuComputePassEncoderRelease(compute_pass);
+    });
+
+    //  Next frame's early pass tests against it
+    pyramid_valid = true;
+
+    return result;
+  }
+
+  CulledDraws GpuCulling::AddLatePass(RenderGraph& graph, uint32_t frame_index, RGResource pyramid_resource)
+  {
+    assert(occlusion);
+
+    CulledDraws culled;
+    culled.draws = graph.ImportBuffer("Late culled draws", late_draw_buffer);
+    culled.visible = graph.ImportBuffer("Late visible instances", late_visible_buffer);
+
+    RenderGraph::PassBuilder pass = graph.AddPass("Late culling");
+    pass.Read(pyramid_resource);
+    culled.draws = pass.Write(culled.draws);
+    culled.visible = pass.Write(culled.visible);
+
+    bool copy_counters = sample_late;
+
+    pass.SetExecute([this, frame_index, copy_counters](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      UNUSED(graph);
+
+      recordCulling(command_encoder, "Late culling", late_pipeline, late_bind_groups[frame_index]);
+
+      if (copy_counters)
+      {
+        wgpuCommandEncoderCopyBufferToBuffer(command_encoder, counter_buffers[frame_index], 0, counter_staging[frame_index], 0, sizeof(Counters));
+      }
+    });
+
+    return culled;
+  }
+
+  void GpuCulling::Terminate()
+  {
+    //  Pipelines and layouts belong to the pipeline cache
+    for (WGPUBindGroup bind_group : bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    for (WGPUBindGroup bind_group : late_bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    for (WGPUBindGroup bind_group : reduce_bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    bind_groups.clear();
+    late_bind_groups.clear();
+    reduce_bind_groups.clear();
+
+    if (depth_bind_group)
+    {
+      wgpuBindGroupRelease(depth_bind_group);
+    }
+    depth_bind_group = nullptr;
+    bound_depth_view = nullptr;
+
+    for (WGPUTextureView view : pyramid_levels)
+    {
+      wgpuTextureViewRelease(view);
+    }
+    pyramid_levels.clear();
+
+    if (pyramid)
+    {
+      wgpuTextureViewRelease(pyramid_view);
+      wgpuTextureRelease(pyramid);
+    }
+    pyramid = nullptr;
+    pyramid_view = nullptr;
+    pyramid_valid = false;
+
+    for (WGPUBuffer* buffer : { &params_buffer, &mesh_buffer, &instance_mesh_buffer, &draw_buffer, &visible_buffer, &late_draw_buffer, &late_visible_buffer, &state_buffer, &draw_visible_buffer })
+    {
+      if (*buffer)
+      {
+        wgpuBufferRelease(*buffer);
+      }
+      *buffer = nullptr;
+    }
+
+    for (size_t i = 0; i < counter_buffers.size(); i++)
+    {
+      wgpuBufferRelease(counter_buffers[i]);
+      wgpuBufferRelease(counter_staging[i]);
+    }
+
+    counter_buffers.clear();
+    counter_staging.clear();
+    counter_states.clear();
+    counter_instances.clear();
+    counter_triangles.clear();
+    bound_instance_buffer = nullptr;
+  }
+};
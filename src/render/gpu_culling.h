@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "render_graph.h"
+#include "pipeline_cache.h"
+#include "mesh_arena.h"
+#include "instance_set.h"
+#include "gpu_events.h"
+#include "mesh.h"
+
+namespace WGPU
+{
+//  Arguments of wgpuRenderPassEncoderDrawIndexedIndirect
+struct DrawIndexedIndirect
+{
+  uint32_t index_count;
+  uint32_t instance_count;
+  uint32_t first_index;
+  int32_t base_vertex;
+  uint32_t first_instance;
+};
+
+//  Outputs of the culling pass, for the passes drawing with them to read
+struct CulledDraws
+{
+  RGResource draws;       //  One DrawIndexedIndirect per mesh and level of detail
+  RGResource visible;     //  Indices of the visible instances, per draw region
+};
+
+struct CullingStats
+{
+  uint32_t visible = 0;     //  Instances drawn in the last sampled frame
+  uint32_t culled = 0;      //  Outside the frustum
+  uint32_t occluded = 0;    //  Inside the frustum but behind the depth pyramid, with occlusion culling
+  uint64_t triangles = 0;   //  Drawn at the selected levels of detail
+  uint64_t full_triangles = 0;  //  Every instance at full detail
+};
+
+//  Compute pass testing every instance's bounding sphere against the camera frustum (shaders/culling.wgsl). Visible
+//  instances are compacted into a per-mesh region of the visible list and counted into one indirect draw per mesh.
+//  firstInstance of indirect draws has to stay 0 without the indirect-first-instance feature, so the raster pass binds
+//  each mesh's region with a dynamic offset instead.
+//
+//  With levels of detail every mesh has a draw and region per level, and the pass picks the coarsest level whose
+//  error projects to at most lod_pixel_error pixels from the current camera. Cross-fading draws the instances within
+//  lod_fade_band of the next switch at both levels, dithered into each other (fs_fade in shaders/rasterization.wgsl).
+//  Visible entries then carry the fade in their top 8 bits
+//
+//  Occlusion culling is two-phase: the early pass also rejects instances behind the depth pyramid built from the
+//  previous frame, those are drawn first. The pyramid is rebuilt from their depth and the late pass gives the instances
+//  the early pass rejected as occluded a second test against it, drawing the ones that turn out visible on top
+class GpuCulling
+{
+public:
+  //  Two-phase Hi-Z occlusion culling against a depth buffer of that size, which is the viewport LOD
+  //  errors are projected into as well. Set before Init
+  bool occlusion = false;
+  uint32_t depth_width = 0;
+  uint32_t depth_height = 0;
+
+  //  Level of detail selection among the arena's levels. lod_fade_band is relative to lod_pixel_error, 0 switches
+  //  levels without cross-fading. Set before SetScene
+  bool lod = false;
+  float lod_pixel_error = 1.0f;
+  float lod_fade_band = 0.0f;
+
+  void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache,
+    const std::vector<WGPUBuffer>& uniform_buffers, GpuEvents* gpu_events);
+  void Terminate();
+
+  //  Mesh bounds and where the meshes and their levels of detail are in the arena, in the same order
+  void SetScene(const std::vector<Mesh>& meshes, const std::vector<MeshRange>& ranges, const std::vector<std::vector<LodRange>>& lods);
+
+  //  Follow the instances, then add the pass resetting the draws and culling into them. The early pass with occlusion
+  CulledDraws AddPass(RenderGraph& graph, uint32_t frame_index, const InstanceSet& instances);
+
+  //  Occlusion culling only: reduce depth, as left by the early draws with sample_count samples, into the pyramid and
+  //  return the pyramid
+  RGResource AddPyramidPass(RenderGraph& graph, RGResource depth, uint32_t sample_count);
+
+  //  Occlusion culling only: test the instances the early pass found occluded against pyramid, into the late draws
+  CulledDraws AddLatePass(RenderGraph& graph, uint32_t frame_index, RGResource pyramid);
+
+  WGPUBuffer GetDrawBuffer() const { return draw_buffer; }
+  WGPUBuffer GetVisibleBuffer() const { return visible_buffer; }
+  WGPUBuffer GetLateDrawBuffer() const { return late_draw_buffer; }
+  WGPUBuffer GetLateVisibleBuffer() const { return late_visible_buffer; }
+
+  //  Draws of the mesh's levels of detail follow each other from its first draw
+  uint32_t GetFirstDraw(uint32_t mesh) const { return meshes[mesh].first_draw; }
+  uint32_t GetLodCount(uint32_t mesh) const { return meshes[mesh].lod_count; }
+
+  //  Byte offset of the draw's visible list and the size every list is bound with
+  uint32_t GetVisibleOffset(uint32_t draw) const { return visible_offsets[draw]; }
+  uint64_t GetVisibleBindingSize() const { return visible_binding_size; }
+
+  //  Changes whenever the visible buffer or its binding size changed, so bind groups holding it have to be rebuilt
+  uint64_t GetVisibleVersion() const { return visible_version; }
+
+  CullingStats GetStats() const { return stats; }
+
+private:
+  //  Levels of detail a mesh can have, MAX_LODS in culling.wgsl
+  static const uint32_t MAX_LODS = 8;
+
+  //  Matches MeshCulling in culling.wgsl
+  struct MeshCulling
+  {
+    float center[3];
+    float radius;
+    uint32_t first_draw;
+    uint32_t lod_count;
+    uint32_t pad[2];
+    float lod_errors[MAX_LODS];
+  };
+
+  //  Matches CullingParams in culling.wgsl
+  struct Params
+  {
+    uint32_t instance_count;
+    uint32_t draw_count;
+    uint32_t pyramid_valid;
+    float lod_threshold;      //  lod_pixel_error in NDC units
+    float lod_fade_band;
+    uint32_t pad[3];
+  };
+
+  //  Matches CullingCounters in culling.wgsl
+  struct Counters
+  {
+    uint32_t visible;
+    uint32_t occluded;
+    uint32_t triangles_low;
+    uint32_t triangles_high;
+  };
+
+  //  Visible counter readback of one slot, as for the ray tracer's ray counter
+  enum class CounterState
+  {
+    Idle,
+    Copied,
+    Mapping,
+  };
+
+  //  Rebuild the instance to mesh map, the visible regions and the draws after instances moved
+  void relayout(const InstanceSet& instances);
+
+  void createBindGroups(WGPUBuffer instance_buffer);
+
+  WGPUBindGroup createBindGroup(size_t slot, WGPUBuffer instance_buffer, WGPUBuffer draws, WGPUBuffer visible) const;
+
+  //  Depth pyramid texture, its views and the bind groups reducing one level into the next
+  void createPyramid();
+
+  //  Record the reset and one culling dispatch
+  void recordCulling(WGPUCommandEncoder command_encoder, const char* label, WGPUComputePipeline pipeline, WGPUBindGroup bind_group) const;
+
+  //  Replace buffer by a new one if it holds less than size bytes
+  void reserve(WGPUBuffer& buffer, uint64_t size, WGPUBufferUsage usage, const char* label);
+
+  std::shared_ptr<WGPUDevice> device;
+  std::shared_ptr<WGPUQueue> queue;
+  std::shared_ptr<PipelineCache> pipeline_cache;
+  GpuEvents* gpu_events = nullptr;
+
+  WGPUComputePipeline reset_pipeline = nullptr;
+  WGPUComputePipeline cull_pipeline = nullptr;
+  WGPUComputePipeline late_pipeline = nullptr;
+  WGPUBindGroupLayout bind_group_layout = nullptr;
+
+  //  Occlusion culling
+  WGPUComputePipeline depth_pipeline = nullptr;
+  WGPUComputePipeline depth_single_pipeline = nullptr;  //  Level 0 from a single sample depth buffer
+  WGPUComputePipeline reduce_pipeline = nullptr;
+  WGPUBindGroupLayout depth_layout = nullptr;
+  WGPUBindGroupLayout depth_single_layout = nullptr;
+  WGPUBindGroupLayout reduce_layout = nullptr;
+  WGPUTexture pyramid = nullptr;
+  WGPUTextureView pyramid_view = nullptr;             //  Every level, for culling
+  std::vector<WGPUTextureView> pyramid_levels;        //  One level each, for building
+  std::vector<WGPUBindGroup> reduce_bind_groups;      //  Level i into level i + 1
+  WGPUBindGroup depth_bind_group = nullptr;
+  WGPUTextureView bound_depth_view = nullptr;         //  Depth transient depth_bind_group reads
+  bool bound_depth_multisampled = true;
+  bool pyramid_valid = false;
+  RGResource frame_pyramid = RG_INVALID;              //  Pyramid as imported into the current frame's graph
+  bool sample_late = false;                           //  Whether the current frame's late pass copies the counters
+
+  std::vector<MeshCulling> meshes;
+  std::vector<MeshRange> mesh_ranges;
+  std::vector<LodRange> draw_lods;        //  Level of detail of every draw
+  std::vector<uint32_t> draw_meshes;      //  Mesh of every draw
+
+  WGPUBuffer params_buffer = nullptr;
+  WGPUBuffer mesh_buffer = nullptr;
+  WGPUBuffer instance_mesh_buffer = nullptr;
+  WGPUBuffer draw_buffer = nullptr;
+  WGPUBuffer visible_buffer = nullptr;
+  WGPUBuffer late_draw_buffer = nullptr;
+  WGPUBuffer late_visible_buffer = nullptr;
+  WGPUBuffer state_buffer = nullptr;                  //  Per instance, whether the late pass tests it
+  WGPUBuffer draw_visible_buffer = nullptr;           //  Per draw, start of its region in the visible list
+
+  std::vector<uint32_t> visible_offsets;
+  uint64_t visible_binding_size = 0;
+  uint64_t visible_version = 0;
+
+  //  What the bind groups and buffers were built for
+  uint64_t layout_version = ~0ull;
+  WGPUBuffer bound_instance_buffer = nullptr;
+  uint32_t instance_count = 0;
+  uint64_t full_triangles = 0;
+
+  //  Per frames-in-flight slot
+  std::vector<WGPUBuffer> uniform_buffers;
+  std::vector<WGPUBindGroup> bind_groups;
+  std::vector<WGPUBindGroup> late_bind_groups;
+  std::vector<WGPUBuffer> counter_buffers;
+  std::vector<WGPUBuffer> counter_staging;
+  std::vector<CounterState> counter_states;
+  std::vector<uint32_t> counter_instances;    //  Instances of the frame whose counter the slot copied
+  std::vector<uint64_t> counter_triangles;    //  Its triangles at full detail
+
+  CullingStats stats;
+};
+};
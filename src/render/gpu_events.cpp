@@ -0,0 +1,129 @@
+#include "gpu_events.h"
+#include "utils.h"
+
+#include <iostream>
+
+#define UNUSED(x) (void)(x)
+
+namespace WGPU
+{
+void GpuEvents::Init(WGPUInstance instance, std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue)
+{
+  this->instance = instance;
+  this->device = device;
+  this->queue = queue;
+}
+
+WGPUSubmissionIndex GpuEvents::Submit(WGPUCommandBuffer command)
+{
+  last_submission = wgpuQueueSubmitForIndex(*queue, 1, &command);
+  has_submission = true;
+
+  return last_submission;
+}
+
+void GpuEvents::OnWorkDone(std::function<void()> callback)
+{
+  //  Callback lives on the heap until its completion is delivered
+  WGPUQueueWorkDoneCallbackInfo callbackInfo = {};
+  callbackInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+  callbackInfo.callback = onWorkDone;
+  callbackInfo.userdata1 = this;
+  callbackInfo.userdata2 = new std::function<void()>(std::move(callback));
+
+  wgpuQueueOnSubmittedWorkDone(*queue, callbackInfo);
+}
+
+void GpuEvents::MapAsync(WGPUBuffer buffer, WGPUMapMode mode, size_t offset, size_t size, std::function<void(bool success)> callback)
+{
+  WGPUBufferMapCallbackInfo callbackInfo = {};
+  callbackInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+  callbackInfo.callback = onMapped;
+  callbackInfo.userdata1 = this;
+  callbackInfo.userdata2 = new std::function<void(bool)>(std::move(callback));
+
+  wgpuBufferMapAsync(buffer, mode, offset, size, callbackInfo);
+}
+
+void GpuEvents::onWorkDone(WGPUQueueWorkDoneStatus status, void* userdata1, void* userdata2)
+{
+  UNUSED(status);
+
+  GpuEvents* self = static_cast<GpuEvents*>(userdata1);
+  std::function<void()>* callback = static_cast<std::function<void()>*>(userdata2);
+
+  (*callback)();
+  delete callback;
+
+  self->stats.dispatched++;
+}
+
+void GpuEvents::onMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2)
+{
+  UNUSED(message);
+
+  GpuEvents* self = static_cast<GpuEvents*>(userdata1);
+  std::function<void(bool)>* callback = static_cast<std::function<void(bool)>*>(userdata2);
+
+  if (status != WGPUMapAsyncStatus_Success)
+  {
+    std::cerr << "Buffer map failed with status " << status << std::endl;
+  }
+
+  (*callback)(status == WGPUMapAsyncStatus_Success);
+  delete callback;
+
+  self->stats.dispatched++;
+}
+
+void GpuEvents::ProcessEvents()
+{
+  wgpuInstanceProcessEvents(instance);
+}
+
+bool GpuEvents::WaitForSubmission(WGPUSubmissionIndex index)
+{
+  if (device_lost)
+  {
+    return false;
+  }
+
+  stats.blocking_waits++;
+
+  wgpuDevicePoll(*device, true, &index);
+  wgpuInstanceProcessEvents(instance);
+
+  return !device_lost;
+}
+
+bool GpuEvents::WaitUntil(const std::function<bool()>& done, double timeout_s)
+{
+  ProcessEvents();
+
+  double start = utils::get_time();
+
+  //  Everything awaited depends on work submitted so far, so one wait on the last submission normally suffices
+  while (!done())
+  {
+    if (!has_submission)
+    {
+      std::cerr << "GpuEvents::WaitUntil: nothing was submitted to wait for" << std::endl;
+      return false;
+    }
+
+    if (!WaitForSubmission(last_submission))
+    {
+      std::cerr << "GpuEvents::WaitUntil: device lost" << std::endl;
+      return false;
+    }
+
+    if (!done() && utils::get_time() - start > timeout_s)
+    {
+      std::cerr << "GpuEvents::WaitUntil: gave up after " << timeout_s << " s" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+};
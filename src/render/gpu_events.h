@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <functional>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+namespace WGPU
+{
+struct GpuEventStats
+{
+  uint64_t dispatched = 0;      //  Callbacks delivered
+  uint64_t blocking_waits = 0;  //  Waits that had to sleep on the GPU
+};
+
+//  Central completion dispatcher: submissions, queue work done and buffer map completions are delivered as callbacks
+//  from ProcessEvents or from the blocking waits. Waits sleep inside the driver until the awaited submission is done
+//  instead of spinning on non-blocking polls, and give up once the device is lost
+class GpuEvents
+{
+public:
+  void Init(WGPUInstance instance, std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue);
+
+  //  Submit one command buffer, return its index for WaitForSubmission
+  WGPUSubmissionIndex Submit(WGPUCommandBuffer command);
+  WGPUSubmissionIndex LastSubmission() const { return last_submission; }
+
+  //  Callback once the queue has finished everything submitted so far
+  void OnWorkDone(std::function<void()> callback);
+
+  //  Map buffer, callback gets whether the map succeeded
+  void MapAsync(WGPUBuffer buffer, WGPUMapMode mode, size_t offset, size_t size, std::function<void(bool success)> callback);
+
+  //  Deliver callbacks of already completed work without blocking
+  void ProcessEvents();
+
+  //  Sleep until the submission has finished, then deliver its callbacks. False if the device is lost
+  bool WaitForSubmission(WGPUSubmissionIndex index);
+
+  //  Sleep on the GPU until done() turns true, for waits on callbacks of submitted work. False without waiting further
+  //  if the device is lost, nothing was submitted or done() is still false after timeout_s, which is checked between
+  //  polls
+  bool WaitUntil(const std::function<bool()>& done, double timeout_s = 5.0);
+
+  //  Called from the device lost callback, on any thread
+  void OnDeviceLost() { device_lost = true; }
+  bool IsDeviceLost() const { return device_lost; }
+
+  const GpuEventStats& GetStats() const { return stats; }
+
+private:
+  static void onWorkDone(WGPUQueueWorkDoneStatus status, void* userdata1, void* userdata2);
+  static void onMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2);
+
+  WGPUInstance instance = nullptr;
+  std::shared_ptr<WGPUDevice> device;
+  std::shared_ptr<WGPUQueue> queue;
+
+  WGPUSubmissionIndex last_submission = 0;
+  bool has_submission = false;
+  std::atomic<bool> device_lost = false;
+
+  GpuEventStats stats;
+};
+};
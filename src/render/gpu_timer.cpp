@@ -0,0 +1,234 @@
+#include "gpu_timer.h"
+
+#include <cassert>
+#include <cstdio>
+
+#define UNUSED(x) (void)(x)
+
+namespace WGPU
+{
+  void GpuTimer::Init(std::shared_ptr<WGPUDevice> device, GpuEvents* gpu_events, uint32_t frames_in_flight, uint32_t scope_count)
+  {
+    this->device = device;
+    this->gpu_events = gpu_events;
+    this->scope_count = scope_count;
+
+    milliseconds.assign(scope_count, 0.0);
+    fragments.assign(scope_count, 0.0);
+
+    //  Feature has to be requested with the device, the adapter may not have it at all
+    if (!wgpuDeviceHasFeature(*device, WGPUFeatureName_TimestampQuery) || !gpu_events)
+    {
+      printf("Timestamp queries are not available, GPU pass times are not measured\n");
+      return;
+    }
+
+    const uint32_t query_count = 2 * scope_count;
+    const bool statistics = wgpuDeviceHasFeature(*device, (WGPUFeatureName)WGPUNativeFeature_PipelineStatisticsQuery);
+
+    //  Query resolves have to start at multiples of 256 bytes
+    statistics_offset = (query_count * sizeof(uint64_t) + 255) & ~255ull;
+    readback_size = statistics ? statistics_offset + scope_count * sizeof(uint64_t) : query_count * sizeof(uint64_t);
+
+    if (!statistics)
+    {
+      printf("Pipeline statistics queries are not available, fragment shader invocations are not counted\n");
+    }
+
+    WGPUQuerySetDescriptor querySetDesc {};
+    querySetDesc.label = {"GPU timer queries", WGPU_STRLEN};
+    querySetDesc.type = WGPUQueryType_Timestamp;
+    querySetDesc.count = query_count;
+
+    //  One statistic per query, the fragment shader invocations of the scope's render pass
+    WGPUPipelineStatisticName statistic = WGPUPipelineStatisticName_FragmentShaderInvocations;
+
+    WGPUQuerySetDescriptorExtras statisticsExtras {};
+    statisticsExtras.chain.sType = (WGPUSType)WGPUSType_QuerySetDescriptorExtras;
+    statisticsExtras.pipelineStatistics = &statistic;
+    statisticsExtras.pipelineStatisticCount = 1;
+
+    WGPUQuerySetDescriptor statisticsDesc {};
+    statisticsDesc.nextInChain = &statisticsExtras.chain;
+    statisticsDesc.label = {"GPU timer fragment queries", WGPU_STRLEN};
+    statisticsDesc.type = (WGPUQueryType)WGPUNativeQueryType_PipelineStatistics;
+    statisticsDesc.count = scope_count;
+
+    WGPUBufferDescriptor resolveDesc {};
+    resolveDesc.label = {"GPU timer resolve", WGPU_STRLEN};
+    resolveDesc.size = readback_size;
+    resolveDesc.usage = WGPUBufferUsage_QueryResolve | WGPUBufferUsage_CopySrc;
+
+    WGPUBufferDescriptor stagingDesc {};
+    stagingDesc.label = {"GPU timer staging", WGPU_STRLEN};
+    stagingDesc.size = readback_size;
+    stagingDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+
+    for (uint32_t i = 0; i < frames_in_flight; i++)
+    {
+      query_sets.push_back(wgpuDeviceCreateQuerySet(*device, &querySetDesc));
+      resolve_buffers.push_back(wgpuDeviceCreateBuffer(*device, &resolveDesc));
+      staging_buffers.push_back(wgpuDeviceCreateBuffer(*device, &stagingDesc));
+      states.push_back(SlotState::Idle);
+      slot_tags.push_back(0);
+      slot_written.emplace_back(scope_count, false);
+      slot_counted.emplace_back(scope_count, false);
+
+      if (statistics)
+      {
+        statistics_sets.push_back(wgpuDeviceCreateQuerySet(*device, &statisticsDesc));
+      }
+
+      //  Scope s writes queries 2s and 2s + 1 of the slot's set
+      writes.emplace_back(scope_count);
+      for (uint32_t scope = 0; scope < scope_count; scope++)
+      {
+        WGPUPassTimestampWrites& scope_writes = writes.back()[scope];
+        scope_writes = {};
+        scope_writes.querySet = query_sets.back();
+        scope_writes.beginningOfPassWriteIndex = 2 * scope;
+        scope_writes.endOfPassWriteIndex = 2 * scope + 1;
+      }
+    }
+  }
+
+  void GpuTimer::BeginFrame(uint32_t frame_index, uint32_t frame_tag)
+  {
+    if (!IsSupported())
+    {
+      return;
+    }
+
+    //  The slot's previous frame is done, its timestamps can be mapped right away
+    if (states[frame_index] == SlotState::Copied)
+    {
+      states[frame_index] = SlotState::Mapping;
+
+      WGPUBuffer staging = staging_buffers[frame_index];
+      const size_t size = readback_size;
+
+      gpu_events->MapAsync(staging, WGPUMapMode_Read, 0, size, [this, staging, frame_index, size](bool success)
+      {
+        if (success)
+        {
+          const uint64_t* timestamps = static_cast<const uint64_t*>(wgpuBufferGetConstMappedRange(staging, 0, size));
+          const uint64_t* statistics = timestamps + statistics_offset / sizeof(uint64_t);
+
+          //  Smoothing restarts with every change of what is measured
+          bool restart = slot_tags[frame_index] != tag;
+          tag = slot_tags[frame_index];
+
+          for (uint32_t scope = 0; scope < scope_count; scope++)
+          {
+            //  Resolved timestamps are nanoseconds. Ends before beginnings happen when the GPU clock is reset
+            double ms = 0.0;
+            if (slot_written[frame_index][scope] && timestamps[2 * scope + 1] >= timestamps[2 * scope])
+            {
+              ms = (timestamps[2 * scope + 1] - timestamps[2 * scope]) / 1e6;
+            }
+
+            milliseconds[scope] = restart ? ms : 0.95 * milliseconds[scope] + 0.05 * ms;
+
+            double count = CountsFragments() && slot_counted[frame_index][scope] ? (double)statistics[scope] : 0.0;
+            fragments[scope] = restart ? count : 0.95 * fragments[scope] + 0.05 * count;
+          }
+
+          wgpuBufferUnmap(staging);
+        }
+
+        //  Buffers released by Terminate complete their mapping with a failure
+        if (frame_index < states.size())
+        {
+          states[frame_index] = SlotState::Idle;
+        }
+      });
+    }
+
+    //  A slot still being mapped skips measuring this frame
+    if (states[frame_index] == SlotState::Idle)
+    {
+      states[frame_index] = SlotState::Measuring;
+      slot_tags[frame_index] = frame_tag;
+      slot_written[frame_index].assign(scope_count, false);
+      slot_counted[frame_index].assign(scope_count, false);
+    }
+  }
+
+  const WGPUPassTimestampWrites* GpuTimer::GetTimestampWrites(uint32_t frame_index, uint32_t scope)
+  {
+    if (!IsSupported() || states[frame_index] != SlotState::Measuring)
+    {
+      return nullptr;
+    }
+
+    assert(scope < scope_count);
+
+    slot_written[frame_index][scope] = true;
+    return &writes[frame_index][scope];
+  }
+
+  StatisticsQuery GpuTimer::GetFragmentQuery(uint32_t frame_index, uint32_t scope)
+  {
+    if (!CountsFragments() || states[frame_index] != SlotState::Measuring)
+    {
+      return {};
+    }
+
+    assert(scope < scope_count);
+
+    slot_counted[frame_index][scope] = true;
+    return { statistics_sets[frame_index], scope };
+  }
+
+  void GpuTimer::AddResolvePass(RenderGraph& graph, uint32_t frame_index, RGResource after)
+  {
+    if (!IsSupported() || states[frame_index] != SlotState::Measuring)
+    {
+      return;
+    }
+
+    RenderGraph::PassBuilder pass = graph.AddPass("GPU timer resolve");
+    pass.Read(after);
+    pass.SideEffect();
+
+    states[frame_index] = SlotState::Copied;
+
+    pass.SetExecute([this, frame_index](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      UNUSED(graph);
+
+      const uint32_t query_count = 2 * scope_count;
+      wgpuCommandEncoderResolveQuerySet(command_encoder, query_sets[frame_index], 0, query_count, resolve_buffers[frame_index], 0);
+      if (CountsFragments())
+      {
+        wgpuCommandEncoderResolveQuerySet(command_encoder, statistics_sets[frame_index], 0, scope_count, resolve_buffers[frame_index], statistics_offset);
+      }
+      wgpuCommandEncoderCopyBufferToBuffer(command_encoder, resolve_buffers[frame_index], 0, staging_buffers[frame_index], 0, readback_size);
+    });
+  }
+
+  void GpuTimer::Terminate()
+  {
+    for (size_t i = 0; i < query_sets.size(); i++)
+    {
+      wgpuQuerySetRelease(query_sets[i]);
+      wgpuBufferRelease(resolve_buffers[i]);
+      wgpuBufferRelease(staging_buffers[i]);
+    }
+
+    for (WGPUQuerySet statistics_set : statistics_sets)
+    {
+      wgpuQuerySetRelease(statistics_set);
+    }
+
+    query_sets.clear();
+    statistics_sets.clear();
+    resolve_buffers.clear();
+    staging_buffers.clear();
+    states.clear();
+    slot_tags.clear();
+    slot_written.clear();
+    slot_counted.clear();
+    writes.clear();
+  }
+};
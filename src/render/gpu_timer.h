@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "render_graph.h"
+#include "gpu_events.h"
+
+namespace WGPU
+{
+//  Pipeline statistics query counting one render pass, query_set is nullptr if the pass is not counted
+struct StatisticsQuery
+{
+  WGPUQuerySet query_set = nullptr;
+  uint32_t index = 0;
+};
+
+//  GPU time of passes from timestamp queries. Every frames-in-flight slot has a query set with a begin and end
+//  timestamp per scope, resolved and copied to staging at the end of the frame and mapped once the slot comes around
+//  again, as GpuCulling reads its counters. Without the timestamp-query feature no pass is measured and times stay 0.
+//  Where the device also has wgpu's pipeline statistics queries, render passes of a scope count their fragment shader
+//  invocations the same way
+class GpuTimer
+{
+public:
+  void Init(std::shared_ptr<WGPUDevice> device, GpuEvents* gpu_events, uint32_t frames_in_flight, uint32_t scope_count);
+  void Terminate();
+
+  bool IsSupported() const { return !query_sets.empty(); }
+  bool CountsFragments() const { return !statistics_sets.empty(); }
+
+  //  Start measuring the slot's frame and read back what it measured last time. Times are smoothed over frames of the
+  //  same tag, e.g. the configuration being measured, and start over when it changes
+  void BeginFrame(uint32_t frame_index, uint32_t tag);
+
+  //  Timestamp writes measuring a pass as scope, nullptr if this frame is not measured. Call while declaring the pass,
+  //  before AddResolvePass, and only for passes the graph will not cull
+  const WGPUPassTimestampWrites* GetTimestampWrites(uint32_t frame_index, uint32_t scope);
+
+  //  Query counting the fragment shader invocations of a render pass as scope, to begin and end inside the pass.
+  //  Declared like timestamp writes, at most one render pass per scope and frame
+  StatisticsQuery GetFragmentQuery(uint32_t frame_index, uint32_t scope);
+
+  //  Resolve the frame's timestamps after the passes writing after, which have to include every measured one
+  void AddResolvePass(RenderGraph& graph, uint32_t frame_index, RGResource after);
+
+  //  Smoothed milliseconds of the scope, 0 if it was not measured in the last frame read back
+  double GetMilliseconds(uint32_t scope) const { return scope < milliseconds.size() ? milliseconds[scope] : 0.0; }
+  //  Smoothed fragment shader invocations of the scope, 0 if it was not counted
+  double GetFragmentInvocations(uint32_t scope) const { return scope < fragments.size() ? fragments[scope] : 0.0; }
+  uint32_t GetTag() const { return tag; }
+
+private:
+  //  Timestamp readback of one slot
+  enum class SlotState
+  {
+    Idle,
+    Measuring,
+    Copied,
+    Mapping,
+  };
+
+  std::shared_ptr<WGPUDevice> device;
+  GpuEvents* gpu_events = nullptr;
+  uint32_t scope_count = 0;
+  uint64_t statistics_offset = 0;   //  Of the statistics in the resolve and staging buffers, after the timestamps
+  uint64_t readback_size = 0;
+
+  //  Per frames-in-flight slot
+  std::vector<WGPUQuerySet> query_sets;
+  std::vector<WGPUQuerySet> statistics_sets;
+  std::vector<WGPUBuffer> resolve_buffers;
+  std::vector<WGPUBuffer> staging_buffers;
+  std::vector<SlotState> states;
+  std::vector<uint32_t> slot_tags;
+  std::vector<std::vector<bool>> slot_written;    //  Scopes the slot's frame measured
+  std::vector<std::vector<bool>> slot_counted;    //  Scopes the slot's frame counted fragments of
+  std::vector<std::vector<WGPUPassTimestampWrites>> writes;
+
+  std::vector<double> milliseconds;
+  std::vector<double> fragments;
+  uint32_t tag = 0;
+};
+};
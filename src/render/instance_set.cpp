@@ -0,0 +1,204 @@
+#include "instance_set.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace WGPU
+{
+  //  Smallest buffer, storage bindings can not be empty
+  static const uint64_t MIN_INSTANCE_CAPACITY = 64;
+
+  InstanceHandle InstanceSet::Add(uint32_t mesh, const float4x4& transform, const float4& color)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (mesh >= groups.size())
+    {
+      groups.resize(mesh + 1);
+      owners.resize(mesh + 1);
+    }
+
+    InstanceHandle handle;
+    if (!free_handles.empty())
+    {
+      handle = free_handles.back();
+      free_handles.pop_back();
+    }
+    else
+    {
+      handle = (InstanceHandle)slots.size();
+      slots.push_back({});
+    }
+
+    slots[handle] = { mesh, (uint32_t)groups[mesh].size() };
+    groups[mesh].push_back({ transform, color });
+    owners[mesh].push_back(handle);
+    layout_changed = true;
+
+    return handle;
+  }
+
+  void InstanceSet::Update(InstanceHandle instance, const float4x4& transform, const float4& color)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(instance < slots.size() && slots[instance].mesh != INVALID_INSTANCE);
+
+    const Slot& slot = slots[instance];
+    groups[slot.mesh][slot.index] = { transform, color };
+
+    if (!layout_changed)
+    {
+      updated.push_back({ slot.mesh, slot.index });
+    }
+  }
+
+  void InstanceSet::Remove(InstanceHandle instance)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(instance < slots.size() && slots[instance].mesh != INVALID_INSTANCE);
+
+    //  Last instance of the group takes the place of the removed one
+    Slot slot = slots[instance];
+    std::vector<InstanceData>& group = groups[slot.mesh];
+    std::vector<InstanceHandle>& group_owners = owners[slot.mesh];
+
+    group[slot.index] = group.back();
+    group_owners[slot.index] = group_owners.back();
+    slots[group_owners[slot.index]].index = slot.index;
+
+    group.pop_back();
+    group_owners.pop_back();
+
+    slots[instance].mesh = INVALID_INSTANCE;
+    free_handles.push_back(instance);
+    layout_changed = true;
+  }
+
+  void InstanceSet::Clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    groups.clear();
+    owners.clear();
+    slots.clear();
+    free_handles.clear();
+    updated.clear();
+    layout_changed = true;
+  }
+
+  uint32_t InstanceSet::Count() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (uint32_t)(slots.size() - free_handles.size());
+  }
+
+  void InstanceSet::reserve(WGPUDevice device, uint64_t count)
+  {
+    if (buffer && count <= capacity)
+    {
+      return;
+    }
+
+    //  Frames in flight keep the old buffer alive through their bind groups
+    if (buffer)
+    {
+      wgpuBufferRelease(buffer);
+      stats.reallocations++;
+    }
+
+    capacity = std::max({ count, 2 * capacity, MIN_INSTANCE_CAPACITY });
+
+    WGPUBufferDescriptor desc {};
+    desc.label = {"Instance buffer", WGPU_STRLEN};
+    desc.size = capacity * sizeof(InstanceData);
+    desc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+    desc.mappedAtCreation = false;
+
+    buffer = wgpuDeviceCreateBuffer(device, &desc);
+  }
+
+  void InstanceSet::Upload(WGPUDevice device, WGPUQueue queue)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    upload_thread = std::this_thread::get_id();
+    stats.uploaded_bytes = 0;
+
+    if (layout_changed)
+    {
+      ranges.resize(groups.size());
+      uploaded.clear();
+
+      for (size_t mesh = 0; mesh < groups.size(); mesh++)
+      {
+        ranges[mesh] = { (uint32_t)uploaded.size(), (uint32_t)groups[mesh].size() };
+        uploaded.insert(uploaded.end(), groups[mesh].begin(), groups[mesh].end());
+      }
+
+      reserve(device, uploaded.size());
+
+      if (!uploaded.empty())
+      {
+        wgpuQueueWriteBuffer(queue, buffer, 0, uploaded.data(), uploaded.size() * sizeof(InstanceData));
+        stats.uploaded_bytes = uploaded.size() * sizeof(InstanceData);
+      }
+
+      stats.instances = (uint32_t)uploaded.size();
+      stats.draws = (uint32_t)std::count_if(ranges.begin(), ranges.end(), [](const InstanceRange& range) { return range.count > 0; });
+
+      layout_changed = false;
+      layout_version++;
+      updated.clear();
+      return;
+    }
+
+    if (updated.empty())
+    {
+      return;
+    }
+
+    //  Positions in the buffer, neighbours are merged into one write
+    std::vector<uint32_t> positions;
+    positions.reserve(updated.size());
+
+    for (const std::pair<uint32_t, uint32_t>& instance : updated)
+    {
+      uint32_t position = ranges[instance.first].first + instance.second;
+      uploaded[position] = groups[instance.first][instance.second];
+      positions.push_back(position);
+    }
+
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+    for (size_t begin = 0; begin < positions.size();)
+    {
+      size_t end = begin + 1;
+      while (end < positions.size() && positions[end] == positions[end - 1] + 1)
+      {
+        end++;
+      }
+
+      uint64_t count = end - begin;
+      wgpuQueueWriteBuffer(queue, buffer, positions[begin] * sizeof(InstanceData), &uploaded[positions[begin]], count * sizeof(InstanceData));
+      stats.uploaded_bytes += count * sizeof(InstanceData);
+
+      begin = end;
+    }
+
+    updated.clear();
+  }
+
+  void InstanceSet::Terminate()
+  {
+    if (buffer)
+    {
+      wgpuBufferRelease(buffer);
+    }
+
+    buffer = nullptr;
+    capacity = 0;
+    ranges.clear();
+    uploaded.clear();
+  }
+};
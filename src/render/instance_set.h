@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "mesh.h"
+
+namespace WGPU
+{
+//  Per-instance data as read by vs_main, matches Instance in rasterization.wgsl
+struct InstanceData
+{
+  float4x4 transform;   //  Applied before Uniforms::modelMtrx
+  float4 color;         //  Multiplies the vertex color, alpha is unused
+};
+
+//  Instances of one mesh inside the instance buffer, drawn by one instanced draw starting at first
+struct InstanceRange
+{
+  uint32_t first;
+  uint32_t count;
+};
+
+struct InstanceStats
+{
+  uint32_t instances = 0;
+  uint32_t draws = 0;             //  Meshes with at least one instance
+  uint64_t uploaded_bytes = 0;    //  Written by the last Upload
+  uint32_t reallocations = 0;     //  Times the buffer had to grow
+};
+
+typedef uint32_t InstanceHandle;
+constexpr InstanceHandle INVALID_INSTANCE = ~0u;
+
+//  Instances of the scene meshes in one storage buffer, grouped by mesh so every mesh is a single draw however many
+//  instances it has. Add, Update and Remove may be called from any thread, they only touch the edits under the mutex.
+//  Upload is the only writer of what the getters below return (buffer, ranges, host copy), so those are read without
+//  the lock: Upload runs on the render thread between frames, before the frame's Draw reads them, and on the main
+//  thread only while loading, before the render thread starts. Asserted in debug builds
+class InstanceSet
+{
+public:
+  InstanceHandle Add(uint32_t mesh, const float4x4& transform, const float4& color = float4(1.0f, 1.0f, 1.0f, 1.0f));
+  void Update(InstanceHandle instance, const float4x4& transform, const float4& color);
+  void Remove(InstanceHandle instance);
+  void Clear();
+
+  uint32_t Count() const;
+
+  //  Bring the buffer up to date. Updates only write their instances, adding and removing rewrites the whole buffer
+  //  as groups move. The buffer is replaced when it has to grow, bind groups holding it have to be rebuilt
+  void Upload(WGPUDevice device, WGPUQueue queue);
+  void Terminate();
+
+  //  Getters below may only be called on the thread of the last Upload
+  WGPUBuffer GetBuffer() const { assert(onUploadThread()); return buffer; }
+
+  //  Indexed by mesh, as of the last Upload. Meshes past the end have no instances
+  const std::vector<InstanceRange>& GetRanges() const { assert(onUploadThread()); return ranges; }
+
+  //  Contents of the buffer after the last Upload, for APIs transforming on the CPU
+  const std::vector<InstanceData>& GetUploaded() const { assert(onUploadThread()); return uploaded; }
+
+  InstanceStats GetStats() const { assert(onUploadThread()); return stats; }
+
+  //  Changes whenever an Upload moved instances, i.e. the ranges changed
+  uint64_t GetLayoutVersion() const { assert(onUploadThread()); return layout_version; }
+
+private:
+  //  Where a handle's instance lives, mesh is INVALID_INSTANCE for free handles
+  struct Slot
+  {
+    uint32_t mesh;
+    uint32_t index;
+  };
+
+  void reserve(WGPUDevice device, uint64_t count);
+
+  bool onUploadThread() const { return upload_thread == std::thread::id() || upload_thread == std::this_thread::get_id(); }
+
+  //  Edits, guarded by mutex
+  mutable std::mutex mutex;
+  std::vector<std::vector<InstanceData>> groups;          //  Per mesh
+  std::vector<std::vector<InstanceHandle>> owners;        //  Handle of every instance of groups
+  std::vector<Slot> slots;
+  std::vector<InstanceHandle> free_handles;
+  std::vector<std::pair<uint32_t, uint32_t>> updated;     //  Mesh and index of instances changed in place
+  bool layout_changed = true;
+
+  //  Written by Upload only, on upload_thread
+  std::thread::id upload_thread;
+  WGPUBuffer buffer = nullptr;
+  uint64_t capacity = 0;                                  //  In instances
+  std::vector<InstanceRange> ranges;
+  std::vector<InstanceData> uploaded;
+  uint64_t layout_version = 0;
+  InstanceStats stats;
+};
+};
@@ -0,0 +1,129 @@
+#include "mesh_arena.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+namespace WGPU
+{
+template <typename T>
+WGPUBuffer MeshArena::createBuffer(WGPUDevice device, const char* label, WGPUBufferUsage usage, uint64_t count,
+  const std::vector<const std::vector<T>*>& parts)
+{
+  //  Empty buffers can not be bound, keep at least one element
+  const uint64_t size = std::max(count, (uint64_t)1) * sizeof(T);
+
+  WGPUBufferDescriptor desc {};
+  desc.label = {label, WGPU_STRLEN};
+  desc.size = (size + 3) & ~3ull;
+  desc.usage = usage | WGPUBufferUsage_CopyDst;
+  desc.mappedAtCreation = true;
+
+  WGPUBuffer buffer = wgpuDeviceCreateBuffer(device, &desc);
+  uint8_t* mapped = static_cast<uint8_t*>(wgpuBufferGetMappedRange(buffer, 0, desc.size));
+
+  for (const std::vector<T>* part : parts)
+  {
+    const std::vector<T>& items = *part;
+
+    if (!items.empty())
+    {
+      memcpy(mapped, items.data(), items.size() * sizeof(T));
+      mapped += items.size() * sizeof(T);
+    }
+  }
+
+  wgpuBufferUnmap(buffer);
+
+  return buffer;
+}
+
+WGPUBuffer MeshArena::createPositionBuffer(WGPUDevice device, uint64_t count, const std::vector<const std::vector<Vertex>*>& parts)
+{
+  const uint64_t size = std::max(count, (uint64_t)1) * 3 * sizeof(float);
+
+  WGPUBufferDescriptor desc {};
+  desc.label = {"Scene position arena", WGPU_STRLEN};
+  desc.size = size;
+  desc.usage = WGPUBufferUsage_Vertex | WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+  desc.mappedAtCreation = true;
+
+  WGPUBuffer buffer = wgpuDeviceCreateBuffer(device, &desc);
+  float* mapped = static_cast<float*>(wgpuBufferGetMappedRange(buffer, 0, desc.size));
+
+  for (const std::vector<Vertex>* part : parts)
+  {
+    for (const Vertex& vertex : *part)
+    {
+      mapped[0] = vertex.pos.x;
+      mapped[1] = vertex.pos.y;
+      mapped[2] = vertex.pos.z;
+      mapped += 3;
+    }
+  }
+
+  wgpuBufferUnmap(buffer);
+
+  return buffer;
+}
+
+void MeshArena::Upload(WGPUDevice device, const std::vector<Mesh>& meshes)
+{
+  Terminate();
+
+  ranges.reserve(meshes.size());
+  lods.reserve(meshes.size());
+
+  //  Levels of detail follow their mesh's indices and share its vertices
+  std::vector<const std::vector<Vertex>*> vertex_parts;
+  std::vector<const std::vector<uint32_t>*> index_parts;
+  uint32_t lod_indices = 0;
+
+  for (const Mesh& mesh : meshes)
+  {
+    ranges.push_back({ vertex_count, (uint32_t)mesh.vertices.size(), index_count, (uint32_t)mesh.indices.size() });
+    lods.push_back({ { index_count, (uint32_t)mesh.indices.size(), 0.0f } });
+
+    vertex_count += (uint32_t)mesh.vertices.size();
+    index_count += (uint32_t)mesh.indices.size();
+    vertex_parts.push_back(&mesh.vertices);
+    index_parts.push_back(&mesh.indices);
+
+    for (const MeshLod& lod : mesh.lods)
+    {
+      lods.back().push_back({ index_count, (uint32_t)lod.indices.size(), lod.error });
+
+      index_count += (uint32_t)lod.indices.size();
+      lod_indices += (uint32_t)lod.indices.size();
+      index_parts.push_back(&lod.indices);
+    }
+  }
+
+  //  Storage usage lets compute passes (ray tracing, culling) read the scene without a copy
+  vertex_buffer = createBuffer(device, "Scene vertex arena", WGPUBufferUsage_Vertex | WGPUBufferUsage_Storage, vertex_count, vertex_parts);
+  index_buffer = createBuffer(device, "Scene index arena", WGPUBufferUsage_Index | WGPUBufferUsage_Storage, index_count, index_parts);
+  position_buffer = createPositionBuffer(device, vertex_count, vertex_parts);
+
+  printf("Scene arena: %zu meshes, %u vertices, %u indices (%u of them LODs), %.2f MB in 3 buffers\n", ranges.size(), vertex_count,
+    index_count, lod_indices, (vertex_count * (sizeof(Vertex) + 3 * sizeof(float)) + index_count * sizeof(uint32_t)) / 1048576.0);
+}
+
+void MeshArena::Terminate()
+{
+  if (vertex_buffer)
+  {
+    wgpuBufferRelease(vertex_buffer);
+    wgpuBufferRelease(index_buffer);
+    wgpuBufferRelease(position_buffer);
+  }
+
+  vertex_buffer = nullptr;
+  index_buffer = nullptr;
+  position_buffer = nullptr;
+
+  ranges.clear();
+  lods.clear();
+  vertex_count = 0;
+  index_count = 0;
+}
+};
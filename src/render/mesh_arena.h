@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "mesh.h"
+
+namespace WGPU
+{
+//  Where one mesh lives inside the arena. Indices are relative to first_vertex, which is the base vertex of its draw
+struct MeshRange
+{
+  uint32_t first_vertex;
+  uint32_t vertex_count;
+  uint32_t first_index;
+  uint32_t index_count;
+};
+
+//  Indices of one level of detail of a mesh, relative to the mesh's first_vertex as well. Level 0 is the full mesh
+struct LodRange
+{
+  uint32_t first_index;
+  uint32_t index_count;
+  float error;              //  Deviation from the full mesh in mesh units, see MeshLod
+};
+
+//  Every mesh of the scene packed into one shared vertex buffer and one shared index buffer, so drawing the scene
+//  binds its buffers once and meshes only differ by their range
+class MeshArena
+{
+public:
+  //  Pack meshes and their levels of detail, replacing what the arena held before
+  void Upload(WGPUDevice device, const std::vector<Mesh>& meshes);
+  void Terminate();
+
+  WGPUBuffer GetVertexBuffer() const { return vertex_buffer; }
+  WGPUBuffer GetIndexBuffer() const { return index_buffer; }
+
+  //  Positions only, 3 floats per vertex in the order of the vertex buffer, so the same indices and base vertices
+  //  draw from it. Depth-only passes fetch 12 bytes per vertex instead of a whole Vertex
+  WGPUBuffer GetPositionBuffer() const { return position_buffer; }
+
+  const std::vector<MeshRange>& GetRanges() const { return ranges; }
+
+  //  Levels of every mesh, starting with the full mesh
+  const std::vector<std::vector<LodRange>>& GetLods() const { return lods; }
+
+  uint32_t GetVertexCount() const { return vertex_count; }
+  uint32_t GetIndexCount() const { return index_count; }
+
+private:
+  //  Buffer mapped at creation and filled by copying parts in order, so the scene is never concatenated on the heap
+  //  first
+  template <typename T>
+  static WGPUBuffer createBuffer(WGPUDevice device, const char* label, WGPUBufferUsage usage, uint64_t count,
+    const std::vector<const std::vector<T>*>& parts);
+
+  //  Position stream of the vertex parts, written straight into the mapped buffer as well
+  static WGPUBuffer createPositionBuffer(WGPUDevice device, uint64_t count, const std::vector<const std::vector<Vertex>*>& parts);
+
+  WGPUBuffer vertex_buffer = nullptr;
+  WGPUBuffer index_buffer = nullptr;
+  WGPUBuffer position_buffer = nullptr;
+
+  std::vector<MeshRange> ranges;
+  std::vector<std::vector<LodRange>> lods;
+  uint32_t vertex_count = 0;
+  uint32_t index_count = 0;
+};
+};
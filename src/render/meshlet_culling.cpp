@@ -0,0 +1,448 @@
+#include "meshlet_culling.h"
+#include "render.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <limits>
+
+#define UNUSED(x) (void)(x)
+
+namespace WGPU
+{
+  static const char* MESHLET_CULLING_SHADER_PATH = "shaders/meshlet_culling.wgsl";
+  static const uint32_t MESHLET_GROUP_SIZE = 64;
+  static const uint32_t MAX_DISPATCH_GROUPS = 65535;
+
+  //  Cluster list entries are two u32, the list stays within the default maxStorageBufferBindingSize of 128 MiB
+  static const uint32_t MAX_CLUSTERS = (128u << 20) / (2 * sizeof(uint32_t));
+
+  //  The shader counts triangles of appended clusters in one u32
+  static_assert((uint64_t)MAX_CLUSTERS * utils::MESHLET_MAX_TRIANGLES <= UINT32_MAX, "Meshlet triangle counter would overflow");
+
+  static_assert(sizeof(DrawIndirect) == 4 * sizeof(uint32_t), "Indirect draws are 4 consecutive u32");
+
+  void MeshletCulling::Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache,
+    const std::vector<WGPUBuffer>& uniform_buffers, GpuEvents* gpu_events)
+  {
+    this->device = device;
+    this->queue = queue;
+    this->pipeline_cache = pipeline_cache;
+    this->uniform_buffers = uniform_buffers;
+    this->gpu_events = gpu_events;
+
+    const WGPUBufferBindingType types[] = {
+      WGPUBufferBindingType_Uniform,          //  Uniforms
+      WGPUBufferBindingType_Uniform,          //  Params
+      WGPUBufferBindingType_ReadOnlyStorage,  //  Instances
+      WGPUBufferBindingType_ReadOnlyStorage,  //  Pairs of every mesh
+      WGPUBufferBindingType_ReadOnlyStorage,  //  Meshlet bounds
+      WGPUBufferBindingType_Storage,          //  Indirect draw
+      WGPUBufferBindingType_Storage,          //  Visible clusters
+      WGPUBufferBindingType_Storage,          //  Counters
+    };
+
+    std::vector<WGPUBindGroupLayoutEntry> entries(sizeof(types) / sizeof(types[0]));
+
+    for (uint32_t binding = 0; binding < entries.size(); binding++)
+    {
+      entries[binding].binding = binding;
+      entries[binding].visibility = WGPUShaderStage_Compute;
+      entries[binding].buffer.type = types[binding];
+      entries[binding].buffer.minBindingSize = 0;
+    }
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.label = {"Meshlet culling bind group layout", WGPU_STRLEN};
+    bindGroupLayoutDesc.entryCount = entries.size();
+    bindGroupLayoutDesc.entries = entries.data();
+    bind_group_layout = pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+
+    WGPUPipelineLayoutDescriptor layoutDesc {};
+    layoutDesc.label = {"Meshlet culling pipeline layout", WGPU_STRLEN};
+    layoutDesc.bindGroupLayoutCount = 1;
+    layoutDesc.bindGroupLayouts = &bind_group_layout;
+    WGPUPipelineLayout layout = pipeline_cache->GetPipelineLayout(layoutDesc);
+
+    WGPUShaderModule shader_module = pipeline_cache->GetShaderModule(readFile(MESHLET_CULLING_SHADER_PATH), "Meshlet culling shader module");
+
+    WGPUComputePipelineDescriptor pipelineDesc {};
+    pipelineDesc.label = {"Meshlet culling pipeline", WGPU_STRLEN};
+    pipelineDesc.layout = layout;
+    pipelineDesc.compute.module = shader_module;
+    pipelineDesc.compute.entryPoint = {"cs_cull", WGPU_STRLEN};
+    cull_pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+    pipelineDesc.label = {"Meshlet draw pipeline", WGPU_STRLEN};
+    pipelineDesc.compute.entryPoint = {"cs_finish", WGPU_STRLEN};
+    finish_pipeline = pipeline_cache->GetComputePipeline(pipelineDesc);
+
+    WGPUBufferDescriptor counterDesc {};
+    counterDesc.label = {"Meshlet counters", WGPU_STRLEN};
+    counterDesc.size = sizeof(Counters);
+    counterDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst;
+
+    WGPUBufferDescriptor stagingDesc {};
+    stagingDesc.label = {"Meshlet counters staging", WGPU_STRLEN};
+    stagingDesc.size = sizeof(Counters);
+    stagingDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+
+    for (size_t i = 0; i < uniform_buffers.size(); i++)
+    {
+      counter_buffers.push_back(wgpuDeviceCreateBuffer(*device, &counterDesc));
+      counter_staging.push_back(wgpuDeviceCreateBuffer(*device, &stagingDesc));
+      counter_states.push_back(CounterState::Idle);
+      counter_pairs.push_back(0);
+      counter_triangles.push_back(0);
+    }
+
+    reserve(params_buffer, sizeof(Params), WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst, "Meshlet culling params");
+    reserve(draw_buffer, sizeof(DrawIndirect), WGPUBufferUsage_Storage | WGPUBufferUsage_Indirect, "Meshlet draw");
+  }
+
+  void MeshletCulling::SetScene(const std::vector<Mesh>& meshes, const std::vector<MeshRange>& ranges)
+  {
+    assert(meshes.size() == ranges.size());
+
+    double start = utils::get_time();
+
+    //  Meshes are independent, large scenes build them on every core
+    std::vector<utils::MeshletMesh> built(meshes.size());
+    utils::ThreadPool pool;
+    pool.ParallelFor(meshes.size(), 1, [&](size_t begin, size_t end)
+    {
+      for (size_t mesh = begin; mesh < end; mesh++)
+      {
+        built[mesh] = utils::build_meshlets(meshes[mesh]);
+      }
+    });
+
+    double elapsed_ms = (utils::get_time() - start) * 1000.0;
+
+    //  Concatenate in mesh order, meshlet vertices become arena vertex indices
+    std::vector<GpuMeshlet> gpu_meshlets;
+    std::vector<uint32_t> vertices;
+    std::vector<uint32_t> triangles;
+
+    first_meshlets.assign(meshes.size(), 0);
+    meshlet_counts.assign(meshes.size(), 0);
+    mesh_triangles.assign(meshes.size(), 0);
+
+    size_t filled_triangles = 0;
+
+    for (size_t mesh = 0; mesh < meshes.size(); mesh++)
+    {
+      const utils::MeshletMesh& meshlets = built[mesh];
+      const uint32_t vertex_base = (uint32_t)vertices.size();
+      const uint32_t triangle_base = (uint32_t)triangles.size();
+
+      first_meshlets[mesh] = (uint32_t)gpu_meshlets.size();
+      meshlet_counts[mesh] = (uint32_t)meshlets.meshlets.size();
+      mesh_triangles[mesh] = (uint32_t)(meshes[mesh].indices.size() / 3);
+
+      for (const utils::Meshlet& meshlet : meshlets.meshlets)
+      {
+        GpuMeshlet gpu {};
+        gpu.vertex_offset = vertex_base + meshlet.vertex_offset;
+        gpu.triangle_offset = triangle_base + meshlet.triangle_offset;
+        gpu.vertex_count = meshlet.vertex_count;
+        gpu.triangle_count = meshlet.triangle_count;
+        gpu.center[0] = meshlet.center.x;
+        gpu.center[1] = meshlet.center.y;
+        gpu.center[2] = meshlet.center.z;
+        gpu.radius = meshlet.radius;
+        gpu.cone_axis[0] = meshlet.cone_axis.x;
+        gpu.cone_axis[1] = meshlet.cone_axis.y;
+        gpu.cone_axis[2] = meshlet.cone_axis.z;
+        gpu.cone_cutoff = meshlet.cone_cutoff;
+        gpu_meshlets.push_back(gpu);
+
+        filled_triangles += meshlet.triangle_count;
+      }
+
+      for (uint32_t vertex : meshlets.vertices)
+      {
+        vertices.push_back(ranges[mesh].first_vertex + vertex);
+      }
+
+      //  Three 8 bit corners per u32, as vs_meshlet unpacks them
+      for (size_t t = 0; t < meshlets.triangles.size(); t += 3)
+      {
+        triangles.push_back(meshlets.triangles[t] | (meshlets.triangles[t + 1] << 8) | (meshlets.triangles[t + 2] << 16));
+      }
+    }
+
+    printf("Meshlets: %zu built in %.1f ms, %.1f of %u triangles filled on average\n", gpu_meshlets.size(), elapsed_ms,
+      gpu_meshlets.empty() ? 0.0 : (double)filled_triangles / gpu_meshlets.size(), utils::MESHLET_MAX_TRIANGLES);
+
+    //  Storage bindings can not be empty, a scene without meshes keeps one unused entry
+    const WGPUBufferUsage usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+    WGPUBuffer previous[] = { meshlet_buffer, meshlet_vertex_buffer, meshlet_triangle_buffer };
+
+    reserve(meshlet_buffer, std::max<size_t>(gpu_meshlets.size(), 1) * sizeof(GpuMeshlet), usage, "Meshlets");
+    reserve(meshlet_vertex_buffer, std::max<size_t>(vertices.size(), 1) * sizeof(uint32_t), usage, "Meshlet vertices");
+    reserve(meshlet_triangle_buffer, std::max<size_t>(triangles.size(), 1) * sizeof(uint32_t), usage, "Meshlet triangles");
+
+    if (!gpu_meshlets.empty())
+    {
+      wgpuQueueWriteBuffer(*queue, meshlet_buffer, 0, gpu_meshlets.data(), gpu_meshlets.size() * sizeof(GpuMeshlet));
+      wgpuQueueWriteBuffer(*queue, meshlet_vertex_buffer, 0, vertices.data(), vertices.size() * sizeof(uint32_t));
+      wgpuQueueWriteBuffer(*queue, meshlet_triangle_buffer, 0, triangles.data(), triangles.size() * sizeof(uint32_t));
+    }
+
+    if (meshlet_buffer != previous[0] || meshlet_vertex_buffer != previous[1] || meshlet_triangle_buffer != previous[2])
+    {
+      buffer_version++;
+    }
+
+    layout_version = ~0ull;
+    bound_instance_buffer = nullptr;
+  }
+
+  void MeshletCulling::reserve(WGPUBuffer& buffer, uint64_t size, WGPUBufferUsage usage, const char* label)
+  {
+    if (buffer && size <= wgpuBufferGetSize(buffer))
+    {
+      return;
+    }
+
+    uint64_t capacity = size;
+
+    //  Frames in flight keep the old buffer alive through their bind groups
+    if (buffer)
+    {
+      capacity = std::max(size, 2 * wgpuBufferGetSize(buffer));
+      wgpuBufferRelease(buffer);
+    }
+
+    WGPUBufferDescriptor desc {};
+    desc.label = {label, WGPU_STRLEN};
+    desc.size = (capacity + 3) & ~3ull;
+    desc.usage = usage;
+    desc.mappedAtCreation = false;
+
+    buffer = wgpuDeviceCreateBuffer(*device, &desc);
+  }
+
+  void MeshletCulling::relayout(const InstanceSet& instances)
+  {
+    const std::vector<InstanceRange>& ranges = instances.GetRanges();
+
+    //  Only meshes with instances and meshlets get an entry, so the shader's search never lands on an empty one
+    std::vector<MeshPairs> pairs;
+    uint64_t first_pair = 0;
+    total_triangles = 0;
+
+    for (size_t mesh = 0; mesh < std::min(ranges.size(), meshlet_counts.size()); mesh++)
+    {
+      uint64_t count = (uint64_t)ranges[mesh].count * meshlet_counts[mesh];
+      if (count == 0)
+      {
+        continue;
+      }
+
+      pairs.push_back({ (uint32_t)first_pair, ranges[mesh].first, first_meshlets[mesh], meshlet_counts[mesh] });
+      first_pair += count;
+      total_triangles += (uint64_t)ranges[mesh].count * mesh_triangles[mesh];
+    }
+
+    //  Pair indices are u32 in the shader
+    pair_count = (uint32_t)std::min<uint64_t>(first_pair, std::numeric_limits<uint32_t>::max());
+    pair_mesh_count = (uint32_t)pairs.size();
+
+    if (first_pair > MAX_CLUSTERS)
+    {
+      printf("Meshlets: %lu clusters, only the first %u visible ones are drawn\n", (unsigned long)first_pair, MAX_CLUSTERS);
+    }
+
+    WGPUBuffer previous_clusters = cluster_buffer;
+    WGPUBuffer previous_pairs = pair_buffer;
+
+    reserve(pair_buffer, std::max<size_t>(pairs.size(), 1) * sizeof(MeshPairs), WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst, "Meshlet pairs");
+    reserve(cluster_buffer, std::max(std::min(pair_count, MAX_CLUSTERS), 1u) * 2 * sizeof(uint32_t), WGPUBufferUsage_Storage, "Visible clusters");
+
+    if (!pairs.empty())
+    {
+      wgpuQueueWriteBuffer(*queue, pair_buffer, 0, pairs.data(), pairs.size() * sizeof(MeshPairs));
+    }
+
+    if (cluster_buffer != previous_clusters)
+    {
+      buffer_version++;
+    }
+
+    layout_version = instances.GetLayoutVersion();
+
+    if (cluster_buffer != previous_clusters || pair_buffer != previous_pairs)
+    {
+      bound_instance_buffer = nullptr;
+    }
+  }
+
+  void MeshletCulling::createBindGroups(WGPUBuffer instance_buffer)
+  {
+    //  Frames in flight keep the previous bind groups alive until they are done
+    for (WGPUBindGroup bind_group : bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    bind_groups.clear();
+
+    bound_instance_buffer = instance_buffer;
+
+    for (size_t i = 0; i < uniform_buffers.size(); i++)
+    {
+      const WGPUBuffer buffers[] = { uniform_buffers[i], params_buffer, instance_buffer, pair_buffer, meshlet_buffer, draw_buffer, cluster_buffer, counter_buffers[i] };
+      WGPUBindGroupEntry entries[8] {};
+
+      for (uint32_t binding = 0; binding < 8; binding++)
+      {
+        entries[binding].binding = binding;
+        entries[binding].buffer = buffers[binding];
+        entries[binding].offset = 0;
+        entries[binding].size = wgpuBufferGetSize(buffers[binding]);
+      }
+
+      WGPUBindGroupDescriptor bindGroupDesc {};
+      bindGroupDesc.label = {"Meshlet culling bind group", WGPU_STRLEN};
+      bindGroupDesc.layout = bind_group_layout;
+      bindGroupDesc.entryCount = 8;
+      bindGroupDesc.entries = entries;
+
+      bind_groups.push_back(wgpuDeviceCreateBindGroup(*device, &bindGroupDesc));
+    }
+  }
+
+  MeshletDraws MeshletCulling::AddPass(RenderGraph& graph, uint32_t frame_index, const InstanceSet& instances)
+  {
+    assert(meshlet_buffer && "SetScene has to be called before culling");
+
+    if (instances.GetLayoutVersion() != layout_version)
+    {
+      relayout(instances);
+    }
+
+    if (instances.GetBuffer() != bound_instance_buffer)
+    {
+      createBindGroups(instances.GetBuffer());
+    }
+
+    //  Queue writes land before the frame's submission, frames in flight keep what they were submitted with
+    Params params = { pair_count, pair_mesh_count, std::min(pair_count, MAX_CLUSTERS), 0 };
+    wgpuQueueWriteBuffer(*queue, params_buffer, 0, &params, sizeof(Params));
+
+    //  The slot's previous frame is done, its counter copy can be mapped right away
+    if (counter_states[frame_index] == CounterState::Copied && gpu_events)
+    {
+      counter_states[frame_index] = CounterState::Mapping;
+
+      WGPUBuffer staging = counter_staging[frame_index];
+      gpu_events->MapAsync(staging, WGPUMapMode_Read, 0, sizeof(Counters), [this, staging, frame_index](bool success)
+      {
+        if (success)
+        {
+          Counters counters = *static_cast<const Counters*>(wgpuBufferGetConstMappedRange(staging, 0, sizeof(Counters)));
+          wgpuBufferUnmap(staging);
+
+          stats.total_clusters = counter_pairs[frame_index];
+          stats.visible_clusters = std::min(counters.clusters, std::min(stats.total_clusters, MAX_CLUSTERS));
+          stats.triangles = counters.triangles;
+          stats.total_triangles = counter_triangles[frame_index];
+        }
+
+        //  Buffers released by Terminate complete their mapping with a failure
+        if (frame_index < counter_states.size())
+        {
+          counter_states[frame_index] = CounterState::Idle;
+        }
+      });
+    }
+
+    bool copy_counters = counter_states[frame_index] == CounterState::Idle && gpu_events;
+    if (copy_counters)
+    {
+      counter_states[frame_index] = CounterState::Copied;
+      counter_pairs[frame_index] = pair_count;
+      counter_triangles[frame_index] = total_triangles;
+    }
+
+    MeshletDraws culled;
+    culled.draw = graph.ImportBuffer("Meshlet draw", draw_buffer);
+    culled.clusters = graph.ImportBuffer("Visible clusters", cluster_buffer);
+
+    RenderGraph::PassBuilder pass = graph.AddPass("Meshlet culling");
+    culled.draw = pass.Write(culled.draw);
+    culled.clusters = pass.Write(culled.clusters);
+
+    pass.SetExecute([this, frame_index, copy_counters](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      UNUSED(graph);
+
+      WGPUBuffer counters = counter_buffers[frame_index];
+      wgpuCommandEncoderClearBuffer(command_encoder, counters, 0, sizeof(Counters));
+
+      WGPUComputePassDescriptor compute_pass_desc {};
+      compute_pass_desc.label = {"Meshlet culling", WGPU_STRLEN};
+
+      //  Dispatches of one pass are ordered, the draw is written once every cluster was appended
+      WGPUComputePassEncoder compute_pass = wgpuCommandEncoderBeginComputePass(command_encoder, &compute_pass_desc);
+      wgpuComputePassEncoderSetBindGroup(compute_pass, 0, bind_groups[frame_index], 0, nullptr);
+
+      if (pair_count > 0)
+      {
+        uint32_t groups = (pair_count + MESHLET_GROUP_SIZE - 1) / MESHLET_GROUP_SIZE;
+        uint32_t groups_x = std::min(groups, MAX_DISPATCH_GROUPS);
+
+        wgpuComputePassEncoderSetPipeline(compute_pass, cull_pipeline);
+        wgpuComputePassEncoderDispatchWorkgroups(compute_pass, groups_x, (groups + groups_x - 1) / groups_x, 1);
+      }
+
+      wgpuComputePassEncoderSetPipeline(compute_pass, finish_pipeline);
+      wgpuComputePassEncoderDispatchWorkgroups(compute_pass, 1, 1, 1);
+
+      wgpuComputePassEncoderEnd(compute_pass);
+      wgpuComputePassEncoderRelease(compute_pass);
+
+      if (copy_counters)
+      {
+        wgpuCommandEncoderCopyBufferToBuffer(command_encoder, counters, 0, counter_staging[frame_index], 0, sizeof(Counters));
+      }
+    });
+
+    return culled;
+  }
+
+  void MeshletCulling::Terminate()
+  {
+    //  Pipelines and layouts belong to the pipeline cache
+    for (WGPUBindGroup bind_group : bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    bind_groups.clear();
+
+    for (WGPUBuffer* buffer : { &params_buffer, &meshlet_buffer, &meshlet_vertex_buffer, &meshlet_triangle_buffer, &pair_buffer, &draw_buffer, &cluster_buffer })
+    {
+      if (*buffer)
+      {
+        wgpuBufferRelease(*buffer);
+      }
+      *buffer = nullptr;
+    }
+
+    for (size_t i = 0; i < counter_buffers.size(); i++)
+    {
+      wgpuBufferRelease(counter_buffers[i]);
+      wgpuBufferRelease(counter_staging[i]);
+    }
+
+    counter_buffers.clear();
+    counter_staging.clear();
+    counter_states.clear();
+    counter_pairs.clear();
+    counter_triangles.clear();
+    bound_instance_buffer = nullptr;
+  }
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "render_graph.h"
+#include "pipeline_cache.h"
+#include "mesh_arena.h"
+#include "instance_set.h"
+#include "gpu_events.h"
+#include "meshlet.h"
+#include "mesh.h"
+
+namespace WGPU
+{
+//  Arguments of wgpuRenderPassEncoderDrawIndirect
+struct DrawIndirect
+{
+  uint32_t vertex_count;
+  uint32_t instance_count;
+  uint32_t first_vertex;
+  uint32_t first_instance;
+};
+
+//  Outputs of the cluster culling pass, for the pass drawing them to read
+struct MeshletDraws
+{
+  RGResource draw;        //  One DrawIndirect, an instance per visible cluster
+  RGResource clusters;    //  (instance, meshlet) of every visible cluster
+};
+
+struct MeshletStats
+{
+  uint32_t visible_clusters = 0;    //  In the last sampled frame
+  uint32_t total_clusters = 0;      //  Meshlets of every instance
+  uint64_t triangles = 0;           //  Of the visible clusters
+  uint64_t total_triangles = 0;     //  Of every instance, what drawing whole meshes submits
+};
+
+//  Meshlet rendering: the scene's meshes are split into meshlets at load (utils::build_meshlets) and a compute pass
+//  (shaders/meshlet_culling.wgsl) tests every meshlet of every instance against the frustum and its backface cone.
+//  Surviving clusters are appended to a list drawn by one non-indexed indirect draw, whose vertex shader pulls the
+//  cluster's triangles and vertices from storage buffers (vs_meshlet in shaders/rasterization.wgsl)
+class MeshletCulling
+{
+public:
+  void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache,
+    const std::vector<WGPUBuffer>& uniform_buffers, GpuEvents* gpu_events);
+  void Terminate();
+
+  //  Build the meshlets of the meshes, where the meshes are in the arena in the same order
+  void SetScene(const std::vector<Mesh>& meshes, const std::vector<MeshRange>& ranges);
+
+  //  Follow the instances, then add the pass culling the clusters into the draw
+  MeshletDraws AddPass(RenderGraph& graph, uint32_t frame_index, const InstanceSet& instances);
+
+  WGPUBuffer GetDrawBuffer() const { return draw_buffer; }
+  WGPUBuffer GetClusterBuffer() const { return cluster_buffer; }
+  WGPUBuffer GetMeshletBuffer() const { return meshlet_buffer; }
+  WGPUBuffer GetMeshletVertexBuffer() const { return meshlet_vertex_buffer; }
+  WGPUBuffer GetMeshletTriangleBuffer() const { return meshlet_triangle_buffer; }
+
+  //  Changes whenever one of the buffers above was replaced, so bind groups holding them have to be rebuilt
+  uint64_t GetBufferVersion() const { return buffer_version; }
+
+  MeshletStats GetStats() const { return stats; }
+
+private:
+  //  Matches Meshlet in meshlet_culling.wgsl and rasterization.wgsl, offsets are into the buffers of the whole scene
+  struct GpuMeshlet
+  {
+    uint32_t vertex_offset;
+    uint32_t triangle_offset;
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+    float center[3];
+    float radius;
+    float cone_axis[3];
+    float cone_cutoff;
+  };
+
+  //  Matches MeshPairs in meshlet_culling.wgsl
+  struct MeshPairs
+  {
+    uint32_t first_pair;
+    uint32_t first_instance;
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+  };
+
+  //  Matches MeshletParams in meshlet_culling.wgsl
+  struct Params
+  {
+    uint32_t pair_count;
+    uint32_t mesh_count;
+    uint32_t capacity;
+    uint32_t pad;
+  };
+
+  //  Matches MeshletCounters in meshlet_culling.wgsl
+  struct Counters
+  {
+    uint32_t clusters;
+    uint32_t triangles;
+  };
+
+  //  Counter readback of one slot, as for GpuCulling
+  enum class CounterState
+  {
+    Idle,
+    Copied,
+    Mapping,
+  };
+
+  //  Rebuild the pair table and the cluster list after instances moved
+  void relayout(const InstanceSet& instances);
+
+  void createBindGroups(WGPUBuffer instance_buffer);
+
+  //  Replace buffer by a new one if it holds less than size bytes
+  void reserve(WGPUBuffer& buffer, uint64_t size, WGPUBufferUsage usage, const char* label);
+
+  std::shared_ptr<WGPUDevice> device;
+  std::shared_ptr<WGPUQueue> queue;
+  std::shared_ptr<PipelineCache> pipeline_cache;
+  GpuEvents* gpu_events = nullptr;
+
+  WGPUComputePipeline cull_pipeline = nullptr;
+  WGPUComputePipeline finish_pipeline = nullptr;
+  WGPUBindGroupLayout bind_group_layout = nullptr;
+
+  //  Per mesh, into the meshlets of the whole scene
+  std::vector<uint32_t> first_meshlets;
+  std::vector<uint32_t> meshlet_counts;
+  std::vector<uint32_t> mesh_triangles;
+
+  WGPUBuffer params_buffer = nullptr;
+  WGPUBuffer meshlet_buffer = nullptr;
+  WGPUBuffer meshlet_vertex_buffer = nullptr;
+  WGPUBuffer meshlet_triangle_buffer = nullptr;
+  WGPUBuffer pair_buffer = nullptr;
+  WGPUBuffer draw_buffer = nullptr;
+  WGPUBuffer cluster_buffer = nullptr;
+  uint64_t buffer_version = 0;
+
+  //  What the bind groups and buffers were built for
+  uint64_t layout_version = ~0ull;
+  WGPUBuffer bound_instance_buffer = nullptr;
+  uint32_t pair_count = 0;
+  uint32_t pair_mesh_count = 0;
+  uint64_t total_triangles = 0;
+
+  //  Per frames-in-flight slot
+  std::vector<WGPUBuffer> uniform_buffers;
+  std::vector<WGPUBindGroup> bind_groups;
+  std::vector<WGPUBuffer> counter_buffers;
+  std::vector<WGPUBuffer> counter_staging;
+  std::vector<CounterState> counter_states;
+  std::vector<uint32_t> counter_pairs;      //  Clusters of the frame whose counters the slot copied
+  std::vector<uint64_t> counter_triangles;
+
+  MeshletStats stats;
+};
+};
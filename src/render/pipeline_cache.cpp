@@ -0,0 +1,507 @@
+#include "pipeline_cache.h"
+#include "utils.h"
+
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <fstream>
+#include <iostream>
+
+namespace WGPU
+{
+//  FNV-1a over the descriptor fields, pointers are followed and never hashed themselves
+class DescriptorHasher
+{
+public:
+  template <typename T>
+  void Add(const T& value)
+  {
+    static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+    bytes(&value, sizeof(T));
+  }
+
+  void Add(WGPUStringView string)
+  {
+    size_t length = string.length == WGPU_STRLEN ? (string.data ? strlen(string.data) : 0) : string.length;
+
+    Add(length);
+    bytes(string.data, length);
+  }
+
+  void Add(const std::string& string)
+  {
+    Add(string.size());
+    bytes(string.data(), string.size());
+  }
+
+  uint64_t Get() const { return hash; }
+
+private:
+  void bytes(const void* data, size_t size)
+  {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+
+    for (size_t i = 0; i < size; i++)
+    {
+      hash = (hash ^ p[i]) * 0x100000001b3ull;
+    }
+  }
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+static void hash_constants(DescriptorHasher& hasher, size_t count, const WGPUConstantEntry* constants)
+{
+  hasher.Add(count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    hasher.Add(constants[i].key);
+    hasher.Add(constants[i].value);
+  }
+}
+
+static void hash_stencil_face(DescriptorHasher& hasher, const WGPUStencilFaceState& face)
+{
+  hasher.Add(face.compare);
+  hasher.Add(face.failOp);
+  hasher.Add(face.depthFailOp);
+  hasher.Add(face.passOp);
+}
+
+static void hash_blend_component(DescriptorHasher& hasher, const WGPUBlendComponent& component)
+{
+  hasher.Add(component.operation);
+  hasher.Add(component.srcFactor);
+  hasher.Add(component.dstFactor);
+}
+
+void PipelineCache::Init(WGPUDevice device, const std::string& manifest_path)
+{
+  this->device = device;
+  this->manifest_path = manifest_path;
+
+  loadManifest();
+}
+
+void PipelineCache::Terminate()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  saveManifest();
+
+  for (auto& [hash, entry] : render_pipelines) wgpuRenderPipelineRelease(entry.object);
+  for (auto& [hash, entry] : compute_pipelines) wgpuComputePipelineRelease(entry.object);
+  for (auto& [hash, entry] : pipeline_layouts) wgpuPipelineLayoutRelease(entry.object);
+  for (auto& [hash, entry] : bind_group_layouts) wgpuBindGroupLayoutRelease(entry.object);
+  for (auto& [hash, entry] : shader_modules) wgpuShaderModuleRelease(entry.object);
+  for (auto& [object, release] : foreign_objects) release();
+
+  render_pipelines.clear();
+  compute_pipelines.clear();
+  pipeline_layouts.clear();
+  bind_group_layouts.clear();
+  shader_modules.clear();
+  object_hashes.clear();
+  foreign_objects.clear();
+  unpersisted.clear();
+}
+
+template <typename T>
+uint64_t PipelineCache::hashOf(T object, void (*add_ref)(T), void (*release)(T), bool& foreign)
+{
+  auto it = object_hashes.find(object);
+
+  if (it != object_hashes.end())
+  {
+    foreign |= unpersisted.count(it->second) > 0;
+    return it->second;
+  }
+
+  //  Pipelines with automatic layouts have none
+  if (!object)
+  {
+    return 0;
+  }
+
+  if (foreign_objects.emplace(object, [object, release]() { release(object); }).second)
+  {
+    add_ref(object);
+  }
+
+  foreign = true;
+  return (uint64_t)(uintptr_t)object;
+}
+
+void PipelineCache::onHit(double compile_ms)
+{
+  stats.lookups++;
+  stats.hits++;
+  stats.saved_ms += compile_ms;
+}
+
+void PipelineCache::onCreated(uint64_t hash, double compile_ms)
+{
+  stats.lookups++;
+  stats.created++;
+  stats.compile_ms += compile_ms;
+
+  if (unpersisted.count(hash))
+  {
+    return;
+  }
+
+  auto it = manifest.find(hash);
+
+  if (it == manifest.end())
+  {
+    manifest[hash] = compile_ms;
+    return;
+  }
+
+  stats.warm++;
+  stats.saved_ms += std::max(it->second - compile_ms, 0.0);
+}
+
+WGPUShaderModule PipelineCache::GetShaderModule(const std::string& wgsl, const char* label)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  DescriptorHasher hasher;
+  hasher.Add(wgsl);
+  uint64_t hash = hasher.Get();
+
+  auto it = shader_modules.find(hash);
+  if (it != shader_modules.end())
+  {
+    onHit(it->second.compile_ms);
+    return it->second.object;
+  }
+
+  WGPUShaderSourceWGSL source = {};
+  source.chain.sType = WGPUSType_ShaderSourceWGSL;
+  source.code = {wgsl.c_str(), wgsl.size()};
+
+  WGPUShaderModuleDescriptor desc = {};
+  desc.nextInChain = (const WGPUChainedStruct*)&source;
+  desc.label = {label, WGPU_STRLEN};
+
+  double start = utils::get_time();
+  WGPUShaderModule module = wgpuDeviceCreateShaderModule(device, &desc);
+  double compile_ms = 1000.0 * (utils::get_time() - start);
+
+  stats.lookups++;
+  stats.compile_ms += compile_ms;
+
+  shader_modules[hash] = {module, compile_ms};
+  object_hashes[module] = hash;
+
+  return module;
+}
+
+WGPUBindGroupLayout PipelineCache::GetBindGroupLayout(const WGPUBindGroupLayoutDescriptor& desc)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  DescriptorHasher hasher;
+  hasher.Add(desc.entryCount);
+
+  for (size_t i = 0; i < desc.entryCount; i++)
+  {
+    const WGPUBindGroupLayoutEntry& entry = desc.entries[i];
+
+    hasher.Add(entry.binding);
+    hasher.Add(entry.visibility);
+    hasher.Add(entry.buffer.type);
+    hasher.Add(entry.buffer.hasDynamicOffset);
+    hasher.Add(entry.buffer.minBindingSize);
+    hasher.Add(entry.sampler.type);
+    hasher.Add(entry.texture.sampleType);
+    hasher.Add(entry.texture.viewDimension);
+    hasher.Add(entry.texture.multisampled);
+    hasher.Add(entry.storageTexture.access);
+    hasher.Add(entry.storageTexture.format);
+    hasher.Add(entry.storageTexture.viewDimension);
+  }
+
+  uint64_t hash = hasher.Get();
+
+  auto it = bind_group_layouts.find(hash);
+  if (it != bind_group_layouts.end())
+  {
+    return it->second.object;
+  }
+
+  WGPUBindGroupLayout layout = wgpuDeviceCreateBindGroupLayout(device, &desc);
+
+  bind_group_layouts[hash] = {layout, 0.0};
+  object_hashes[layout] = hash;
+
+  return layout;
+}
+
+WGPUPipelineLayout PipelineCache::GetPipelineLayout(const WGPUPipelineLayoutDescriptor& desc)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  DescriptorHasher hasher;
+  bool foreign = false;
+  hasher.Add(desc.bindGroupLayoutCount);
+
+  for (size_t i = 0; i < desc.bindGroupLayoutCount; i++)
+  {
+    hasher.Add(hashOf(desc.bindGroupLayouts[i], wgpuBindGroupLayoutAddRef, wgpuBindGroupLayoutRelease, foreign));
+  }
+
+  uint64_t hash = hasher.Get();
+
+  auto it = pipeline_layouts.find(hash);
+  if (it != pipeline_layouts.end())
+  {
+    return it->second.object;
+  }
+
+  WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(device, &desc);
+
+  if (foreign)
+  {
+    unpersisted.insert(hash);
+  }
+
+  pipeline_layouts[hash] = {layout, 0.0};
+  object_hashes[layout] = hash;
+
+  return layout;
+}
+
+WGPURenderPipeline PipelineCache::GetRenderPipeline(const WGPURenderPipelineDescriptor& desc)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  DescriptorHasher hasher;
+  bool foreign = false;
+  hasher.Add((uint32_t)1);    //  Kind, so a render and a compute pipeline never share a key
+  hasher.Add(hashOf(desc.layout, wgpuPipelineLayoutAddRef, wgpuPipelineLayoutRelease, foreign));
+
+  const WGPUVertexState& vertex = desc.vertex;
+  hasher.Add(hashOf(vertex.module, wgpuShaderModuleAddRef, wgpuShaderModuleRelease, foreign));
+  hasher.Add(vertex.entryPoint);
+  hash_constants(hasher, vertex.constantCount, vertex.constants);
+  hasher.Add(vertex.bufferCount);
+
+  for (size_t i = 0; i < vertex.bufferCount; i++)
+  {
+    const WGPUVertexBufferLayout& buffer = vertex.buffers[i];
+
+    hasher.Add(buffer.arrayStride);
+    hasher.Add(buffer.stepMode);
+    hasher.Add(buffer.attributeCount);
+
+    for (size_t j = 0; j < buffer.attributeCount; j++)
+    {
+      hasher.Add(buffer.attributes[j].format);
+      hasher.Add(buffer.attributes[j].offset);
+      hasher.Add(buffer.attributes[j].shaderLocation);
+    }
+  }
+
+  hasher.Add(desc.primitive.topology);
+  hasher.Add(desc.primitive.stripIndexFormat);
+  hasher.Add(desc.primitive.frontFace);
+  hasher.Add(desc.primitive.cullMode);
+  hasher.Add(desc.primitive.unclippedDepth);
+
+  hasher.Add(desc.depthStencil != nullptr);
+  if (const WGPUDepthStencilState* depth = desc.depthStencil)
+  {
+    hasher.Add(depth->format);
+    hasher.Add(depth->depthWriteEnabled);
+    hasher.Add(depth->depthCompare);
+    hash_stencil_face(hasher, depth->stencilFront);
+    hash_stencil_face(hasher, depth->stencilBack);
+    hasher.Add(depth->stencilReadMask);
+    hasher.Add(depth->stencilWriteMask);
+    hasher.Add(depth->depthBias);
+    hasher.Add(depth->depthBiasSlopeScale);
+    hasher.Add(depth->depthBiasClamp);
+  }
+
+  hasher.Add(desc.multisample.count);
+  hasher.Add(desc.multisample.mask);
+  hasher.Add(desc.multisample.alphaToCoverageEnabled);
+
+  hasher.Add(desc.fragment != nullptr);
+  if (const WGPUFragmentState* fragment = desc.fragment)
+  {
+    hasher.Add(hashOf(fragment->module, wgpuShaderModuleAddRef, wgpuShaderModuleRelease, foreign));
+    hasher.Add(fragment->entryPoint);
+    hash_constants(hasher, fragment->constantCount, fragment->constants);
+    hasher.Add(fragment->targetCount);
+
+    for (size_t i = 0; i < fragment->targetCount; i++)
+    {
+      const WGPUColorTargetState& target = fragment->targets[i];
+
+      hasher.Add(target.format);
+      hasher.Add(target.writeMask);
+      hasher.Add(target.blend != nullptr);
+
+      if (target.blend)
+      {
+        hash_blend_component(hasher, target.blend->color);
+        hash_blend_component(hasher, target.blend->alpha);
+      }
+    }
+  }
+
+  uint64_t hash = hasher.Get();
+
+  auto it = render_pipelines.find(hash);
+  if (it != render_pipelines.end())
+  {
+    onHit(it->second.compile_ms);
+    return it->second.object;
+  }
+
+  double start = utils::get_time();
+  WGPURenderPipeline pipeline = wgpuDeviceCreateRenderPipeline(device, &desc);
+  double compile_ms = 1000.0 * (utils::get_time() - start);
+
+  if (foreign)
+  {
+    unpersisted.insert(hash);
+  }
+
+  onCreated(hash, compile_ms);
+
+  render_pipelines[hash] = {pipeline, compile_ms};
+  object_hashes[pipeline] = hash;
+
+  return pipeline;
+}
+
+WGPUComputePipeline PipelineCache::GetComputePipeline(const WGPUComputePipelineDescriptor& desc)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  DescriptorHasher hasher;
+  bool foreign = false;
+  hasher.Add((uint32_t)2);
+  hasher.Add(hashOf(desc.layout, wgpuPipelineLayoutAddRef, wgpuPipelineLayoutRelease, foreign));
+  hasher.Add(hashOf(desc.compute.module, wgpuShaderModuleAddRef, wgpuShaderModuleRelease, foreign));
+  hasher.Add(desc.compute.entryPoint);
+  hash_constants(hasher, desc.compute.constantCount, desc.compute.constants);
+
+  uint64_t hash = hasher.Get();
+
+  auto it = compute_pipelines.find(hash);
+  if (it != compute_pipelines.end())
+  {
+    onHit(it->second.compile_ms);
+    return it->second.object;
+  }
+
+  double start = utils::get_time();
+  WGPUComputePipeline pipeline = wgpuDeviceCreateComputePipeline(device, &desc);
+  double compile_ms = 1000.0 * (utils::get_time() - start);
+
+  if (foreign)
+  {
+    unpersisted.insert(hash);
+  }
+
+  onCreated(hash, compile_ms);
+
+  compute_pipelines[hash] = {pipeline, compile_ms};
+  object_hashes[pipeline] = hash;
+
+  return pipeline;
+}
+
+template <typename T>
+bool PipelineCache::removeFrom(std::unordered_map<uint64_t, Entry<T>>& objects, uint64_t hash, const void* object, void (*release)(T))
+{
+  auto it = objects.find(hash);
+
+  if (it == objects.end() || it->second.object != object)
+  {
+    return false;
+  }
+
+  release(it->second.object);
+  objects.erase(it);
+
+  return true;
+}
+
+void PipelineCache::Remove(const void* object)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto it = object_hashes.find(object);
+
+  if (!object || it == object_hashes.end())
+  {
+    return;
+  }
+
+  uint64_t hash = it->second;
+  object_hashes.erase(it);
+
+  //  A failed build must not count as known to the manifest either
+  if (removeFrom(render_pipelines, hash, object, wgpuRenderPipelineRelease) || removeFrom(compute_pipelines, hash, object, wgpuComputePipelineRelease))
+  {
+    manifest.erase(hash);
+    return;
+  }
+
+  removeFrom(shader_modules, hash, object, wgpuShaderModuleRelease) ||
+    removeFrom(pipeline_layouts, hash, object, wgpuPipelineLayoutRelease) ||
+    removeFrom(bind_group_layouts, hash, object, wgpuBindGroupLayoutRelease);
+}
+
+PipelineCacheStats PipelineCache::GetStats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return stats;
+}
+
+void PipelineCache::loadManifest()
+{
+  if (manifest_path.empty())
+  {
+    return;
+  }
+
+  std::ifstream file(manifest_path);
+  uint64_t hash;
+  double compile_ms;
+
+  while (file >> std::hex >> hash >> std::dec >> compile_ms)
+  {
+    manifest[hash] = compile_ms;
+  }
+}
+
+void PipelineCache::saveManifest() const
+{
+  if (manifest_path.empty())
+  {
+    return;
+  }
+
+  std::ofstream file(manifest_path);
+
+  if (!file)
+  {
+    std::cerr << "Could not write pipeline cache manifest " << manifest_path << std::endl;
+    return;
+  }
+
+  for (const auto& [hash, compile_ms] : manifest)
+  {
+    file << std::hex << hash << " " << std::dec << compile_ms << "\n";
+  }
+}
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+namespace WGPU
+{
+struct PipelineCacheStats
+{
+  uint64_t lookups = 0;           //  Shader module and pipeline requests
+  uint64_t hits = 0;              //  Requests served by an already created module or pipeline
+  uint64_t created = 0;           //  Pipelines compiled in this run
+  uint64_t warm = 0;              //  Of those, pipelines the manifest knows from a previous run
+  double compile_ms = 0.0;        //  Spent creating shader modules and pipelines
+  double saved_ms = 0.0;          //  Compile time of the pipelines that hits reused, plus warm start gains
+};
+
+//  Dedupes shader modules, bind group layouts, pipeline layouts and pipelines by a hash of their full descriptor.
+//  Handles are owned by the cache and released by Terminate, callers must not release them. Descriptors may refer to
+//  objects the cache did not create, those are referenced until Terminate. Thread safe, so pipelines can be rebuilt in
+//  the background while frames are rendered.
+//
+//  wgpu-native exposes no pipeline cache blobs, so the driver's own shader cache is what makes warm starts cheaper.
+//  The cache keeps a manifest of descriptor hashes and their cold compile times on disk to report that gain
+class PipelineCache
+{
+public:
+  //  manifest_path may be empty to keep everything in memory
+  void Init(WGPUDevice device, const std::string& manifest_path = "pipeline_cache.txt");
+
+  //  Write the manifest and release everything
+  void Terminate();
+
+  WGPUShaderModule GetShaderModule(const std::string& wgsl, const char* label);
+  WGPUBindGroupLayout GetBindGroupLayout(const WGPUBindGroupLayoutDescriptor& desc);
+  WGPUPipelineLayout GetPipelineLayout(const WGPUPipelineLayoutDescriptor& desc);
+  WGPURenderPipeline GetRenderPipeline(const WGPURenderPipelineDescriptor& desc);
+  WGPUComputePipeline GetComputePipeline(const WGPUComputePipelineDescriptor& desc);
+
+  //  Drop and release an object that failed validation, so the same descriptor is compiled again next time
+  void Remove(const void* object);
+
+  PipelineCacheStats GetStats() const;
+
+private:
+  template <typename T>
+  struct Entry
+  {
+    T object;
+    double compile_ms;
+  };
+
+  template <typename T>
+  static bool removeFrom(std::unordered_map<uint64_t, Entry<T>>& objects, uint64_t hash, const void* object, void (*release)(T));
+
+  //  Hash of an object created by the cache. Foreign ones are keyed by their handle and get a reference, so their
+  //  address can not be reused by another object while entries keyed by it exist. Sets foreign when the hash depends
+  //  on such an address, directly or through a cached object keyed by one
+  template <typename T>
+  uint64_t hashOf(T object, void (*add_ref)(T), void (*release)(T), bool& foreign);
+
+  //  Account a created pipeline against the manifest, unless its key is unpersisted
+  void onCreated(uint64_t hash, double compile_ms);
+  void onHit(double compile_ms);
+
+  void loadManifest();
+  void saveManifest() const;
+
+  WGPUDevice device = nullptr;
+  std::string manifest_path;
+
+  std::unordered_map<uint64_t, Entry<WGPUShaderModule>> shader_modules;
+  std::unordered_map<uint64_t, Entry<WGPUBindGroupLayout>> bind_group_layouts;
+  std::unordered_map<uint64_t, Entry<WGPUPipelineLayout>> pipeline_layouts;
+  std::unordered_map<uint64_t, Entry<WGPURenderPipeline>> render_pipelines;
+  std::unordered_map<uint64_t, Entry<WGPUComputePipeline>> compute_pipelines;
+
+  //  Handle -> descriptor hash, so descriptors referring to cached objects hash by content
+  std::unordered_map<const void*, uint64_t> object_hashes;
+
+  //  Foreign handle -> release of the reference taken by hashOf
+  std::unordered_map<const void*, std::function<void()>> foreign_objects;
+
+  //  Descriptor hash -> cold compile time in ms, as first recorded
+  std::unordered_map<uint64_t, double> manifest;
+
+  //  Descriptor hashes that include a foreign handle address, meaningless in the next run so never in the manifest
+  std::unordered_set<uint64_t> unpersisted;
+
+  PipelineCacheStats stats;
+
+  mutable std::mutex mutex;
+};
+};
@@ -0,0 +1,535 @@
+#include "ray_tracing.h"
+#include "slang_compiler.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <cassert>
+
+#define UNUSED(x) (void)(x)
+
+namespace WGPU
+{
+  static const char* RAY_TRACING_SHADER_PATH = "shaders/ray_tracing.slang";
+  static const char* RAY_TRACING_ENTRY_POINT = "computeMain";
+  static const uint32_t RAY_TRACING_GROUP_SIZE = 8;
+
+  //  Traversal stack entries of a thread, STACK_SIZE in ray_tracing.slang. A path from the root pushes at most one
+  //  entry per inner node, so the BVH is built no deeper
+  static const uint32_t RAY_TRACING_STACK_SIZE = 64;
+
+  //  Instances are baked into the BVH, a budget keeps large instance counts from exhausting host and GPU memory
+  static const uint64_t MAX_BAKED_TRIANGLES = 16u << 20;
+
+  //  The shader reads vertices as tightly packed floats
+  static_assert(sizeof(Vertex) == 11 * sizeof(float), "ray_tracing.slang expects 11 floats per Vertex");
+  static_assert(sizeof(utils::BvhNode) == 32 && sizeof(utils::BvhTriangle) == 16, "BVH layout is shared with ray_tracing.slang");
+
+  RGResource RayTracingRenderAPI::Draw(const FrameContext& frame)
+  {
+    assert(!bind_groups.empty() && "SetScene has to be called before drawing");
+
+    RenderGraph& graph = *frame.graph;
+    const uint32_t frame_index = frame.frame_index;
+
+    //  Rays per second are taken over the frame rate, which the tracer dominates
+    double now = utils::get_time();
+    if (last_draw_time > 0.0)
+    {
+      frame_interval_ms = 0.95 * frame_interval_ms + 0.05 * 1000.0 * (now - last_draw_time);
+    }
+    last_draw_time = now;
+
+    //  The slot's previous frame is done, its counter copy can be mapped right away
+    if (counter_states[frame_index] == CounterState::Copied && gpu_events)
+    {
+      counter_states[frame_index] = CounterState::Mapping;
+
+      WGPUBuffer staging = counter_staging[frame_index];
+      gpu_events->MapAsync(staging, WGPUMapMode_Read, 0, sizeof(uint32_t), [this, staging, frame_index](bool success)
+      {
+        if (success)
+        {
+          stats.rays = *static_cast<const uint32_t*>(wgpuBufferGetConstMappedRange(staging, 0, sizeof(uint32_t)));
+          stats.rays_per_second = frame_interval_ms > 0.0 ? stats.rays * 1000.0 / frame_interval_ms : 0.0;
+          wgpuBufferUnmap(staging);
+        }
+
+        //  Buffers released by Terminate complete their mapping with a failure
+        if (frame_index < counter_states.size())
+        {
+          counter_states[frame_index] = CounterState::Idle;
+        }
+      });
+    }
+
+    bool sample_rays = counter_states[frame_index] == CounterState::Idle && gpu_events;
+    if (sample_rays)
+    {
+      counter_states[frame_index] = CounterState::Copied;
+    }
+
+    RGResource color = graph.ImportTexture("Ray tracing texture", frame_textures[frame_index], frame_texture_views[frame_index]);
+    RGResource pixels = graph.ImportBuffer("Ray tracing pixels", pixel_buffers[frame_index]);
+
+    RenderGraph::PassBuilder trace = graph.AddPass("Ray tracing");
+    pixels = trace.Write(pixels);
+
+    trace.SetExecute([this, frame_index, sample_rays](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      UNUSED(graph);
+
+      WGPUBuffer counter = counter_buffers[frame_index];
+      wgpuCommandEncoderClearBuffer(command_encoder, counter, 0, sizeof(uint32_t));
+
+      WGPUComputePassDescriptor compute_pass_desc {};
+      compute_pass_desc.label = {"Ray tracing", WGPU_STRLEN};
+
+      //  Shader failed to compile at startup and no reload fixed it yet: black frames instead of an invalid dispatch
+      if (pipeline)
+      {
+        WGPUComputePassEncoder compute_pass = wgpuCommandEncoderBeginComputePass(command_encoder, &compute_pass_desc);
+        wgpuComputePassEncoderSetPipeline(compute_pass, pipeline);
+        wgpuComputePassEncoderSetBindGroup(compute_pass, 0, bind_groups[frame_index], 0, nullptr);
+        wgpuComputePassEncoderDispatchWorkgroups(compute_pass, (WIDTH + RAY_TRACING_GROUP_SIZE - 1) / RAY_TRACING_GROUP_SIZE, (HEIGHT + RAY_TRACING_GROUP_SIZE - 1) / RAY_TRACING_GROUP_SIZE, 1);
+        wgpuComputePassEncoderEnd(compute_pass);
+        wgpuComputePassEncoderRelease(compute_pass);
+      }
+      else
+      {
+        wgpuCommandEncoderClearBuffer(command_encoder, pixel_buffers[frame_index], 0, WGPU_WHOLE_SIZE);
+      }
+
+      if (sample_rays)
+      {
+        wgpuCommandEncoderCopyBufferToBuffer(command_encoder, counter, 0, counter_staging[frame_index], 0, sizeof(uint32_t));
+      }
+    });
+
+    //  Rows of WIDTH * 4 bytes, so the buffer copies into the texture as is
+    RenderGraph::PassBuilder resolve = graph.AddPass("Ray tracing resolve");
+    resolve.Read(pixels);
+    color = resolve.Write(color);
+
+    resolve.SetExecute([this, pixels, color](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      WGPUTexelCopyBufferInfo src {};
+      src.buffer = graph.GetBuffer(pixels);
+      src.layout.offset = 0;
+      src.layout.bytesPerRow = WIDTH * 4;
+      src.layout.rowsPerImage = HEIGHT;
+
+      WGPUTexelCopyTextureInfo dest {};
+      dest.texture = graph.GetTexture(color);
+      dest.origin = {0, 0, 0};
+      dest.aspect = WGPUTextureAspect_All;
+      dest.mipLevel = 0;
+
+      WGPUExtent3D size = {WIDTH, HEIGHT, 1};
+      wgpuCommandEncoderCopyBufferToTexture(command_encoder, &src, &dest, &size);
+    });
+
+    //  output_buffer has the layout of the pixels, it is only touched when somebody asked for the frame
+    if (readback_requested)
+    {
+      RenderGraph::PassBuilder readback = graph.AddPass("Ray tracing readback");
+
+      readback.Read(pixels);
+      RGResource output = readback.Write(graph.ImportBuffer("Output buffer", output_buffers[frame_index]));
+      readback.SideEffect();
+
+      readback.SetExecute([this, pixels, output](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+      {
+        wgpuCommandEncoderCopyBufferToBuffer(command_encoder, graph.GetBuffer(pixels), 0, graph.GetBuffer(output), 0, (uint64_t)WIDTH * HEIGHT * 4);
+      });
+
+      readback_requested = false;
+    }
+
+    return color;
+  }
+
+  void RayTracingRenderAPI::Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache, std::shared_ptr<MeshArena> mesh_arena, const std::vector<WGPUBuffer>& output_buffers, const std::vector<WGPUBuffer>& uniform_buffers)
+  {
+    assert(output_buffers.size() == uniform_buffers.size());
+
+    this->device = device;
+    this->queue = queue;
+    this->pipeline_cache = pipeline_cache;
+    this->mesh_arena = mesh_arena;
+    this->output_buffers = output_buffers;
+    this->uniform_buffers = uniform_buffers;
+
+    WGPUTextureDescriptor textureDesc {};
+    textureDesc.dimension = WGPUTextureDimension_2D;
+    textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
+    textureDesc.size = {WIDTH, HEIGHT, 1};
+    textureDesc.sampleCount = 1;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.label = {"Ray tracing texture", WGPU_STRLEN};
+    textureDesc.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst | WGPUTextureUsage_CopySrc;
+
+    WGPUTextureViewDescriptor textureViewDesc {};
+    textureViewDesc.aspect = WGPUTextureAspect_All;
+    textureViewDesc.baseArrayLayer = 0;
+    textureViewDesc.arrayLayerCount = 1;
+    textureViewDesc.dimension = WGPUTextureViewDimension_2D;
+    textureViewDesc.format = WGPUTextureFormat_RGBA8Unorm;
+    textureViewDesc.mipLevelCount = 1;
+    textureViewDesc.baseMipLevel = 0;
+    textureViewDesc.label = {"Ray tracing texture view", WGPU_STRLEN};
+
+    WGPUBufferDescriptor pixelsDesc {};
+    pixelsDesc.label = {"Ray tracing pixels", WGPU_STRLEN};
+    pixelsDesc.size = (uint64_t)WIDTH * HEIGHT * 4;
+    pixelsDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst;
+
+    WGPUBufferDescriptor counterDesc {};
+    counterDesc.label = {"Ray counter", WGPU_STRLEN};
+    counterDesc.size = sizeof(uint32_t);
+    counterDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst;
+
+    WGPUBufferDescriptor stagingDesc {};
+    stagingDesc.label = {"Ray counter staging", WGPU_STRLEN};
+    stagingDesc.size = sizeof(uint32_t);
+    stagingDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+
+    for (size_t i = 0; i < uniform_buffers.size(); i++)
+    {
+      frame_textures.push_back(wgpuDeviceCreateTexture(*device, &textureDesc));
+      frame_texture_views.push_back(wgpuTextureCreateView(frame_textures.back(), &textureViewDesc));
+      pixel_buffers.push_back(wgpuDeviceCreateBuffer(*device, &pixelsDesc));
+      counter_buffers.push_back(wgpuDeviceCreateBuffer(*device, &counterDesc));
+      counter_staging.push_back(wgpuDeviceCreateBuffer(*device, &stagingDesc));
+      counter_states.push_back(CounterState::Idle);
+    }
+
+    std::string error;
+    pipeline = createPipeline(readFile(RAY_TRACING_SHADER_PATH), error);
+
+    //  Frames stay black until a reload of the shader succeeds
+    if (!pipeline)
+    {
+      std::cerr << RAY_TRACING_SHADER_PATH << ": " << error << std::endl;
+    }
+  }
+
+  void RayTracingRenderAPI::SetScene(const std::vector<Mesh>& meshes)
+  {
+    releaseScene();
+
+    std::vector<Mesh> baked;
+    const bool instanced = bakeInstances(meshes, baked);
+    const std::vector<Mesh>& traced = instanced ? baked : meshes;
+
+    double start = utils::get_time();
+    utils::ThreadPool pool;
+    utils::BvhSettings bvh_settings;
+    bvh_settings.max_depth = RAY_TRACING_STACK_SIZE;
+    utils::Bvh bvh = utils::build_bvh(traced, bvh_settings, &pool);
+    double build_ms = 1000.0 * (utils::get_time() - start);
+
+    utils::BvhStats bvh_stats = utils::analyze_bvh(bvh, bvh_settings);
+    assert(bvh_stats.max_depth <= RAY_TRACING_STACK_SIZE && "The BVH is deeper than the shader's traversal stack");
+
+    //  Leaves of an empty scene are never reached, the buffer only has to be bindable
+    if (bvh.triangles.empty())
+    {
+      bvh.triangles.push_back({});
+    }
+
+    printf("Ray tracing BVH: %zu nodes over %zu triangles, built in %.2f ms on %u threads, SAH cost %.2f, depth %u, leaves of %.2f triangles\n",
+      bvh.nodes.size(), bvh.triangles.size(), build_ms, pool.Size(), bvh_stats.sah_cost, bvh_stats.max_depth, bvh_stats.average_leaf_size);
+
+    WGPUBufferDescriptor nodesDesc {};
+    nodesDesc.label = {"BVH nodes", WGPU_STRLEN};
+    nodesDesc.size = bvh.nodes.size() * sizeof(utils::BvhNode);
+    nodesDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+    utils::load_data_to_buffer(&node_buffer, bvh.nodes.data(), nodesDesc, *device);
+
+    WGPUBufferDescriptor trianglesDesc {};
+    trianglesDesc.label = {"BVH triangles", WGPU_STRLEN};
+    trianglesDesc.size = bvh.triangles.size() * sizeof(utils::BvhTriangle);
+    trianglesDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+    utils::load_data_to_buffer(&triangle_buffer, bvh.triangles.data(), trianglesDesc, *device);
+
+    Params params = { WIDTH, HEIGHT, ao_samples, ao_radius };
+
+    WGPUBufferDescriptor paramsDesc {};
+    paramsDesc.label = {"Ray tracing params", WGPU_STRLEN};
+    paramsDesc.size = sizeof(Params);
+    paramsDesc.usage = WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst;
+    utils::load_data_to_buffer(&params_buffer, &params, paramsDesc, *device);
+
+    //  Vertices are read straight from the scene arena unless instances had to be baked
+    if (instanced)
+    {
+      std::vector<Vertex> vertices;
+      for (const Mesh& mesh : baked)
+      {
+        vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+      }
+
+      //  Empty buffers can not be bound
+      if (vertices.empty())
+      {
+        vertices.push_back({});
+      }
+
+      WGPUBufferDescriptor verticesDesc {};
+      verticesDesc.label = {"Ray tracing baked vertices", WGPU_STRLEN};
+      verticesDesc.size = vertices.size() * sizeof(Vertex);
+      verticesDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+      utils::load_data_to_buffer(&baked_vertex_buffer, vertices.data(), verticesDesc, *device);
+    }
+
+    WGPUBuffer vertex_buffer = instanced ? baked_vertex_buffer : mesh_arena->GetVertexBuffer();
+    WGPUBindGroupLayout bindGroupLayout = getBindGroupLayout();
+
+    for (size_t i = 0; i < uniform_buffers.size(); i++)
+    {
+      std::vector<WGPUBindGroupEntry> entries(7);
+      const WGPUBuffer buffers[] = { uniform_buffers[i], params_buffer, node_buffer, triangle_buffer, vertex_buffer, pixel_buffers[i], counter_buffers[i] };
+
+      for (uint32_t binding = 0; binding < entries.size(); binding++)
+      {
+        entries[binding].binding = binding;
+        entries[binding].buffer = buffers[binding];
+        entries[binding].offset = 0;
+        entries[binding].size = wgpuBufferGetSize(buffers[binding]);
+      }
+
+      WGPUBindGroupDescriptor bindGroupDesc {};
+      bindGroupDesc.label = {"Ray tracing bind group", WGPU_STRLEN};
+      bindGroupDesc.layout = bindGroupLayout;
+      bindGroupDesc.entryCount = entries.size();
+      bindGroupDesc.entries = entries.data();
+
+      bind_groups.push_back(wgpuDeviceCreateBindGroup(*device, &bindGroupDesc));
+    }
+  }
+
+  bool RayTracingRenderAPI::bakeInstances(const std::vector<Mesh>& meshes, std::vector<Mesh>& baked) const
+  {
+    if (!instances)
+    {
+      return false;
+    }
+
+    const std::vector<InstanceRange>& ranges = instances->GetRanges();
+    const std::vector<InstanceData>& uploaded = instances->GetUploaded();
+    const float4x4 identity {};
+
+    bool plain = true;
+    uint64_t triangle_count = 0;
+
+    for (uint32_t mesh = 0; mesh < meshes.size(); mesh++)
+    {
+      const InstanceRange range = mesh < ranges.size() ? ranges[mesh] : InstanceRange{0, 0};
+      triangle_count += (uint64_t)range.count * (meshes[mesh].indices.size() / 3);
+
+      for (uint32_t i = range.first; i < range.first + range.count && plain; i++)
+      {
+        const float4& color = uploaded[i].color;
+        plain = memcmp(&uploaded[i].transform, &identity, sizeof(float4x4)) == 0 && color.x == 1.0f && color.y == 1.0f && color.z == 1.0f;
+      }
+
+      plain = plain && range.count == 1;
+    }
+
+    if (plain)
+    {
+      return false;
+    }
+
+    if (triangle_count > MAX_BAKED_TRIANGLES)
+    {
+      printf("Ray tracing: %llu instanced triangles exceed the budget of %llu, tracing every mesh once without its instances. Use fewer --instances\n",
+        (unsigned long long)triangle_count, (unsigned long long)MAX_BAKED_TRIANGLES);
+      return false;
+    }
+
+    //  Same products as vs_main, before the model matrix the shader applies
+    for (uint32_t mesh = 0; mesh < meshes.size() && mesh < ranges.size(); mesh++)
+    {
+      for (uint32_t i = ranges[mesh].first; i < ranges[mesh].first + ranges[mesh].count; i++)
+      {
+        const InstanceData& instance = uploaded[i];
+
+        baked.emplace_back();
+        Mesh& copy = baked.back();
+        copy.indices = meshes[mesh].indices;
+        copy.vertices.reserve(meshes[mesh].vertices.size());
+
+        for (Vertex vertex : meshes[mesh].vertices)
+        {
+          float4 position = instance.transform * float4(vertex.pos.x, vertex.pos.y, vertex.pos.z, 1.0f);
+          float4 normal = instance.transform * float4(vertex.normal.x, vertex.normal.y, vertex.normal.z, 0.0f);
+
+          vertex.pos = float3(position.x, position.y, position.z);
+          vertex.normal = float3(normal.x, normal.y, normal.z);
+          vertex.color = vertex.color * float3(instance.color.x, instance.color.y, instance.color.z);
+          copy.vertices.push_back(vertex);
+        }
+      }
+    }
+
+    printf("Ray tracing: baked %u instances, %llu triangles\n", instances->Count(), (unsigned long long)triangle_count);
+
+    return true;
+  }
+
+  WGPUBindGroupLayout RayTracingRenderAPI::getBindGroupLayout() const
+  {
+    const WGPUBufferBindingType types[] = {
+      WGPUBufferBindingType_Uniform,          //  Uniforms
+      WGPUBufferBindingType_Uniform,          //  Params
+      WGPUBufferBindingType_ReadOnlyStorage,  //  BVH nodes
+      WGPUBufferBindingType_ReadOnlyStorage,  //  BVH triangles
+      WGPUBufferBindingType_ReadOnlyStorage,  //  Scene vertices
+      WGPUBufferBindingType_Storage,          //  Pixels
+      WGPUBufferBindingType_Storage,          //  Ray counter
+    };
+
+    std::vector<WGPUBindGroupLayoutEntry> entries(sizeof(types) / sizeof(types[0]));
+
+    for (uint32_t binding = 0; binding < entries.size(); binding++)
+    {
+      entries[binding].binding = binding;
+      entries[binding].visibility = WGPUShaderStage_Compute;
+      entries[binding].buffer.type = types[binding];
+      entries[binding].buffer.minBindingSize = 0;
+    }
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.label = {"Ray tracing bind group layout", WGPU_STRLEN};
+    bindGroupLayoutDesc.entryCount = entries.size();
+    bindGroupLayoutDesc.entries = entries.data();
+
+    return pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+  }
+
+  WGPUComputePipeline RayTracingRenderAPI::createPipeline(const std::string& source, std::string& error) const
+  {
+    std::string wgsl;
+
+    if (!compile_slang_to_wgsl(RAY_TRACING_SHADER_PATH, source, RAY_TRACING_ENTRY_POINT, wgsl, error))
+    {
+      return nullptr;
+    }
+
+    return buildPipeline(wgsl, error);
+  }
+
+  WGPUComputePipeline RayTracingRenderAPI::buildPipeline(const std::string& wgsl, std::string& error) const
+  {
+    WGPUShaderModule shader_module = nullptr;
+    WGPUComputePipeline next = nullptr;
+
+    if (!utils::validation_scope(*device, [&]() { shader_module = pipeline_cache->GetShaderModule(wgsl, "Ray tracing shader module"); }, error))
+    {
+      pipeline_cache->Remove(shader_module);
+      return nullptr;
+    }
+
+    WGPUBindGroupLayout bindGroupLayout = getBindGroupLayout();
+
+    WGPUPipelineLayoutDescriptor layoutDesc {};
+    layoutDesc.label = {"Ray tracing pipeline layout", WGPU_STRLEN};
+    layoutDesc.bindGroupLayoutCount = 1;
+    layoutDesc.bindGroupLayouts = &bindGroupLayout;
+    WGPUPipelineLayout layout = pipeline_cache->GetPipelineLayout(layoutDesc);
+
+    //  Slang keeps the entry point name in WGSL
+    WGPUComputePipelineDescriptor pipelineDesc {};
+    pipelineDesc.label = {"Ray tracing pipeline", WGPU_STRLEN};
+    pipelineDesc.layout = layout;
+    pipelineDesc.compute.module = shader_module;
+    pipelineDesc.compute.entryPoint = {RAY_TRACING_ENTRY_POINT, WGPU_STRLEN};
+
+    if (!utils::validation_scope(*device, [&]() { next = pipeline_cache->GetComputePipeline(pipelineDesc); }, error))
+    {
+      pipeline_cache->Remove(next);
+      return nullptr;
+    }
+
+    return next;
+  }
+
+  void RayTracingRenderAPI::WatchShaders(ShaderHotReload& reload)
+  {
+    //  Slang compilation, module and pipeline all run on the reload thread, the swap only exchanges the pipeline
+    reload.Watch(RAY_TRACING_SHADER_PATH, [this](const std::string& source, double& build_ms) -> ShaderSwap
+    {
+      std::string wgsl;
+      std::string error;
+
+      if (!compile_slang_to_wgsl(RAY_TRACING_SHADER_PATH, source, RAY_TRACING_ENTRY_POINT, wgsl, error))
+      {
+        std::cerr << RAY_TRACING_SHADER_PATH << ": " << error << std::endl;
+        return nullptr;
+      }
+
+      double start = utils::get_time();
+      WGPUComputePipeline next = buildPipeline(wgsl, error);
+      build_ms = 1000.0 * (utils::get_time() - start);
+
+      if (!next)
+      {
+        std::cerr << RAY_TRACING_SHADER_PATH << ": " << error << std::endl;
+        return nullptr;
+      }
+
+      return [this, next]() { pipeline = next; };
+    });
+  }
+
+  void RayTracingRenderAPI::releaseScene()
+  {
+    for (WGPUBindGroup bind_group : bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    bind_groups.clear();
+
+    if (node_buffer)
+    {
+      wgpuBufferRelease(node_buffer);
+      wgpuBufferRelease(triangle_buffer);
+      wgpuBufferRelease(params_buffer);
+    }
+
+    if (baked_vertex_buffer)
+    {
+      wgpuBufferRelease(baked_vertex_buffer);
+    }
+
+    node_buffer = nullptr;
+    triangle_buffer = nullptr;
+    params_buffer = nullptr;
+    baked_vertex_buffer = nullptr;
+  }
+
+  void RayTracingRenderAPI::Terminate()
+  {
+    //  Pipeline belongs to the pipeline cache
+    releaseScene();
+
+    for (size_t i = 0; i < frame_textures.size(); i++)
+    {
+      wgpuTextureViewRelease(frame_texture_views[i]);
+      wgpuTextureRelease(frame_textures[i]);
+      wgpuBufferRelease(pixel_buffers[i]);
+      wgpuBufferRelease(counter_buffers[i]);
+      wgpuBufferRelease(counter_staging[i]);
+    }
+
+    frame_textures.clear();
+    frame_texture_views.clear();
+    pixel_buffers.clear();
+    counter_buffers.clear();
+    counter_staging.clear();
+    counter_states.clear();
+  }
+};
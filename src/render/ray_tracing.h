@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "render.h"
+#include "bvh.h"
+
+namespace WGPU
+{
+//  Compute shader tracer: primary, shadow and ambient occlusion rays through a BVH of the scene in storage buffers.
+//  Pixels are written as RGBA8 into a buffer with the layout of output_buffer and copied into the frame texture, so
+//  frames are always returned in the API's own texture, never in FrameContext::target
+class RayTracingRenderAPI : virtual public RenderAPI
+{
+public:
+  RayTracingRenderAPI(const uint32_t RENDER_WIDTH, const uint32_t RENDER_HEIGHT) : RenderAPI(RENDER_WIDTH, RENDER_HEIGHT) {}
+
+  RGResource Draw(const FrameContext& frame) override;
+  void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache, std::shared_ptr<MeshArena> mesh_arena, const std::vector<WGPUBuffer>& output_buffers, const std::vector<WGPUBuffer>& uniform_buffers) override;
+  void Terminate() override;
+
+  void WatchShaders(ShaderHotReload& reload) override;
+
+  //  Build the BVH over meshes and upload it, they have to be the meshes of mesh_arena. Instances are taken as of their
+  //  last upload, later edits are traced once SetScene is called again
+  void SetScene(const std::vector<Mesh>& meshes) override;
+
+  RenderAPIStats GetStats() const override { return stats; }
+
+  WGPUTextureView GetFrameTextureView(uint32_t frame_index) const override { return frame_texture_views[frame_index]; }
+
+  //  Hemisphere rays per hit and their length, AO is off with 0 samples. Set before SetScene
+  uint32_t ao_samples = 4;
+  float ao_radius = 0.5f;
+
+private:
+  //  Matches RayTracingParams in ray_tracing.slang
+  struct Params
+  {
+    uint32_t width;
+    uint32_t height;
+    uint32_t ao_samples;
+    float ao_radius;
+  };
+
+  //  Ray counter readback of one slot: copied by a frame, mapped once the slot comes around again
+  enum class CounterState
+  {
+    Idle,
+    Copied,
+    Mapping,
+  };
+
+  WGPUBindGroupLayout getBindGroupLayout() const;
+
+  //  Compile the Slang source and build the pipeline around it, nullptr and the diagnostics on failure
+  WGPUComputePipeline createPipeline(const std::string& source, std::string& error) const;
+
+  //  Device side of createPipeline, validated in an error scope of the calling thread
+  WGPUComputePipeline buildPipeline(const std::string& wgsl, std::string& error) const;
+
+  //  Copies of meshes for every instance, transformed and tinted as vs_main does. False when every mesh has a single
+  //  plain instance and the arena can be traced as is, or when the copies would exceed the triangle budget and the
+  //  arena is traced without instances instead
+  bool bakeInstances(const std::vector<Mesh>& meshes, std::vector<Mesh>& baked) const;
+
+  void releaseScene();
+
+  //  Replaced between frames by shader hot reload
+  WGPUComputePipeline pipeline = nullptr;
+
+  WGPUBuffer params_buffer = nullptr;
+  WGPUBuffer node_buffer = nullptr;
+  WGPUBuffer triangle_buffer = nullptr;
+  WGPUBuffer baked_vertex_buffer = nullptr;   //  Vertices of the baked instances, nullptr when the arena's are traced
+
+  //  Per frames-in-flight slot
+  std::vector<WGPUTexture> frame_textures;
+  std::vector<WGPUTextureView> frame_texture_views;
+  std::vector<WGPUBuffer> pixel_buffers;
+  std::vector<WGPUBuffer> counter_buffers;
+  std::vector<WGPUBuffer> counter_staging;
+  std::vector<WGPUBindGroup> bind_groups;
+  std::vector<WGPUBuffer> output_buffers;
+  std::vector<WGPUBuffer> uniform_buffers;
+
+  std::vector<CounterState> counter_states;
+  double last_draw_time = 0.0;
+  double frame_interval_ms = 0.0;
+  RenderAPIStats stats;
+};
+};
@@ -2,57 +2,338 @@
 #include "utils.h"
 #include "mesh.h"
 #include <iostream>
+#include <cassert>
+#include <algorithm>
 
 #define UNUSED(x) (void)(x)
 
 namespace WGPU
 {
+  static const char* RASTERIZATION_SHADER_PATH = "shaders/rasterization.wgsl";
+
   std::string readFile(const char* path) {
       std::ifstream file(path, std::ios::binary);
       return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
   }
 
-  void RasterizationRenderAPI::Draw() const
+  RGResource RasterizationRenderAPI::Draw(const FrameContext& frame)
+  {
+    assert(!(frame.target != RG_INVALID && readback_requested) && "Readback frames have to be resolved into the frame texture");
+
+    RenderGraph& graph = *frame.graph;
+    const uint32_t frame_index = frame.frame_index;
+
+    if (!(frame.aa == applied_aa))
+    {
+      applyAntiAliasing(frame.aa);
+    }
+
+    const uint32_t samples = sample_count;
+    const bool post_aa = applied_aa.fxaa && samples == 1;
+
+    //  Meshlets pull their vertices in the vertex shader and have no position-only pipeline
+    const bool prepass = frame.depth_prepass && pipelines.depth;
+
+    //  FXAA writes through a storage binding, which the frame texture has and a swapchain view does not
+    RGResource color = frame.target;
+    if (color == RG_INVALID || post_aa)
+    {
+      color = graph.ImportTexture("Rasterization texture", frame_textures[frame_index], frame_texture_views[frame_index]);
+    }
+
+    timer->BeginFrame(frame_index, applied_aa.sample_count | (post_aa ? 0x100u : 0u) | (prepass ? 0x200u : 0u));
+
+    if (instances->GetBuffer() != bound_instance_buffer)
+    {
+      createBindGroups();
+    }
+
+    MeshletDraws clusters = { RG_INVALID, RG_INVALID };
+    if (meshlet_culling)
+    {
+      clusters = meshlet_culling->AddPass(graph, frame_index, *instances);
+
+      if (meshlet_culling->GetBufferVersion() != bound_meshlet_version)
+      {
+        createMeshletBindGroup();
+      }
+    }
+
+    CulledDraws culled = { RG_INVALID, RG_INVALID };
+    if (culling)
+    {
+      culled = culling->AddPass(graph, frame_index, *instances);
+
+      if (culling->GetVisibleVersion() != bound_visible_version)
+      {
+        createVisibleBindGroups();
+      }
+    }
+
+    //  Occlusion culling samples the depth of the early draws, and the late draws continue on top of them
+    const bool occlusion = culling && culling->occlusion;
+    const WGPUTextureUsage depth_usage = occlusion ? WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding : WGPUTextureUsage_RenderAttachment;
+
+    RenderGraph::PassBuilder pass = graph.AddPass("Rasterization");
+
+    if (culling)
+    {
+      pass.Read(culled.draws);
+      pass.Read(culled.visible);
+    }
+    else if (meshlet_culling)
+    {
+      pass.Read(clusters.draw);
+      pass.Read(clusters.clusters);
+    }
+
+    //  Multisampled frames are drawn into a transient resolved into color, single sample ones straight into color or,
+    //  with FXAA, into a transient the post-process reads
+    RGResource target = color;
+    if (samples > 1)
+    {
+      target = pass.CreateTexture("Rasterization multisample texture", { WGPUTextureFormat_RGBA8Unorm, WIDTH, HEIGHT, samples, 1, WGPUTextureUsage_RenderAttachment });
+    }
+    else if (post_aa)
+    {
+      target = pass.CreateTexture("Rasterization aliased texture", { WGPUTextureFormat_RGBA8Unorm, WIDTH, HEIGHT, 1, 1, WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding });
+    }
+    else
+    {
+      pass.Write(color);
+    }
+
+    RGResource depth = pass.CreateTexture("Rasterization depth texture", { depth_format, WIDTH, HEIGHT, samples, 1, depth_usage });
+    RGResource resolve = occlusion || samples == 1 ? RG_INVALID : pass.Write(color);
+    const ScenePassQueries scene_queries = getScenePassQueries(frame_index, false, prepass);
+
+    pass.SetExecute([this, target, depth, resolve, frame_index, prepass, scene_queries](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+    {
+      if (meshlet_culling)
+      {
+        recordScenePass(command_encoder, graph, target, depth, resolve, false, frame_index, meshlet_culling->GetDrawBuffer(), meshlet_bind_group,
+          false, scene_queries);
+      }
+      else
+      {
+        recordScenePass(command_encoder, graph, target, depth, resolve, false, frame_index,
+          culling ? culling->GetDrawBuffer() : nullptr, visible_bind_group, prepass, scene_queries);
+      }
+    });
+
+    if (occlusion)
+    {
+      RGResource pyramid = culling->AddPyramidPass(graph, depth, samples);
+      CulledDraws late = culling->AddLatePass(graph, frame_index, pyramid);
+
+      RenderGraph::PassBuilder late_pass = graph.AddPass("Rasterization late");
+      late_pass.Read(late.draws);
+      late_pass.Read(late.visible);
+      late_pass.Read(target);
+      late_pass.Read(depth);
+      late_pass.Write(target);
+      late_pass.Write(depth);
+
+      RGResource late_resolve = RG_INVALID;
+      if (samples > 1)
+      {
+        late_resolve = late_pass.Write(color);
+      }
+
+      const ScenePassQueries late_queries = getScenePassQueries(frame_index, true, prepass);
+
+      late_pass.SetExecute([this, target, depth, late_resolve, frame_index, prepass, late_queries](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+      {
+        recordScenePass(command_encoder, graph, target, depth, late_resolve, true, frame_index, culling->GetLateDrawBuffer(), late_visible_bind_group,
+          prepass, late_queries);
+      });
+    }
+
+    if (post_aa)
+    {
+      fxaa->AddPass(graph, frame_index, target, color, WIDTH, HEIGHT, timer->GetTimestampWrites(frame_index, SCOPE_FXAA));
+    }
+
+    timer->AddResolvePass(graph, frame_index, color);
+
+    //  output_buffer is only touched when somebody asked for the frame
+    if (readback_requested)
+    {
+      RenderGraph::PassBuilder readback = graph.AddPass("Rasterization readback");
+
+      readback.Read(color);
+      RGResource output = readback.Write(graph.ImportBuffer("Output buffer", output_buffers[frame_index]));
+      readback.SideEffect();
+
+      readback.SetExecute([this, color, output](WGPUCommandEncoder command_encoder, const RenderGraph& graph)
+      {
+        copyFrameToOutputBuffer(command_encoder, graph.GetTexture(color), graph.GetBuffer(output));
+      });
+
+      readback_requested = false;
+    }
+
+    return color;
+  }
+
+  void RasterizationRenderAPI::recordScenePass(WGPUCommandEncoder command_encoder, const RenderGraph& graph, RGResource target, RGResource depth,
+    RGResource resolve, bool load, uint32_t frame_index, WGPUBuffer draws, WGPUBindGroup visible, bool prepass,
+    const ScenePassQueries& queries) const
   {
-    WGPUCommandEncoderDescriptor command_encoder_desc = { .label = {"Rasterization command encoder", WGPU_STRLEN} };
-    WGPUCommandEncoder command_encoder = wgpuDeviceCreateCommandEncoder(*device, &command_encoder_desc);
+    if (prepass)
+    {
+      recordDepthPass(command_encoder, graph, depth, load, frame_index, draws, visible, queries);
+    }
 
     WGPURenderPassColorAttachment renderPassColorAttachment = {};
-    renderPassColorAttachment.view = multisample_texture_view;
-    renderPassColorAttachment.resolveTarget = nullptr;
-    renderPassColorAttachment.loadOp = WGPULoadOp_Clear;
-    renderPassColorAttachment.storeOp = WGPUStoreOp_Store;
-    renderPassColorAttachment.resolveTarget = frame_texture_view;
+    renderPassColorAttachment.view = graph.GetTextureView(target);
+    renderPassColorAttachment.loadOp = load ? WGPULoadOp_Load : WGPULoadOp_Clear;
+    renderPassColorAttachment.storeOp = graph.StoreOp(target);
+    renderPassColorAttachment.resolveTarget = resolve != RG_INVALID ? graph.GetTextureView(resolve) : nullptr;
     renderPassColorAttachment.clearValue = WGPUColor{ 0.0, 0.0, 0.0, 0.0 };
     renderPassColorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
 
+    //  After a pre-pass depth is complete and only tested
     WGPURenderPassDepthStencilAttachment depthStencilAttachment {};
-    depthStencilAttachment.view = depth_texture_view;
+    depthStencilAttachment.view = graph.GetTextureView(depth);
     depthStencilAttachment.depthClearValue = 1.0f;
-    depthStencilAttachment.depthLoadOp = WGPULoadOp_Clear;
-    depthStencilAttachment.depthStoreOp = WGPUStoreOp_Store;
+    depthStencilAttachment.depthLoadOp = load || prepass ? WGPULoadOp_Load : WGPULoadOp_Clear;
+    depthStencilAttachment.depthStoreOp = graph.StoreOp(depth);
     depthStencilAttachment.depthReadOnly = (WGPUBool)false;
     depthStencilAttachment.stencilClearValue = 0;
     depthStencilAttachment.stencilLoadOp = WGPULoadOp_Clear;
-		depthStencilAttachment.stencilStoreOp = WGPUStoreOp_Store;
+    depthStencilAttachment.stencilStoreOp = WGPUStoreOp_Store;
     depthStencilAttachment.stencilReadOnly = true;
 
     WGPURenderPassDescriptor renderPassDesc{};
     renderPassDesc.colorAttachmentCount = 1;
     renderPassDesc.colorAttachments = &renderPassColorAttachment;
     renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
-    renderPassDesc.timestampWrites = nullptr;
+    renderPassDesc.timestampWrites = queries.timestamps;
 
     WGPURenderPassEncoder render_pass_encoder = wgpuCommandEncoderBeginRenderPass(command_encoder, &renderPassDesc);
 
-    wgpuRenderPassEncoderSetPipeline(render_pass_encoder, pipeline);
-    wgpuRenderPassEncoderSetVertexBuffer(render_pass_encoder, 0, vertex_buffer, 0, wgpuBufferGetSize(vertex_buffer));
-    wgpuRenderPassEncoderSetBindGroup(render_pass_encoder, 0, bind_group, 0, nullptr);
-    wgpuRenderPassEncoderDraw(render_pass_encoder, indices_count, 1, 0, 0);
+    if (queries.fragments.query_set)
+    {
+      wgpuRenderPassEncoderBeginPipelineStatisticsQuery(render_pass_encoder, queries.fragments.query_set, queries.fragments.index);
+    }
+
+    wgpuRenderPassEncoderSetPipeline(render_pass_encoder, prepass ? pipelines.equal : pipelines.color);
+    wgpuRenderPassEncoderSetBindGroup(render_pass_encoder, 0, bind_groups[frame_index], 0, nullptr);
+
+    //  Every visible cluster of every mesh in one draw, vertices are pulled from storage buffers
+    if (meshlet_culling)
+    {
+      wgpuRenderPassEncoderSetBindGroup(render_pass_encoder, 1, visible, 0, nullptr);
+      wgpuRenderPassEncoderDrawIndirect(render_pass_encoder, draws, 0);
+    }
+    else
+    {
+      recordDraws(render_pass_encoder, mesh_arena->GetVertexBuffer(), draws, visible);
+    }
+
+    if (queries.fragments.query_set)
+    {
+      wgpuRenderPassEncoderEndPipelineStatisticsQuery(render_pass_encoder);
+    }
+
+    wgpuRenderPassEncoderEnd(render_pass_encoder);
+    wgpuRenderPassEncoderRelease(render_pass_encoder);
+  }
+
+  void RasterizationRenderAPI::recordDepthPass(WGPUCommandEncoder command_encoder, const RenderGraph& graph, RGResource depth, bool load,
+    uint32_t frame_index, WGPUBuffer draws, WGPUBindGroup visible, const ScenePassQueries& queries) const
+  {
+    //  The colour pass after it reads the depth again
+    WGPURenderPassDepthStencilAttachment depthStencilAttachment {};
+    depthStencilAttachment.view = graph.GetTextureView(depth);
+    depthStencilAttachment.depthClearValue = 1.0f;
+    depthStencilAttachment.depthLoadOp = load ? WGPULoadOp_Load : WGPULoadOp_Clear;
+    depthStencilAttachment.depthStoreOp = WGPUStoreOp_Store;
+    depthStencilAttachment.depthReadOnly = (WGPUBool)false;
+    depthStencilAttachment.stencilClearValue = 0;
+    depthStencilAttachment.stencilLoadOp = WGPULoadOp_Clear;
+    depthStencilAttachment.stencilStoreOp = WGPUStoreOp_Store;
+    depthStencilAttachment.stencilReadOnly = true;
+
+    WGPURenderPassDescriptor renderPassDesc{};
+    renderPassDesc.label = {"Depth pre-pass", WGPU_STRLEN};
+    renderPassDesc.colorAttachmentCount = 0;
+    renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+    renderPassDesc.timestampWrites = queries.prepass_timestamps;
+
+    WGPURenderPassEncoder render_pass_encoder = wgpuCommandEncoderBeginRenderPass(command_encoder, &renderPassDesc);
+
+    if (queries.prepass_fragments.query_set)
+    {
+      wgpuRenderPassEncoderBeginPipelineStatisticsQuery(render_pass_encoder, queries.prepass_fragments.query_set, queries.prepass_fragments.index);
+    }
+
+    wgpuRenderPassEncoderSetPipeline(render_pass_encoder, pipelines.depth);
+    wgpuRenderPassEncoderSetBindGroup(render_pass_encoder, 0, bind_groups[frame_index], 0, nullptr);
+    recordDraws(render_pass_encoder, mesh_arena->GetPositionBuffer(), draws, visible);
+
+    if (queries.prepass_fragments.query_set)
+    {
+      wgpuRenderPassEncoderEndPipelineStatisticsQuery(render_pass_encoder);
+    }
 
     wgpuRenderPassEncoderEnd(render_pass_encoder);
     wgpuRenderPassEncoderRelease(render_pass_encoder);
+  }
+
+  void RasterizationRenderAPI::recordDraws(WGPURenderPassEncoder render_pass_encoder, WGPUBuffer vertex_buffer, WGPUBuffer draws, WGPUBindGroup visible) const
+  {
+    //  State is set once for the whole scene, meshes only differ by their range in the arena and their instances
+    WGPUBuffer index_buffer = mesh_arena->GetIndexBuffer();
 
+    wgpuRenderPassEncoderSetVertexBuffer(render_pass_encoder, 0, vertex_buffer, 0, wgpuBufferGetSize(vertex_buffer));
+    wgpuRenderPassEncoderSetIndexBuffer(render_pass_encoder, index_buffer, WGPUIndexFormat_Uint32, 0, wgpuBufferGetSize(index_buffer));
+
+    const std::vector<MeshRange>& ranges = mesh_arena->GetRanges();
+    const std::vector<InstanceRange>& instance_ranges = instances->GetRanges();
+
+    for (size_t mesh = 0; mesh < std::min(ranges.size(), instance_ranges.size()); mesh++)
+    {
+      const MeshRange& range = ranges[mesh];
+      const InstanceRange& instance_range = instance_ranges[mesh];
+
+      if (instance_range.count > 0 && draws)
+      {
+        //  Instance count comes from the culling pass, instances from the draw's visible list. One draw per level of
+        //  detail, levels no instance picked draw nothing
+        for (uint32_t lod = 0; lod < culling->GetLodCount((uint32_t)mesh); lod++)
+        {
+          uint32_t draw = culling->GetFirstDraw((uint32_t)mesh) + lod;
+          uint32_t offset = culling->GetVisibleOffset(draw);
+          wgpuRenderPassEncoderSetBindGroup(render_pass_encoder, 1, visible, 1, &offset);
+          wgpuRenderPassEncoderDrawIndexedIndirect(render_pass_encoder, draws, draw * sizeof(DrawIndexedIndirect));
+        }
+      }
+      else if (instance_range.count > 0)
+      {
+        wgpuRenderPassEncoderDrawIndexed(render_pass_encoder, range.index_count, instance_range.count, range.first_index, (int32_t)range.first_vertex, instance_range.first);
+      }
+    }
+  }
+
+  RasterizationRenderAPI::ScenePassQueries RasterizationRenderAPI::getScenePassQueries(uint32_t frame_index, bool late, bool prepass) const
+  {
+    ScenePassQueries queries;
+    queries.timestamps = timer->GetTimestampWrites(frame_index, late ? SCOPE_SCENE_LATE : SCOPE_SCENE);
+    queries.fragments = timer->GetFragmentQuery(frame_index, late ? SCOPE_SCENE_LATE : SCOPE_SCENE);
+
+    if (prepass)
+    {
+      queries.prepass_timestamps = timer->GetTimestampWrites(frame_index, late ? SCOPE_PREPASS_LATE : SCOPE_PREPASS);
+      queries.prepass_fragments = timer->GetFragmentQuery(frame_index, late ? SCOPE_PREPASS_LATE : SCOPE_PREPASS);
+    }
+
+    return queries;
+  }
+
+  void RasterizationRenderAPI::copyFrameToOutputBuffer(WGPUCommandEncoder command_encoder, WGPUTexture frame_texture, WGPUBuffer output_buffer) const
+  {
     uint32_t bytesPerRowUnpadded = WIDTH * 4;
     uint32_t bytesPerRow = bytesPerRowUnpadded;
     uint32_t bufferSize = bytesPerRow * HEIGHT;
@@ -71,57 +352,23 @@ namespace WGPU
     dest.layout.rowsPerImage = HEIGHT;
 
     wgpuCommandEncoderCopyTextureToBuffer(command_encoder, &src, &dest, &textureSize);
-
-    WGPUCommandBufferDescriptor cmd_desc{};
-    cmd_desc.label = { "Rasterization command buffer", WGPU_STRLEN };
-    WGPUCommandBuffer command_buffer = wgpuCommandEncoderFinish(command_encoder, &cmd_desc);
-
-    wgpuQueueSubmit(*queue, 1, &command_buffer);
-    wgpuCommandBufferRelease(command_buffer);
-    wgpuCommandEncoderRelease(command_encoder);
-
-    wgpuDevicePoll(*device, false, nullptr);
   }
 
-  void RasterizationRenderAPI::Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, const int indices_count, WGPUBuffer output_buffer, WGPUBuffer vertex_buffer, WGPUBuffer index_buffer, WGPUBuffer uniform_buffer)
+  void RasterizationRenderAPI::Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache, std::shared_ptr<MeshArena> mesh_arena, const std::vector<WGPUBuffer>& output_buffers, const std::vector<WGPUBuffer>& uniform_buffers)
   {
+    assert(output_buffers.size() == uniform_buffers.size());
+
     this->device = device;
     this->queue = queue;
-    this->output_buffer = output_buffer;
-    this->vertex_buffer = vertex_buffer;
-    this->index_buffer = index_buffer;
-    this->uniform_buffer = uniform_buffer;
-    this->indices_count = indices_count;
+    this->pipeline_cache = pipeline_cache;
+    this->mesh_arena = mesh_arena;
+    this->output_buffers = output_buffers;
+    this->uniform_buffers = uniform_buffers;
 
     //  Init texture and its view
     //  Create texture
     WGPUExtent3D textureSize = {(uint32_t)WIDTH, (uint32_t)HEIGHT, 1};
 
-    WGPUTextureDescriptor multisampleTextureDesc{};
-    multisampleTextureDesc.dimension = WGPUTextureDimension_2D;
-    multisampleTextureDesc.format = WGPUTextureFormat_RGBA8Unorm;
-    multisampleTextureDesc.size = textureSize;
-    multisampleTextureDesc.sampleCount = 4;
-    multisampleTextureDesc.viewFormatCount = 0;
-    multisampleTextureDesc.viewFormats = nullptr;
-    multisampleTextureDesc.mipLevelCount = 1;
-    multisampleTextureDesc.label = {"Rasterization multisample texture", WGPU_STRLEN};
-    multisampleTextureDesc.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst | WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc;
-
-    multisample_texture = wgpuDeviceCreateTexture(*device, &multisampleTextureDesc);
-
-    WGPUTextureViewDescriptor multisampleTextureViewDesc {};
-    multisampleTextureViewDesc.aspect = WGPUTextureAspect_All;
-    multisampleTextureViewDesc.baseArrayLayer = 0;
-    multisampleTextureViewDesc.arrayLayerCount = 1;
-    multisampleTextureViewDesc.dimension = WGPUTextureViewDimension_2D;
-    multisampleTextureViewDesc.format = WGPUTextureFormat_RGBA8Unorm;
-    multisampleTextureViewDesc.mipLevelCount = 1;
-    multisampleTextureViewDesc.baseMipLevel = 0;
-    multisampleTextureViewDesc.label = {"Rasterization multisample texture view", WGPU_STRLEN};
-    
-    multisample_texture_view = wgpuTextureCreateView(multisample_texture, &multisampleTextureViewDesc);
-
     WGPUTextureDescriptor textureDesc{};
     textureDesc.dimension = WGPUTextureDimension_2D;
     textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
@@ -131,9 +378,8 @@ namespace WGPU
     textureDesc.viewFormats = nullptr;
     textureDesc.mipLevelCount = 1;
     textureDesc.label = {"Rasterization texture", WGPU_STRLEN};
-    textureDesc.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst | WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc;
-
-    frame_texture = wgpuDeviceCreateTexture(*device, &textureDesc);
+    textureDesc.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst | WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc |
+      WGPUTextureUsage_StorageBinding;
 
     WGPUTextureViewDescriptor textureViewDesc {};
     textureViewDesc.aspect = WGPUTextureAspect_All;
@@ -145,31 +391,309 @@ namespace WGPU
     textureViewDesc.baseMipLevel = 0;
     textureViewDesc.label = {"Rasterization texture view", WGPU_STRLEN};
     
-    frame_texture_view = wgpuTextureCreateView(frame_texture, &textureViewDesc);
+    //  One resolve texture per slot, so the composite pass of frame N never shares a texture with frame N+1
+    for (size_t i = 0; i < uniform_buffers.size(); i++)
+    {
+      frame_textures.push_back(wgpuDeviceCreateTexture(*device, &textureDesc));
+      frame_texture_views.push_back(wgpuTextureCreateView(frame_textures.back(), &textureViewDesc));
+    }
     
     //  Load the shader module
-    std::string shader_code = readFile("shaders/rasterization.wgsl");
+    std::string shader_code = readFile(RASTERIZATION_SHADER_PATH);
+    shader_module = pipeline_cache->GetShaderModule(shader_code, "Rasterization shader module");
 
-    const WGPUChainedStruct tmp1 = { .sType = WGPUSType_ShaderSourceWGSL };
-    
-    const WGPUShaderSourceWGSL tmp2 = {
-      .chain = tmp1,
-      .code = {shader_code.c_str(), WGPU_STRLEN},
-    };
+    pipelines = createPipelines(shader_module, sample_count);
+    applied_aa = { sample_count, false };
+
+    timer = std::make_unique<GpuTimer>();
+    timer->Init(device, gpu_events, (uint32_t)uniform_buffers.size(), SCOPE_COUNT);
+
+    fxaa = std::make_unique<Fxaa>();
+    fxaa->Init(device, pipeline_cache, (uint32_t)uniform_buffers.size());
+
+    //  Depth target itself is declared per frame in the render graph
+    WGPUDepthStencilState depth_stencil_state;
+    utils::set_default_depth_stencil_state(depth_stencil_state);
+    depth_format = depth_stencil_state.format;
+
+    assert(instances && instances->GetBuffer() && "Instances have to be set and uploaded before Init");
+    createBindGroups();
+
+    if (meshlets)
+    {
+      meshlet_culling = std::make_unique<MeshletCulling>();
+      meshlet_culling->Init(device, queue, pipeline_cache, uniform_buffers, gpu_events);
+    }
+    else if (gpu_culling || occlusion_culling || lod)
+    {
+      culling = std::make_unique<GpuCulling>();
+      culling->occlusion = occlusion_culling;
+      culling->depth_width = WIDTH;
+      culling->depth_height = HEIGHT;
+      culling->lod = lod;
+      culling->lod_pixel_error = lod_pixel_error;
+      culling->lod_fade_band = lod_fade ? 0.5f : 0.0f;
+      culling->Init(device, queue, pipeline_cache, uniform_buffers, gpu_events);
+    }
+  }
 
-    const WGPUShaderModuleDescriptor tmp3 = {
-      .nextInChain = (const WGPUChainedStruct *)&tmp2,
-      .label = {"Rasterization shader module", WGPU_STRLEN}
+  void RasterizationRenderAPI::SetScene(const std::vector<Mesh>& meshes)
+  {
+    if (culling)
+    {
+      culling->SetScene(meshes, mesh_arena->GetRanges(), mesh_arena->GetLods());
+    }
+
+    if (meshlet_culling)
+    {
+      meshlet_culling->SetScene(meshes, mesh_arena->GetRanges());
+    }
+  }
+
+  RenderAPIStats RasterizationRenderAPI::GetStats() const
+  {
+    RenderAPIStats stats;
+
+    if (culling)
+    {
+      CullingStats culling_stats = culling->GetStats();
+      stats.visible_objects = culling_stats.visible;
+      stats.culled_objects = culling_stats.culled;
+      stats.occluded_objects = culling_stats.occluded;
+      stats.triangles = culling_stats.triangles;
+      stats.scene_triangles = culling_stats.full_triangles;
+    }
+
+    //  Times belong to the anti-aliasing of the frame they were measured in
+    const uint32_t tag = timer->GetTag();
+    stats.aa = { tag & 0xffu, (tag & 0x100u) != 0 };
+    stats.depth_prepass = (tag & 0x200u) != 0;
+    stats.gpu_prepass_ms = timer->GetMilliseconds(SCOPE_PREPASS) + timer->GetMilliseconds(SCOPE_PREPASS_LATE);
+    stats.gpu_scene_ms = timer->GetMilliseconds(SCOPE_SCENE) + timer->GetMilliseconds(SCOPE_SCENE_LATE) + stats.gpu_prepass_ms;
+    stats.gpu_aa_ms = timer->GetMilliseconds(SCOPE_FXAA);
+    stats.fragments = timer->GetFragmentInvocations(SCOPE_SCENE) + timer->GetFragmentInvocations(SCOPE_SCENE_LATE);
+    stats.prepass_fragments = timer->GetFragmentInvocations(SCOPE_PREPASS) + timer->GetFragmentInvocations(SCOPE_PREPASS_LATE);
+
+    if (meshlet_culling)
+    {
+      MeshletStats meshlet_stats = meshlet_culling->GetStats();
+      stats.visible_clusters = meshlet_stats.visible_clusters;
+      stats.total_clusters = meshlet_stats.total_clusters;
+      stats.triangles = meshlet_stats.triangles;
+      stats.scene_triangles = meshlet_stats.total_triangles;
+    }
+
+    return stats;
+  }
+
+  void RasterizationRenderAPI::createBindGroups()
+  {
+    //  Frames in flight keep the previous bind groups alive until they are done
+    for (WGPUBindGroup bind_group : bind_groups)
+    {
+      wgpuBindGroupRelease(bind_group);
+    }
+    bind_groups.clear();
+
+    bound_instance_buffer = instances->GetBuffer();
+    WGPUBindGroupLayout bindGroupLayout = getBindGroupLayout();
+
+    for (WGPUBuffer uniform_buffer : uniform_buffers)
+    {
+      WGPUBindGroupEntry bindings[2] {};
+      bindings[0].binding = 0;
+      bindings[0].buffer = uniform_buffer;
+      bindings[0].offset = 0;
+      bindings[0].size = sizeof(Uniforms);
+
+      bindings[1].binding = 1;
+      bindings[1].buffer = bound_instance_buffer;
+      bindings[1].offset = 0;
+      bindings[1].size = wgpuBufferGetSize(bound_instance_buffer);
+
+      WGPUBindGroupDescriptor bindGroupDesc {};
+      bindGroupDesc.layout = bindGroupLayout;
+      bindGroupDesc.entryCount = 2;
+      bindGroupDesc.entries = bindings;
+      
+      bind_groups.push_back(wgpuDeviceCreateBindGroup(*device, &bindGroupDesc));
+    }
+  }
+
+  void RasterizationRenderAPI::createVisibleBindGroups()
+  {
+    for (WGPUBindGroup bind_group : { visible_bind_group, late_visible_bind_group })
+    {
+      if (bind_group)
+      {
+        wgpuBindGroupRelease(bind_group);
+      }
+    }
+
+    bound_visible_version = culling->GetVisibleVersion();
+
+    auto create = [this](WGPUBuffer buffer)
+    {
+      WGPUBindGroupEntry binding {};
+      binding.binding = 0;
+      binding.buffer = buffer;
+      binding.offset = 0;
+      binding.size = culling->GetVisibleBindingSize();
+
+      WGPUBindGroupDescriptor bindGroupDesc {};
+      bindGroupDesc.label = {"Visible instances bind group", WGPU_STRLEN};
+      bindGroupDesc.layout = getVisibleBindGroupLayout();
+      bindGroupDesc.entryCount = 1;
+      bindGroupDesc.entries = &binding;
+
+      return wgpuDeviceCreateBindGroup(*device, &bindGroupDesc);
     };
 
+    visible_bind_group = create(culling->GetVisibleBuffer());
+    late_visible_bind_group = culling->occlusion ? create(culling->GetLateVisibleBuffer()) : nullptr;
+  }
+
+  void RasterizationRenderAPI::createMeshletBindGroup()
+  {
+    if (meshlet_bind_group)
+    {
+      wgpuBindGroupRelease(meshlet_bind_group);
+    }
+
+    bound_meshlet_version = meshlet_culling->GetBufferVersion();
+
+    const WGPUBuffer buffers[] = { meshlet_culling->GetMeshletBuffer(), meshlet_culling->GetMeshletVertexBuffer(),
+      meshlet_culling->GetMeshletTriangleBuffer(), mesh_arena->GetVertexBuffer(), meshlet_culling->GetClusterBuffer() };
+    WGPUBindGroupEntry bindings[5] {};
+
+    for (uint32_t i = 0; i < 5; i++)
+    {
+      bindings[i].binding = i + 1;
+      bindings[i].buffer = buffers[i];
+      bindings[i].offset = 0;
+      bindings[i].size = wgpuBufferGetSize(buffers[i]);
+    }
+
+    WGPUBindGroupDescriptor bindGroupDesc {};
+    bindGroupDesc.label = {"Meshlet bind group", WGPU_STRLEN};
+    bindGroupDesc.layout = getMeshletBindGroupLayout();
+    bindGroupDesc.entryCount = 5;
+    bindGroupDesc.entries = bindings;
+
+    meshlet_bind_group = wgpuDeviceCreateBindGroup(*device, &bindGroupDesc);
+  }
+
+  WGPUBindGroupLayout RasterizationRenderAPI::getMeshletBindGroupLayout() const
+  {
+    //  Bindings 1 to 5, binding 0 of group 1 is the visible list of vs_culled
+    WGPUBindGroupLayoutEntry bindingLayouts[5] {};
+
+    for (uint32_t i = 0; i < 5; i++)
+    {
+      bindingLayouts[i].binding = i + 1;
+      bindingLayouts[i].visibility = WGPUShaderStage_Vertex;
+      bindingLayouts[i].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+      bindingLayouts[i].buffer.minBindingSize = 0;
+    }
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.entryCount = 5;
+    bindGroupLayoutDesc.entries = bindingLayouts;
+
+    return pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+  }
+
+  WGPUBindGroupLayout RasterizationRenderAPI::getVisibleBindGroupLayout() const
+  {
+    WGPUBindGroupLayoutEntry bindingLayout {};
+    bindingLayout.binding = 0;
+    bindingLayout.visibility = WGPUShaderStage_Vertex;
+    bindingLayout.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    bindingLayout.buffer.hasDynamicOffset = true;
+    bindingLayout.buffer.minBindingSize = sizeof(uint32_t);
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.entryCount = 1;
+    bindGroupLayoutDesc.entries = &bindingLayout;
+
+    return pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+  }
+
+  WGPUBindGroupLayout RasterizationRenderAPI::getBindGroupLayout() const
+  {
+    WGPUBindGroupLayoutEntry bindingLayouts[2] {};
+    bindingLayouts[0].binding = 0;
+    bindingLayouts[0].visibility = WGPUShaderStage_Fragment | WGPUShaderStage_Vertex;
+    bindingLayouts[0].buffer.type = WGPUBufferBindingType_Uniform;
+    bindingLayouts[0].buffer.minBindingSize = sizeof(Uniforms);
+
+    //  Instances
+    bindingLayouts[1].binding = 1;
+    bindingLayouts[1].visibility = WGPUShaderStage_Vertex;
+    bindingLayouts[1].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    bindingLayouts[1].buffer.minBindingSize = sizeof(InstanceData);
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
+    bindGroupLayoutDesc.entryCount = 2;
+    bindGroupLayoutDesc.entries = bindingLayouts;
+    
+    return pipeline_cache->GetBindGroupLayout(bindGroupLayoutDesc);
+  }
+
+  void RasterizationRenderAPI::applyAntiAliasing(const AntiAliasing& requested)
+  {
+    if (requested.sample_count != sample_count)
+    {
+      if (requested == rejected_aa)
+      {
+        return;
+      }
+
+      //  Sample counts other than 1 and 4 depend on the adapter and the formats, probe targets and pipeline together
+      std::string error;
+      ScenePipelines next;
+      bool valid = utils::validation_scope(*device, [&]()
+      {
+        for (WGPUTextureFormat format : { WGPUTextureFormat_RGBA8Unorm, depth_format })
+        {
+          WGPUTextureDescriptor probeDesc {};
+          probeDesc.label = {"Sample count probe", WGPU_STRLEN};
+          probeDesc.dimension = WGPUTextureDimension_2D;
+          probeDesc.format = format;
+          probeDesc.size = {1, 1, 1};
+          probeDesc.sampleCount = requested.sample_count;
+          probeDesc.mipLevelCount = 1;
+          probeDesc.usage = WGPUTextureUsage_RenderAttachment;
+          wgpuTextureRelease(wgpuDeviceCreateTexture(*device, &probeDesc));
+        }
+
+        next = createPipelines(shader_module, requested.sample_count);
+      }, error);
+
+      if (!valid)
+      {
+        std::cerr << requested.sample_count << "x MSAA is not supported: " << error << std::endl;
+        removePipelines(next);
+        rejected_aa = requested;
+        return;
+      }
+
+      //  Frames in flight keep the previous pipelines, the cache keeps them for switching back
+      pipelines = next;
+      sample_count = requested.sample_count;
+    }
+
+    applied_aa = requested;
+  }
+
+  RasterizationRenderAPI::ScenePipelines RasterizationRenderAPI::createPipelines(WGPUShaderModule module, uint32_t samples) const
+  {
     WGPUBlendState blend_state = utils::wgpu_create_blend_state(true);
 
      /* Depth stencil state */
     WGPUDepthStencilState depth_stencil_state;
     utils::set_default_depth_stencil_state(depth_stencil_state);
 
-    WGPUShaderModule shader_module = wgpuDeviceCreateShaderModule(*this->device, &tmp3);
-
     std::vector<WGPUVertexAttribute> vertexAttribs(4);
 
     // pos
@@ -198,26 +722,20 @@ namespace WGPU
     vertexBufferLayout.arrayStride = sizeof(Vertex);
     vertexBufferLayout.stepMode = WGPUVertexStepMode_Vertex;
 
-    WGPUBindGroupLayoutEntry bindingLayout {};
-    bindingLayout.binding = 0;
-    bindingLayout.visibility = WGPUShaderStage_Fragment | WGPUShaderStage_Vertex;
-    bindingLayout.buffer.type = WGPUBufferBindingType_Uniform;
-    bindingLayout.buffer.minBindingSize = sizeof(Uniforms);
-
-    WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
-    bindGroupLayoutDesc.entryCount = 1;
-    bindGroupLayoutDesc.entries = &bindingLayout;
-    
-    WGPUBindGroupLayout bindGroupLayout = wgpuDeviceCreateBindGroupLayout(*device, &bindGroupLayoutDesc);
+    //  Culled draws read their instances through the visible list in group 1, meshlets their clusters and vertices
+    const bool culled = (gpu_culling || occlusion_culling || lod) && !meshlets;
+    const WGPUBindGroupLayout bindGroupLayouts[] = { getBindGroupLayout(),
+      meshlets ? getMeshletBindGroupLayout() : culled ? getVisibleBindGroupLayout() : nullptr };
 
     WGPUPipelineLayoutDescriptor layoutDesc {};
-    layoutDesc.bindGroupLayoutCount = 1;
+    layoutDesc.bindGroupLayoutCount = culled || meshlets ? 2 : 1;
     layoutDesc.label = {"Rasterization pipeline layout", WGPU_STRLEN};
-    layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)(&bindGroupLayout);
-    WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(*device, &layoutDesc);
+    layoutDesc.bindGroupLayouts = bindGroupLayouts;
+    WGPUPipelineLayout layout = pipeline_cache->GetPipelineLayout(layoutDesc);
 
-    WGPUVertexState vertex_state = { .module = shader_module, .entryPoint = {"vs_main", WGPU_STRLEN}, .constantCount = 0, .constants = nullptr };
-    vertex_state.bufferCount = 1;
+    const char* vertex_entry_point = meshlets ? "vs_meshlet" : culled ? "vs_culled" : "vs_main";
+    WGPUVertexState vertex_state = { .module = module, .entryPoint = {vertex_entry_point, WGPU_STRLEN}, .constantCount = 0, .constants = nullptr };
+    vertex_state.bufferCount = meshlets ? 0 : 1;
     vertex_state.buffers = &vertexBufferLayout;
     
     const WGPUColorTargetState tmp4 = {
@@ -226,49 +744,12 @@ namespace WGPU
       .writeMask = WGPUColorWriteMask_All,
     };
     const WGPUColorTargetState targets[] = { tmp4 };
-    const WGPUFragmentState fragment_state = { .module = shader_module, .entryPoint = {"fs_main", WGPU_STRLEN}, .constantCount = 0, .constants = nullptr, .targetCount = 1, .targets = targets };
-
-    // Create the depth texture
-    WGPUTextureDescriptor depthTextureDesc {};
-    depthTextureDesc.dimension = WGPUTextureDimension_2D;
-    depthTextureDesc.format = depth_stencil_state.format;
-    depthTextureDesc.mipLevelCount = 1;
-    depthTextureDesc.size = {WIDTH, HEIGHT, 1};
-    depthTextureDesc.usage = WGPUTextureUsage_RenderAttachment;
-    depthTextureDesc.sampleCount = 4;
-    depthTextureDesc.viewFormatCount = 1;
-    depthTextureDesc.viewFormats = (WGPUTextureFormat*)(&depth_stencil_state.format);
-
-    WGPUTexture depthTexture = wgpuDeviceCreateTexture(*device, &depthTextureDesc);
-
-    // Create the view of the depth texture manipulated by the rasterizer
-    WGPUTextureViewDescriptor depthTextureViewDesc {};
-    depthTextureViewDesc.aspect = WGPUTextureAspect_DepthOnly;
-    depthTextureViewDesc.baseArrayLayer = 0;
-    depthTextureViewDesc.arrayLayerCount = 1;
-    depthTextureViewDesc.baseMipLevel = 0;
-    depthTextureViewDesc.mipLevelCount = 1;
-    depthTextureViewDesc.dimension = WGPUTextureViewDimension_2D;
-    depthTextureViewDesc.format = depth_stencil_state.format;
-
-    depth_texture_view = wgpuTextureCreateView(depthTexture, &depthTextureViewDesc);
-
-    WGPUBindGroupEntry binding {};
-    binding.binding = 0;
-    binding.buffer = uniform_buffer;
-    binding.offset = 0;
-    binding.size = sizeof(Uniforms);
-
-    WGPUBindGroupDescriptor bindGroupDesc {};
-    bindGroupDesc.layout = bindGroupLayout;
-    bindGroupDesc.entryCount = bindGroupLayoutDesc.entryCount;
-    bindGroupDesc.entries = &binding;
-    
-    bind_group = wgpuDeviceCreateBindGroup(*device, &bindGroupDesc);
+    const char* fragment_entry_point = culled && lod && lod_fade ? "fs_fade" : "fs_main";
+    const WGPUFragmentState fragment_state = { .module = module, .entryPoint = {fragment_entry_point, WGPU_STRLEN}, .constantCount = 0, .constants = nullptr, .targetCount = 1, .targets = targets };
 
     // MSAA
     const WGPUPrimitiveState prim_state = { .topology = WGPUPrimitiveTopology_TriangleList, .stripIndexFormat = WGPUIndexFormat_Undefined, .frontFace = WGPUFrontFace_CCW, .cullMode = WGPUCullMode_None };
-    const WGPUMultisampleState multisample_state = { .count = 4, .mask = 0xFFFFFFFF, .alphaToCoverageEnabled = false };
+    const WGPUMultisampleState multisample_state = { .count = samples, .mask = 0xFFFFFFFF, .alphaToCoverageEnabled = false };
 
     WGPURenderPipelineDescriptor renderPipelineDesc{};
     renderPipelineDesc.label = {"Rasterization pipeline", WGPU_STRLEN};
@@ -279,15 +760,144 @@ namespace WGPU
     renderPipelineDesc.multisample = multisample_state;
     renderPipelineDesc.depthStencil = &depth_stencil_state;
 
-    pipeline = wgpuDeviceCreateRenderPipeline(*this->device, &renderPipelineDesc);
+    ScenePipelines scene_pipelines;
+    scene_pipelines.color = pipeline_cache->GetRenderPipeline(renderPipelineDesc);
+
+    if (meshlets)
+    {
+      return scene_pipelines;
+    }
+
+    //  Colour pass after the pre-pass: the fragments that made it into the depth buffer are shaded once
+    WGPUDepthStencilState equal_depth_stencil_state = depth_stencil_state;
+    equal_depth_stencil_state.depthCompare = WGPUCompareFunction_Equal;
+    equal_depth_stencil_state.depthWriteEnabled = (WGPUOptionalBool)false;
+
+    renderPipelineDesc.label = {"Rasterization colour after depth pre-pass pipeline", WGPU_STRLEN};
+    renderPipelineDesc.depthStencil = &equal_depth_stencil_state;
+    scene_pipelines.equal = pipeline_cache->GetRenderPipeline(renderPipelineDesc);
+
+    //  Depth pre-pass: tightly packed positions and no colour target. Only cross-faded levels need a fragment shader,
+    //  to discard the same pixels as fs_fade
+    WGPUVertexAttribute positionAttrib {};
+    positionAttrib.shaderLocation = 0;
+    positionAttrib.format = WGPUVertexFormat_Float32x3;
+    positionAttrib.offset = 0;
+
+    WGPUVertexBufferLayout positionBufferLayout {};
+    positionBufferLayout.attributeCount = 1;
+    positionBufferLayout.attributes = &positionAttrib;
+    positionBufferLayout.arrayStride = 3 * sizeof(float);
+    positionBufferLayout.stepMode = WGPUVertexStepMode_Vertex;
+
+    const bool fade = culled && lod && lod_fade;
+    WGPUVertexState depth_vertex_state = { .module = module, .entryPoint = {culled ? "vs_depth_culled" : "vs_depth", WGPU_STRLEN}, .constantCount = 0, .constants = nullptr };
+    depth_vertex_state.bufferCount = 1;
+    depth_vertex_state.buffers = &positionBufferLayout;
+
+    const WGPUFragmentState depth_fragment_state = { .module = module, .entryPoint = {"fs_depth_fade", WGPU_STRLEN}, .constantCount = 0, .constants = nullptr, .targetCount = 0, .targets = nullptr };
+
+    renderPipelineDesc.label = {"Depth pre-pass pipeline", WGPU_STRLEN};
+    renderPipelineDesc.vertex = depth_vertex_state;
+    renderPipelineDesc.fragment = fade ? &depth_fragment_state : nullptr;
+    renderPipelineDesc.depthStencil = &depth_stencil_state;
+    scene_pipelines.depth = pipeline_cache->GetRenderPipeline(renderPipelineDesc);
+
+    return scene_pipelines;
+  }
+
+  void RasterizationRenderAPI::removePipelines(const ScenePipelines& failed) const
+  {
+    for (WGPURenderPipeline failed_pipeline : { failed.color, failed.depth, failed.equal })
+    {
+      pipeline_cache->Remove(failed_pipeline);
+    }
+  }
+
+  void RasterizationRenderAPI::WatchShaders(ShaderHotReload& reload)
+  {
+    //  WGSL needs no CPU side preparation, module and pipelines are built and validated on the reload thread
+    reload.Watch(RASTERIZATION_SHADER_PATH, [this](const std::string& source, double& build_ms) -> ShaderSwap
+    {
+      double start = utils::get_time();
+      std::string error;
+      WGPUShaderModule next_module = nullptr;
+      ScenePipelines next;
+      const uint32_t samples = sample_count;
+
+      if (!utils::validation_scope(*device, [&]() { next_module = pipeline_cache->GetShaderModule(source, "Rasterization shader module"); }, error))
+      {
+        std::cerr << RASTERIZATION_SHADER_PATH << ": " << error << std::endl;
+        pipeline_cache->Remove(next_module);
+        return nullptr;
+      }
+
+      if (!utils::validation_scope(*device, [&]() { next = createPipelines(next_module, samples); }, error))
+      {
+        std::cerr << "Rasterization pipeline: " << error << std::endl;
+        removePipelines(next);
+        return nullptr;
+      }
+
+      build_ms = 1000.0 * (utils::get_time() - start);
+
+      //  The previous pipelines stay in the cache, frames still in flight may use them
+      return [this, next, next_module, samples]()
+      {
+        //  Built for the sample count at the start of the rebuild. Should it have changed meanwhile, the next frame
+        //  switches back to the requested one with the new module like any anti-aliasing change
+        shader_module = next_module;
+        pipelines = next;
+        sample_count = samples;
+        applied_aa.sample_count = samples;
+      };
+    });
   }
 
   void RasterizationRenderAPI::Terminate()
   {
-    wgpuRenderPipelineRelease(pipeline);
-    
-    wgpuTextureViewRelease(frame_texture_view);
-    wgpuTextureRelease(frame_texture);
-    wgpuTextureViewRelease(depth_texture_view);
+    //  Pipeline belongs to the pipeline cache
+    for (size_t i = 0; i < frame_textures.size(); i++)
+    {
+      wgpuBindGroupRelease(bind_groups[i]);
+      wgpuTextureViewRelease(frame_texture_views[i]);
+      wgpuTextureRelease(frame_textures[i]);
+    }
+
+    if (culling)
+    {
+      culling->Terminate();
+    }
+
+    for (WGPUBindGroup bind_group : { visible_bind_group, late_visible_bind_group })
+    {
+      if (bind_group)
+      {
+        wgpuBindGroupRelease(bind_group);
+      }
+    }
+    visible_bind_group = nullptr;
+    late_visible_bind_group = nullptr;
+
+    if (meshlet_culling)
+    {
+      meshlet_culling->Terminate();
+    }
+
+    if (meshlet_bind_group)
+    {
+      wgpuBindGroupRelease(meshlet_bind_group);
+    }
+    meshlet_bind_group = nullptr;
+
+    if (fxaa)
+    {
+      fxaa->Terminate();
+    }
+
+    if (timer)
+    {
+      timer->Terminate();
+    }
   }
 };
\ No newline at end of file
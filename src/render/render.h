@@ -1,33 +1,126 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <string>
 #include <fstream>
+#include <vector>
 
 #include <LiteMath.h>
 
 #include <webgpu/webgpu.h>
 #include <webgpu/wgpu.h>
 
+#include "render_graph.h"
+#include "pipeline_cache.h"
+#include "shader_reload.h"
+#include "mesh_arena.h"
+#include "instance_set.h"
+#include "gpu_events.h"
+#include "gpu_culling.h"
+#include "meshlet_culling.h"
+#include "gpu_timer.h"
+#include "fxaa.h"
+#include "mesh.h"
+
 using LiteMath::float3;
 
 namespace WGPU
 { 
+//  Anti-aliasing of rasterized frames
+struct AntiAliasing
+{
+  uint32_t sample_count = 4;    //  MSAA samples: 1, 2, 4 or 8, 2 and 8 where the adapter supports them
+  bool fxaa = false;            //  FXAA compute pass over single sample frames, ignored with MSAA
+
+  bool operator==(const AntiAliasing& other) const = default;
+};
+
+//  Everything a render API needs to declare one frame
+struct FrameContext
+{
+  RenderGraph* graph;           //  Frame graph the API adds its passes to, compiled and submitted by the caller
+  RGResource target;            //  If not RG_INVALID the frame is resolved straight into it (e.g. swapchain view). APIs
+                                //  that can not render into it return their own texture, which the caller composites
+  uint32_t frame_index;         //  Slot in the frames-in-flight ring
+  const Uniforms* uniforms;     //  Host copy of what uniform_buffers[frame_index] holds for this frame
+  AntiAliasing aa;              //  Requested anti-aliasing, APIs that do not rasterize ignore it
+  bool depth_prepass = false;   //  Lay down depth with a position-only pass before shading, rasterization only
+};
+
+//  Counters a render API measures about its own work, zero where they do not apply
+struct RenderAPIStats
+{
+  uint64_t rays = 0;              //  Rays traced in the last sampled frame
+  double rays_per_second = 0.0;
+  uint64_t triangles = 0;         //  Triangles rasterised after culling and clipping, or drawn as culled meshlets or levels of detail
+  double cpu_ms = 0.0;            //  CPU time the API spends rendering a frame itself, smoothed
+  uint32_t raster_tiles = 0;      //  Screen tiles of the software rasterizer
+  uint32_t raster_threads = 0;    //  Worker threads they are shared by
+  uint32_t visible_objects = 0;   //  Instances passing GPU culling in the last sampled frame
+  uint32_t culled_objects = 0;    //  Outside the frustum
+  uint32_t occluded_objects = 0;  //  Behind the depth pyramid
+  uint32_t visible_clusters = 0;  //  Meshlets passing cluster culling in the last sampled frame
+  uint32_t total_clusters = 0;    //  Meshlets of every instance
+  uint64_t scene_triangles = 0;   //  Triangles of every instance, what drawing whole meshes submits
+  AntiAliasing aa;                //  Anti-aliasing the GPU times below were measured with
+  double gpu_scene_ms = 0.0;      //  Smoothed GPU time of the scene passes, from timestamp queries
+  double gpu_aa_ms = 0.0;         //  Of the FXAA pass
+  bool depth_prepass = false;     //  Whether the times and counts below were measured with a depth pre-pass
+  double gpu_prepass_ms = 0.0;    //  Part of gpu_scene_ms spent in depth pre-passes
+  double fragments = 0.0;         //  Smoothed fragment shader invocations of the colour passes, from pipeline statistics
+  double prepass_fragments = 0.0; //  Of the depth pre-passes, 0 unless they discard cross-faded pixels
+};
+
+//  Whole file as a string, empty if it can not be read
+std::string readFile(const char* path);
+
 class RenderAPI
 {
 public:
   RenderAPI(const uint32_t RENDER_WIDTH, const uint32_t RENDER_HEIGHT) : WIDTH(RENDER_WIDTH), HEIGHT(RENDER_HEIGHT) {}
 
-  virtual void Draw() const = 0;
-  virtual void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, const int indices_count, WGPUBuffer output_buffer, WGPUBuffer vertex_buffer, WGPUBuffer index_buffer, WGPUBuffer uniform_buffer) = 0; 
+  //  Add the frame's passes to frame.graph and return the resource holding the frame.
+  //  Without target the frame is resolved into the API's own frame texture of the slot
+  virtual RGResource Draw(const FrameContext& frame) = 0;
+  //  output_buffers and uniform_buffers hold one buffer per frames-in-flight slot. Shaders and pipelines come from
+  //  pipeline_cache, which owns them. The scene is every mesh of mesh_arena
+  virtual void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache, std::shared_ptr<MeshArena> mesh_arena, const std::vector<WGPUBuffer>& output_buffers, const std::vector<WGPUBuffer>& uniform_buffers) = 0;
   virtual void Terminate() = 0;
 
+  //  Register the API's shader files for hot reload, after Init
+  virtual void WatchShaders(ShaderHotReload& reload) { (void)reload; }
+
+  //  Host copy of the scene mesh_arena holds, for APIs that build their own structures from it. Called after Init
+  virtual void SetScene(const std::vector<Mesh>& meshes) { (void)meshes; }
+
+  virtual RenderAPIStats GetStats() const { return {}; }
+
+  //  Dispatcher of buffer mappings and queue completions, set before Init by APIs reading results back
+  void SetGpuEvents(GpuEvents* events) { gpu_events = events; }
+
+  //  Instances of the mesh_arena meshes to draw, uploaded before Init and then by the caller at the start of every
+  //  frame. APIs without instancing draw every mesh once, untransformed
+  void SetInstances(std::shared_ptr<InstanceSet> instance_set) { instances = instance_set; }
+
+  //  View of the API's own frame texture of the slot, valid for frames drawn without target view
+  virtual WGPUTextureView GetFrameTextureView(uint32_t frame_index) const = 0;
+
+  //  Copy the next frame into output_buffers[frame_index]. The frame has to be drawn without target
+  void RequestReadback() { readback_requested = true; }
+
 protected:
   uint32_t WIDTH, HEIGHT;
 
+  bool readback_requested = false;
+
   std::shared_ptr<WGPUDevice> device;
   std::shared_ptr<WGPUQueue> queue;
+  std::shared_ptr<PipelineCache> pipeline_cache;
+  std::shared_ptr<MeshArena> mesh_arena;
+  std::shared_ptr<InstanceSet> instances;
+  GpuEvents* gpu_events = nullptr;
 };
 
 class RasterizationRenderAPI : virtual public RenderAPI
@@ -35,29 +128,144 @@ class RasterizationRenderAPI : virtual public RenderAPI
 public:
   RasterizationRenderAPI(const uint32_t RENDER_WIDTH, const uint32_t RENDER_HEIGHT) : RenderAPI(RENDER_WIDTH, RENDER_HEIGHT) {}
   
-  void Draw() const override;
-  void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, const int indices_count, WGPUBuffer output_buffer, WGPUBuffer vertex_buffer, WGPUBuffer index_buffer, WGPUBuffer uniform_buffer) override;
-  // void SetScene(const std::vector<SimpleMesh>& meshes);
+  RGResource Draw(const FrameContext& frame) override;
+  void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache, std::shared_ptr<MeshArena> mesh_arena, const std::vector<WGPUBuffer>& output_buffers, const std::vector<WGPUBuffer>& uniform_buffers) override;
   void Terminate() override;
+
+  void WatchShaders(ShaderHotReload& reload) override;
+
+  //  Mesh bounds for GPU culling, meshlets for meshlet rendering
+  void SetScene(const std::vector<Mesh>& meshes) override;
+
+  RenderAPIStats GetStats() const override;
+
+  WGPUTextureView GetFrameTextureView(uint32_t frame_index) const override { return frame_texture_views[frame_index]; }
 public:
+  //  Frustum cull instances in a compute pass and draw the survivors with indirect draws. Set before Init
+  bool gpu_culling = false;
+
+  //  Two-phase Hi-Z occlusion culling on top of frustum culling, implies gpu_culling. Set before Init
+  bool occlusion_culling = false;
+
+  //  Draw meshlets that survive frustum and backface cone culling in a compute pass, with one indirect draw pulling
+  //  their vertices. Replaces gpu_culling and occlusion_culling. Set before Init
+  bool meshlets = false;
+
+  //  Draw every culled instance at the coarsest of its mesh's levels of detail whose error projects to at most
+  //  lod_pixel_error pixels, implies gpu_culling. lod_fade dithers between levels near a switch. Set before Init
+  bool lod = false;
+  float lod_pixel_error = 1.0f;
+  bool lod_fade = false;
 
 private:
-  WGPURenderPipeline pipeline;
-  
-  WGPUTexture frame_texture;
-  WGPUTextureView frame_texture_view;
-  WGPUTextureView depth_texture_view;
-  WGPUTexture multisample_texture;
-  WGPUTextureView multisample_texture_view;
+  //  Record copy of a frame texture into an output buffer
+  void copyFrameToOutputBuffer(WGPUCommandEncoder command_encoder, WGPUTexture frame_texture, WGPUBuffer output_buffer) const;
+
+  WGPUBindGroupLayout getBindGroupLayout() const;
+
+  //  Visible list of the drawn mesh, bound with a dynamic offset per draw
+  WGPUBindGroupLayout getVisibleBindGroupLayout() const;
+
+  //  Meshlets, their vertices and triangles, the arena vertices and the visible clusters, for vs_meshlet
+  WGPUBindGroupLayout getMeshletBindGroupLayout() const;
+
+  //  (Re)create the bind groups around the current instance buffer
+  void createBindGroups();
+
+  void createVisibleBindGroups();
+
+  void createMeshletBindGroup();
+
+  //  Pipelines of one shader module and sample count
+  struct ScenePipelines
+  {
+    WGPURenderPipeline color = nullptr;   //  Shades and writes depth, the scene pass without pre-pass
+    WGPURenderPipeline depth = nullptr;   //  Position-only depth pre-pass, nullptr with meshlets
+    WGPURenderPipeline equal = nullptr;   //  Shades what the pre-pass left visible: depth test Equal, no depth writes
+  };
+
+  //  Timestamp writes and fragment queries of the render passes of one scene pass, see GpuTimer
+  struct ScenePassQueries
+  {
+    const WGPUPassTimestampWrites* timestamps = nullptr;
+    const WGPUPassTimestampWrites* prepass_timestamps = nullptr;
+    StatisticsQuery fragments;
+    StatisticsQuery prepass_fragments;
+  };
+
+  //  Record the scene into target and depth, cleared first unless load. Resolves into resolve unless RG_INVALID.
+  //  draws are the culled draws with the visible lists in visible, nullptr draws every instance of the set. With
+  //  meshlets draws is the single cluster draw and visible the meshlet bind group. With prepass a depth-only render
+  //  pass comes first and the colour pass only shades the fragments it left visible
+  void recordScenePass(WGPUCommandEncoder command_encoder, const RenderGraph& graph, RGResource target, RGResource depth,
+    RGResource resolve, bool load, uint32_t frame_index, WGPUBuffer draws, WGPUBindGroup visible, bool prepass,
+    const ScenePassQueries& queries) const;
+
+  //  Depth-only render pass of the scene from the arena's position stream
+  void recordDepthPass(WGPUCommandEncoder command_encoder, const RenderGraph& graph, RGResource depth, bool load,
+    uint32_t frame_index, WGPUBuffer draws, WGPUBindGroup visible, const ScenePassQueries& queries) const;
+
+  //  Indexed draws of every mesh from vertex_buffer, the pipeline and bind group 0 already set
+  void recordDraws(WGPURenderPassEncoder render_pass_encoder, WGPUBuffer vertex_buffer, WGPUBuffer draws, WGPUBindGroup visible) const;
+
+  //  Queries of the early or late scene pass, declared with the pass
+  ScenePassQueries getScenePassQueries(uint32_t frame_index, bool late, bool prepass) const;
+
+  //  Build the pipelines around module for that many samples through the pipeline cache
+  ScenePipelines createPipelines(WGPUShaderModule module, uint32_t samples) const;
+
+  //  Drop pipelines that failed validation from the pipeline cache
+  void removePipelines(const ScenePipelines& failed) const;
+
+  //  Switch to the requested anti-aliasing. Only the pipeline is rebuilt (or found in the pipeline cache), the targets
+  //  are render graph transients that follow the sample count. Sample counts the adapter can not render at are
+  //  reported once and keep the current one
+  void applyAntiAliasing(const AntiAliasing& requested);
+
+  //  Replaced between frames by shader hot reload swaps and sample count changes, both on the render thread
+  ScenePipelines pipelines;
+  WGPUShaderModule shader_module = nullptr;
+
+  //  Applied anti-aliasing, pipelines are built for its sample count. Read by shader rebuilds on the reload thread
+  std::atomic<uint32_t> sample_count = 4;
+  AntiAliasing applied_aa;
+  AntiAliasing rejected_aa = { 0, false };
+
+  //  GPU time of the scene passes, their depth pre-passes and the FXAA pass, per GpuScope. Render passes of the scene
+  //  count their fragment shader invocations as well
+  enum GpuScope : uint32_t
+  {
+    SCOPE_SCENE,
+    SCOPE_SCENE_LATE,
+    SCOPE_PREPASS,
+    SCOPE_PREPASS_LATE,
+    SCOPE_FXAA,
+    SCOPE_COUNT,
+  };
+  std::unique_ptr<GpuTimer> timer;
+  std::unique_ptr<Fxaa> fxaa;
   
-  WGPUBindGroup bind_group;
+  //  Per frames-in-flight slot, rebuilt when the instance buffer grows
+  std::vector<WGPUTexture> frame_textures;
+  std::vector<WGPUTextureView> frame_texture_views;
+  std::vector<WGPUBindGroup> bind_groups;
+  WGPUBuffer bound_instance_buffer = nullptr;
+  std::vector<WGPUBuffer> output_buffers;
+  std::vector<WGPUBuffer> uniform_buffers;
+
+  //  Only with GPU culling, rebuilt when the culling pass replaces its visible buffer
+  std::unique_ptr<GpuCulling> culling;
+  WGPUBindGroup visible_bind_group = nullptr;
+  WGPUBindGroup late_visible_bind_group = nullptr;
+  uint64_t bound_visible_version = 0;
 
-  WGPUBuffer output_buffer;
-  WGPUBuffer vertex_buffer;
-  WGPUBuffer index_buffer;
-  WGPUBuffer uniform_buffer;
+  //  Only with meshlets, rebuilt when cluster culling replaces one of its buffers
+  std::unique_ptr<MeshletCulling> meshlet_culling;
+  WGPUBindGroup meshlet_bind_group = nullptr;
+  uint64_t bound_meshlet_version = 0;
 
-  int indices_count;
+  //  Multisample color, single sample color for FXAA and depth targets are render graph transients
+  WGPUTextureFormat depth_format;
 };
 
 };
\ No newline at end of file
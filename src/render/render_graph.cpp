@@ -0,0 +1,458 @@
+#include "render_graph.h"
+
+#include <cassert>
+#include <algorithm>
+
+namespace WGPU
+{
+//  Pooled objects not used for that many frames are released
+constexpr uint32_t MAX_UNUSED_FRAMES = 8;
+
+RGResource RenderGraph::PassBuilder::CreateTexture(const std::string& name, const RGTextureDesc& desc)
+{
+  Resource resource;
+  resource.name = name;
+  resource.is_texture = true;
+  resource.texture_desc = desc;
+
+  graph.resources.push_back(resource);
+
+  return Write((RGResource)(graph.resources.size() - 1));
+}
+
+RGResource RenderGraph::PassBuilder::CreateBuffer(const std::string& name, const RGBufferDesc& desc)
+{
+  Resource resource;
+  resource.name = name;
+  resource.is_texture = false;
+  resource.buffer_desc = desc;
+
+  graph.resources.push_back(resource);
+
+  return Write((RGResource)(graph.resources.size() - 1));
+}
+
+RGResource RenderGraph::PassBuilder::Read(RGResource resource)
+{
+  assert(resource < graph.resources.size());
+
+  graph.passes[pass].reads.push_back(resource);
+  return resource;
+}
+
+RGResource RenderGraph::PassBuilder::Write(RGResource resource)
+{
+  assert(resource < graph.resources.size());
+
+  graph.passes[pass].writes.push_back(resource);
+  return resource;
+}
+
+void RenderGraph::PassBuilder::SideEffect()
+{
+  graph.passes[pass].side_effect = true;
+}
+
+void RenderGraph::PassBuilder::SetExecute(ExecuteFn execute)
+{
+  graph.passes[pass].execute = std::move(execute);
+}
+
+void RenderGraph::Init(std::shared_ptr<WGPUDevice> device)
+{
+  this->device = device;
+}
+
+void RenderGraph::Terminate()
+{
+  Reset();
+
+  for (Physical& physical : pool)
+  {
+    releasePhysical(physical);
+  }
+  pool.clear();
+}
+
+void RenderGraph::Reset()
+{
+  resources.clear();
+  passes.clear();
+  order.clear();
+  executing = -1;
+}
+
+RGResource RenderGraph::ImportTexture(const std::string& name, WGPUTexture texture, WGPUTextureView view)
+{
+  Resource resource;
+  resource.name = name;
+  resource.is_texture = true;
+  resource.imported = true;
+  resource.texture = texture;
+  resource.view = view;
+
+  resources.push_back(resource);
+  return (RGResource)(resources.size() - 1);
+}
+
+RGResource RenderGraph::ImportBuffer(const std::string& name, WGPUBuffer buffer)
+{
+  Resource resource;
+  resource.name = name;
+  resource.is_texture = false;
+  resource.imported = true;
+  resource.buffer = buffer;
+
+  resources.push_back(resource);
+  return (RGResource)(resources.size() - 1);
+}
+
+void RenderGraph::MarkOutput(RGResource resource)
+{
+  resources[resource].output = true;
+}
+
+RenderGraph::PassBuilder RenderGraph::AddPass(const std::string& name)
+{
+  Pass pass;
+  pass.name = name;
+  passes.push_back(pass);
+
+  return PassBuilder(*this, (uint32_t)(passes.size() - 1));
+}
+
+void RenderGraph::Compile()
+{
+  cullPasses();
+  sortPasses();
+  computeLifetimes();
+  allocateTransients();
+}
+
+void RenderGraph::cullPasses()
+{
+  //  Resources are versioned by declaration order: a pass can only consume what earlier passes produced,
+  //  so one backward sweep finds everything the outputs depend on
+  std::vector<bool> needed(resources.size(), false);
+
+  for (uint32_t i = 0; i < resources.size(); i++)
+  {
+    needed[i] = resources[i].output;
+  }
+
+  stats.passes = (uint32_t)passes.size();
+  stats.culled_passes = 0;
+
+  for (int32_t i = (int32_t)passes.size() - 1; i >= 0; i--)
+  {
+    Pass& pass = passes[i];
+
+    pass.alive = pass.side_effect;
+    for (RGResource resource : pass.writes)
+    {
+      pass.alive = pass.alive || needed[resource];
+    }
+
+    if (!pass.alive)
+    {
+      stats.culled_passes++;
+      continue;
+    }
+
+    for (RGResource resource : pass.reads)
+    {
+      needed[resource] = true;
+    }
+  }
+}
+
+void RenderGraph::sortPasses()
+{
+  //  Edges: last earlier writer -> reader (RAW), earlier readers and writers -> writer (WAR, WAW)
+  const uint32_t count = (uint32_t)passes.size();
+
+  std::vector<std::vector<uint32_t>> edges(count);
+  std::vector<uint32_t> in_degree(count, 0);
+  std::vector<int32_t> last_writer(resources.size(), -1);
+  std::vector<std::vector<uint32_t>> readers(resources.size());
+
+  auto addEdge = [&](int32_t from, uint32_t to)
+  {
+    if (from < 0 || (uint32_t)from == to) return;
+    if (std::find(edges[from].begin(), edges[from].end(), to) != edges[from].end()) return;
+
+    edges[from].push_back(to);
+    in_degree[to]++;
+  };
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (!passes[i].alive) continue;
+
+    for (RGResource resource : passes[i].reads)
+    {
+      addEdge(last_writer[resource], i);
+    }
+
+    for (RGResource resource : passes[i].writes)
+    {
+      addEdge(last_writer[resource], i);
+      for (uint32_t reader : readers[resource])
+      {
+        addEdge((int32_t)reader, i);
+      }
+    }
+
+    for (RGResource resource : passes[i].reads)
+    {
+      readers[resource].push_back(i);
+    }
+
+    for (RGResource resource : passes[i].writes)
+    {
+      last_writer[resource] = (int32_t)i;
+      readers[resource].clear();
+    }
+  }
+
+  //  Kahn's algorithm, ties are broken by declaration order to keep the result stable
+  order.clear();
+  std::vector<uint32_t> ready;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (passes[i].alive && in_degree[i] == 0) ready.push_back(i);
+  }
+
+  while (!ready.empty())
+  {
+    auto next = std::min_element(ready.begin(), ready.end());
+    uint32_t pass = *next;
+    ready.erase(next);
+
+    order.push_back(pass);
+
+    for (uint32_t dependent : edges[pass])
+    {
+      if (--in_degree[dependent] == 0) ready.push_back(dependent);
+    }
+  }
+}
+
+void RenderGraph::computeLifetimes()
+{
+  for (uint32_t i = 0; i < order.size(); i++)
+  {
+    const Pass& pass = passes[order[i]];
+
+    auto touch = [&](RGResource resource)
+    {
+      Resource& res = resources[resource];
+      if (res.first_use < 0) res.first_use = (int32_t)i;
+      res.last_use = (int32_t)i;
+    };
+
+    std::for_each(pass.reads.begin(), pass.reads.end(), touch);
+    std::for_each(pass.writes.begin(), pass.writes.end(), touch);
+  }
+}
+
+void RenderGraph::allocateTransients()
+{
+  for (Physical& physical : pool)
+  {
+    physical.busy_until = -1;
+  }
+
+  //  Allocate in order of first use, so a transient can take over an object whose previous user is already done
+  std::vector<uint32_t> transients;
+  for (uint32_t i = 0; i < resources.size(); i++)
+  {
+    if (!resources[i].imported && resources[i].first_use >= 0) transients.push_back(i);
+  }
+
+  std::sort(transients.begin(), transients.end(), [&](uint32_t a, uint32_t b) { return resources[a].first_use < resources[b].first_use; });
+
+  stats.transient_resources = (uint32_t)transients.size();
+  stats.transient_bytes = 0;
+
+  for (uint32_t index : transients)
+  {
+    Resource& res = resources[index];
+
+    stats.transient_bytes += res.is_texture ? textureBytes(res.texture_desc) : res.buffer_desc.size;
+
+    int32_t found = -1;
+    for (uint32_t i = 0; i < pool.size() && found < 0; i++)
+    {
+      const Physical& physical = pool[i];
+
+      if (physical.is_texture != res.is_texture || physical.busy_until >= res.first_use) continue;
+
+      bool compatible = res.is_texture
+        ? physical.texture_desc == res.texture_desc
+        : physical.buffer_desc.usage == res.buffer_desc.usage && physical.buffer_desc.size >= res.buffer_desc.size;
+
+      if (compatible) found = (int32_t)i;
+    }
+
+    if (found < 0)
+    {
+      Physical physical;
+      physical.is_texture = res.is_texture;
+
+      if (res.is_texture)
+      {
+        physical.texture_desc = res.texture_desc;
+
+        WGPUTextureDescriptor textureDesc {};
+        textureDesc.label = {res.name.c_str(), WGPU_STRLEN};
+        textureDesc.dimension = WGPUTextureDimension_2D;
+        textureDesc.format = res.texture_desc.format;
+        textureDesc.size = {res.texture_desc.width, res.texture_desc.height, 1};
+        textureDesc.sampleCount = res.texture_desc.sample_count;
+        textureDesc.mipLevelCount = res.texture_desc.mip_level_count;
+        textureDesc.usage = res.texture_desc.usage;
+        textureDesc.viewFormatCount = 0;
+        textureDesc.viewFormats = nullptr;
+
+        physical.texture = wgpuDeviceCreateTexture(*device, &textureDesc);
+        physical.view = wgpuTextureCreateView(physical.texture, nullptr);
+      }
+      else
+      {
+        physical.buffer_desc = res.buffer_desc;
+
+        WGPUBufferDescriptor bufferDesc {};
+        bufferDesc.label = {res.name.c_str(), WGPU_STRLEN};
+        bufferDesc.size = res.buffer_desc.size;
+        bufferDesc.usage = res.buffer_desc.usage;
+        bufferDesc.mappedAtCreation = false;
+
+        physical.buffer = wgpuDeviceCreateBuffer(*device, &bufferDesc);
+      }
+
+      pool.push_back(physical);
+      found = (int32_t)(pool.size() - 1);
+    }
+
+    Physical& physical = pool[found];
+    physical.busy_until = res.last_use;
+
+    res.physical = found;
+    res.texture = physical.texture;
+    res.view = physical.view;
+    res.buffer = physical.buffer;
+  }
+
+  //  Trim objects the graph has stopped asking for
+  stats.physical_resources = 0;
+  stats.physical_bytes = 0;
+
+  for (Physical& physical : pool)
+  {
+    physical.unused_frames = physical.busy_until >= 0 ? 0 : physical.unused_frames + 1;
+  }
+
+  for (uint32_t i = 0; i < pool.size();)
+  {
+    if (pool[i].unused_frames > MAX_UNUSED_FRAMES)
+    {
+      releasePhysical(pool[i]);
+      pool.erase(pool.begin() + i);
+
+      for (Resource& res : resources)
+      {
+        if (res.physical > (int32_t)i) res.physical--;
+      }
+      continue;
+    }
+
+    if (pool[i].busy_until >= 0)
+    {
+      stats.physical_resources++;
+      stats.physical_bytes += pool[i].is_texture ? textureBytes(pool[i].texture_desc) : pool[i].buffer_desc.size;
+    }
+    i++;
+  }
+}
+
+void RenderGraph::Execute(WGPUCommandEncoder encoder)
+{
+  for (uint32_t i = 0; i < order.size(); i++)
+  {
+    ExecutePass(i, encoder);
+  }
+}
+
+void RenderGraph::ExecutePass(uint32_t index, WGPUCommandEncoder encoder)
+{
+  const Pass& pass = passes[order[index]];
+
+  executing = (int32_t)index;
+  if (pass.execute)
+  {
+    pass.execute(encoder, *this);
+  }
+  executing = -1;
+}
+
+WGPUTexture RenderGraph::GetTexture(RGResource resource) const
+{
+  return resources[resource].texture;
+}
+
+WGPUTextureView RenderGraph::GetTextureView(RGResource resource) const
+{
+  return resources[resource].view;
+}
+
+WGPUBuffer RenderGraph::GetBuffer(RGResource resource) const
+{
+  return resources[resource].buffer;
+}
+
+WGPUStoreOp RenderGraph::StoreOp(RGResource resource) const
+{
+  const Resource& res = resources[resource];
+
+  if (res.imported || res.output || res.last_use > executing)
+  {
+    return WGPUStoreOp_Store;
+  }
+
+  return WGPUStoreOp_Discard;
+}
+
+void RenderGraph::releasePhysical(Physical& physical)
+{
+  if (physical.texture)
+  {
+    wgpuTextureViewRelease(physical.view);
+    wgpuTextureRelease(physical.texture);
+  }
+
+  if (physical.buffer)
+  {
+    wgpuBufferRelease(physical.buffer);
+  }
+}
+
+uint64_t RenderGraph::textureBytes(const RGTextureDesc& desc)
+{
+  uint64_t texel_size = 4;
+
+  switch (desc.format)
+  {
+    case WGPUTextureFormat_R8Unorm: texel_size = 1; break;
+    case WGPUTextureFormat_RG8Unorm: texel_size = 2; break;
+    case WGPUTextureFormat_RGBA16Float: texel_size = 8; break;
+    case WGPUTextureFormat_RGBA32Float: texel_size = 16; break;
+    default: break;
+  }
+
+  //  Rough estimate, mip chains add at most a third
+  uint64_t bytes = texel_size * desc.width * desc.height * desc.sample_count;
+  return desc.mip_level_count > 1 ? bytes + bytes / 3 : bytes;
+}
+};
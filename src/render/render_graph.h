@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+namespace WGPU
+{
+//  Handle of a texture or buffer declared in a RenderGraph, valid for one frame
+using RGResource = uint32_t;
+constexpr RGResource RG_INVALID = UINT32_MAX;
+
+struct RGTextureDesc
+{
+  WGPUTextureFormat format = WGPUTextureFormat_RGBA8Unorm;
+  uint32_t width = 1;
+  uint32_t height = 1;
+  uint32_t sample_count = 1;
+  uint32_t mip_level_count = 1;
+  WGPUTextureUsage usage = WGPUTextureUsage_RenderAttachment;
+
+  bool operator==(const RGTextureDesc& other) const = default;
+};
+
+struct RGBufferDesc
+{
+  uint64_t size = 0;
+  WGPUBufferUsage usage = WGPUBufferUsage_Storage;
+
+  bool operator==(const RGBufferDesc& other) const = default;
+};
+
+struct RenderGraphStats
+{
+  uint32_t passes = 0;              //  Passes declared in the last frame
+  uint32_t culled_passes = 0;       //  Passes not contributing to any output
+  uint32_t transient_resources = 0; //  Transient textures and buffers declared
+  uint32_t physical_resources = 0;  //  GPU objects they were aliased onto
+  uint64_t transient_bytes = 0;     //  Memory the transients would take without aliasing
+  uint64_t physical_bytes = 0;      //  Memory actually allocated for them
+};
+
+//  Frame graph: passes declare the resources they read and write, the graph culls passes whose results are never used,
+//  orders the rest and backs transient resources with pooled GPU objects, reusing one object for transients whose
+//  lifetimes do not overlap. WebGPU has no memory aliasing, so aliasing happens at the texture/buffer object level
+//
+//  The current frames declare no transients with disjoint lifetimes: the colour target (multisampled, or the FXAA
+//  input) and the depth texture are both created by the rasterization pass, so they are live at the same time. Hence
+//  physical_bytes equals transient_bytes and aliasing saves nothing yet, the pool only spares re-creating the objects
+//  every frame. Transients of later passes alias as soon as their lifetimes stop overlapping
+class RenderGraph
+{
+public:
+  using ExecuteFn = std::function<void(WGPUCommandEncoder encoder, const RenderGraph& graph)>;
+
+  //  Declares resources and accesses of one pass
+  class PassBuilder
+  {
+  public:
+    PassBuilder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+    //  Transient resources only live inside the frame. Creating a resource counts as writing it
+    RGResource CreateTexture(const std::string& name, const RGTextureDesc& desc);
+    RGResource CreateBuffer(const std::string& name, const RGBufferDesc& desc);
+
+    RGResource Read(RGResource resource);
+    RGResource Write(RGResource resource);
+
+    //  Pass is never culled (e.g. readbacks, queries)
+    void SideEffect();
+
+    void SetExecute(ExecuteFn execute);
+
+  private:
+    RenderGraph& graph;
+    uint32_t pass;
+  };
+
+  void Init(std::shared_ptr<WGPUDevice> device);
+  void Terminate();
+
+  //  Drop the previous frame's description, pooled GPU objects are kept
+  void Reset();
+
+  //  Resources owned outside of the graph. texture may be nullptr if only the view is known (e.g. swapchain view)
+  RGResource ImportTexture(const std::string& name, WGPUTexture texture, WGPUTextureView view);
+  RGResource ImportBuffer(const std::string& name, WGPUBuffer buffer);
+
+  //  Passes contributing to an output are kept alive
+  void MarkOutput(RGResource resource);
+
+  PassBuilder AddPass(const std::string& name);
+
+  //  Cull, order and allocate transient resources
+  void Compile();
+
+  //  Record all passes into one encoder
+  void Execute(WGPUCommandEncoder encoder);
+
+  //  Record a single compiled pass, index in [0, ExecutedPassCount())
+  void ExecutePass(uint32_t index, WGPUCommandEncoder encoder);
+  uint32_t ExecutedPassCount() const { return (uint32_t)order.size(); }
+
+  WGPUTexture GetTexture(RGResource resource) const;
+  WGPUTextureView GetTextureView(RGResource resource) const;
+  WGPUBuffer GetBuffer(RGResource resource) const;
+
+  //  Discard if nothing reads the resource after the pass being executed, so attachments are not written back for nothing
+  WGPUStoreOp StoreOp(RGResource resource) const;
+
+  const RenderGraphStats& GetStats() const { return stats; }
+
+private:
+  struct Resource
+  {
+    std::string name;
+    bool is_texture = true;
+    bool imported = false;
+    bool output = false;
+
+    RGTextureDesc texture_desc;
+    RGBufferDesc buffer_desc;
+
+    //  Execution order range of passes using the resource, filled by Compile
+    int32_t first_use = -1;
+    int32_t last_use = -1;
+
+    int32_t physical = -1;
+
+    WGPUTexture texture = nullptr;
+    WGPUTextureView view = nullptr;
+    WGPUBuffer buffer = nullptr;
+  };
+
+  struct Pass
+  {
+    std::string name;
+    std::vector<RGResource> reads;
+    std::vector<RGResource> writes;
+    bool side_effect = false;
+    bool alive = false;
+    ExecuteFn execute;
+  };
+
+  //  GPU object backing transient resources, kept across frames
+  struct Physical
+  {
+    bool is_texture = true;
+    RGTextureDesc texture_desc;
+    RGBufferDesc buffer_desc;
+
+    WGPUTexture texture = nullptr;
+    WGPUTextureView view = nullptr;
+    WGPUBuffer buffer = nullptr;
+
+    int32_t busy_until = -1;    //  Last execution index using it in the current frame
+    uint32_t unused_frames = 0;
+  };
+
+  void cullPasses();
+  void sortPasses();
+  void computeLifetimes();
+  void allocateTransients();
+  void releasePhysical(Physical& physical);
+
+  static uint64_t textureBytes(const RGTextureDesc& desc);
+
+  std::shared_ptr<WGPUDevice> device;
+
+  std::vector<Resource> resources;
+  std::vector<Pass> passes;
+  std::vector<uint32_t> order;
+  std::vector<Physical> pool;
+
+  int32_t executing = -1;
+
+  RenderGraphStats stats;
+};
+};
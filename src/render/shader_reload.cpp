@@ -0,0 +1,122 @@
+#include "shader_reload.h"
+#include "utils.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+namespace WGPU
+{
+void ShaderHotReload::Watch(const std::string& path, ShaderRebuild rebuild)
+{
+  watcher.Watch(path);
+  shaders.push_back({ path, std::move(rebuild) });
+}
+
+void ShaderHotReload::Start()
+{
+  if (shaders.empty() || running)
+  {
+    return;
+  }
+
+  running = true;
+  thread = std::thread([this]() { threadLoop(); });
+}
+
+void ShaderHotReload::Stop()
+{
+  running = false;
+
+  if (thread.joinable())
+  {
+    thread.join();
+  }
+}
+
+void ShaderHotReload::threadLoop()
+{
+  while (running)
+  {
+    //  Short timeout, so Stop never waits long
+    std::vector<std::string> changed = watcher.Wait(100);
+
+    if (changed.empty())
+    {
+      continue;
+    }
+
+    double change_time = utils::get_time();
+
+    //  Editors often write in several steps, let them finish and merge what changed meanwhile
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (const std::string& path : watcher.Wait(0))
+    {
+      if (std::find(changed.begin(), changed.end(), path) == changed.end())
+      {
+        changed.push_back(path);
+      }
+    }
+
+    for (const Shader& shader : shaders)
+    {
+      if (std::find(changed.begin(), changed.end(), shader.path) == changed.end())
+      {
+        continue;
+      }
+
+      std::ifstream file(shader.path, std::ios::binary);
+      std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+      double start = utils::get_time();
+      double build_ms = 0.0;
+      ShaderSwap swap = source.empty() ? nullptr : shader.rebuild(source, build_ms);
+      double total_ms = 1000.0 * (utils::get_time() - start);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      stats.compile_ms = total_ms - build_ms;
+      stats.build_ms = build_ms;
+
+      if (!swap)
+      {
+        stats.failures++;
+        std::cerr << "Reload of " << shader.path << " failed, keeping the previous pipeline" << std::endl;
+        continue;
+      }
+
+      pending.push_back({ std::move(swap), shader.path, change_time });
+      has_pending = true;
+    }
+  }
+}
+
+void ShaderHotReload::ApplyPending()
+{
+  //  Common case costs one atomic load
+  if (!has_pending.load(std::memory_order_acquire))
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (Pending& entry : pending)
+  {
+    entry.swap();
+
+    stats.reloads++;
+    stats.latency_ms = 1000.0 * (utils::get_time() - entry.change_time);
+  }
+
+  pending.clear();
+  has_pending = false;
+}
+
+ShaderReloadStats ShaderHotReload::GetStats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return stats;
+}
+};
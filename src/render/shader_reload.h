@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+
+#include "file_watcher.h"
+
+namespace WGPU
+{
+struct ShaderReloadStats
+{
+  uint64_t reloads = 0;       //  Rebuilds swapped in
+  uint64_t failures = 0;      //  Rebuilds that failed, the previous pipelines were kept
+  double compile_ms = 0.0;    //  CPU side of the last rebuild (reading, transpiling), on the reload thread
+  double build_ms = 0.0;      //  Device side of the last rebuild (module and pipelines), on the reload thread
+  double latency_ms = 0.0;    //  Last file change to swap at a frame boundary
+};
+
+//  Exchanges the finished handles of a rebuild, runs on the render thread between frames and must not build anything
+using ShaderSwap = std::function<void()>;
+
+//  Rebuild of a watched shader, runs on the reload thread. Compiles the source, creates and validates the module and
+//  pipelines, adding the time spent on the device objects to build_ms, and returns the swap. nullptr if it failed.
+//  Error scopes are per thread, so validating here does not see errors of frames being recorded on the render thread
+using ShaderRebuild = std::function<ShaderSwap(const std::string& source, double& build_ms)>;
+
+//  Watches shader files and rebuilds them on a background thread. Finished rebuilds wait until the render loop calls
+//  ApplyPending between two frames, which swaps them in, so frames never see a half swapped state and the render loop
+//  never waits on a compile
+class ShaderHotReload
+{
+public:
+  ~ShaderHotReload() { Stop(); }
+
+  //  Register before Start
+  void Watch(const std::string& path, ShaderRebuild rebuild);
+
+  void Start();
+  void Stop();
+
+  //  Swap in finished rebuilds, call at a frame boundary on the render thread
+  void ApplyPending();
+
+  ShaderReloadStats GetStats() const;
+
+private:
+  void threadLoop();
+
+  struct Shader
+  {
+    std::string path;
+    ShaderRebuild rebuild;
+  };
+
+  struct Pending
+  {
+    ShaderSwap swap;
+    std::string path;
+    double change_time;
+  };
+
+  utils::FileWatcher watcher;
+  std::vector<Shader> shaders;
+
+  std::thread thread;
+  std::atomic<bool> running = false;
+
+  mutable std::mutex mutex;
+  std::vector<Pending> pending;
+  std::atomic<bool> has_pending = false;
+  ShaderReloadStats stats;
+};
+};
@@ -0,0 +1,63 @@
+#include "slang_compiler.h"
+
+#include <mutex>
+
+#include <slang.h>
+#include <slang-com-ptr.h>
+
+namespace WGPU
+{
+bool compile_slang_to_wgsl(const std::string& path, const std::string& source, const char* entry_point, std::string& wgsl, std::string& diagnostics)
+{
+  //  Creating the global session loads the core module and takes a while, it is kept for the whole run.
+  //  Slang sessions are not thread safe, the shader reload thread compiles while the main thread may too
+  static std::mutex mutex;
+  static Slang::ComPtr<slang::IGlobalSession> global_session;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (!global_session && SLANG_FAILED(slang::createGlobalSession(global_session.writeRef())))
+  {
+    diagnostics = "Could not create the Slang global session";
+    return false;
+  }
+
+  slang::TargetDesc target {};
+  target.format = SLANG_WGSL;
+
+  slang::SessionDesc session_desc {};
+  session_desc.targets = &target;
+  session_desc.targetCount = 1;
+
+  Slang::ComPtr<slang::ISession> session;
+  global_session->createSession(session_desc, session.writeRef());
+
+  Slang::ComPtr<slang::ICompileRequest> request;
+  session->createCompileRequest(request.writeRef());
+
+  int translation_unit = request->addTranslationUnit(SLANG_SOURCE_LANGUAGE_SLANG, nullptr);
+  request->addTranslationUnitSourceString(translation_unit, path.c_str(), source.c_str());
+  int entry_point_index = request->addEntryPoint(translation_unit, entry_point, SLANG_STAGE_COMPUTE);
+
+  SlangResult result = request->compile();
+  const char* output = request->getDiagnosticOutput();
+  diagnostics = output ? output : "";
+
+  if (SLANG_FAILED(result))
+  {
+    return false;
+  }
+
+  size_t size = 0;
+  const char* code = static_cast<const char*>(request->getEntryPointCode(entry_point_index, &size));
+  wgsl.assign(code, size);
+
+  //  Sizes of some Slang versions count the terminating zero
+  while (!wgsl.empty() && wgsl.back() == '\0')
+  {
+    wgsl.pop_back();
+  }
+
+  return true;
+}
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+namespace WGPU
+{
+//  Compile the entry point of a Slang source to WGSL. path only names the source in diagnostics.
+//  Return false and the compiler diagnostics on failure. Thread safe, all calls share one Slang global session
+bool compile_slang_to_wgsl(const std::string& path, const std::string& source, const char* entry_point, std::string& wgsl, std::string& diagnostics);
+};
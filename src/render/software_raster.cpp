@@ -0,0 +1,728 @@
+#include "software_raster.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+//  Edge functions and depth tests are evaluated for four pixels of a row at once
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFTWARE_RASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace WGPU
+{
+  //  Tiles are the unit of parallel work, blocks the unit of the depth rejection
+  static const uint32_t TILE_SIZE = 64;
+  static const uint32_t BLOCK_SIZE = 8;
+  static const uint32_t TILE_BLOCKS = TILE_SIZE / BLOCK_SIZE;
+  static_assert(TILE_SIZE % BLOCK_SIZE == 0 && BLOCK_SIZE % 4 == 0, "Rows of a block are read four pixels at a time");
+
+  //  Chunks of triangle setup per worker thread, so threads finishing early find more
+  static const uint32_t CHUNKS_PER_THREAD = 4;
+  static const size_t VERTEX_GRAIN = 4096;
+
+  //  fs_main of rasterization.wgsl
+  static const float LIGHT_COLOR_1[3] = {1.0f, 0.9f, 0.6f};
+  static const float LIGHT_COLOR_2[3] = {0.6f, 0.9f, 1.0f};
+  static const float LIGHT_DIRECTION_1[3] = {0.5f, -0.9f, 0.1f};
+  static const float LIGHT_DIRECTION_2[3] = {0.2f, 0.4f, 0.3f};
+
+  namespace
+  {
+#ifdef SOFTWARE_RASTER_SSE2
+    struct Lanes
+    {
+      __m128 v;
+    };
+
+    inline Lanes lanes_set(float a) { return {_mm_set1_ps(a)}; }
+    inline Lanes lanes_ramp(float a) { return {_mm_setr_ps(a, a + 1.0f, a + 2.0f, a + 3.0f)}; }
+    inline Lanes lanes_load(const float* p) { return {_mm_loadu_ps(p)}; }
+    inline void lanes_store(float* p, Lanes a) { _mm_storeu_ps(p, a.v); }
+    inline Lanes operator+(Lanes a, Lanes b) { return {_mm_add_ps(a.v, b.v)}; }
+    inline Lanes operator*(Lanes a, Lanes b) { return {_mm_mul_ps(a.v, b.v)}; }
+
+    //  Bit i set where lane i passes
+    inline uint32_t mask_ge(Lanes a, Lanes b) { return (uint32_t)_mm_movemask_ps(_mm_cmpge_ps(a.v, b.v)); }
+    inline uint32_t mask_lt(Lanes a, Lanes b) { return (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+#else
+    struct Lanes
+    {
+      float v[4];
+    };
+
+    inline Lanes lanes_set(float a) { return {{a, a, a, a}}; }
+    inline Lanes lanes_ramp(float a) { return {{a, a + 1.0f, a + 2.0f, a + 3.0f}}; }
+    inline Lanes lanes_load(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+    inline void lanes_store(float* p, Lanes a) { std::copy(a.v, a.v + 4, p); }
+    inline Lanes operator+(Lanes a, Lanes b) { return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}}; }
+    inline Lanes operator*(Lanes a, Lanes b) { return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}}; }
+
+    inline uint32_t mask_ge(Lanes a, Lanes b)
+    {
+      uint32_t mask = 0;
+      for (uint32_t i = 0; i < 4; i++) mask |= (a.v[i] >= b.v[i] ? 1u : 0u) << i;
+      return mask;
+    }
+
+    inline uint32_t mask_lt(Lanes a, Lanes b)
+    {
+      uint32_t mask = 0;
+      for (uint32_t i = 0; i < 4; i++) mask |= (a.v[i] < b.v[i] ? 1u : 0u) << i;
+      return mask;
+    }
+#endif
+
+    //  Lanes of the group starting at x that lie in [first, last]
+    inline uint32_t lanes_between(int32_t x, int32_t first, int32_t last)
+    {
+      uint32_t mask = 0;
+      for (int32_t i = 0; i < 4; i++) mask |= (x + i >= first && x + i <= last ? 1u : 0u) << i;
+      return mask;
+    }
+
+    inline float clamp01(float x) { return std::min(std::max(x, 0.0f), 1.0f); }
+
+    inline uint32_t pack_color(const float rgba[4])
+    {
+      uint32_t packed = 0;
+      for (uint32_t i = 0; i < 4; i++)
+      {
+        packed |= (uint32_t)(clamp01(rgba[i]) * 255.0f + 0.5f) << (8 * i);
+      }
+      return packed;
+    }
+  };
+
+  SoftwareRasterRenderAPI::SoftwareRasterRenderAPI(const uint32_t RENDER_WIDTH, const uint32_t RENDER_HEIGHT) : RenderAPI(RENDER_WIDTH, RENDER_HEIGHT)
+  {
+    tiles_x = (WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+    depth_stride = (WIDTH + 3) & ~3u;
+
+    color.resize((size_t)WIDTH * HEIGHT);
+    depth.resize((size_t)depth_stride * HEIGHT);
+  }
+
+  RGResource SoftwareRasterRenderAPI::Draw(const FrameContext& frame)
+  {
+    assert(frame.uniforms && "The software rasterizer needs the frame's uniforms on the CPU");
+
+    const uint32_t frame_index = frame.frame_index;
+
+    Render(*frame.uniforms);
+
+    //  Queue writes land before the frame's commands, the slot's texture is no longer read once its frame began
+    WGPUTexelCopyTextureInfo dest {};
+    dest.texture = frame_textures[frame_index];
+    dest.origin = {0, 0, 0};
+    dest.aspect = WGPUTextureAspect_All;
+    dest.mipLevel = 0;
+
+    WGPUTexelCopyBufferLayout layout {};
+    layout.offset = 0;
+    layout.bytesPerRow = WIDTH * 4;
+    layout.rowsPerImage = HEIGHT;
+
+    WGPUExtent3D size = {WIDTH, HEIGHT, 1};
+    wgpuQueueWriteTexture(*queue, &dest, color.data(), color.size() * sizeof(uint32_t), &layout, &size);
+
+    if (readback_requested)
+    {
+      wgpuQueueWriteBuffer(*queue, output_buffers[frame_index], 0, color.data(), color.size() * sizeof(uint32_t));
+      readback_requested = false;
+    }
+
+    return frame.graph->ImportTexture("Software raster texture", frame_textures[frame_index], frame_texture_views[frame_index]);
+  }
+
+  void SoftwareRasterRenderAPI::Render(const Uniforms& uniforms)
+  {
+    double start = utils::get_time();
+
+    if (!pool)
+    {
+      pool = std::make_unique<utils::ThreadPool>(threads);
+    }
+
+    const uint32_t tile_count = tiles_x * tiles_y;
+    const uint32_t chunk_count = std::max(pool->Size(), 1u) * CHUNKS_PER_THREAD;
+
+    chunk_triangles.resize(chunk_count);
+    bins.resize((size_t)chunk_count * tile_count);
+
+    buildDrawItems();
+    transformVertices(uniforms);
+
+    pool->ParallelFor(chunk_count, 1, [this, chunk_count](size_t begin, size_t end)
+    {
+      for (size_t chunk = begin; chunk < end; chunk++)
+      {
+        binTriangles((uint32_t)chunk, chunk_count);
+      }
+    });
+
+    //  Tiles own disjoint pixels, so they write color and depth without synchronisation
+    float alpha = uniforms.color.w;
+    pool->ParallelFor(tile_count, 1, [this, chunk_count, alpha](size_t begin, size_t end)
+    {
+      for (size_t tile = begin; tile < end; tile++)
+      {
+        rasterizeTile((uint32_t)tile, chunk_count, alpha);
+      }
+    });
+
+    uint64_t triangles = 0;
+    for (const std::vector<ScreenTriangle>& chunk : chunk_triangles)
+    {
+      triangles += chunk.size();
+    }
+
+    stats.triangles = triangles;
+    stats.raster_tiles = tile_count;
+    stats.raster_threads = pool->Size();
+    stats.cpu_ms = 0.95 * stats.cpu_ms + 0.05 * 1000.0 * (utils::get_time() - start);
+  }
+
+  void SoftwareRasterRenderAPI::buildDrawItems()
+  {
+    draw_items.clear();
+    vertex_total = 0;
+    triangle_total = 0;
+
+    auto add = [this](uint32_t mesh, uint32_t instance)
+    {
+      draw_items.push_back({ mesh, instance, vertex_total, triangle_total });
+      vertex_total += mesh_ranges[mesh].vertex_count;
+      triangle_total += mesh_ranges[mesh].index_count / 3;
+    };
+
+    if (!instances)
+    {
+      for (uint32_t mesh = 0; mesh < mesh_ranges.size(); mesh++)
+      {
+        add(mesh, INVALID_INSTANCE);
+      }
+      return;
+    }
+
+    //  Same order as the instanced draws of the GPU rasterizer
+    const std::vector<InstanceRange>& ranges = instances->GetRanges();
+
+    for (uint32_t mesh = 0; mesh < std::min(mesh_ranges.size(), ranges.size()); mesh++)
+    {
+      for (uint32_t i = 0; i < ranges[mesh].count; i++)
+      {
+        add(mesh, ranges[mesh].first + i);
+      }
+    }
+  }
+
+  void SoftwareRasterRenderAPI::transformVertices(const Uniforms& uniforms)
+  {
+    clip_vertices.resize(vertex_total);
+
+    const float4x4 view_projection = uniforms.projMtrx * uniforms.viewMtrx;
+
+    //  Fetched on the render thread, the workers only read it
+    const InstanceData* uploaded = instances ? instances->GetUploaded().data() : nullptr;
+
+    pool->ParallelFor(vertex_total, VERTEX_GRAIN, [this, &uniforms, &view_projection, uploaded](size_t begin, size_t end)
+    {
+      //  Last draw starting at or before begin
+      size_t item = std::upper_bound(draw_items.begin(), draw_items.end(), begin, [](size_t vertex, const DrawItem& draw) { return vertex < draw.first_vertex; }) - draw_items.begin() - 1;
+
+      for (size_t i = begin; i < end; item++)
+      {
+        const DrawItem& draw = draw_items[item];
+        const MeshRange& range = mesh_ranges[draw.mesh];
+
+        //  Same products as vs_main
+        float4x4 model = uniforms.modelMtrx;
+        float tint[3] = {1.0f, 1.0f, 1.0f};
+
+        if (draw.instance != INVALID_INSTANCE)
+        {
+          const InstanceData& instance = uploaded[draw.instance];
+          model = model * instance.transform;
+          tint[0] = instance.color.x;
+          tint[1] = instance.color.y;
+          tint[2] = instance.color.z;
+        }
+
+        const float4x4 mvp = view_projection * model;
+        const size_t draw_end = std::min(end, (size_t)draw.first_vertex + range.vertex_count);
+
+        for (; i < draw_end; i++)
+        {
+          const Vertex& vertex = vertices[range.first_vertex + (i - draw.first_vertex)];
+          ClipVertex& out = clip_vertices[i];
+
+          float4 position = mvp * float4(vertex.pos.x, vertex.pos.y, vertex.pos.z, 1.0f);
+          float4 normal = model * float4(vertex.normal.x, vertex.normal.y, vertex.normal.z, 0.0f);
+
+          out.position[0] = position.x;
+          out.position[1] = position.y;
+          out.position[2] = position.z;
+          out.position[3] = position.w;
+          out.normal[0] = normal.x;
+          out.normal[1] = normal.y;
+          out.normal[2] = normal.z;
+          out.color[0] = vertex.color.x * tint[0];
+          out.color[1] = vertex.color.y * tint[1];
+          out.color[2] = vertex.color.z * tint[2];
+        }
+      }
+    });
+  }
+
+  void SoftwareRasterRenderAPI::binTriangles(uint32_t chunk, uint32_t chunk_count)
+  {
+    const uint32_t tile_count = tiles_x * tiles_y;
+    const size_t begin = (size_t)triangle_total * chunk / chunk_count;
+    const size_t end = (size_t)triangle_total * (chunk + 1) / chunk_count;
+
+    chunk_triangles[chunk].clear();
+    for (uint32_t tile = 0; tile < tile_count; tile++)
+    {
+      bins[(size_t)chunk * tile_count + tile].clear();
+    }
+
+    if (begin == end)
+    {
+      return;
+    }
+
+    //  Outside bits of the WebGPU clip volume -w <= x, y <= w, 0 <= z <= w
+    auto outcode = [](const ClipVertex& v)
+    {
+      const float* p = v.position;
+      return (p[0] < -p[3] ? 1u : 0u) | (p[0] > p[3] ? 2u : 0u) | (p[1] < -p[3] ? 4u : 0u) | (p[1] > p[3] ? 8u : 0u) |
+        (p[2] < 0.0f ? 16u : 0u) | (p[2] > p[3] ? 32u : 0u);
+    };
+    const uint32_t NEAR_BIT = 16;
+
+    size_t item = std::upper_bound(draw_items.begin(), draw_items.end(), begin, [](size_t triangle, const DrawItem& draw) { return triangle < draw.first_triangle; }) - draw_items.begin() - 1;
+
+    for (size_t t = begin; t < end; t++)
+    {
+      while (t >= draw_items[item].first_triangle + mesh_ranges[draw_items[item].mesh].index_count / 3)
+      {
+        item++;
+      }
+
+      const DrawItem& draw = draw_items[item];
+      const uint32_t* triangle = indices.data() + mesh_ranges[draw.mesh].first_index + 3 * (t - draw.first_triangle);
+      const ClipVertex* v[3] = { &clip_vertices[draw.first_vertex + triangle[0]], &clip_vertices[draw.first_vertex + triangle[1]], &clip_vertices[draw.first_vertex + triangle[2]] };
+      uint32_t codes[3] = { outcode(*v[0]), outcode(*v[1]), outcode(*v[2]) };
+
+      //  Every vertex outside the same plane
+      if (codes[0] & codes[1] & codes[2])
+      {
+        continue;
+      }
+
+      //  Only the near plane is clipped geometrically, x and y are left to the screen bounds and z > w to the depth test
+      if (!((codes[0] | codes[1] | codes[2]) & NEAR_BIT))
+      {
+        setupTriangle(*v[0], *v[1], *v[2], chunk);
+        continue;
+      }
+
+      ClipVertex polygon[4];
+      uint32_t polygon_size = 0;
+
+      for (uint32_t i = 0; i < 3; i++)
+      {
+        const ClipVertex& a = *v[i];
+        const ClipVertex& b = *v[(i + 1) % 3];
+        float da = a.position[2];
+        float db = b.position[2];
+
+        if (da >= 0.0f)
+        {
+          polygon[polygon_size++] = a;
+        }
+
+        if ((da >= 0.0f) != (db >= 0.0f))
+        {
+          float s = da / (da - db);
+          ClipVertex& c = polygon[polygon_size++];
+
+          for (uint32_t k = 0; k < 4; k++) c.position[k] = a.position[k] + s * (b.position[k] - a.position[k]);
+          for (uint32_t k = 0; k < 3; k++) c.normal[k] = a.normal[k] + s * (b.normal[k] - a.normal[k]);
+          for (uint32_t k = 0; k < 3; k++) c.color[k] = a.color[k] + s * (b.color[k] - a.color[k]);
+        }
+      }
+
+      for (uint32_t i = 1; i + 1 < polygon_size; i++)
+      {
+        setupTriangle(polygon[0], polygon[i], polygon[i + 1], chunk);
+      }
+    }
+  }
+
+  //  Largest value of an edge function over the pixel centers of a rectangle
+  static inline float max_over_rect(float a, float b, float c, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+  {
+    return c + std::max(a * x0, a * x1) + std::max(b * y0, b * y1);
+  }
+
+  static inline bool outside_rect(const float edge_a[3], const float edge_b[3], const float edge_c[3], int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+  {
+    for (uint32_t i = 0; i < 3; i++)
+    {
+      if (max_over_rect(edge_a[i], edge_b[i], edge_c[i], x0, y0, x1, y1) < 0.0f)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void SoftwareRasterRenderAPI::setupTriangle(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, uint32_t chunk)
+  {
+    const ClipVertex* v[3] = { &v0, &v1, &v2 };
+    float x[3], y[3], z[3];
+    ScreenTriangle tri;
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+      const float* p = v[i]->position;
+      tri.inv_w[i] = 1.0f / p[3];
+      x[i] = (p[0] * tri.inv_w[i] * 0.5f + 0.5f) * WIDTH;
+      y[i] = (0.5f - p[1] * tri.inv_w[i] * 0.5f) * HEIGHT;
+      z[i] = p[2] * tri.inv_w[i];
+
+      for (uint32_t k = 0; k < 3; k++)
+      {
+        tri.normal[i][k] = v[i]->normal[k] * tri.inv_w[i];
+        tri.color[i][k] = v[i]->color[k] * tri.inv_w[i];
+      }
+    }
+
+    //  No culling, both windings are drawn like with cullMode None. Degenerate and non finite triangles drop out here
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(std::fabs(area) > 1e-8f))
+    {
+      return;
+    }
+
+    //  Pixels whose centers are inside the bounds, coordinates are clamped before conversion as they are unbounded
+    auto first_pixel = [](float a, float b, float c, uint32_t size) { return (int32_t)std::ceil(std::min(std::max(std::min({a, b, c}) - 0.5f, -1.0f), (float)size)); };
+    auto last_pixel = [](float a, float b, float c, uint32_t size) { return (int32_t)std::floor(std::min(std::max(std::max({a, b, c}) - 0.5f, -1.0f), (float)size)); };
+
+    tri.min_x = std::max(first_pixel(x[0], x[1], x[2], WIDTH), 0);
+    tri.max_x = std::min(last_pixel(x[0], x[1], x[2], WIDTH), (int32_t)WIDTH - 1);
+    tri.min_y = std::max(first_pixel(y[0], y[1], y[2], HEIGHT), 0);
+    tri.max_y = std::min(last_pixel(y[0], y[1], y[2], HEIGHT), (int32_t)HEIGHT - 1);
+
+    if (tri.min_x > tri.max_x || tri.min_y > tri.max_y)
+    {
+      return;
+    }
+
+    //  Edge opposite to each vertex, divided by the signed area so inside is positive for both windings and the
+    //  values are the barycentric coordinates. c is taken at the center of the first pixel of the bounds
+    const float origin_x = tri.min_x + 0.5f;
+    const float origin_y = tri.min_y + 0.5f;
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+      uint32_t j = (i + 1) % 3;
+      uint32_t k = (i + 2) % 3;
+
+      tri.edge_a[i] = (y[j] - y[k]) / area;
+      tri.edge_b[i] = (x[k] - x[j]) / area;
+      tri.edge_c[i] = ((y[j] - y[k]) * (origin_x - x[j]) + (x[k] - x[j]) * (origin_y - y[j])) / area;
+    }
+
+    //  Depth is linear in screen space
+    tri.depth_a = tri.edge_a[0] * z[0] + tri.edge_a[1] * z[1] + tri.edge_a[2] * z[2];
+    tri.depth_b = tri.edge_b[0] * z[0] + tri.edge_b[1] * z[1] + tri.edge_b[2] * z[2];
+    tri.depth_c = tri.edge_c[0] * z[0] + tri.edge_c[1] * z[1] + tri.edge_c[2] * z[2];
+    tri.min_depth = std::min({z[0], z[1], z[2]});
+
+    if (tri.min_depth >= 1.0f)
+    {
+      return;
+    }
+
+    std::vector<ScreenTriangle>& triangles = chunk_triangles[chunk];
+    const uint32_t index = (uint32_t)triangles.size();
+    const uint32_t tile_count = tiles_x * tiles_y;
+    bool binned = false;
+
+    for (int32_t ty = tri.min_y / (int32_t)TILE_SIZE; ty <= tri.max_y / (int32_t)TILE_SIZE; ty++)
+    {
+      for (int32_t tx = tri.min_x / (int32_t)TILE_SIZE; tx <= tri.max_x / (int32_t)TILE_SIZE; tx++)
+      {
+        int32_t x0 = std::max(tx * (int32_t)TILE_SIZE, tri.min_x);
+        int32_t y0 = std::max(ty * (int32_t)TILE_SIZE, tri.min_y);
+        int32_t x1 = std::min((tx + 1) * (int32_t)TILE_SIZE - 1, tri.max_x);
+        int32_t y1 = std::min((ty + 1) * (int32_t)TILE_SIZE - 1, tri.max_y);
+
+        //  Long thin triangles cross many tiles of their bounds without touching them
+        if (outside_rect(tri.edge_a, tri.edge_b, tri.edge_c, x0 - tri.min_x, y0 - tri.min_y, x1 - tri.min_x, y1 - tri.min_y))
+        {
+          continue;
+        }
+
+        bins[(size_t)chunk * tile_count + ty * tiles_x + tx].push_back(index);
+        binned = true;
+      }
+    }
+
+    if (binned)
+    {
+      triangles.push_back(tri);
+    }
+  }
+
+  void SoftwareRasterRenderAPI::rasterizeTile(uint32_t tile, uint32_t chunk_count, float alpha)
+  {
+    const uint32_t tile_count = tiles_x * tiles_y;
+    const int32_t tile_x0 = (int32_t)((tile % tiles_x) * TILE_SIZE);
+    const int32_t tile_y0 = (int32_t)((tile / tiles_x) * TILE_SIZE);
+    const int32_t tile_x1 = std::min(tile_x0 + (int32_t)TILE_SIZE, (int32_t)WIDTH) - 1;
+    const int32_t tile_y1 = std::min(tile_y0 + (int32_t)TILE_SIZE, (int32_t)HEIGHT) - 1;
+
+    //  Same clear values as the raster pass
+    for (int32_t y = tile_y0; y <= tile_y1; y++)
+    {
+      std::fill(color.begin() + (size_t)y * WIDTH + tile_x0, color.begin() + (size_t)y * WIDTH + tile_x1 + 1, 0u);
+      std::fill(depth.begin() + (size_t)y * depth_stride + tile_x0, depth.begin() + (size_t)y * depth_stride + tile_x1 + 1, 1.0f);
+    }
+
+    //  Farthest depth of every block and of the tile: triangles starting behind them are skipped
+    float block_max[TILE_BLOCKS * TILE_BLOCKS];
+    std::fill(block_max, block_max + TILE_BLOCKS * TILE_BLOCKS, 1.0f);
+    float tile_max = 1.0f;
+
+    const Lanes zero = lanes_set(0.0f);
+
+    for (uint32_t chunk = 0; chunk < chunk_count; chunk++)
+    {
+      const std::vector<ScreenTriangle>& triangles = chunk_triangles[chunk];
+
+      //  Chunks and their bins keep the submission order, so blending matches the GPU
+      for (uint32_t index : bins[(size_t)chunk * tile_count + tile])
+      {
+        const ScreenTriangle& tri = triangles[index];
+
+        if (tri.min_depth >= tile_max)
+        {
+          continue;
+        }
+
+        const int32_t x0 = std::max(tri.min_x, tile_x0);
+        const int32_t y0 = std::max(tri.min_y, tile_y0);
+        const int32_t x1 = std::min(tri.max_x, tile_x1);
+        const int32_t y1 = std::min(tri.max_y, tile_y1);
+        bool tile_changed = false;
+
+        for (int32_t by = (y0 - tile_y0) / (int32_t)BLOCK_SIZE; by <= (y1 - tile_y0) / (int32_t)BLOCK_SIZE; by++)
+        {
+          for (int32_t bx = (x0 - tile_x0) / (int32_t)BLOCK_SIZE; bx <= (x1 - tile_x0) / (int32_t)BLOCK_SIZE; bx++)
+          {
+            float& block_depth = block_max[by * TILE_BLOCKS + bx];
+
+            if (tri.min_depth >= block_depth)
+            {
+              continue;
+            }
+
+            const int32_t block_x0 = tile_x0 + bx * (int32_t)BLOCK_SIZE;
+            const int32_t block_y0 = tile_y0 + by * (int32_t)BLOCK_SIZE;
+            const int32_t rect_x0 = std::max(block_x0, x0);
+            const int32_t rect_y0 = std::max(block_y0, y0);
+            const int32_t rect_x1 = std::min(block_x0 + (int32_t)BLOCK_SIZE - 1, x1);
+            const int32_t rect_y1 = std::min(block_y0 + (int32_t)BLOCK_SIZE - 1, y1);
+
+            if (outside_rect(tri.edge_a, tri.edge_b, tri.edge_c, rect_x0 - tri.min_x, rect_y0 - tri.min_y, rect_x1 - tri.min_x, rect_y1 - tri.min_y))
+            {
+              continue;
+            }
+
+            bool block_changed = false;
+
+            for (int32_t y = rect_y0; y <= rect_y1; y++)
+            {
+              const float fy = (float)(y - tri.min_y);
+              const Lanes row0 = lanes_set(tri.edge_b[0] * fy + tri.edge_c[0]);
+              const Lanes row1 = lanes_set(tri.edge_b[1] * fy + tri.edge_c[1]);
+              const Lanes row2 = lanes_set(tri.edge_b[2] * fy + tri.edge_c[2]);
+              const Lanes row_depth = lanes_set(tri.depth_b * fy + tri.depth_c);
+
+              float* depth_row = depth.data() + (size_t)y * depth_stride;
+              uint32_t* color_row = color.data() + (size_t)y * WIDTH;
+
+              for (int32_t x = block_x0 + ((rect_x0 - block_x0) & ~3); x <= rect_x1; x += 4)
+              {
+                const Lanes px = lanes_ramp((float)(x - tri.min_x));
+                const Lanes e0 = lanes_set(tri.edge_a[0]) * px + row0;
+                const Lanes e1 = lanes_set(tri.edge_a[1]) * px + row1;
+                const Lanes e2 = lanes_set(tri.edge_a[2]) * px + row2;
+
+                uint32_t mask = mask_ge(e0, zero) & mask_ge(e1, zero) & mask_ge(e2, zero) & lanes_between(x, rect_x0, rect_x1);
+                if (!mask)
+                {
+                  continue;
+                }
+
+                const Lanes z = lanes_set(tri.depth_a) * px + row_depth;
+                mask &= mask_lt(z, lanes_load(depth_row + x)) & mask_ge(z, zero);
+                if (!mask)
+                {
+                  continue;
+                }
+
+                float l0[4], l1[4], l2[4], zs[4];
+                lanes_store(l0, e0);
+                lanes_store(l1, e1);
+                lanes_store(l2, e2);
+                lanes_store(zs, z);
+
+                for (uint32_t lane = 0; lane < 4; lane++)
+                {
+                  if (!(mask & (1u << lane)))
+                  {
+                    continue;
+                  }
+
+                  //  Perspective correct attributes
+                  const float weights[3] = { l0[lane], l1[lane], l2[lane] };
+                  const float w = 1.0f / (weights[0] * tri.inv_w[0] + weights[1] * tri.inv_w[1] + weights[2] * tri.inv_w[2]);
+
+                  float normal[3], base[3];
+                  for (uint32_t k = 0; k < 3; k++)
+                  {
+                    normal[k] = (weights[0] * tri.normal[0][k] + weights[1] * tri.normal[1][k] + weights[2] * tri.normal[2][k]) * w;
+                    base[k] = (weights[0] * tri.color[0][k] + weights[1] * tri.color[1][k] + weights[2] * tri.color[2][k]) * w;
+                  }
+
+                  float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                  float inv_length = length > 0.0f ? 1.0f / length : 0.0f;
+
+                  float shading1 = 0.0f;
+                  float shading2 = 0.0f;
+                  for (uint32_t k = 0; k < 3; k++)
+                  {
+                    shading1 += LIGHT_DIRECTION_1[k] * normal[k] * inv_length;
+                    shading2 += LIGHT_DIRECTION_2[k] * normal[k] * inv_length;
+                  }
+                  shading1 = std::max(shading1, 0.0f);
+                  shading2 = std::max(shading2, 0.0f);
+
+                  //  Gamma-correction, then SrcAlpha / OneMinusSrcAlpha blending on color and alpha
+                  const uint32_t dst = color_row[x + lane];
+                  float rgba[4];
+                  for (uint32_t k = 0; k < 3; k++)
+                  {
+                    float src = std::pow(base[k] * (shading1 * LIGHT_COLOR_1[k] + shading2 * LIGHT_COLOR_2[k]), 2.2f);
+                    rgba[k] = src * alpha + ((dst >> (8 * k)) & 0xff) / 255.0f * (1.0f - alpha);
+                  }
+                  rgba[3] = alpha * alpha + (dst >> 24) / 255.0f * (1.0f - alpha);
+
+                  color_row[x + lane] = pack_color(rgba);
+                  depth_row[x + lane] = zs[lane];
+                }
+
+                block_changed = true;
+              }
+            }
+
+            if (block_changed)
+            {
+              float farthest = 0.0f;
+              for (int32_t y = block_y0; y <= std::min(block_y0 + (int32_t)BLOCK_SIZE - 1, tile_y1); y++)
+              {
+                const float* depth_row = depth.data() + (size_t)y * depth_stride;
+                farthest = std::max(farthest, *std::max_element(depth_row + block_x0, depth_row + std::min(block_x0 + (int32_t)BLOCK_SIZE - 1, tile_x1) + 1));
+              }
+
+              block_depth = farthest;
+              tile_changed = true;
+            }
+          }
+        }
+
+        if (tile_changed)
+        {
+          tile_max = *std::max_element(block_max, block_max + TILE_BLOCKS * TILE_BLOCKS);
+        }
+      }
+    }
+  }
+
+  void SoftwareRasterRenderAPI::Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache, std::shared_ptr<MeshArena> mesh_arena, const std::vector<WGPUBuffer>& output_buffers, const std::vector<WGPUBuffer>& uniform_buffers)
+  {
+    assert(output_buffers.size() == uniform_buffers.size());
+
+    this->device = device;
+    this->queue = queue;
+    this->pipeline_cache = pipeline_cache;
+    this->mesh_arena = mesh_arena;
+    this->output_buffers = output_buffers;
+
+    if (!pool)
+    {
+      pool = std::make_unique<utils::ThreadPool>(threads);
+    }
+
+    WGPUTextureDescriptor textureDesc {};
+    textureDesc.dimension = WGPUTextureDimension_2D;
+    textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
+    textureDesc.size = {WIDTH, HEIGHT, 1};
+    textureDesc.sampleCount = 1;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.label = {"Software raster texture", WGPU_STRLEN};
+    textureDesc.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst | WGPUTextureUsage_CopySrc;
+
+    WGPUTextureViewDescriptor textureViewDesc {};
+    textureViewDesc.aspect = WGPUTextureAspect_All;
+    textureViewDesc.baseArrayLayer = 0;
+    textureViewDesc.arrayLayerCount = 1;
+    textureViewDesc.dimension = WGPUTextureViewDimension_2D;
+    textureViewDesc.format = WGPUTextureFormat_RGBA8Unorm;
+    textureViewDesc.mipLevelCount = 1;
+    textureViewDesc.baseMipLevel = 0;
+    textureViewDesc.label = {"Software raster texture view", WGPU_STRLEN};
+
+    for (size_t i = 0; i < output_buffers.size(); i++)
+    {
+      frame_textures.push_back(wgpuDeviceCreateTexture(*device, &textureDesc));
+      frame_texture_views.push_back(wgpuTextureCreateView(frame_textures.back(), &textureViewDesc));
+    }
+  }
+
+  void SoftwareRasterRenderAPI::SetScene(const std::vector<Mesh>& meshes)
+  {
+    vertices.clear();
+    indices.clear();
+    mesh_ranges.clear();
+
+    for (const Mesh& mesh : meshes)
+    {
+      mesh_ranges.push_back({ (uint32_t)vertices.size(), (uint32_t)mesh.vertices.size(), (uint32_t)indices.size(), (uint32_t)mesh.indices.size() });
+
+      vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+      indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+    }
+  }
+
+  void SoftwareRasterRenderAPI::Terminate()
+  {
+    for (size_t i = 0; i < frame_textures.size(); i++)
+    {
+      wgpuTextureViewRelease(frame_texture_views[i]);
+      wgpuTextureRelease(frame_textures[i]);
+    }
+
+    frame_textures.clear();
+    frame_texture_views.clear();
+    pool.reset();
+  }
+};
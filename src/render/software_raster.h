@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <webgpu/webgpu.h>
+#include <webgpu/wgpu.h>
+
+#include "render.h"
+#include "thread_pool.h"
+
+namespace WGPU
+{
+//  CPU reference of RasterizationRenderAPI: same instances, transform, two-light shading, Less depth test and alpha
+//  blending, one sample per pixel. Triangles are binned into screen tiles and tiles are rasterised in parallel with 4-wide edge
+//  functions and a per-block max depth to reject hidden triangles early. Pixels are RGBA8 rows of WIDTH like
+//  output_buffer, uploaded into the API's own frame texture, so frames are never drawn into FrameContext::target
+class SoftwareRasterRenderAPI : virtual public RenderAPI
+{
+public:
+  SoftwareRasterRenderAPI(const uint32_t RENDER_WIDTH, const uint32_t RENDER_HEIGHT);
+
+  RGResource Draw(const FrameContext& frame) override;
+  void Init(std::shared_ptr<WGPUDevice> device, std::shared_ptr<WGPUQueue> queue, std::shared_ptr<PipelineCache> pipeline_cache, std::shared_ptr<MeshArena> mesh_arena, const std::vector<WGPUBuffer>& output_buffers, const std::vector<WGPUBuffer>& uniform_buffers) override;
+  void Terminate() override;
+
+  //  Keeps a copy of the meshes, in the order of mesh_arena
+  void SetScene(const std::vector<Mesh>& meshes) override;
+
+  RenderAPIStats GetStats() const override { return stats; }
+
+  WGPUTextureView GetFrameTextureView(uint32_t frame_index) const override { return frame_texture_views[frame_index]; }
+
+  //  Rasterise a frame into GetPixels(), needs no device
+  void Render(const Uniforms& uniforms);
+
+  //  Last rendered frame in the layout of output_buffer
+  const std::vector<uint32_t>& GetPixels() const { return color; }
+
+  //  Worker threads, 0 for one per hardware thread. Set before Init or the first Render
+  uint32_t threads = 0;
+
+private:
+  //  Vertex shader output
+  struct ClipVertex
+  {
+    float position[4];
+    float normal[3];
+    float color[3];
+  };
+
+  //  One instance of one mesh, its vertices and triangles are numbered after those of the draws before it
+  struct DrawItem
+  {
+    uint32_t mesh;
+    uint32_t instance;          //  Into InstanceSet::GetUploaded(), INVALID_INSTANCE for the untransformed mesh
+    uint32_t first_vertex;      //  Into clip_vertices
+    uint32_t first_triangle;
+  };
+
+  //  Triangle after clipping and setup. Planes give a value at the center of pixel (x, y) as
+  //  a * (x - min_x) + b * (y - min_y) + c, relative to the bounds so small triangles far from the origin keep precision
+  struct ScreenTriangle
+  {
+    float edge_a[3], edge_b[3], edge_c[3];    //  Barycentric weight of each vertex, negative outside
+    float depth_a, depth_b, depth_c;
+    float min_depth;
+    int32_t min_x, min_y, max_x, max_y;       //  Covered pixels, clamped to the screen
+    float inv_w[3];
+    float normal[3][3];                       //  Attributes divided by w, for perspective correct interpolation
+    float color[3][3];
+  };
+
+  //  Draws of the instances as last uploaded, or of every mesh once without instance set
+  void buildDrawItems();
+
+  void transformVertices(const Uniforms& uniforms);
+
+  //  Clip, set up and bin the triangles of one chunk
+  void binTriangles(uint32_t chunk, uint32_t chunk_count);
+  void setupTriangle(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, uint32_t chunk);
+
+  void rasterizeTile(uint32_t tile, uint32_t chunk_count, float alpha);
+
+  //  Created by Init or the first Render
+  std::unique_ptr<utils::ThreadPool> pool;
+
+  //  Scene packed like mesh_arena, indices are relative to the first vertex of their mesh
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<MeshRange> mesh_ranges;
+
+  uint32_t tiles_x, tiles_y;
+  uint32_t depth_stride;                      //  WIDTH padded so rows can be read four pixels at a time
+
+  //  Frame state, rebuilt by every Render
+  std::vector<DrawItem> draw_items;
+  uint32_t vertex_total = 0;
+  uint32_t triangle_total = 0;
+  std::vector<ClipVertex> clip_vertices;
+  std::vector<std::vector<ScreenTriangle>> chunk_triangles;
+  std::vector<std::vector<uint32_t>> bins;    //  [chunk * tile count + tile], indices into chunk_triangles
+  std::vector<uint32_t> color;
+  std::vector<float> depth;
+
+  //  Per frames-in-flight slot
+  std::vector<WGPUTexture> frame_textures;
+  std::vector<WGPUTextureView> frame_texture_views;
+  std::vector<WGPUBuffer> output_buffers;
+
+  RenderAPIStats stats;
+};
+};
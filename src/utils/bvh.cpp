@@ -0,0 +1,475 @@
+#include "bvh.h"
+
+#include <cfloat>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+namespace utils
+{
+namespace
+{
+//  Nodes with more triangles bin in parallel and build their children as separate tasks
+constexpr uint32_t PARALLEL_BINNING_THRESHOLD = 64 * 1024;
+constexpr uint32_t PARALLEL_SUBTREE_THRESHOLD = 4 * 1024;
+constexpr uint32_t MAX_BINS = 32;
+
+struct Bounds
+{
+  float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+  float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+  void Grow(const float p[3])
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      min[k] = std::min(min[k], p[k]);
+      max[k] = std::max(max[k], p[k]);
+    }
+  }
+
+  void Grow(const Bounds& other)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      min[k] = std::min(min[k], other.min[k]);
+      max[k] = std::max(max[k], other.max[k]);
+    }
+  }
+
+  float Area() const
+  {
+    if (min[0] > max[0])
+    {
+      return 0.0f;
+    }
+
+    float d[3] = { max[0] - min[0], max[1] - min[1], max[2] - min[2] };
+    return 2.0f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+  }
+};
+
+//  Triangle bounds and centroid, computed once before the build
+struct BuildTriangle
+{
+  Bounds bounds;
+  float centroid[3];
+  BvhTriangle triangle;
+};
+
+struct Bin
+{
+  Bounds bounds;
+  uint32_t count = 0;
+};
+
+class Builder
+{
+public:
+  Builder(std::vector<BuildTriangle>& build, const BvhSettings& settings, ThreadPool* pool)
+    : build(build), settings(settings), pool(pool), bin_count(std::clamp(settings.bins, 2u, MAX_BINS))
+  {
+    //  Leaves hold at least one triangle, so a binary tree over them has at most 2n - 1 nodes
+    nodes.resize(std::max<size_t>(2 * build.size(), 1));
+  }
+
+  void Build()
+  {
+    node_count = 1;
+    buildNode(0, 0, (uint32_t)build.size(), 0);
+    nodes.resize(node_count);
+  }
+
+  std::vector<BvhNode> nodes;
+
+private:
+  //  Run body over [begin, end), split into tasks for large ranges
+  void forRange(uint32_t begin, uint32_t end, const std::function<void(uint32_t, uint32_t)>& body)
+  {
+    if (pool && end - begin >= PARALLEL_BINNING_THRESHOLD)
+    {
+      pool->ParallelFor(end - begin, 16 * 1024, [&](size_t b, size_t e) { body(begin + (uint32_t)b, begin + (uint32_t)e); });
+    }
+    else
+    {
+      body(begin, end);
+    }
+  }
+
+  void buildNode(uint32_t node_index, uint32_t begin, uint32_t end, uint32_t depth)
+  {
+    Bounds bounds, centroids;
+    std::mutex mutex;
+
+    forRange(begin, end, [&](uint32_t b, uint32_t e)
+    {
+      Bounds local_bounds, local_centroids;
+
+      for (uint32_t i = b; i < e; i++)
+      {
+        local_bounds.Grow(build[i].bounds);
+        local_centroids.Grow(build[i].centroid);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      bounds.Grow(local_bounds);
+      centroids.Grow(local_centroids);
+    });
+
+    BvhNode& node = nodes[node_index];
+    std::copy(bounds.min, bounds.min + 3, node.bounds_min);
+    std::copy(bounds.max, bounds.max + 3, node.bounds_max);
+
+    const uint32_t count = end - begin;
+
+    if (count == 1 || depth >= settings.max_depth)
+    {
+      node.first = begin;
+      node.count = count;
+      return;
+    }
+
+    float split_cost = FLT_MAX;
+    uint32_t middle = splitSah(begin, end, centroids, split_cost);
+
+    //  A split costs a traversal step plus the children's intersections, weighted by their chance of being hit
+    const float area = bounds.Area();
+    if (count <= settings.max_leaf_size && area > 0.0f &&
+      settings.traversal_cost + split_cost / area * settings.intersection_cost >= count * settings.intersection_cost)
+    {
+      node.first = begin;
+      node.count = count;
+      return;
+    }
+
+    //  Children are allocated together, node may be written by other tasks only through its own index
+    uint32_t left = node_count.fetch_add(2);
+    nodes[node_index].first = left;
+    nodes[node_index].count = 0;
+
+    if (pool && count >= PARALLEL_SUBTREE_THRESHOLD)
+    {
+      pool->ParallelInvoke([&]() { buildNode(left, begin, middle, depth + 1); }, [&]() { buildNode(left + 1, middle, end, depth + 1); });
+    }
+    else
+    {
+      buildNode(left, begin, middle, depth + 1);
+      buildNode(left + 1, middle, end, depth + 1);
+    }
+  }
+
+  //  Partition [begin, end) at the cheapest binned SAH split and return the first triangle of the right side. cost is
+  //  the split's sum of child areas times triangle counts. FLT_MAX for the object median fallback, so nodes the bins can
+  //  not separate stay leaves when small enough
+  uint32_t splitSah(uint32_t begin, uint32_t end, const Bounds& centroids, float& cost)
+  {
+    Bin bins[3][MAX_BINS];
+    float scale[3];
+
+    for (int k = 0; k < 3; k++)
+    {
+      float extent = centroids.max[k] - centroids.min[k];
+      scale[k] = extent > 0.0f ? bin_count / extent : 0.0f;
+    }
+
+    auto bin_of = [&](const BuildTriangle& t, int k)
+    {
+      return std::min((uint32_t)((t.centroid[k] - centroids.min[k]) * scale[k]), bin_count - 1);
+    };
+
+    auto bin_range = [&](uint32_t b, uint32_t e, Bin (*out)[MAX_BINS])
+    {
+      for (uint32_t i = b; i < e; i++)
+      {
+        for (int k = 0; k < 3; k++)
+        {
+          Bin& bin = out[k][bin_of(build[i], k)];
+          bin.bounds.Grow(build[i].bounds);
+          bin.count++;
+        }
+      }
+    };
+
+    if (pool && end - begin >= PARALLEL_BINNING_THRESHOLD)
+    {
+      std::mutex mutex;
+
+      forRange(begin, end, [&](uint32_t b, uint32_t e)
+      {
+        Bin local[3][MAX_BINS];
+        bin_range(b, e, local);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k = 0; k < 3; k++)
+        {
+          for (uint32_t j = 0; j < bin_count; j++)
+          {
+            bins[k][j].bounds.Grow(local[k][j].bounds);
+            bins[k][j].count += local[k][j].count;
+          }
+        }
+      });
+    }
+    else
+    {
+      bin_range(begin, end, bins);
+    }
+
+    //  Sweep from the right for the right side areas, then from the left evaluating each plane
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    uint32_t best_plane = 0;
+
+    for (int k = 0; k < 3; k++)
+    {
+      if (scale[k] == 0.0f)
+      {
+        continue;
+      }
+
+      float right_area[MAX_BINS];
+      uint32_t right_count[MAX_BINS];
+      Bounds right;
+      uint32_t count = 0;
+
+      for (uint32_t j = bin_count - 1; j > 0; j--)
+      {
+        right.Grow(bins[k][j].bounds);
+        count += bins[k][j].count;
+        right_area[j] = right.Area();
+        right_count[j] = count;
+      }
+
+      Bounds left;
+      count = 0;
+
+      for (uint32_t plane = 1; plane < bin_count; plane++)
+      {
+        left.Grow(bins[k][plane - 1].bounds);
+        count += bins[k][plane - 1].count;
+
+        if (count == 0 || right_count[plane] == 0)
+        {
+          continue;
+        }
+
+        float cost = left.Area() * count + right_area[plane] * right_count[plane];
+        if (cost < best_cost)
+        {
+          best_cost = cost;
+          best_axis = k;
+          best_plane = plane;
+        }
+      }
+    }
+
+    //  All centroids in one bin, fall back to an object median
+    if (best_axis < 0)
+    {
+      int axis = 0;
+      for (int k = 1; k < 3; k++)
+      {
+        if (centroids.max[k] - centroids.min[k] > centroids.max[axis] - centroids.min[axis])
+        {
+          axis = k;
+        }
+      }
+
+      uint32_t middle = begin + (end - begin) / 2;
+      std::nth_element(build.begin() + begin, build.begin() + middle, build.begin() + end,
+        [axis](const BuildTriangle& a, const BuildTriangle& b) { return a.centroid[axis] < b.centroid[axis]; });
+      return middle;
+    }
+
+    cost = best_cost;
+
+    return (uint32_t)(std::partition(build.begin() + begin, build.begin() + end,
+      [&](const BuildTriangle& t) { return bin_of(t, best_axis) < best_plane; }) - build.begin());
+  }
+
+  std::vector<BuildTriangle>& build;
+  const BvhSettings& settings;
+  ThreadPool* pool;
+  const uint32_t bin_count;
+
+  std::atomic<uint32_t> node_count = 0;
+};
+
+//  Renumber nodes depth first with sibling pairs together. Parallel builds allocate nodes in whatever order the tasks
+//  ran, this makes the layout independent of it and keeps the top of every subtree close to its parent
+std::vector<BvhNode> flatten(const std::vector<BvhNode>& nodes)
+{
+  std::vector<BvhNode> flat;
+  flat.reserve(nodes.size());
+  flat.push_back(nodes[0]);
+
+  //  (source node, its index in flat) of inner nodes whose children still have to be placed
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  if (nodes[0].count == 0 && nodes.size() > 1)
+  {
+    stack.push_back({ 0, 0 });
+  }
+
+  while (!stack.empty())
+  {
+    auto [source, target] = stack.back();
+    stack.pop_back();
+
+    uint32_t left = nodes[source].first;
+    uint32_t flat_left = (uint32_t)flat.size();
+
+    flat[target].first = flat_left;
+    flat.push_back(nodes[left]);
+    flat.push_back(nodes[left + 1]);
+
+    //  Left subtree is placed first
+    if (nodes[left + 1].count == 0)
+    {
+      stack.push_back({ left + 1, flat_left + 1 });
+    }
+    if (nodes[left].count == 0)
+    {
+      stack.push_back({ left, flat_left });
+    }
+  }
+
+  return flat;
+}
+}
+
+Bvh build_bvh(const std::vector<Mesh>& meshes, const BvhSettings& settings, ThreadPool* pool)
+{
+  //  Triangle offsets of the meshes, so triangles can be set up in parallel
+  std::vector<size_t> first_triangle(meshes.size() + 1, 0);
+  std::vector<uint32_t> base_vertex(meshes.size(), 0);
+
+  for (size_t m = 0; m < meshes.size(); m++)
+  {
+    first_triangle[m + 1] = first_triangle[m] + meshes[m].indices.size() / 3;
+    base_vertex[m] = m == 0 ? 0 : base_vertex[m - 1] + (uint32_t)meshes[m - 1].vertices.size();
+  }
+
+  std::vector<BuildTriangle> build(first_triangle.back());
+
+  auto setup = [&](size_t begin, size_t end)
+  {
+    size_t m = std::upper_bound(first_triangle.begin(), first_triangle.end(), begin) - first_triangle.begin() - 1;
+
+    for (size_t i = begin; i < end; i++)
+    {
+      while (i >= first_triangle[m + 1])
+      {
+        m++;
+      }
+
+      const Mesh& mesh = meshes[m];
+      const uint32_t* indices = &mesh.indices[(i - first_triangle[m]) * 3];
+      BuildTriangle& t = build[i];
+
+      t.bounds = Bounds();
+      t.triangle = { base_vertex[m] + indices[0], base_vertex[m] + indices[1], base_vertex[m] + indices[2], (uint32_t)m };
+
+      for (int k = 0; k < 3; k++)
+      {
+        const float3& p = mesh.vertices[indices[k]].pos;
+        const float position[3] = { p.x, p.y, p.z };
+        t.bounds.Grow(position);
+      }
+      for (int k = 0; k < 3; k++)
+      {
+        t.centroid[k] = 0.5f * (t.bounds.min[k] + t.bounds.max[k]);
+      }
+    }
+  };
+
+  if (pool)
+  {
+    pool->ParallelFor(build.size(), 16 * 1024, setup);
+  }
+  else
+  {
+    setup(0, build.size());
+  }
+
+  Bvh bvh;
+
+  //  Empty scenes still get a root, its inverted bounds miss every ray
+  if (build.empty())
+  {
+    Bounds empty;
+    bvh.nodes.push_back({});
+    std::copy(empty.min, empty.min + 3, bvh.nodes[0].bounds_min);
+    std::copy(empty.max, empty.max + 3, bvh.nodes[0].bounds_max);
+    return bvh;
+  }
+
+  BvhSettings checked = settings;
+  checked.max_leaf_size = std::max(settings.max_leaf_size, 1u);
+
+  Builder builder(build, checked, pool);
+  builder.Build();
+  bvh.nodes = flatten(builder.nodes);
+
+  bvh.triangles.resize(build.size());
+  for (size_t i = 0; i < build.size(); i++)
+  {
+    bvh.triangles[i] = build[i].triangle;
+  }
+
+  return bvh;
+}
+
+BvhStats analyze_bvh(const Bvh& bvh, const BvhSettings& settings)
+{
+  BvhStats stats;
+
+  auto area = [](const BvhNode& node)
+  {
+    Bounds bounds;
+    bounds.Grow(node.bounds_min);
+    bounds.Grow(node.bounds_max);
+    return bounds.Area();
+  };
+
+  float root_area = area(bvh.nodes[0]);
+  double cost = 0.0;
+  uint64_t leaf_depths = 0, leaf_triangles = 0;
+
+  stats.nodes = (uint32_t)bvh.nodes.size();
+  stats.min_leaf_size = UINT32_MAX;
+
+  //  (node, depth)
+  std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 0 } };
+
+  while (!stack.empty())
+  {
+    auto [index, depth] = stack.back();
+    stack.pop_back();
+
+    const BvhNode& node = bvh.nodes[index];
+    stats.max_depth = std::max(stats.max_depth, depth);
+
+    if (node.count == 0 && bvh.nodes.size() > 1)
+    {
+      cost += settings.traversal_cost * area(node);
+      stack.push_back({ node.first, depth + 1 });
+      stack.push_back({ node.first + 1, depth + 1 });
+      continue;
+    }
+
+    cost += settings.intersection_cost * area(node) * node.count;
+    stats.leaves++;
+    stats.min_leaf_size = std::min(stats.min_leaf_size, node.count);
+    stats.max_leaf_size = std::max(stats.max_leaf_size, node.count);
+    leaf_depths += depth;
+    leaf_triangles += node.count;
+  }
+
+  stats.average_leaf_depth = stats.leaves ? (float)leaf_depths / stats.leaves : 0.0f;
+  stats.average_leaf_size = stats.leaves ? (float)leaf_triangles / stats.leaves : 0.0f;
+  stats.sah_cost = root_area > 0.0f ? (float)(cost / root_area) : 0.0f;
+
+  return stats;
+}
+
+};
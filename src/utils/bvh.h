@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.h"
+#include "thread_pool.h"
+
+namespace utils
+{
+
+//  Node of a flattened BVH, 32 bytes and laid out to be uploaded to storage buffers as is
+struct BvhNode
+{
+  float bounds_min[3];
+  uint32_t first;       //  Leaf: first triangle, inner node: left child, the right child follows it
+  float bounds_max[3];
+  uint32_t count;       //  Triangles of a leaf, 0 for inner nodes
+};
+
+//  Triangle referenced by leaves, vertex indices are into the vertices of all meshes concatenated in order, the
+//  layout MeshArena uploads
+struct BvhTriangle
+{
+  uint32_t v0, v1, v2;
+  uint32_t mesh;
+};
+
+struct Bvh
+{
+  std::vector<BvhNode> nodes;           //  Root first, never empty. Depth first, sibling pairs stored together
+  std::vector<BvhTriangle> triangles;   //  In leaf order
+};
+
+struct BvhSettings
+{
+  uint32_t max_leaf_size = 4;           //  Largest leaf the SAH may keep when no split pays off, larger nodes always split
+  uint32_t max_depth = 64;              //  Nodes this deep become leaves whatever their size, bounds traversal stacks
+  uint32_t bins = 16;                   //  SAH split candidates per axis, at most 32
+  float traversal_cost = 1.0f;          //  SAH cost of visiting a node, relative to intersecting a triangle
+  float intersection_cost = 1.0f;       //  Both decide between the best split and a leaf
+};
+
+struct BvhStats
+{
+  uint32_t nodes = 0;
+  uint32_t leaves = 0;
+  uint32_t max_depth = 0;
+  float average_leaf_depth = 0.0f;
+  uint32_t min_leaf_size = 0;
+  uint32_t max_leaf_size = 0;
+  float average_leaf_size = 0.0f;
+  float sah_cost = 0.0f;                //  Expected cost of a random ray hitting the root, in triangle intersections
+};
+
+//  Build a BVH over every triangle of meshes with binned SAH splits. With a pool, binning of large nodes and the
+//  subtrees are built in parallel; the result is the same with or without it
+Bvh build_bvh(const std::vector<Mesh>& meshes, const BvhSettings& settings = {}, ThreadPool* pool = nullptr);
+
+//  Tree quality, costs as in settings
+BvhStats analyze_bvh(const Bvh& bvh, const BvhSettings& settings = {});
+
+};
@@ -0,0 +1,117 @@
+#include "file_watcher.h"
+
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace utils
+{
+static std::filesystem::file_time_type write_time_of(const std::filesystem::path& path)
+{
+  std::error_code error;
+  std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+
+  return error ? std::filesystem::file_time_type::min() : time;
+}
+
+FileWatcher::FileWatcher()
+{
+#if defined(__linux__)
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (inotify_fd < 0)
+  {
+    std::cerr << "inotify is not available, falling back to polling file times" << std::endl;
+  }
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#if defined(__linux__)
+  if (inotify_fd >= 0)
+  {
+    close(inotify_fd);
+  }
+#endif
+}
+
+void FileWatcher::Watch(const std::string& path)
+{
+  std::error_code error;
+  std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+
+  if (error)
+  {
+    canonical = std::filesystem::absolute(path);
+  }
+
+  files.push_back({ path, canonical, write_time_of(canonical) });
+
+#if defined(__linux__)
+  if (inotify_fd >= 0)
+  {
+    //  Adding a directory twice returns the same watch
+    std::string directory = canonical.parent_path().string();
+
+    if (inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+    {
+      std::cerr << "Could not watch " << directory << std::endl;
+    }
+  }
+#endif
+}
+
+std::vector<std::string> FileWatcher::Wait(int timeout_ms)
+{
+#if defined(__linux__)
+  if (inotify_fd >= 0)
+  {
+    pollfd fd = { inotify_fd, POLLIN, 0 };
+
+    if (poll(&fd, 1, timeout_ms) <= 0)
+    {
+      return {};
+    }
+
+    //  Drain the events, only the fact that something in the directories was written matters
+    alignas(inotify_event) char buffer[4096];
+    while (read(inotify_fd, buffer, sizeof(buffer)) > 0)
+    {
+    }
+  }
+  else
+#endif
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+  }
+
+  //  Events name files of the watched directories, write times tell which of ours changed
+  std::vector<std::string> changed;
+
+  for (File& file : files)
+  {
+    std::filesystem::file_time_type time = write_time_of(file.canonical);
+
+    if (time != file.write_time)
+    {
+      file.write_time = time;
+
+      if (std::find(changed.begin(), changed.end(), file.path) == changed.end())
+      {
+        changed.push_back(file.path);
+      }
+    }
+  }
+
+  return changed;
+}
+
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <filesystem>
+
+namespace utils
+{
+
+//  Reports files that were written since the last call. Uses inotify on Linux, so waiting costs nothing, and
+//  compares modification times elsewhere. Directories are watched rather than files, so editors replacing a file by
+//  renaming a new one over it are caught too
+class FileWatcher
+{
+public:
+  FileWatcher();
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  void Watch(const std::string& path);
+
+  //  Block up to timeout_ms for changes, return the watched paths (as passed to Watch) that changed
+  std::vector<std::string> Wait(int timeout_ms);
+
+private:
+  struct File
+  {
+    std::string path;
+    std::filesystem::path canonical;
+    std::filesystem::file_time_type write_time;
+  };
+
+  std::vector<File> files;
+
+#if defined(__linux__)
+  int inotify_fd = -1;
+#endif
+};
+
+};
@@ -16,10 +16,18 @@ struct Vertex
   float2 texCoord;
 };
 
+//  Simplified version of a mesh, indexing the mesh's own vertices
+struct MeshLod
+{
+  std::vector<uint32_t> indices;
+  float error;                    //  Geometric deviation from the full mesh, in mesh units
+};
+
 struct Mesh
 {
   std::vector<Vertex> vertices;
   std::vector<uint32_t> indices;
+  std::vector<MeshLod> lods;      //  Coarser and coarser, empty unless generated (utils::build_lod_chain)
 };
 
 struct Uniforms
@@ -0,0 +1,427 @@
+#include "mesh_utils.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace utils
+{
+VertexWelder::VertexWelder(Mesh& mesh, size_t expected_vertices) : mesh(mesh)
+{
+  indices.reserve(expected_vertices);
+}
+
+bool VertexWelder::Key::operator==(const Key& other) const
+{
+  return memcmp(values, other.values, sizeof(values)) == 0;
+}
+
+size_t VertexWelder::KeyHash::operator()(const Key& key) const
+{
+  //  FNV-1a over the bits, equal floats with different bits (0.0 and -0.0) stay separate vertices
+  uint64_t hash = 0xcbf29ce484222325ull;
+  uint32_t bits[8];
+  memcpy(bits, key.values, sizeof(bits));
+
+  for (uint32_t word : bits)
+  {
+    hash = (hash ^ word) * 0x100000001b3ull;
+  }
+
+  return (size_t)hash;
+}
+
+void VertexWelder::Add(const Vertex& vertex)
+{
+  Key key = {{ vertex.pos.x, vertex.pos.y, vertex.pos.z, vertex.normal.x, vertex.normal.y, vertex.normal.z, vertex.texCoord.x, vertex.texCoord.y }};
+
+  auto [it, inserted] = indices.try_emplace(key, (uint32_t)mesh.vertices.size());
+
+  if (inserted)
+  {
+    mesh.vertices.push_back(vertex);
+  }
+
+  mesh.indices.push_back(it->second);
+}
+
+namespace
+{
+//  FIFO of the last cache_size transformed vertices
+class VertexCacheSim
+{
+public:
+  explicit VertexCacheSim(uint32_t cache_size) : cache(cache_size, UINT32_MAX) {}
+
+  //  Return true if index had to be transformed
+  bool Access(uint32_t index)
+  {
+    for (uint32_t cached : cache)
+    {
+      if (cached == index)
+      {
+        return false;
+      }
+    }
+
+    cache[head] = index;
+    head = (head + 1) % (uint32_t)cache.size();
+
+    return true;
+  }
+
+  void Reset()
+  {
+    std::fill(cache.begin(), cache.end(), UINT32_MAX);
+    head = 0;
+  }
+
+private:
+  std::vector<uint32_t> cache;
+  uint32_t head = 0;
+};
+}
+
+uint32_t vertex_cache_misses(const std::vector<uint32_t>& indices, uint32_t cache_size)
+{
+  VertexCacheSim cache(cache_size);
+  uint32_t misses = 0;
+
+  for (uint32_t index : indices)
+  {
+    misses += cache.Access(index);
+  }
+
+  return misses;
+}
+
+VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size)
+{
+  VertexCacheStats stats;
+  stats.misses = vertex_cache_misses(indices, cache_size);
+  stats.acmr = indices.empty() ? 0.0f : stats.misses / (indices.size() / 3.0f);
+  stats.atvr = vertex_count == 0 ? 0.0f : stats.misses / (float)vertex_count;
+
+  return stats;
+}
+
+std::vector<uint32_t> optimize_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size,
+  std::vector<uint32_t>* clusters)
+{
+  const size_t triangle_count = indices.size() / 3;
+
+  //  Triangles around each vertex, and how many of them are not emitted yet
+  std::vector<uint32_t> live(vertex_count, 0);
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  std::vector<uint32_t> adjacency(triangle_count * 3);
+
+  for (size_t i = 0; i < triangle_count * 3; i++)
+  {
+    live[indices[i]]++;
+  }
+  for (size_t v = 0; v < vertex_count; v++)
+  {
+    offsets[v + 1] = offsets[v] + live[v];
+  }
+
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+
+  for (size_t i = 0; i < triangle_count * 3; i++)
+  {
+    adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+  }
+
+  std::vector<uint32_t> cache_time(vertex_count, 0);
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> dead_end;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> result;
+  result.reserve(triangle_count * 3);
+
+  if (clusters)
+  {
+    clusters->clear();
+  }
+
+  uint32_t time = cache_size + 1;
+  size_t cursor = 0;
+
+  auto in_cache = [&](uint32_t v) { return time - cache_time[v] <= cache_size; };
+
+  //  Next vertex to fan around when the last one has no good neighbour: the most recent dead end with triangles left,
+  //  else the next one in index order
+  auto skip_dead_end = [&]() -> int64_t
+  {
+    while (!dead_end.empty())
+    {
+      uint32_t v = dead_end.back();
+      dead_end.pop_back();
+
+      if (live[v] > 0)
+      {
+        return v;
+      }
+    }
+
+    while (cursor < vertex_count && live[cursor] == 0)
+    {
+      cursor++;
+    }
+
+    return cursor < vertex_count ? (int64_t)cursor : -1;
+  };
+
+  int64_t fanning = skip_dead_end();
+
+  while (fanning >= 0)
+  {
+    //  A fan that does not start in the cache can be drawn anywhere without hurting its neighbours
+    if (clusters && !in_cache((uint32_t)fanning))
+    {
+      uint32_t start = (uint32_t)(result.size() / 3);
+
+      if (clusters->empty() || clusters->back() != start)
+      {
+        clusters->push_back(start);
+      }
+    }
+
+    candidates.clear();
+
+    for (uint32_t i = offsets[fanning]; i < offsets[fanning + 1]; i++)
+    {
+      uint32_t t = adjacency[i];
+
+      if (emitted[t])
+      {
+        continue;
+      }
+
+      for (uint32_t k = 0; k < 3; k++)
+      {
+        uint32_t v = indices[t * 3 + k];
+
+        result.push_back(v);
+        dead_end.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+
+        if (!in_cache(v))
+        {
+          cache_time[v] = time++;
+        }
+      }
+
+      emitted[t] = true;
+    }
+
+    //  Prefer the oldest candidate that stays in the cache while its remaining triangles are emitted
+    int64_t best = -1;
+    int64_t best_priority = -1;
+
+    for (uint32_t v : candidates)
+    {
+      if (live[v] == 0)
+      {
+        continue;
+      }
+
+      int64_t priority = 0;
+
+      if (time - cache_time[v] + 2 * live[v] <= cache_size)
+      {
+        priority = time - cache_time[v];
+      }
+
+      if (priority > best_priority)
+      {
+        best = v;
+        best_priority = priority;
+      }
+    }
+
+    fanning = best >= 0 ? best : skip_dead_end();
+  }
+
+  return result;
+}
+
+std::vector<uint32_t> optimize_overdraw(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+  const std::vector<uint32_t>& clusters, float threshold, uint32_t cache_size)
+{
+  const uint32_t triangle_count = (uint32_t)(indices.size() / 3);
+
+  if (triangle_count == 0)
+  {
+    return indices;
+  }
+
+  //  Split the hard clusters where the cache efficiency so far is close to the one of the whole cluster
+  std::vector<uint32_t> starts;
+  VertexCacheSim cache(cache_size);
+
+  for (size_t c = 0; c < clusters.size(); c++)
+  {
+    uint32_t begin = clusters[c];
+    uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+    uint32_t misses = 0;
+
+    cache.Reset();
+    for (uint32_t i = begin * 3; i < end * 3; i++)
+    {
+      misses += cache.Access(indices[i]);
+    }
+
+    float target = threshold * misses / (end - begin);
+    uint32_t soft_begin = begin;
+    uint32_t soft_misses = 0;
+
+    starts.push_back(begin);
+    cache.Reset();
+
+    for (uint32_t t = begin; t < end; t++)
+    {
+      for (uint32_t k = 0; k < 3; k++)
+      {
+        soft_misses += cache.Access(indices[t * 3 + k]);
+      }
+
+      if (t + 1 < end && soft_misses <= target * (t + 1 - soft_begin))
+      {
+        starts.push_back(t + 1);
+        soft_begin = t + 1;
+        soft_misses = 0;
+        cache.Reset();
+      }
+    }
+  }
+
+  if (starts.empty() || starts.front() != 0)
+  {
+    starts.insert(starts.begin(), 0);
+  }
+
+  //  Area weighted centroid and normal of each cluster and of the whole mesh
+  struct Cluster
+  {
+    uint32_t begin;
+    uint32_t end;
+    float key;
+  };
+
+  std::vector<Cluster> sorted(starts.size());
+  std::vector<float3> centroids(starts.size(), float3(0, 0, 0));
+  std::vector<float3> normals(starts.size(), float3(0, 0, 0));
+  std::vector<float> areas(starts.size(), 0.0f);
+  float3 mesh_centroid(0, 0, 0);
+  float mesh_area = 0.0f;
+
+  for (size_t c = 0; c < starts.size(); c++)
+  {
+    sorted[c].begin = starts[c];
+    sorted[c].end = c + 1 < starts.size() ? starts[c + 1] : triangle_count;
+
+    for (uint32_t t = sorted[c].begin; t < sorted[c].end; t++)
+    {
+      const float3& a = vertices[indices[t * 3 + 0]].pos;
+      const float3& b = vertices[indices[t * 3 + 1]].pos;
+      const float3& d = vertices[indices[t * 3 + 2]].pos;
+
+      float3 normal = LiteMath::cross(b - a, d - a);
+      float area = LiteMath::length(normal);
+
+      centroids[c] += (a + b + d) * (area / 3.0f);
+      normals[c] += normal;
+      areas[c] += area;
+    }
+
+    mesh_centroid += centroids[c];
+    mesh_area += areas[c];
+  }
+
+  if (mesh_area > 0.0f)
+  {
+    mesh_centroid /= mesh_area;
+  }
+
+  //  Clusters far out along their own normal are likely to occlude the rest, draw them first
+  for (size_t c = 0; c < sorted.size(); c++)
+  {
+    float normal_length = LiteMath::length(normals[c]);
+    sorted[c].key = 0.0f;
+
+    if (areas[c] > 0.0f && normal_length > 0.0f)
+    {
+      sorted[c].key = LiteMath::dot(centroids[c] / areas[c] - mesh_centroid, normals[c] / normal_length);
+    }
+  }
+
+  std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.key > b.key; });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+
+  for (const Cluster& cluster : sorted)
+  {
+    result.insert(result.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+  }
+
+  return result;
+}
+
+void optimize_vertex_fetch(Mesh& mesh)
+{
+  std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+  std::vector<Vertex> vertices;
+  vertices.reserve(mesh.vertices.size());
+
+  //  Vertices no triangle uses are dropped
+  for (uint32_t& index : mesh.indices)
+  {
+    if (remap[index] == UINT32_MAX)
+    {
+      remap[index] = (uint32_t)vertices.size();
+      vertices.push_back(mesh.vertices[index]);
+    }
+
+    index = remap[index];
+  }
+
+  mesh.vertices.swap(vertices);
+}
+
+void optimize_mesh(Mesh& mesh, uint32_t cache_size)
+{
+  std::vector<uint32_t> clusters;
+
+  mesh.indices = optimize_vertex_cache(mesh.indices, mesh.vertices.size(), cache_size, &clusters);
+  mesh.indices = optimize_overdraw(mesh.indices, mesh.vertices, clusters, 1.05f, cache_size);
+  optimize_vertex_fetch(mesh);
+}
+
+BoundingSphere compute_bounding_sphere(const Mesh& mesh)
+{
+  if (mesh.vertices.empty())
+  {
+    return { float3(0.0f, 0.0f, 0.0f), 0.0f };
+  }
+
+  float3 bounds_min = mesh.vertices[0].pos;
+  float3 bounds_max = mesh.vertices[0].pos;
+
+  for (const Vertex& vertex : mesh.vertices)
+  {
+    bounds_min = float3(std::min(bounds_min.x, vertex.pos.x), std::min(bounds_min.y, vertex.pos.y), std::min(bounds_min.z, vertex.pos.z));
+    bounds_max = float3(std::max(bounds_max.x, vertex.pos.x), std::max(bounds_max.y, vertex.pos.y), std::max(bounds_max.z, vertex.pos.z));
+  }
+
+  BoundingSphere sphere { (bounds_min + bounds_max) * 0.5f, 0.0f };
+
+  for (const Vertex& vertex : mesh.vertices)
+  {
+    sphere.radius = std::max(sphere.radius, LiteMath::length(vertex.pos - sphere.center));
+  }
+
+  return sphere;
+}
+
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+#include "mesh.h"
+
+namespace utils
+{
+
+//  Dedupes vertices by their (position, normal, texcoord) bits while a mesh is built, so shared corners are stored
+//  once and referenced by index
+class VertexWelder
+{
+public:
+  explicit VertexWelder(Mesh& mesh, size_t expected_vertices = 0);
+
+  //  Append the index of vertex to the mesh, adding the vertex if it was not seen yet
+  void Add(const Vertex& vertex);
+
+private:
+  struct Key
+  {
+    float values[8];
+
+    bool operator==(const Key& other) const;
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const;
+  };
+
+  Mesh& mesh;
+  std::unordered_map<Key, uint32_t, KeyHash> indices;
+};
+
+//  Vertex shader invocations of an indexed triangle list under a FIFO post-transform cache of cache_size entries
+uint32_t vertex_cache_misses(const std::vector<uint32_t>& indices, uint32_t cache_size = 16);
+
+struct VertexCacheStats
+{
+  uint32_t misses = 0;
+  float acmr = 0.0f;    //  Average cache miss ratio, transformed vertices per triangle. 3 is the worst, ~0.5 the best
+  float atvr = 0.0f;    //  Average transformed vertex ratio, transformed vertices per vertex. 1 is the best
+};
+
+VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size = 16);
+
+//  Reorder triangles for the post-transform cache with Tipsify (Sander et al. 2007). Optionally return the offsets
+//  of the triangles where the fan restarted from a vertex out of the cache, which start a new cluster
+std::vector<uint32_t> optimize_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size = 16,
+  std::vector<uint32_t>* clusters = nullptr);
+
+//  Reorder the clusters of a vertex cache optimized triangle list so outward facing ones on the hull come first, which
+//  lowers overdraw from any view point. Clusters are split further while their ACMR stays within threshold of the
+//  original, so the cache efficiency is traded for at most that factor
+std::vector<uint32_t> optimize_overdraw(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+  const std::vector<uint32_t>& clusters, float threshold = 1.05f, uint32_t cache_size = 16);
+
+//  Renumber vertices in the order the triangles first use them, so vertex fetches walk the buffer linearly
+void optimize_vertex_fetch(Mesh& mesh);
+
+//  All three stages in order: vertex cache, overdraw, vertex fetch
+void optimize_mesh(Mesh& mesh, uint32_t cache_size = 16);
+
+struct BoundingSphere
+{
+  float3 center;
+  float radius;
+};
+
+//  Sphere around the vertices of the mesh, centered on their box. Zero radius at the origin for empty meshes
+BoundingSphere compute_bounding_sphere(const Mesh& mesh);
+
+};
@@ -0,0 +1,165 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace utils
+{
+
+//  Sphere around the meshlet's vertices centered on their box and the cone of its triangle normals, as
+//  meshoptimizer's meshopt_computeClusterBounds but with the average normal as the axis
+static void compute_bounds(Meshlet& meshlet, const Mesh& mesh, const MeshletMesh& result)
+{
+  const uint32_t* vertices = &result.vertices[meshlet.vertex_offset];
+  const uint8_t* triangles = &result.triangles[meshlet.triangle_offset * 3];
+
+  float3 bounds_min = mesh.vertices[vertices[0]].pos;
+  float3 bounds_max = bounds_min;
+
+  for (uint32_t i = 1; i < meshlet.vertex_count; i++)
+  {
+    float3 p = mesh.vertices[vertices[i]].pos;
+    bounds_min = float3(std::min(bounds_min.x, p.x), std::min(bounds_min.y, p.y), std::min(bounds_min.z, p.z));
+    bounds_max = float3(std::max(bounds_max.x, p.x), std::max(bounds_max.y, p.y), std::max(bounds_max.z, p.z));
+  }
+
+  meshlet.center = (bounds_min + bounds_max) * 0.5f;
+  meshlet.radius = 0.0f;
+
+  for (uint32_t i = 0; i < meshlet.vertex_count; i++)
+  {
+    meshlet.radius = std::max(meshlet.radius, LiteMath::length(mesh.vertices[vertices[i]].pos - meshlet.center));
+  }
+
+  //  Geometric normals, counter-clockwise triangles face the camera as the rasterizer's frontFace
+  std::vector<float3> normals;
+  normals.reserve(meshlet.triangle_count);
+  float3 axis(0.0f, 0.0f, 0.0f);
+
+  for (uint32_t t = 0; t < meshlet.triangle_count; t++)
+  {
+    float3 a = mesh.vertices[vertices[triangles[t * 3 + 0]]].pos;
+    float3 b = mesh.vertices[vertices[triangles[t * 3 + 1]]].pos;
+    float3 c = mesh.vertices[vertices[triangles[t * 3 + 2]]].pos;
+
+    float3 normal = LiteMath::cross(b - a, c - a);
+    float area = LiteMath::length(normal);
+
+    //  Degenerate triangles are invisible from everywhere
+    if (area > 0.0f)
+    {
+      normals.push_back(normal / area);
+      axis = axis + normal / area;
+    }
+  }
+
+  meshlet.cone_axis = float3(0.0f, 0.0f, 0.0f);
+  meshlet.cone_cutoff = 1.0f;
+
+  float axis_length = LiteMath::length(axis);
+  if (normals.empty() || axis_length <= 0.0f)
+  {
+    return;
+  }
+
+  axis = axis / axis_length;
+
+  float min_dot = 1.0f;
+  for (const float3& normal : normals)
+  {
+    min_dot = std::min(min_dot, LiteMath::dot(normal, axis));
+  }
+
+  //  Normals spread over (almost) a hemisphere or more, some triangle faces every camera outside the meshlet
+  if (min_dot <= 0.1f)
+  {
+    return;
+  }
+
+  //  The normal cone has half angle acos(min_dot). Every triangle faces away where the view direction is within
+  //  90 degrees minus that of the axis, whose cosine is sin(acos(min_dot))
+  meshlet.cone_axis = axis;
+  meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+MeshletMesh build_meshlets(const Mesh& mesh, uint32_t max_vertices, uint32_t max_triangles)
+{
+  assert(max_vertices >= 3 && max_vertices <= 256 && max_triangles >= 1);
+
+  MeshletMesh result;
+
+  const size_t triangle_count = mesh.indices.size() / 3;
+  result.triangles.reserve(triangle_count * 3);
+  result.vertices.reserve(mesh.indices.size());
+
+  //  Meshlet vertex index of every mesh vertex in the current meshlet, stamped with the meshlet to skip clearing
+  std::vector<uint8_t> local(mesh.vertices.size(), 0);
+  std::vector<uint32_t> stamp(mesh.vertices.size(), ~0u);
+
+  Meshlet current {};
+
+  auto finish = [&]()
+  {
+    if (current.triangle_count == 0)
+    {
+      return;
+    }
+
+    compute_bounds(current, mesh, result);
+    result.meshlets.push_back(current);
+
+    current = {};
+    current.vertex_offset = (uint32_t)result.vertices.size();
+    current.triangle_offset = (uint32_t)(result.triangles.size() / 3);
+  };
+
+  for (size_t t = 0; t < triangle_count; t++)
+  {
+    const uint32_t* corners = &mesh.indices[t * 3];
+    const uint32_t meshlet_index = (uint32_t)result.meshlets.size();
+
+    uint32_t new_vertices = 0;
+    for (int k = 0; k < 3; k++)
+    {
+      bool repeated = (k > 0 && corners[k] == corners[0]) || (k > 1 && corners[k] == corners[1]);
+      new_vertices += stamp[corners[k]] != meshlet_index && !repeated ? 1 : 0;
+    }
+
+    if (current.vertex_count + new_vertices > max_vertices || current.triangle_count + 1 > max_triangles)
+    {
+      finish();
+    }
+
+    //  finish() started a new meshlet, every stamp belongs to an older one now
+    const uint32_t stamp_index = (uint32_t)result.meshlets.size();
+
+    for (int k = 0; k < 3; k++)
+    {
+      uint32_t vertex = corners[k];
+
+      if (stamp[vertex] != stamp_index)
+      {
+        stamp[vertex] = stamp_index;
+        local[vertex] = (uint8_t)current.vertex_count++;
+        result.vertices.push_back(vertex);
+      }
+
+      result.triangles.push_back(local[vertex]);
+    }
+
+    current.triangle_count++;
+  }
+
+  finish();
+
+  return result;
+}
+
+bool meshlet_backfacing(const Meshlet& meshlet, const float3& camera_position)
+{
+  float3 view = meshlet.center - camera_position;
+  return LiteMath::dot(view, meshlet.cone_axis) >= meshlet.cone_cutoff * LiteMath::length(view) + meshlet.radius;
+}
+
+};
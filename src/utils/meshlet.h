@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.h"
+
+namespace utils
+{
+
+//  Cluster of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles, the sizes mesh shading
+//  hardware is tuned for. Triangles index the meshlet's own vertex list, so each index fits a byte
+static const uint32_t MESHLET_MAX_VERTICES = 64;
+static const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+struct Meshlet
+{
+  uint32_t vertex_offset;     //  First entry in MeshletMesh::vertices
+  uint32_t triangle_offset;   //  First triangle in MeshletMesh::triangles, three bytes each
+  uint32_t vertex_count;
+  uint32_t triangle_count;
+
+  //  Bounding sphere and the cone around the triangle normals. No triangle faces the camera when it is inside the
+  //  backface cone, see meshlet_backfacing. A cutoff of 1 marks clusters too curved for the test
+  float3 center;
+  float radius;
+  float3 cone_axis;
+  float cone_cutoff;
+};
+
+struct MeshletMesh
+{
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t> vertices;   //  Mesh vertex index of every meshlet vertex
+  std::vector<uint8_t> triangles;   //  Meshlet vertex index of every triangle corner
+};
+
+//  Split the triangles of mesh into meshlets in index order, starting a new one whenever the next triangle would
+//  overflow either limit. Meshes optimised for the vertex cache keep neighbours together, which fills the meshlets
+MeshletMesh build_meshlets(const Mesh& mesh, uint32_t max_vertices = MESHLET_MAX_VERTICES, uint32_t max_triangles = MESHLET_MAX_TRIANGLES);
+
+//  Whether every triangle of the meshlet faces away from a camera at camera_position, in the space of the mesh
+bool meshlet_backfacing(const Meshlet& meshlet, const float3& camera_position);
+
+};
@@ -0,0 +1,417 @@
+#include "simplify.h"
+#include "mesh_utils.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+namespace utils
+{
+namespace
+{
+//  Sum of squared distances to a set of planes, weighted by triangle area. Divided by the weight it is the mean
+//  squared distance, whose root is the error reported in mesh units
+struct Quadric
+{
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0;
+  double c = 0;
+  double weight = 0;
+
+  void AddPlane(double nx, double ny, double nz, double d, double w)
+  {
+    a00 += w * nx * nx; a01 += w * nx * ny; a02 += w * nx * nz;
+    a11 += w * ny * ny; a12 += w * ny * nz; a22 += w * nz * nz;
+    b0 += w * nx * d; b1 += w * ny * d; b2 += w * nz * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  void Add(const Quadric& q)
+  {
+    a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+    b0 += q.b0; b1 += q.b1; b2 += q.b2;
+    c += q.c;
+    weight += q.weight;
+  }
+
+  //  Mean squared distance of p to the planes
+  double Error(const float3& p) const
+  {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+      2.0 * (b0 * x + b1 * y + b2 * z) + c;
+
+    return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+struct Collapse
+{
+  uint32_t from;    //  Position moved away
+  uint32_t to;      //  Position it lands on
+  float error;
+};
+
+float3 triangle_normal(const float3& a, const float3& b, const float3& c)
+{
+  return LiteMath::cross(b - a, c - a);
+}
+}
+
+std::vector<uint32_t> simplify(const Mesh& mesh, const std::vector<uint32_t>& indices, size_t target_index_count,
+  float target_error, float* result_error)
+{
+  const size_t vertex_count = mesh.vertices.size();
+  size_t triangle_count = indices.size() / 3;
+
+  //  Vertices split by normals or texture coordinates share a position, they are collapsed as one
+  std::vector<uint32_t> position_of(vertex_count);
+  std::vector<float3> positions;
+  {
+    struct PositionHash
+    {
+      size_t operator()(const float3& p) const
+      {
+        uint32_t bits[3];
+        memcpy(bits, &p.x, sizeof(bits));
+        return (size_t)((bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u));
+      }
+    };
+    struct PositionEqual
+    {
+      bool operator()(const float3& a, const float3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+    };
+
+    std::unordered_map<float3, uint32_t, PositionHash, PositionEqual> ids;
+    ids.reserve(vertex_count);
+
+    for (size_t v = 0; v < vertex_count; v++)
+    {
+      auto [it, inserted] = ids.try_emplace(mesh.vertices[v].pos, (uint32_t)positions.size());
+      if (inserted)
+      {
+        positions.push_back(mesh.vertices[v].pos);
+      }
+      position_of[v] = it->second;
+    }
+  }
+
+  const size_t position_count = positions.size();
+
+  //  Vertices of every position
+  std::vector<uint32_t> copies_first(position_count + 1, 0);
+  std::vector<uint32_t> copies(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++)
+  {
+    copies_first[position_of[v] + 1]++;
+  }
+  for (size_t p = 0; p < position_count; p++)
+  {
+    copies_first[p + 1] += copies_first[p];
+  }
+  {
+    std::vector<uint32_t> fill(copies_first.begin(), copies_first.end() - 1);
+    for (size_t v = 0; v < vertex_count; v++)
+    {
+      copies[fill[position_of[v]]++] = (uint32_t)v;
+    }
+  }
+
+  std::vector<uint32_t> result = indices;
+  std::vector<bool> alive(triangle_count, true);
+
+  //  Triangles with two corners on one position (poles of UV spheres, welded slivers) cover nothing
+  for (size_t t = 0; t < alive.size(); t++)
+  {
+    uint32_t a = position_of[result[t * 3]], b = position_of[result[t * 3 + 1]], c = position_of[result[t * 3 + 2]];
+    if (a == b || b == c || a == c)
+    {
+      alive[t] = false;
+      triangle_count--;
+    }
+  }
+
+  //  Plane quadrics of the triangles around every position
+  std::vector<Quadric> quadrics(position_count);
+  for (size_t t = 0; t < alive.size(); t++)
+  {
+    if (!alive[t])
+    {
+      continue;
+    }
+
+    const float3& a = positions[position_of[result[t * 3 + 0]]];
+    const float3& b = positions[position_of[result[t * 3 + 1]]];
+    const float3& c = positions[position_of[result[t * 3 + 2]]];
+
+    float3 normal = triangle_normal(a, b, c);
+    float area = LiteMath::length(normal);
+
+    if (area <= 0.0f)
+    {
+      continue;
+    }
+
+    normal = normal / area;
+    double d = -LiteMath::dot(normal, a);
+
+    for (int k = 0; k < 3; k++)
+    {
+      quadrics[position_of[result[t * 3 + k]]].AddPlane(normal.x, normal.y, normal.z, d, 0.5 * area);
+    }
+  }
+
+  //  Positions on an open border, where an edge has one triangle, never move so the outline and cracks between
+  //  meshes stay as they are
+  std::vector<bool> locked(position_count, false);
+  {
+    std::unordered_map<uint64_t, int32_t> edges;
+    edges.reserve(triangle_count * 3);
+
+    for (size_t t = 0; t < alive.size(); t++)
+    {
+      for (int k = 0; alive[t] && k < 3; k++)
+      {
+        uint32_t a = position_of[result[t * 3 + k]];
+        uint32_t b = position_of[result[t * 3 + (k + 1) % 3]];
+        uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+        edges[key]++;
+      }
+    }
+
+    for (const auto& [key, count] : edges)
+    {
+      if (count == 1)
+      {
+        locked[key >> 32] = true;
+        locked[key & 0xffffffffu] = true;
+      }
+    }
+  }
+
+  const size_t target_triangles = target_index_count / 3;
+  const double max_error = (double)target_error * target_error;
+  double reached = 0.0;
+
+  //  Triangles around every position, rebuilt every pass
+  std::vector<uint32_t> adjacency_first(position_count + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<Collapse> collapses;
+  std::vector<bool> touched(position_count);
+
+  while (triangle_count > target_triangles)
+  {
+    std::fill(adjacency_first.begin(), adjacency_first.end(), 0);
+    for (size_t t = 0; t < alive.size(); t++)
+    {
+      for (int k = 0; alive[t] && k < 3; k++)
+      {
+        adjacency_first[position_of[result[t * 3 + k]] + 1]++;
+      }
+    }
+    for (size_t p = 0; p < position_count; p++)
+    {
+      adjacency_first[p + 1] += adjacency_first[p];
+    }
+    adjacency.resize(adjacency_first[position_count]);
+    {
+      std::vector<uint32_t> fill(adjacency_first.begin(), adjacency_first.end() - 1);
+      for (size_t t = 0; t < alive.size(); t++)
+      {
+        for (int k = 0; alive[t] && k < 3; k++)
+        {
+          adjacency[fill[position_of[result[t * 3 + k]]]++] = (uint32_t)t;
+        }
+      }
+    }
+
+    //  Every edge in both directions, cheapest first
+    collapses.clear();
+    for (size_t t = 0; t < alive.size(); t++)
+    {
+      for (int k = 0; alive[t] && k < 3; k++)
+      {
+        uint32_t a = position_of[result[t * 3 + k]];
+        uint32_t b = position_of[result[t * 3 + (k + 1) % 3]];
+
+        for (auto [from, to] : { std::pair(a, b), std::pair(b, a) })
+        {
+          if (!locked[from])
+          {
+            Quadric q = quadrics[from];
+            q.Add(quadrics[to]);
+            collapses.push_back({ from, to, (float)q.Error(positions[to]) });
+          }
+        }
+      }
+    }
+
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+    //  Each collapse removes about two triangles. Positions around a collapse are left alone for the rest of the pass,
+    //  so the flip test below sees their final positions
+    std::fill(touched.begin(), touched.end(), false);
+    size_t budget = (triangle_count - target_triangles + 1) / 2;
+    size_t applied = 0;
+
+    for (const Collapse& collapse : collapses)
+    {
+      if (applied >= budget || collapse.error > max_error)
+      {
+        break;
+      }
+
+      if (touched[collapse.from] || touched[collapse.to])
+      {
+        continue;
+      }
+
+      //  Moving from onto to must not turn a remaining triangle over
+      bool flips = false;
+      for (uint32_t i = adjacency_first[collapse.from]; i < adjacency_first[collapse.from + 1] && !flips; i++)
+      {
+        uint32_t t = adjacency[i];
+        uint32_t p[3] = { position_of[result[t * 3]], position_of[result[t * 3 + 1]], position_of[result[t * 3 + 2]] };
+
+        if (!alive[t] || p[0] == collapse.to || p[1] == collapse.to || p[2] == collapse.to)
+        {
+          continue;
+        }
+
+        float3 before = triangle_normal(positions[p[0]], positions[p[1]], positions[p[2]]);
+        for (uint32_t& corner : p)
+        {
+          corner = corner == collapse.from ? collapse.to : corner;
+        }
+        float3 after = triangle_normal(positions[p[0]], positions[p[1]], positions[p[2]]);
+
+        flips = LiteMath::dot(before, after) <= 0.0f;
+      }
+
+      if (flips)
+      {
+        continue;
+      }
+
+      for (uint32_t i = adjacency_first[collapse.from]; i < adjacency_first[collapse.from + 1]; i++)
+      {
+        uint32_t t = adjacency[i];
+        if (!alive[t])
+        {
+          continue;
+        }
+
+        for (int k = 0; k < 3; k++)
+        {
+          touched[position_of[result[t * 3 + k]]] = true;
+        }
+
+        //  Triangles on the collapsed edge vanish
+        bool on_edge = false;
+        for (int k = 0; k < 3; k++)
+        {
+          on_edge |= position_of[result[t * 3 + k]] == collapse.to;
+        }
+
+        if (on_edge)
+        {
+          alive[t] = false;
+          triangle_count--;
+          continue;
+        }
+
+        //  Others take the vertex of to that looks most like the one they had
+        for (int k = 0; k < 3; k++)
+        {
+          uint32_t& vertex = result[t * 3 + k];
+          if (position_of[vertex] != collapse.from)
+          {
+            continue;
+          }
+
+          const Vertex& old = mesh.vertices[vertex];
+          float best = -2.0f;
+
+          for (uint32_t c = copies_first[collapse.to]; c < copies_first[collapse.to + 1]; c++)
+          {
+            const Vertex& candidate = mesh.vertices[copies[c]];
+            float texcoord_distance = std::abs(candidate.texCoord.x - old.texCoord.x) + std::abs(candidate.texCoord.y - old.texCoord.y);
+            float score = LiteMath::dot(candidate.normal, old.normal) - 1e-3f * texcoord_distance;
+
+            if (score > best)
+            {
+              best = score;
+              vertex = copies[c];
+            }
+          }
+        }
+      }
+
+      quadrics[collapse.to].Add(quadrics[collapse.from]);
+      reached = std::max(reached, (double)collapse.error);
+      applied++;
+    }
+
+    if (applied == 0)
+    {
+      break;
+    }
+  }
+
+  std::vector<uint32_t> simplified;
+  simplified.reserve(triangle_count * 3);
+
+  for (size_t t = 0; t < alive.size(); t++)
+  {
+    if (alive[t])
+    {
+      simplified.insert(simplified.end(), result.begin() + t * 3, result.begin() + t * 3 + 3);
+    }
+  }
+
+  if (result_error)
+  {
+    *result_error = (float)std::sqrt(reached);
+  }
+
+  return simplified;
+}
+
+std::vector<MeshLod> build_lod_chain(const Mesh& mesh, const LodSettings& settings)
+{
+  std::vector<MeshLod> lods;
+
+  const float max_error = settings.max_error * compute_bounding_sphere(mesh).radius;
+  const std::vector<uint32_t>* previous = &mesh.indices;
+  float previous_error = 0.0f;
+
+  for (uint32_t level = 0; level < settings.max_levels; level++)
+  {
+    size_t previous_triangles = previous->size() / 3;
+    size_t target = std::max<size_t>((size_t)(previous_triangles * settings.ratio), settings.min_triangles);
+
+    if (target >= previous_triangles)
+    {
+      break;
+    }
+
+    float error = 0.0f;
+    std::vector<uint32_t> indices = simplify(mesh, *previous, target * 3, max_error - previous_error, &error);
+
+    //  Less than 10% fewer triangles is not worth another level
+    if (indices.empty() || indices.size() / 3 > previous_triangles * 9 / 10)
+    {
+      break;
+    }
+
+    lods.push_back({ optimize_vertex_cache(indices, mesh.vertices.size()), previous_error + error });
+    previous = &lods.back().indices;
+    previous_error = lods.back().error;
+  }
+
+  return lods;
+}
+
+};
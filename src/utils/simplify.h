@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.h"
+
+namespace utils
+{
+
+//  Quadric error metric simplification (Garland and Heckbert 1997) of the triangles in indices, by collapsing
+//  vertices into a neighbour so no new vertices are made and the result indexes mesh.vertices. Vertices sharing a
+//  position move together, each takes the attributes of the neighbour's vertex with the closest normal. Open borders
+//  stay in place. Stops at target_index_count indices or once the next collapse would deviate more than target_error
+//  from the input, in mesh units. result_error receives the deviation reached
+std::vector<uint32_t> simplify(const Mesh& mesh, const std::vector<uint32_t>& indices, size_t target_index_count,
+  float target_error, float* result_error = nullptr);
+
+struct LodSettings
+{
+  uint32_t max_levels = 4;          //  Levels below the full mesh
+  float ratio = 0.25f;              //  Triangles of each level relative to the previous one
+  float max_error = 0.25f;          //  Largest deviation of any level, relative to the bounding sphere radius
+  uint32_t min_triangles = 8;       //  No level below that
+};
+
+//  Simplify every level from the previous one and reorder it for the vertex cache. Levels that would barely shrink
+//  end the chain early. Errors add up along the chain, so each is a bound against the full mesh
+std::vector<MeshLod> build_lod_chain(const Mesh& mesh, const LodSettings& settings = {});
+
+};
@@ -0,0 +1,170 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace utils
+{
+ThreadPool::ThreadPool(uint32_t thread_count)
+{
+  if (thread_count == 0)
+  {
+    thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  for (uint32_t i = 0; i < thread_count; i++)
+  {
+    workers.emplace_back([this]() { workerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  Wait();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  task_available.notify_all();
+
+  for (std::thread& worker : workers)
+  {
+    worker.join();
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+  pending++;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  task_available.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  all_done.wait(lock, [this]() { return pending.load() == 0; });
+}
+
+void ThreadPool::workerLoop()
+{
+  while (true)
+  {
+    std::function<void()> task;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      task_available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+      if (stopping && tasks.empty())
+      {
+        return;
+      }
+
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+
+    task();
+
+    if (--pending == 0)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      all_done.notify_all();
+    }
+  }
+}
+
+bool ThreadPool::runPendingTask()
+{
+  std::function<void()> task;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (tasks.empty())
+    {
+      return false;
+    }
+
+    task = std::move(tasks.front());
+    tasks.pop_front();
+  }
+
+  task();
+
+  if (--pending == 0)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    all_done.notify_all();
+  }
+
+  return true;
+}
+
+void ThreadPool::waitFor(const std::atomic<size_t>& counter)
+{
+  while (counter.load() > 0)
+  {
+    if (!runPendingTask())
+    {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& body)
+{
+  if (count == 0)
+  {
+    return;
+  }
+
+  //  A few chunks per thread keep the load balanced when chunks take different time
+  grain = std::max(grain, (size_t)1);
+  size_t chunk = std::max(grain, (count + Size() * 4 - 1) / (Size() * 4));
+  size_t chunk_count = (count + chunk - 1) / chunk;
+
+  if (chunk_count == 1)
+  {
+    body(0, count);
+    return;
+  }
+
+  std::atomic<size_t> remaining = chunk_count;
+
+  for (size_t i = 0; i < chunk_count; i++)
+  {
+    size_t begin = i * chunk;
+    size_t end = std::min(begin + chunk, count);
+
+    Submit([&body, &remaining, begin, end]()
+    {
+      body(begin, end);
+      remaining--;
+    });
+  }
+
+  waitFor(remaining);
+}
+
+void ThreadPool::ParallelInvoke(const std::function<void()>& a, const std::function<void()>& b)
+{
+  std::atomic<size_t> remaining = 1;
+
+  Submit([&a, &remaining]()
+  {
+    a();
+    remaining--;
+  });
+
+  b();
+
+  waitFor(remaining);
+}
+
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace utils
+{
+
+//  Fixed set of worker threads consuming a shared FIFO of tasks. Threads waiting on a group of tasks help running
+//  queued tasks, so parallel sections may be nested inside tasks without deadlocking the pool
+class ThreadPool
+{
+public:
+  //  0 threads means one per hardware thread
+  explicit ThreadPool(uint32_t thread_count = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void Submit(std::function<void()> task);
+
+  //  Block until every submitted task has finished
+  void Wait();
+
+  //  Tasks queued or running
+  size_t Pending() const { return pending.load(); }
+
+  uint32_t Size() const { return (uint32_t)workers.size(); }
+
+  //  Run body over [0, count) split into chunks of at least grain items, blocking until all chunks are done
+  void ParallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& body);
+
+  //  Run both functions in parallel, blocking until both are done
+  void ParallelInvoke(const std::function<void()>& a, const std::function<void()>& b);
+
+private:
+  void workerLoop();
+
+  //  Pop and run one queued task on the calling thread, return false if the queue was empty
+  bool runPendingTask();
+
+  //  Help with queued tasks until counter drops to zero
+  void waitFor(const std::atomic<size_t>& counter);
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+
+  mutable std::mutex mutex;
+  std::condition_variable task_available;
+  std::condition_variable all_done;
+
+  std::atomic<size_t> pending = 0;
+  bool stopping = false;
+};
+
+};
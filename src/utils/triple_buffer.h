@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+namespace utils
+{
+
+//  Lock-free single producer, single consumer mailbox holding the latest published value. The producer fills
+//  WriteBuffer() and publishes it, the consumer switches to the newest value with Update(). Neither side ever
+//  blocks the other, values the consumer did not pick up in time are overwritten by newer ones
+template <typename T>
+class TripleBuffer
+{
+public:
+  //  Producer side: value to fill before Publish
+  T& WriteBuffer() { return buffers[write_index]; }
+
+  //  Producer side: hand the write buffer over, return false if the previously published value was never read
+  bool Publish()
+  {
+    uint32_t previous = middle.exchange(write_index | FRESH, std::memory_order_acq_rel);
+    write_index = previous & INDEX_MASK;
+    middle.notify_one();
+
+    return (previous & FRESH) == 0;
+  }
+
+  //  Consumer side: switch to the newest value, return false if nothing new was published since the last call
+  bool Update()
+  {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+    {
+      return false;
+    }
+
+    uint32_t previous = middle.exchange(read_index, std::memory_order_acq_rel);
+    read_index = previous & INDEX_MASK;
+
+    return true;
+  }
+
+  //  Consumer side: sleep until a value Update would pick up is published
+  void Wait() const
+  {
+    uint32_t state = middle.load(std::memory_order_acquire);
+
+    while ((state & FRESH) == 0)
+    {
+      middle.wait(state, std::memory_order_acquire);
+      state = middle.load(std::memory_order_acquire);
+    }
+  }
+
+  //  Consumer side: value selected by the last Update, owned by the consumer until the next one
+  T& Read() { return buffers[read_index]; }
+  const T& Read() const { return buffers[read_index]; }
+
+private:
+  static constexpr uint32_t INDEX_MASK = 3;
+  static constexpr uint32_t FRESH = 4;
+
+  T buffers[3] {};
+
+  //  Each index is owned by exactly one of the producer, the consumer and the shared middle slot
+  uint32_t write_index = 0;
+  uint32_t read_index = 1;
+  std::atomic<uint32_t> middle = 2;
+};
+
+};
@@ -1,5 +1,7 @@
 #include "utils.h"
 
+#include <chrono>
+
 namespace utils
 {
 void load_data_to_buffer(WGPUBuffer *buffer, void *data, const WGPUBufferDescriptor &buffer_desc, WGPUDevice device)
@@ -52,4 +54,50 @@ void set_default_depth_stencil_state(WGPUDepthStencilState &depthStencilState)
   set_default_stencil_face_state(depthStencilState.stencilFront);
   set_default_stencil_face_state(depthStencilState.stencilBack);
 }
+
+bool validation_scope(WGPUDevice device, const std::function<void()>& body, std::string& error)
+{
+  wgpuDevicePushErrorScope(device, WGPUErrorFilter_Validation);
+
+  body();
+
+  struct Result
+  {
+    bool failed = false;
+    std::string message;
+  } result;
+
+  //  wgpu-native resolves the scope inside the call
+  WGPUPopErrorScopeCallbackInfo callbackInfo = {};
+  callbackInfo.mode = WGPUCallbackMode_AllowSpontaneous;
+  callbackInfo.callback = [](WGPUPopErrorScopeStatus status, WGPUErrorType type, WGPUStringView message, void* userdata1, void* userdata2)
+  {
+    (void)userdata2;
+
+    Result* result = static_cast<Result*>(userdata1);
+
+    if (status == WGPUPopErrorScopeStatus_Success && type != WGPUErrorType_NoError)
+    {
+      result->failed = true;
+      if (message.data)
+      {
+        result->message = message.length == WGPU_STRLEN ? std::string(message.data) : std::string(message.data, message.length);
+      }
+    }
+  };
+  callbackInfo.userdata1 = &result;
+
+  wgpuDevicePopErrorScope(device, callbackInfo);
+
+  error = result.message;
+
+  return !result.failed;
+}
+
+double get_time()
+{
+  static const auto start = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 };
\ No newline at end of file
@@ -5,6 +5,9 @@
 
 #include <LiteMath.h>
 
+#include <string>
+#include <functional>
+
 using LiteMath::float3;
 
 namespace utils
@@ -21,5 +24,12 @@ void load_data_to_buffer(WGPUBuffer *buffer, void *data, const WGPUBufferDescrip
 WGPUBlendState wgpu_create_blend_state(bool enable_blend);
 void set_default_depth_stencil_state(WGPUDepthStencilState &depthStencilState);
 
+//  Seconds since the first call, usable without GLFW
+double get_time();
+
+//  Run body inside a validation error scope of device. Return false and the error message if body caused one.
+//  Scopes are per thread as in the WebGPU spec (wgpu 25 and later), errors of other threads do not end up here
+bool validation_scope(WGPUDevice device, const std::function<void()>& body, std::string& error);
+
 
 };
\ No newline at end of file